@@ -0,0 +1,339 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+/*
+ * A stand-in VST plugin for the benchmarks: a gain with a few dummy
+ * parameters, built as a native shared object and loaded by the native
+ * host instead of a Windows DLL.
+ *
+ * Environment:
+ *  - VST_BRIDGE_BENCH_CHANNELS: number of inputs and outputs (default: 2)
+ *  - VST_BRIDGE_BENCH_DSP_US: simulated DSP time per block (default: 0)
+ *  - VST_BRIDGE_BENCH_STALL_US, VST_BRIDGE_BENCH_STALL_EVERY: stall for
+ *    that long once every that many blocks, to simulate sporadic late
+ *    blocks (default: never)
+ *  - VST_BRIDGE_BENCH_GUI_US: time spent in effGetParamDisplay and
+ *    effEditIdle, to simulate an expensive GUI call (default: 0)
+ *  - VST_BRIDGE_BENCH_AUTOMATE_MS: calls audioMasterAutomate, between
+ *    audioMasterBeginEdit and audioMasterEndEdit, from a thread of its own
+ *    every that many ms, like a plugin GUI (default: never)
+ *  - VST_BRIDGE_BENCH_MIDI_OUT: notes sent to the host in each block, each
+ *    in its own audioMasterProcessEvents call, like an arpeggiator
+ *    (default: 0)
+ *  - VST_BRIDGE_BENCH_QUERIES: queries about the DAW in each block
+ *    (sample rate, block size, process level, canDo), like the plugins
+ *    which don't remember the answers (default: 0)
+ *  - VST_BRIDGE_BENCH_TIME: 1 replaces the first sample of the first output
+ *    with the samplePos audioMasterGetTime returns, to check that the
+ *    plugin gets the time of its block (default: 0)
+ *  - VST_BRIDGE_BENCH_LOAD_US: time spent in effOpen and effSetChunk,
+ *    sleeping, like a plugin reading its samples from disk (default: 0)
+ */
+
+#define BENCH_NUM_PARAMS 16
+
+struct bench_plugin {
+  AEffect  e;
+  float    params[BENCH_NUM_PARAMS];
+  int      nevents;
+  uint64_t dsp_ns;
+  uint64_t stall_ns;
+  uint64_t stall_every;
+  uint64_t nblocks;
+  uint64_t gui_ns;
+  uint64_t load_us;
+  int      midi_out;
+  int      queries;
+  bool     time;
+  audioMasterCallback audio_master;
+  int                 automate_ms;
+  volatile bool       automate_stop;
+  // the automate thread may be stuck in audio_master past effClose
+  int                 refs;
+};
+
+static void bench_plugin_unref(struct bench_plugin *p)
+{
+  if (__sync_sub_and_fetch(&p->refs, 1) == 0)
+    free(p);
+}
+
+static int bench_getenv(const char *name)
+{
+  const char *value = getenv(name);
+  return value ? atoi(value) : 0;
+}
+
+static uint64_t bench_plugin_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_plugin_burn(uint64_t ns)
+{
+  if (ns == 0)
+    return;
+
+  uint64_t end = bench_plugin_now_ns() + ns;
+  while (bench_plugin_now_ns() < end)
+    ;
+}
+
+// burns the CPU like a DSP would, rather than sleeping
+static void bench_plugin_load(struct bench_plugin *p)
+{
+  uint64_t ns = p->dsp_ns;
+
+  ++p->nblocks;
+  if (p->stall_every > 0 && p->nblocks % p->stall_every == 0)
+    ns += p->stall_ns;
+  bench_plugin_burn(ns);
+
+  for (int i = 0; i < p->queries; ++i) {
+    switch (i % 4) {
+    case 0: p->audio_master(&p->e, audioMasterGetSampleRate, 0, 0, NULL, 0); break;
+    case 1: p->audio_master(&p->e, audioMasterGetBlockSize, 0, 0, NULL, 0); break;
+    case 2: p->audio_master(&p->e, audioMasterGetCurrentProcessLevel, 0, 0, NULL, 0); break;
+    case 3: p->audio_master(&p->e, audioMasterCanDo, 0, 0, (void *)"sendVstEvents", 0); break;
+    }
+  }
+
+  for (int i = 0; i < p->midi_out; ++i) {
+    VstMidiEvent me;
+    VstEvents evs;
+
+    memset(&me, 0, sizeof (me));
+    me.type        = kVstMidiType;
+    me.byteSize    = sizeof (me);
+    me.deltaFrames = i;
+    me.midiData[0] = 0x90;
+    me.midiData[1] = 60 + i % 12;
+    me.midiData[2] = 100;
+    evs.numEvents  = 1;
+    evs.reserved   = 0;
+    evs.events[0]  = (VstEvent *)&me;
+    p->audio_master(&p->e, audioMasterProcessEvents, 0, 0, &evs, 0);
+  }
+}
+
+static double bench_plugin_time(struct bench_plugin *p)
+{
+  VstTimeInfo *info = (VstTimeInfo *)p->audio_master(&p->e, audioMasterGetTime, 0, 0, NULL, 0);
+  return info ? info->samplePos : -1;
+}
+
+static void *bench_plugin_automate(void *arg)
+{
+  struct bench_plugin *p = (struct bench_plugin *)arg;
+
+  while (true) {
+    usleep(p->automate_ms * 1000);
+    if (p->automate_stop)
+      break;
+    p->audio_master(&p->e, audioMasterBeginEdit, 0, 0, NULL, 0);
+    p->audio_master(&p->e, audioMasterAutomate, 0, 0, NULL, p->params[0]);
+    p->audio_master(&p->e, audioMasterEndEdit, 0, 0, NULL, 0);
+  }
+  bench_plugin_unref(p);
+  return NULL;
+}
+
+static VstIntPtr VSTCALLBACK bench_dispatcher(AEffect  *effect,
+                                              VstInt32  opcode,
+                                              VstInt32  index,
+                                              VstIntPtr value,
+                                              void     *ptr,
+                                              float     /*opt*/)
+{
+  struct bench_plugin *p = (struct bench_plugin *)effect->object;
+
+  switch (opcode) {
+  case effClose:
+    p->automate_stop = true;
+    bench_plugin_unref(p);
+    return 0;
+
+  case effGetParamName:
+    snprintf((char *)ptr, kVstMaxParamStrLen, "P%d", index);
+    return 0;
+
+  case effGetParamLabel:
+    strcpy((char *)ptr, "dB");
+    return 0;
+
+  case effGetParamDisplay:
+    bench_plugin_burn(p->gui_ns);
+    snprintf((char *)ptr, kVstMaxParamStrLen, "%.3f", p->params[index % BENCH_NUM_PARAMS]);
+    return 0;
+
+  case effEditIdle:
+    bench_plugin_burn(p->gui_ns);
+    return 0;
+
+  case effGetEffectName:
+    strcpy((char *)ptr, "vst-bridge bench");
+    return 1;
+
+  case effGetVendorString:
+    strcpy((char *)ptr, "vst-bridge");
+    return 1;
+
+  case effGetProductString:
+    strcpy((char *)ptr, "bench gain");
+    return 1;
+
+  case effGetVendorVersion:
+    return 1;
+
+  case effGetVstVersion:
+    return kVstVersion;
+
+  case effGetPlugCategory:
+    return kPlugCategEffect;
+
+  case effOpen:
+    usleep(p->load_us);
+    return 0;
+
+  case effGetChunk:
+    *(void **)ptr = p->params;
+    return sizeof (p->params);
+
+  case effSetChunk:
+    // the parameters, then whatever the DAW stored with them
+    usleep(p->load_us);
+    if (value >= (VstIntPtr)sizeof (p->params))
+      memcpy(p->params, ptr, sizeof (p->params));
+    return 0;
+
+  case effProcessEvents: {
+    struct VstEvents *evs = (struct VstEvents *)ptr;
+    p->nevents += evs->numEvents;
+    for (int i = 0; i < evs->numEvents; ++i) {
+      if (evs->events[i]->type != kVstSysExType)
+        continue;
+      // the dump the bench sends
+      VstMidiSysexEvent *sysex = (VstMidiSysexEvent *)evs->events[i];
+      for (int j = 0; j < sysex->dumpBytes; ++j) {
+        if (sysex->sysexDump[j] != (j & 0x7f)) {
+          fprintf(stderr, "bench plugin: corrupted sysex dump at %d\n", j);
+          break;
+        }
+      }
+    }
+    return 1;
+  }
+
+  case effCanDo:
+    return !strcmp((const char *)ptr, "receiveVstEvents") ||
+      !strcmp((const char *)ptr, "receiveVstMidiEvent");
+
+  default:
+    return 0;
+  }
+}
+
+static void VSTCALLBACK bench_process(AEffect *effect,
+                                      float  **inputs,
+                                      float  **outputs,
+                                      VstInt32 frames)
+{
+  struct bench_plugin *p = (struct bench_plugin *)effect->object;
+
+  for (int c = 0; c < effect->numOutputs; ++c)
+    for (int i = 0; i < frames; ++i)
+      outputs[c][i] = inputs[c % effect->numInputs][i] * p->params[0];
+  if (p->time && frames > 0)
+    outputs[0][0] = bench_plugin_time(p);
+  bench_plugin_load(p);
+}
+
+static void VSTCALLBACK bench_process_double(AEffect *effect,
+                                             double **inputs,
+                                             double **outputs,
+                                             VstInt32 frames)
+{
+  struct bench_plugin *p = (struct bench_plugin *)effect->object;
+
+  for (int c = 0; c < effect->numOutputs; ++c)
+    for (int i = 0; i < frames; ++i)
+      outputs[c][i] = inputs[c % effect->numInputs][i] * p->params[0];
+  if (p->time && frames > 0)
+    outputs[0][0] = bench_plugin_time(p);
+  bench_plugin_load(p);
+}
+
+static void VSTCALLBACK bench_set_parameter(AEffect *effect,
+                                            VstInt32 index,
+                                            float    value)
+{
+  struct bench_plugin *p = (struct bench_plugin *)effect->object;
+  p->params[index % BENCH_NUM_PARAMS] = value;
+}
+
+static float VSTCALLBACK bench_get_parameter(AEffect *effect,
+                                             VstInt32 index)
+{
+  struct bench_plugin *p = (struct bench_plugin *)effect->object;
+  return p->params[index % BENCH_NUM_PARAMS];
+}
+
+extern "C" AEffect *VSTPluginMain(audioMasterCallback audio_master);
+
+AEffect *VSTPluginMain(audioMasterCallback audio_master)
+{
+  struct bench_plugin *p = (struct bench_plugin *)calloc(1, sizeof (*p));
+  int channels = bench_getenv("VST_BRIDGE_BENCH_CHANNELS");
+
+  if (!p)
+    return NULL;
+
+  // the host must answer during plugin main, like with a real plugin
+  if (audio_master(&p->e, audioMasterVersion, 0, 0, NULL, 0) == 0)
+    fprintf(stderr, "bench plugin: audioMasterVersion returned 0\n");
+
+  p->params[0]                = 1;
+  p->e.magic                  = kEffectMagic;
+  p->e.object                 = p;
+  p->e.dispatcher             = bench_dispatcher;
+  p->e.setParameter           = bench_set_parameter;
+  p->e.getParameter           = bench_get_parameter;
+  p->e.processReplacing       = bench_process;
+  p->e.processDoubleReplacing = bench_process_double;
+  p->e.numPrograms            = 1;
+  p->e.numParams              = BENCH_NUM_PARAMS;
+  p->e.numInputs              = channels > 0 ? channels : 2;
+  p->e.numOutputs             = p->e.numInputs;
+  p->e.flags                  = effFlagsCanReplacing | effFlagsCanDoubleReplacing |
+    effFlagsProgramChunks;
+  p->e.uniqueID               = 0x76627262; // vbrb
+  p->e.version                = 1;
+  p->dsp_ns                   = bench_getenv("VST_BRIDGE_BENCH_DSP_US") * 1000ULL;
+  p->stall_ns                 = bench_getenv("VST_BRIDGE_BENCH_STALL_US") * 1000ULL;
+  p->stall_every              = bench_getenv("VST_BRIDGE_BENCH_STALL_EVERY");
+  p->gui_ns                   = bench_getenv("VST_BRIDGE_BENCH_GUI_US") * 1000ULL;
+  p->load_us                  = bench_getenv("VST_BRIDGE_BENCH_LOAD_US");
+  p->midi_out                 = bench_getenv("VST_BRIDGE_BENCH_MIDI_OUT");
+  p->queries                  = bench_getenv("VST_BRIDGE_BENCH_QUERIES");
+  p->time                     = bench_getenv("VST_BRIDGE_BENCH_TIME");
+  p->audio_master             = audio_master;
+  p->automate_ms              = bench_getenv("VST_BRIDGE_BENCH_AUTOMATE_MS");
+  p->refs                     = 1;
+  if (p->automate_ms > 0) {
+    pthread_t thread;
+    p->refs = 2;
+    if (pthread_create(&thread, NULL, bench_plugin_automate, p))
+      p->refs = 1;
+    else
+      pthread_detach(thread);
+  }
+  return &p->e;
+}
@@ -0,0 +1,253 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "../common/common.h"
+#include "bench-util.h"
+
+double g_bench_sample_rate = 48000;
+int    g_bench_block_size  = 64;
+int    g_bench_process_level = kVstProcessLevelRealtime;
+double g_bench_sample_pos;
+uint64_t g_bench_events_out;
+
+static struct VstTimeInfo g_bench_time_info;
+
+uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool bench_replace_magic(void *mem, size_t size,
+                                const char *magic, const char *replacement)
+{
+  char pattern[PATH_MAX];
+
+  memset(pattern, 0, sizeof (pattern));
+  strcpy(pattern, magic);
+  void *pos = memmem(mem, size, pattern, sizeof (pattern));
+  if (!pos) {
+    fprintf(stderr, "`%s' magic not found in plugin\n", magic);
+    return false;
+  }
+
+  memset(pattern, 0, sizeof (pattern));
+  strncpy(pattern, replacement, sizeof (pattern) - 1);
+  memcpy(pos, pattern, sizeof (pattern));
+  return true;
+}
+
+bool bench_bridge_load(struct bench_bridge *bridge,
+                       const char *tpl,
+                       const char *host,
+                       const char *dll)
+{
+  char host_path[PATH_MAX];
+  char dll_path[PATH_MAX];
+  char dlls[PATH_MAX];
+  size_t len = 0;
+  struct stat st;
+
+  memset(bridge, 0, sizeof (*bridge));
+  if (!realpath(host, host_path)) {
+    fprintf(stderr, "%s: %m\n", host);
+    return false;
+  }
+
+  // a chain: the dlls, one per line
+  snprintf(dlls, sizeof (dlls), "%s", dll);
+  for (char *path = strtok(dlls, VST_BRIDGE_CHAIN_SEP); path;
+       path = strtok(NULL, VST_BRIDGE_CHAIN_SEP)) {
+    char real_path[PATH_MAX];
+    if (!realpath(path, real_path)) {
+      fprintf(stderr, "%s: %m\n", path);
+      return false;
+    }
+    len += snprintf(dll_path + len, sizeof (dll_path) - len, "%s%s",
+                    len ? VST_BRIDGE_CHAIN_SEP : "", real_path);
+    if (len >= sizeof (dll_path)) {
+      fprintf(stderr, "%s: %s\n", dll, strerror(ENAMETOOLONG));
+      return false;
+    }
+  }
+
+  int fd_tpl = open(tpl, O_RDONLY);
+  if (fd_tpl < 0 || fstat(fd_tpl, &st)) {
+    fprintf(stderr, "%s: %m\n", tpl);
+    return false;
+  }
+
+  strcpy(bridge->path, "/tmp/vst-bridge-bench-XXXXXX.so");
+  int fd_so = mkstemps(bridge->path, 3);
+  if (fd_so < 0) {
+    fprintf(stderr, "%s: %m\n", bridge->path);
+    close(fd_tpl);
+    return false;
+  }
+
+  bool ok = sendfile(fd_so, fd_tpl, NULL, st.st_size) == st.st_size;
+  close(fd_tpl);
+
+  void *mem = ok ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_so, 0)
+    : MAP_FAILED;
+  ok = mem != MAP_FAILED &&
+    bench_replace_magic(mem, st.st_size, VST_BRIDGE_TPL_DLL, dll_path) &&
+    bench_replace_magic(mem, st.st_size, VST_BRIDGE_TPL_HOST, host_path);
+  if (mem != MAP_FAILED)
+    munmap(mem, st.st_size);
+  close(fd_so);
+
+  bridge->temporary = true;
+  if (!ok) {
+    fprintf(stderr, "failed to load the bridge %s: copy failed\n", bridge->path);
+    bench_bridge_unload(bridge);
+    return false;
+  }
+  return bench_bridge_load_so(bridge, bridge->path);
+}
+
+bool bench_bridge_load_so(struct bench_bridge *bridge, const char *path)
+{
+  if (path != bridge->path) {
+    memset(bridge, 0, sizeof (*bridge));
+    strncpy(bridge->path, path, sizeof (bridge->path) - 1);
+  }
+
+  bridge->handle = dlopen(bridge->path, RTLD_NOW | RTLD_LOCAL);
+  if (bridge->handle)
+    bridge->plugin_main = (AEffect *(*)(audioMasterCallback))dlsym(
+      bridge->handle, "VSTPluginMain");
+  if (!bridge->plugin_main) {
+    fprintf(stderr, "failed to load the bridge %s: %s\n", bridge->path, dlerror());
+    bench_bridge_unload(bridge);
+    return false;
+  }
+  return true;
+}
+
+void bench_bridge_unload(struct bench_bridge *bridge)
+{
+  if (bridge->handle)
+    dlclose(bridge->handle);
+  if (bridge->temporary)
+    unlink(bridge->path);
+  memset(bridge, 0, sizeof (*bridge));
+}
+
+AEffect *bench_bridge_open(struct bench_bridge *bridge, int channels)
+{
+  char buffer[16];
+
+  snprintf(buffer, sizeof (buffer), "%d", channels);
+  setenv("VST_BRIDGE_BENCH_CHANNELS", buffer, 1);
+
+  AEffect *effect = bridge->plugin_main(bench_audio_master);
+  if (!effect)
+    return NULL;
+
+  effect->dispatcher(effect, effOpen, 0, 0, NULL, 0);
+  effect->dispatcher(effect, effSetSampleRate, 0, 0, NULL, g_bench_sample_rate);
+  effect->dispatcher(effect, effSetBlockSize, 0, g_bench_block_size, NULL, 0);
+  effect->dispatcher(effect, effMainsChanged, 0, 1, NULL, 0);
+  return effect;
+}
+
+void bench_bridge_close(AEffect *effect)
+{
+  effect->dispatcher(effect, effMainsChanged, 0, 0, NULL, 0);
+  effect->dispatcher(effect, effClose, 0, 0, NULL, 0);
+}
+
+VstIntPtr VSTCALLBACK bench_audio_master(AEffect  * /*effect*/,
+                                         VstInt32  opcode,
+                                         VstInt32  /*index*/,
+                                         VstIntPtr /*value*/,
+                                         void     *ptr,
+                                         float     /*opt*/)
+{
+  switch (opcode) {
+  case audioMasterVersion:
+    return kVstVersion;
+
+  case audioMasterGetSampleRate:
+    return g_bench_sample_rate;
+
+  case audioMasterGetBlockSize:
+    return g_bench_block_size;
+
+  case audioMasterGetCurrentProcessLevel:
+    return g_bench_process_level;
+
+  case audioMasterGetTime:
+    g_bench_time_info.sampleRate = g_bench_sample_rate;
+    g_bench_time_info.samplePos  = g_bench_sample_pos;
+    g_bench_time_info.tempo      = 120;
+    g_bench_time_info.flags      = kVstTempoValid;
+    return (VstIntPtr)&g_bench_time_info;
+
+  case audioMasterGetVendorString:
+    strcpy((char *)ptr, "vst-bridge");
+    return 1;
+
+  case audioMasterGetProductString:
+    strcpy((char *)ptr, "vst-bridge-bench");
+    return 1;
+
+  case audioMasterGetVendorVersion:
+    return 1;
+
+  case audioMasterProcessEvents:
+    g_bench_events_out += ((struct VstEvents *)ptr)->numEvents;
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+bool bench_latency_init(struct bench_latency *lat, size_t capacity)
+{
+  lat->samples  = (uint64_t *)malloc(capacity * sizeof (*lat->samples));
+  lat->count    = 0;
+  lat->capacity = lat->samples ? capacity : 0;
+  lat->sorted   = true;
+  return lat->samples;
+}
+
+void bench_latency_free(struct bench_latency *lat)
+{
+  free(lat->samples);
+  memset(lat, 0, sizeof (*lat));
+}
+
+void bench_latency_add(struct bench_latency *lat, uint64_t ns)
+{
+  if (lat->count < lat->capacity)
+    lat->samples[lat->count++] = ns;
+  lat->sorted = false;
+}
+
+uint64_t bench_latency_quantile(struct bench_latency *lat, double q)
+{
+  if (lat->count == 0)
+    return 0;
+  if (!lat->sorted) {
+    std::sort(lat->samples, lat->samples + lat->count);
+    lat->sorted = true;
+  }
+
+  size_t i = q * (lat->count - 1) + 0.5;
+  return lat->samples[MIN(i, lat->count - 1)];
+}
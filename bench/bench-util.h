@@ -0,0 +1,69 @@
+#ifndef BENCH_UTIL_H
+# define BENCH_UTIL_H
+
+# include <limits.h>
+# include <stddef.h>
+# include <stdint.h>
+
+# include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+/*
+ * Helpers shared by the benchmark drivers: they load the real plugin
+ * template (patched to spawn the native host with the bench plugin), and
+ * play the role of the DAW.
+ */
+
+struct bench_bridge {
+  char   path[PATH_MAX];
+  bool   temporary;
+  void  *handle;
+  AEffect *(*plugin_main)(audioMasterCallback audio_master);
+};
+
+struct bench_latency {
+  uint64_t *samples;
+  size_t    count;
+  size_t    capacity;
+  bool      sorted;
+};
+
+extern double g_bench_sample_rate;
+extern int    g_bench_block_size;
+/* what the DAW answers audioMasterGetCurrentProcessLevel and audioMasterGetTime with */
+extern int    g_bench_process_level;
+extern double g_bench_sample_pos;
+/* events received with audioMasterProcessEvents */
+extern uint64_t g_bench_events_out;
+
+uint64_t bench_now_ns(void);
+
+/*
+ * copies the template, points it at host and dll (or a chain of dlls, one
+ * per line), and dlopen()s it
+ */
+bool bench_bridge_load(struct bench_bridge *bridge,
+                       const char *tpl,
+                       const char *host,
+                       const char *dll);
+/* dlopen()s a bridge made by vst-bridge-maker, as is */
+bool bench_bridge_load_so(struct bench_bridge *bridge, const char *path);
+void bench_bridge_unload(struct bench_bridge *bridge);
+
+/* VSTPluginMain, then the usual DAW setup up to effMainsChanged(1) */
+AEffect *bench_bridge_open(struct bench_bridge *bridge, int channels);
+void bench_bridge_close(AEffect *effect);
+
+VstIntPtr VSTCALLBACK bench_audio_master(AEffect  *effect,
+                                         VstInt32  opcode,
+                                         VstInt32  index,
+                                         VstIntPtr value,
+                                         void     *ptr,
+                                         float     opt);
+
+bool bench_latency_init(struct bench_latency *lat, size_t capacity);
+void bench_latency_free(struct bench_latency *lat);
+void bench_latency_add(struct bench_latency *lat, uint64_t ns);
+/* q in [0, 1] */
+uint64_t bench_latency_quantile(struct bench_latency *lat, double q);
+
+#endif /* !BENCH_UTIL_H */
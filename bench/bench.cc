@@ -0,0 +1,848 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../common/common.h"
+#include "bench-util.h"
+
+/*
+ * Loopback benchmark of the bridge protocol: the real plugin template
+ * talks to the real host.cc (built natively) over the real socketpair,
+ * the plugin being a native gain. Reports the per-block round trip
+ * latency and the throughput.
+ */
+
+#define BENCH_MAX_CHANNELS 32
+#define BENCH_MAX_FRAMES 1024
+#define BENCH_MAX_EVENTS 1024
+#define BENCH_MAX_SYSEX (64 * 1024)
+
+struct bench_config {
+  bool double_precision;
+  int  channels;
+  int  frames;
+  int  events;
+  // bytes of a sysex dump sent with the events
+  int  sysex;
+  int  params;
+  // notes the plugin sends back in each block (VST_BRIDGE_BENCH_MIDI_OUT)
+  int  midi_out;
+  // queries about the DAW the plugin makes in each block
+  // (VST_BRIDGE_BENCH_QUERIES)
+  int  queries;
+};
+
+struct bench_buffers {
+  float           *inputs[BENCH_MAX_CHANNELS];
+  float           *outputs[BENCH_MAX_CHANNELS];
+  double          *inputsd[BENCH_MAX_CHANNELS];
+  double          *outputsd[BENCH_MAX_CHANNELS];
+  struct VstEvents *events;
+  VstMidiEvent     midi[BENCH_MAX_EVENTS];
+  VstMidiSysexEvent sysex;
+};
+
+static const char *g_tpl  = "../plugin/vst-bridge-plugin-tpl.so";
+static const char *g_host = "./vst-bridge-host-native.exe";
+static const char *g_dll  = "./vst-bridge-bench-plugin.so";
+static int g_iterations   = 2000;
+
+static bool bench_buffers_init(struct bench_buffers *bufs)
+{
+  memset(bufs, 0, sizeof (*bufs));
+  for (int i = 0; i < BENCH_MAX_CHANNELS; ++i) {
+    bufs->inputs[i]   = (float *)calloc(BENCH_MAX_FRAMES, sizeof (float));
+    bufs->outputs[i]  = (float *)calloc(BENCH_MAX_FRAMES, sizeof (float));
+    bufs->inputsd[i]  = (double *)calloc(BENCH_MAX_FRAMES, sizeof (double));
+    bufs->outputsd[i] = (double *)calloc(BENCH_MAX_FRAMES, sizeof (double));
+    if (!bufs->inputs[i] || !bufs->outputs[i] || !bufs->inputsd[i] || !bufs->outputsd[i])
+      return false;
+    for (int j = 0; j < BENCH_MAX_FRAMES; ++j) {
+      bufs->inputs[i][j]  = (j % 64) / 64.0f;
+      bufs->inputsd[i][j] = (j % 64) / 64.0;
+    }
+  }
+
+  bufs->events = (struct VstEvents *)calloc(
+    1, sizeof (*bufs->events) + (BENCH_MAX_EVENTS + 1) * sizeof (VstEvent *));
+  if (!bufs->events)
+    return false;
+  for (int i = 0; i < BENCH_MAX_EVENTS; ++i) {
+    VstMidiEvent *me = bufs->midi + i;
+    me->type        = kVstMidiType;
+    me->byteSize    = sizeof (*me);
+    me->midiData[0] = (i & 1) ? 0x80 : 0x90;
+    me->midiData[1] = 36 + i % 64;
+    me->midiData[2] = 100;
+    bufs->events->events[i] = (VstEvent *)me;
+  }
+
+  // checked by the bench plugin
+  bufs->sysex.type      = kVstSysExType;
+  bufs->sysex.byteSize  = sizeof (bufs->sysex);
+  bufs->sysex.sysexDump = (char *)malloc(BENCH_MAX_SYSEX);
+  if (!bufs->sysex.sysexDump)
+    return false;
+  for (int i = 0; i < BENCH_MAX_SYSEX; ++i)
+    bufs->sysex.sysexDump[i] = i & 0x7f;
+  return true;
+}
+
+static bool bench_config_fits(const struct bench_config *cfg)
+{
+  size_t len = cfg->double_precision ?
+    VST_BRIDGE_FRAMES_DOUBLE_LEN(cfg->channels * cfg->frames) :
+    VST_BRIDGE_FRAMES_LEN(cfg->channels * cfg->frames);
+  return len <= sizeof (struct vst_bridge_request);
+}
+
+static void bench_block(AEffect *effect,
+                        const struct bench_config *cfg,
+                        struct bench_buffers *bufs,
+                        int iteration)
+{
+  if (cfg->events > 0 || cfg->sysex > 0) {
+    for (int i = 0; i < cfg->events; ++i)
+      bufs->midi[i].deltaFrames = i % cfg->frames;
+    bufs->events->numEvents = cfg->events;
+    if (cfg->sysex > 0) {
+      bufs->sysex.dumpBytes = cfg->sysex;
+      bufs->events->events[bufs->events->numEvents++] = (VstEvent *)&bufs->sysex;
+    }
+    effect->dispatcher(effect, effProcessEvents, 0, 0, bufs->events, 0);
+  }
+
+  for (int i = 0; i < cfg->params; ++i) {
+    int index = (iteration + i) % effect->numParams;
+    effect->setParameter(effect, index, 1.0f);
+    effect->getParameter(effect, index);
+  }
+
+  if (cfg->double_precision)
+    effect->processDoubleReplacing(effect, bufs->inputsd, bufs->outputsd, cfg->frames);
+  else
+    effect->processReplacing(effect, bufs->inputs, bufs->outputs, cfg->frames);
+}
+
+static void bench_print(struct bench_latency *lat, double elapsed, int frames)
+{
+  double blocks_per_sec = g_iterations / elapsed;
+
+  printf("%8.1f %8.1f %8.1f %8.1f %8.1f %10.0f %8.1fx\n",
+         bench_latency_quantile(lat, 0.5) / 1e3,
+         bench_latency_quantile(lat, 0.9) / 1e3,
+         bench_latency_quantile(lat, 0.99) / 1e3,
+         bench_latency_quantile(lat, 0.999) / 1e3,
+         bench_latency_quantile(lat, 1) / 1e3,
+         blocks_per_sec,
+         blocks_per_sec * frames / g_bench_sample_rate);
+}
+
+static void bench_run(AEffect *effect,
+                      const struct bench_config *cfg,
+                      struct bench_buffers *bufs,
+                      struct bench_latency *lat)
+{
+  printf("%-6s %3dch %5dfr %4dev %5dsx %3dpar %2dout %2dqry ",
+         cfg->double_precision ? "double" : "float", cfg->channels, cfg->frames,
+         cfg->events, cfg->sysex, cfg->params, cfg->midi_out, cfg->queries);
+
+  if (!bench_config_fits(cfg)) {
+    printf("  skipped: exceeds the request size\n");
+    return;
+  }
+
+  g_bench_block_size = cfg->frames;
+  effect->dispatcher(effect, effMainsChanged, 0, 0, NULL, 0);
+  effect->dispatcher(effect, effSetBlockSize, 0, cfg->frames, NULL, 0);
+  effect->dispatcher(effect, effSetProcessPrecision, 0,
+                     cfg->double_precision ? kVstProcessPrecision64 : kVstProcessPrecision32,
+                     NULL, 0);
+  effect->dispatcher(effect, effMainsChanged, 0, 1, NULL, 0);
+
+  for (int i = 0; i < g_iterations / 10; ++i)
+    bench_block(effect, cfg, bufs, i);
+
+  lat->count = 0;
+  g_bench_events_out = 0;
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < g_iterations; ++i) {
+    uint64_t t0 = bench_now_ns();
+    bench_block(effect, cfg, bufs, i);
+    bench_latency_add(lat, bench_now_ns() - t0);
+  }
+  bench_print(lat, (bench_now_ns() - start) / 1e9, cfg->frames);
+  if (g_bench_events_out != (uint64_t)g_iterations * cfg->midi_out)
+    printf("  %llu events out, expected %llu\n", (unsigned long long)g_bench_events_out,
+           (unsigned long long)g_iterations * cfg->midi_out);
+  fflush(stdout);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -t, --template=<so>    the plugin template (%s)\n"
+          "  -H, --host=<exe>       the native host (%s)\n"
+          "  -p, --plugin=<so>      the bench plugin (%s)\n"
+          "  -n, --iterations=<n>   blocks per configuration (%d)\n"
+          "  -q, --quick            only a few configurations\n"
+          "  -c, --chain=<n>        only n plugins in series, as n bridges and as\n"
+          "                         one chain bridge\n"
+          "  -o, --offline=<n>      only an offline bounce, waiting for each block\n"
+          "                         and with n blocks in flight\n"
+          "  -l, --load=<n>         only a project load of n instances, waiting\n"
+          "                         for each setup call and not\n"
+          "  -Q, --queries=<n>      only the queries of a DAW loading n instances,\n"
+          "                         without the cache, then with it, twice\n"
+          "  -r, --reblock=<n>      only calls of 1 to 80 frames, as they come and\n"
+          "                         gathered in blocks of n frames\n",
+          argv0, g_tpl, g_host, g_dll, g_iterations);
+}
+
+/*
+ * n bench plugins in series, 2ch 256fr: n bridges, each block crossing the
+ * socket n times, then a single bridge to a chain of them in one host.
+ * Each plugin gets its own gain, and both must output the same.
+ */
+static bool bench_chain(int n, struct bench_buffers *bufs, struct bench_latency *lat)
+{
+  const int frames = 256;
+  struct bench_bridge bridges[n + 1];
+  AEffect *effects[n + 1];
+  float stages[2][2][BENCH_MAX_FRAMES];
+  float *ports[2][2] = { { stages[0][0], stages[0][1] }, { stages[1][0], stages[1][1] } };
+  float series[2][BENCH_MAX_FRAMES];
+  char dlls[PATH_MAX];
+  size_t len = 0;
+  bool ok = true;
+
+  dlls[0] = '\0';
+  for (int i = 0; i < n; ++i)
+    len += snprintf(dlls + len, sizeof (dlls) - len, "%s%s", i ? VST_BRIDGE_CHAIN_SEP : "", g_dll);
+
+  g_bench_block_size = frames;
+  for (int i = 0; i <= n; ++i) {
+    if (!bench_bridge_load(&bridges[i], g_tpl, g_host, i < n ? g_dll : dlls))
+      return false;
+    effects[i] = bench_bridge_open(&bridges[i], 2);
+    if (!effects[i]) {
+      fprintf(stderr, "failed to instantiate the bridge\n");
+      return false;
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    float gain = 1.0f - 0.05f * (i + 1);
+    effects[i]->setParameter(effects[i], 0, gain);
+    effects[n]->setParameter(effects[n], i * effects[i]->numParams, gain);
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    char label[64];
+    if (pass)
+      snprintf(label, sizeof (label), "a chain of %d, float 2ch %dfr", n, frames);
+    else
+      snprintf(label, sizeof (label), "%d bridges in series, float 2ch %dfr", n, frames);
+    printf("%-54s ", label);
+
+    lat->count = 0;
+    uint64_t start = bench_now_ns();
+    for (int it = 0; it < g_iterations; ++it) {
+      uint64_t t0 = bench_now_ns();
+      if (pass) {
+        effects[n]->processReplacing(effects[n], bufs->inputs, bufs->outputs, frames);
+      } else {
+        float **in = bufs->inputs;
+        for (int i = 0; i < n; ++i) {
+          float **out = i == n - 1 ? bufs->outputs : ports[i & 1];
+          effects[i]->processReplacing(effects[i], in, out, frames);
+          in = out;
+        }
+      }
+      bench_latency_add(lat, bench_now_ns() - t0);
+    }
+    bench_print(lat, (bench_now_ns() - start) / 1e9, frames);
+
+    if (!pass) {
+      memcpy(series[0], bufs->outputs[0], frames * sizeof (float));
+      memcpy(series[1], bufs->outputs[1], frames * sizeof (float));
+    } else if (memcmp(series[0], bufs->outputs[0], frames * sizeof (float)) ||
+               memcmp(series[1], bufs->outputs[1], frames * sizeof (float))) {
+      printf("  the chain's output differs from the bridges in series\n");
+      ok = false;
+    }
+  }
+
+  for (int i = 0; i <= n; ++i) {
+    bench_bridge_close(effects[i]);
+    bench_bridge_unload(&bridges[i]);
+  }
+  return ok;
+}
+
+/* blocks of a bounce which differ from each other, unlike the usual inputs */
+static void bench_offline_inputs(struct bench_buffers *bufs, int frames, int block)
+{
+  for (int c = 0; c < 2; ++c)
+    for (int j = 0; j < frames; ++j)
+      bufs->inputs[c][j] = ((block * frames + j * (c + 1)) % 997) / 997.0f;
+}
+
+/*
+ * A bounce of 2ch 256fr blocks by a DAW rendering 1 or 4 tracks in turn,
+ * each with a bridge, at a few simulated DSP loads: the bridges waiting
+ * for each block, then with n blocks in flight
+ * (VST_BRIDGE_OFFLINE_PIPELINE), the hosts working meanwhile. Then the DAW
+ * goes from real time to offline and back, and the pipeline's output must
+ * be the other's, n blocks late, the time the plugin sees included.
+ */
+#define BENCH_OFFLINE_TRACKS 4
+
+static bool bench_offline(int n,
+                          struct bench_bridge *bridge,
+                          struct bench_buffers *bufs,
+                          struct bench_latency *lat)
+{
+  static const int dsp_us[] = { 0, 100 };
+  static const int tracks[] = { 1, BENCH_OFFLINE_TRACKS };
+  const int frames = 256;
+  const int blocks = 300;
+  AEffect *effects[BENCH_OFFLINE_TRACKS];
+  char value[16];
+  bool ok = true;
+
+  g_bench_block_size    = frames;
+  g_bench_process_level = kVstProcessLevelOffline;
+  for (size_t d = 0; d < sizeof (dsp_us) / sizeof (dsp_us[0]); ++d) {
+    snprintf(value, sizeof (value), "%d", dsp_us[d]);
+    setenv("VST_BRIDGE_BENCH_DSP_US", value, 1);
+    for (size_t t = 0; t < sizeof (tracks) / sizeof (tracks[0]); ++t) {
+      for (int pass = 0; pass < 2; ++pass) {
+        snprintf(value, sizeof (value), "%d", pass ? n : 0);
+        setenv("VST_BRIDGE_OFFLINE_PIPELINE", value, 1);
+        for (int i = 0; i < tracks[t]; ++i) {
+          effects[i] = bench_bridge_open(bridge, 2);
+          if (!effects[i]) {
+            fprintf(stderr, "failed to instantiate the bridge\n");
+            return false;
+          }
+        }
+
+        char label[64];
+        snprintf(label, sizeof (label), "bounce, %d track%s, dsp %3dus, %d in flight",
+                 tracks[t], tracks[t] > 1 ? "s" : "", dsp_us[d], pass ? n : 1);
+        printf("%-54s ", label);
+
+        lat->count = 0;
+        uint64_t start = bench_now_ns();
+        for (int it = 0; it < g_iterations; ++it) {
+          uint64_t t0 = bench_now_ns();
+          for (int i = 0; i < tracks[t]; ++i)
+            effects[i]->processReplacing(effects[i], bufs->inputs, bufs->outputs, frames);
+          bench_latency_add(lat, bench_now_ns() - t0);
+        }
+        bench_print(lat, (bench_now_ns() - start) / 1e9, frames);
+        for (int i = 0; i < tracks[t]; ++i)
+          bench_bridge_close(effects[i]);
+      }
+    }
+  }
+  unsetenv("VST_BRIDGE_BENCH_DSP_US");
+
+  setenv("VST_BRIDGE_BENCH_TIME", "1", 1);
+  for (int i = 0; i < 2; ++i) {
+    snprintf(value, sizeof (value), "%d", i ? n : 0);
+    setenv("VST_BRIDGE_OFFLINE_PIPELINE", value, 1);
+    effects[i] = bench_bridge_open(bridge, 2);
+    if (!effects[i]) {
+      fprintf(stderr, "failed to instantiate the bridge\n");
+      return false;
+    }
+  }
+  unsetenv("VST_BRIDGE_BENCH_TIME");
+  unsetenv("VST_BRIDGE_OFFLINE_PIPELINE");
+  if (effects[1]->initialDelay != effects[0]->initialDelay + n * frames) {
+    printf("  initialDelay is %d with the pipeline, expected %d\n",
+           effects[1]->initialDelay, effects[0]->initialDelay + n * frames);
+    ok = false;
+  }
+
+  // the bridge waiting for each block, and what the pipeline owes
+  float history[VST_BRIDGE_PIPELINE_MAX + 1][2][BENCH_MAX_FRAMES];
+  float *outputs[2] = { bufs->outputs[0], bufs->outputs[1] };
+  float delayed[2][BENCH_MAX_FRAMES];
+  float *delayed_ptrs[2] = { delayed[0], delayed[1] };
+  int mismatches = 0;
+
+  for (int it = 0; it < 3 * blocks; ++it) {
+    g_bench_process_level = it >= blocks && it < 2 * blocks ?
+      kVstProcessLevelOffline : kVstProcessLevelRealtime;
+    g_bench_sample_pos = (double)it * frames;
+    bench_offline_inputs(bufs, frames, it);
+    effects[0]->processReplacing(effects[0], bufs->inputs, outputs, frames);
+    effects[1]->processReplacing(effects[1], bufs->inputs, delayed_ptrs, frames);
+
+    float (*slot)[BENCH_MAX_FRAMES] = history[it % (n + 1)];
+    memcpy(slot[0], outputs[0], frames * sizeof (float));
+    memcpy(slot[1], outputs[1], frames * sizeof (float));
+    float (*expected)[BENCH_MAX_FRAMES] = history[(it + 1) % (n + 1)];
+    for (int c = 0; c < 2; ++c) {
+      for (int j = 0; j < frames; ++j) {
+        float want = it >= n ? expected[c][j] : 0;
+        if (delayed[c][j] != want && mismatches++ < 4)
+          printf("  block %d, channel %d, frame %d: %f, expected %f\n",
+                 it, c, j, delayed[c][j], want);
+      }
+    }
+  }
+  g_bench_process_level = kVstProcessLevelRealtime;
+  g_bench_sample_pos    = 0;
+  printf("real time, offline and back, %d blocks of each: %s\n", blocks,
+         mismatches ? "the pipeline's output differs" : "same output, n blocks late");
+  ok = ok && !mismatches;
+
+  for (int i = 0; i < 2; ++i)
+    bench_bridge_close(effects[i]);
+  return ok;
+}
+
+/*
+ * A project load of n instances: each is instantiated and set up the way
+ * a DAW restoring it does, its state a 1 MB chunk, then all are resumed
+ * and process a block. The plugin takes 20 ms in effOpen and in
+ * effSetChunk. The setup calls waited for, then sent without waiting
+ * (VST_BRIDGE_ASYNC_SETUP); either way each instance must process with
+ * the gain its chunk set.
+ */
+#define BENCH_LOAD_CHUNK (1024 * 1024)
+
+static bool bench_load(int n, struct bench_bridge *bridge, struct bench_buffers *bufs)
+{
+  const int frames = 256;
+  AEffect *effects[n];
+  static float chunk[BENCH_LOAD_CHUNK / sizeof (float)];
+  bool ok = true;
+
+  setenv("VST_BRIDGE_BENCH_LOAD_US", "20000", 1);
+  bench_offline_inputs(bufs, frames, 1);
+  for (int async = 0; async < 2; ++async) {
+    setenv("VST_BRIDGE_ASYNC_SETUP", async ? "1" : "0", 1);
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < n; ++i) {
+      effects[i] = bridge->plugin_main(bench_audio_master);
+      if (!effects[i]) {
+        fprintf(stderr, "failed to instantiate the bridge\n");
+        return false;
+      }
+      AEffect *e = effects[i];
+      chunk[0] = 1.0f / (i + 2);
+      e->dispatcher(e, effOpen, 0, 0, NULL, 0);
+      e->dispatcher(e, effSetSampleRate, 0, 0, NULL, g_bench_sample_rate);
+      e->dispatcher(e, effSetBlockSize, 0, frames, NULL, 0);
+      e->dispatcher(e, effSetChunk, 0, sizeof (chunk), chunk, 0);
+    }
+    uint64_t loaded = bench_now_ns();
+    int mismatches = 0;
+    for (int i = 0; i < n; ++i) {
+      effects[i]->dispatcher(effects[i], effMainsChanged, 0, 1, NULL, 0);
+      effects[i]->processReplacing(effects[i], bufs->inputs, bufs->outputs, frames);
+      for (int j = 0; j < frames; ++j)
+        if (bufs->outputs[0][j] != bufs->inputs[0][j] * (1.0f / (i + 2)))
+          ++mismatches;
+    }
+    uint64_t end = bench_now_ns();
+
+    char label[64];
+    snprintf(label, sizeof (label), "load, %d instances, %s", n,
+             async ? "setup sent" : "setup waited for");
+    printf("%-54s DAW's loop %7.1f ms, resumed %7.1f ms%s\n", label,
+           (loaded - start) / 1e6, (end - start) / 1e6,
+           mismatches ? ", wrong gain" : "");
+    ok = ok && !mismatches;
+
+    for (int i = 0; i < n; ++i)
+      bench_bridge_close(effects[i]);
+  }
+  unsetenv("VST_BRIDGE_ASYNC_SETUP");
+  unsetenv("VST_BRIDGE_BENCH_LOAD_US");
+  return ok;
+}
+
+/*
+ * The queries a DAW makes about a plugin it loads: its name, vendor and
+ * versions, canDo, pins, and the names and properties of its parameters
+ * and programs. The answers are appended to answers, to compare them.
+ */
+static size_t bench_queries_ask(AEffect *e, char *answers, size_t size)
+{
+  static const char * const can_dos[] = {
+    "sendVstEvents", "sendVstMidiEvent", "receiveVstEvents",
+    "receiveVstMidiEvent", "receiveVstTimeInfo", "offline", "bypass",
+    "midiProgramNames",
+  };
+  static const VstInt32 opcodes[] = {
+    effGetEffectName, effGetVendorString, effGetProductString,
+    effGetVendorVersion, effGetVstVersion, effGetPlugCategory,
+    effGetNumMidiInputChannels, effGetNumMidiOutputChannels,
+  };
+  union {
+    char                   str[256];
+    VstParameterProperties param;
+    VstPinProperties       pin;
+  } answer;
+  size_t len = 0;
+  VstIntPtr ret;
+
+#define BENCH_ANSWER(Opcode, Index, Ptr)                                \
+  do {                                                                  \
+    memset(&answer, 0, sizeof (answer));                                \
+    ret = e->dispatcher(e, Opcode, Index, 0, Ptr, 0);                   \
+    if (len + sizeof (ret) + sizeof (answer) <= size) {                 \
+      memcpy(answers + len, &ret, sizeof (ret));                        \
+      memcpy(answers + len + sizeof (ret), &answer, sizeof (answer));   \
+      len += sizeof (ret) + sizeof (answer);                            \
+    }                                                                   \
+  } while (0)
+
+  for (size_t i = 0; i < sizeof (opcodes) / sizeof (opcodes[0]); ++i)
+    BENCH_ANSWER(opcodes[i], 0, &answer);
+  for (size_t i = 0; i < sizeof (can_dos) / sizeof (can_dos[0]); ++i)
+    BENCH_ANSWER(effCanDo, 0, (void *)can_dos[i]);
+  for (VstInt32 i = 0; i < e->numInputs; ++i)
+    BENCH_ANSWER(effGetInputProperties, i, &answer);
+  for (VstInt32 i = 0; i < e->numOutputs; ++i)
+    BENCH_ANSWER(effGetOutputProperties, i, &answer);
+  for (VstInt32 i = 0; i < e->numParams; ++i) {
+    BENCH_ANSWER(effGetParamName, i, &answer);
+    BENCH_ANSWER(effGetParameterProperties, i, &answer);
+  }
+  for (VstInt32 i = 0; i < e->numPrograms; ++i)
+    BENCH_ANSWER(effGetProgramNameIndexed, i, &answer);
+
+#undef BENCH_ANSWER
+  return len;
+}
+
+/*
+ * n instances loaded without the cache, then in a first session and in
+ * the next one, with a cache directory of our own: the plugin answers the
+ * first instance's queries, the cache the others', then the next
+ * session's. The answers must be the same.
+ */
+static bool bench_queries(int n)
+{
+  static const char * const labels[] = {
+    "without the cache", "first session", "next session",
+  };
+  static char answers[3][256 * 1024];
+  size_t len[3] = { 0, 0, 0 };
+  char cache[] = "/tmp/vst-bridge-bench-cache-XXXXXX";
+  char cmd[64];
+  AEffect *effects[n];
+  bool ok = true;
+
+  if (!mkdtemp(cache)) {
+    perror(cache);
+    return false;
+  }
+  setenv("XDG_CACHE_HOME", cache, 1);
+  for (int pass = 0; pass < 3 && ok; ++pass) {
+    struct bench_bridge bridge;
+
+    setenv("VST_BRIDGE_QUERY_CACHE", pass ? "1" : "0", 1);
+    if (!bench_bridge_load(&bridge, g_tpl, g_host, g_dll)) {
+      ok = false;
+      break;
+    }
+
+    uint64_t start = bench_now_ns();
+    uint64_t asking = 0;
+    for (int i = 0; i < n; ++i) {
+      effects[i] = bridge.plugin_main(bench_audio_master);
+      if (!effects[i]) {
+        fprintf(stderr, "failed to instantiate the bridge\n");
+        ok = false;
+        n = i;
+        break;
+      }
+      effects[i]->dispatcher(effects[i], effOpen, 0, 0, NULL, 0);
+      uint64_t ask = bench_now_ns();
+      len[pass] = bench_queries_ask(effects[i], answers[pass], sizeof (answers[pass]));
+      asking += bench_now_ns() - ask;
+    }
+    uint64_t end = bench_now_ns();
+
+    char label[64];
+    snprintf(label, sizeof (label), "queries, %d instances, %s", n, labels[pass]);
+    printf("%-54s queries %7.2f ms, load %7.1f ms\n", label, asking / 1e6,
+           (end - start) / 1e6);
+
+    for (int i = 0; i < n; ++i)
+      bench_bridge_close(effects[i]);
+    bench_bridge_unload(&bridge);
+
+    if (ok && (len[pass] != len[0] || memcmp(answers[pass], answers[0], len[0]))) {
+      fprintf(stderr, "%s: the cache's answers aren't the plugin's\n", labels[pass]);
+      ok = false;
+    }
+  }
+  unsetenv("VST_BRIDGE_QUERY_CACHE");
+  unsetenv("XDG_CACHE_HOME");
+
+  snprintf(cmd, sizeof (cmd), "rm -rf %s", cache);
+  if (system(cmd))
+    fprintf(stderr, "%s: not removed\n", cache);
+  return ok;
+}
+
+/*
+ * A DAW splitting its 2ch blocks at automation points, in calls of 1 to
+ * 80 frames, 32 on average: the bridge taking each call as it comes, then
+ * gathering them in blocks of n frames (VST_BRIDGE_REBLOCK). The latency
+ * is per DAW call. The gathered output must be the other's, n frames
+ * late, as initialDelay says.
+ */
+static bool bench_reblock(int n, struct bench_bridge *bridge, struct bench_latency *lat)
+{
+  static const int calls[] = { 1, 7, 16, 3, 64, 32, 5, 48, 80, 64 };
+  const int ncalls = sizeof (calls) / sizeof (calls[0]);
+  const int frames = 32;
+  const int total = g_iterations * frames;
+  AEffect *effects[2];
+  float *streams[2][2];
+  char value[16];
+  bool ok = true;
+
+  g_bench_block_size = 80;
+  // a miss would replace a block, and the outputs would differ
+  setenv("VST_BRIDGE_DEADLINE", "0", 1);
+  for (int i = 0; i < 2; ++i) {
+    snprintf(value, sizeof (value), "%d", i ? n : 0);
+    setenv("VST_BRIDGE_REBLOCK", value, 1);
+    effects[i] = bench_bridge_open(bridge, 2);
+    if (!effects[i]) {
+      fprintf(stderr, "failed to instantiate the bridge\n");
+      return false;
+    }
+    for (int c = 0; c < 2; ++c) {
+      streams[i][c] = (float *)calloc(total + 80, sizeof (float));
+      if (!streams[i][c])
+        return false;
+    }
+  }
+  unsetenv("VST_BRIDGE_REBLOCK");
+  unsetenv("VST_BRIDGE_DEADLINE");
+
+  float *inputs[2];
+  for (int c = 0; c < 2; ++c) {
+    inputs[c] = (float *)malloc((total + 80) * sizeof (float));
+    if (!inputs[c])
+      return false;
+    for (int j = 0; j < total + 80; ++j)
+      inputs[c][j] = ((j * (c + 1)) % 997) / 997.0f;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    char label[64];
+    if (i)
+      snprintf(label, sizeof (label), "calls of 1 to 80 frames, in blocks of %d", n);
+    else
+      snprintf(label, sizeof (label), "calls of 1 to 80 frames, as they come");
+    printf("%-54s ", label);
+
+    lat->count = 0;
+    int pos = 0;
+    uint64_t start = bench_now_ns();
+    for (int it = 0; it < g_iterations; ++it) {
+      int len = calls[it % ncalls];
+      float *in[2] = { inputs[0] + pos, inputs[1] + pos };
+      float *out[2] = { streams[i][0] + pos, streams[i][1] + pos };
+      uint64_t t0 = bench_now_ns();
+      effects[i]->processReplacing(effects[i], in, out, len);
+      bench_latency_add(lat, bench_now_ns() - t0);
+      pos += len;
+    }
+    bench_print(lat, (bench_now_ns() - start) / 1e9, frames);
+  }
+
+  int mismatches = 0;
+  int played = (g_iterations / ncalls) * ncalls * frames;
+  for (int c = 0; c < 2; ++c) {
+    for (int j = 0; j < played; ++j) {
+      float want = j >= n ? streams[0][c][j - n] : 0;
+      if (streams[1][c][j] != want && mismatches++ < 4)
+        printf("  channel %d, frame %d: %f, expected %f\n", c, j, streams[1][c][j], want);
+    }
+  }
+  if (effects[1]->initialDelay != effects[0]->initialDelay + n) {
+    printf("  initialDelay is %d in blocks, expected %d\n",
+           effects[1]->initialDelay, effects[0]->initialDelay + n);
+    ok = false;
+  }
+  printf("in blocks of %d: %s\n", n,
+         mismatches ? "the output differs" : "same output, n frames late");
+  ok = ok && !mismatches;
+
+  for (int i = 0; i < 2; ++i) {
+    bench_bridge_close(effects[i]);
+    for (int c = 0; c < 2; ++c)
+      free(streams[i][c]);
+  }
+  for (int c = 0; c < 2; ++c)
+    free(inputs[c]);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option options[] = {
+    { "template", required_argument, NULL, 't' },
+    { "host", required_argument, NULL, 'H' },
+    { "plugin", required_argument, NULL, 'p' },
+    { "iterations", required_argument, NULL, 'n' },
+    { "quick", no_argument, NULL, 'q' },
+    { "chain", required_argument, NULL, 'c' },
+    { "offline", required_argument, NULL, 'o' },
+    { "load", required_argument, NULL, 'l' },
+    { "queries", required_argument, NULL, 'Q' },
+    { "reblock", required_argument, NULL, 'r' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  static const int channels[] = { 2, 8, 32 };
+  static const int frames[] = { 32, 64, 128, 256, 512, 1024 };
+  static const int densities[] = { 0, 16, 64, 256, 1024 };
+  static const int sysex[] = { 256, 4096, BENCH_MAX_SYSEX };
+  bool quick = false;
+  int chain = 0;
+  int offline = 0;
+  int load = 0;
+  int queries = 0;
+  int reblock = 0;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "t:H:p:n:qc:o:l:Q:r:h", options, NULL)) != -1) {
+    switch (opt) {
+    case 't': g_tpl = optarg; break;
+    case 'H': g_host = optarg; break;
+    case 'p': g_dll = optarg; break;
+    case 'n': g_iterations = atoi(optarg); break;
+    case 'q': quick = true; break;
+    case 'c': chain = atoi(optarg); break;
+    case 'o': offline = atoi(optarg); break;
+    case 'l': load = atoi(optarg); break;
+    case 'Q': queries = atoi(optarg); break;
+    case 'r': reblock = atoi(optarg); break;
+    default: usage(argv[0]); return 2;
+    }
+  }
+  if (g_iterations <= 0 || chain < 0 || chain > VST_BRIDGE_CHAIN_MAX ||
+      offline < 0 || offline > VST_BRIDGE_PIPELINE_MAX || load < 0 || queries < 0 ||
+      reblock < 0 || reblock > VST_BRIDGE_REBLOCK_MAX) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct bench_bridge bridge;
+  struct bench_buffers bufs;
+  struct bench_latency lat;
+
+  if (!bench_buffers_init(&bufs) || !bench_latency_init(&lat, g_iterations) ||
+      !bench_bridge_load(&bridge, g_tpl, g_host, g_dll))
+    return 1;
+
+  printf("%-54s %8s %8s %8s %8s %8s %10s %9s\n", "configuration (latency in us)",
+         "p50", "p90", "p99", "p99.9", "max", "blocks/s", "realtime");
+
+  if (chain > 0) {
+    bench_bridge_unload(&bridge);
+    return bench_chain(chain, &bufs, &lat) ? 0 : 1;
+  }
+  if (offline > 0) {
+    bool ok = bench_offline(offline, &bridge, &bufs, &lat);
+    bench_bridge_unload(&bridge);
+    return ok ? 0 : 1;
+  }
+  if (load > 0) {
+    bool ok = bench_load(load, &bridge, &bufs);
+    bench_bridge_unload(&bridge);
+    return ok ? 0 : 1;
+  }
+  if (queries > 0) {
+    bench_bridge_unload(&bridge);
+    return bench_queries(queries) ? 0 : 1;
+  }
+  if (reblock > 0) {
+    bool ok = bench_reblock(reblock, &bridge, &lat);
+    bench_bridge_unload(&bridge);
+    return ok ? 0 : 1;
+  }
+
+  for (size_t c = 0; c < sizeof (channels) / sizeof (channels[0]); ++c) {
+    if (quick && channels[c] != 2)
+      continue;
+
+    AEffect *effect = bench_bridge_open(&bridge, channels[c]);
+    if (!effect) {
+      fprintf(stderr, "failed to instantiate the bridge (%d channels)\n", channels[c]);
+      return 1;
+    }
+
+    for (int precision = 0; precision < 2; ++precision) {
+      for (size_t f = 0; f < sizeof (frames) / sizeof (frames[0]); ++f) {
+        if (quick && frames[f] != 64 && frames[f] != 512)
+          continue;
+        struct bench_config cfg = { precision == 1, channels[c], frames[f], 0, 0, 0, 0, 0 };
+        bench_run(effect, &cfg, &bufs, &lat);
+      }
+    }
+
+    if (channels[c] == 2) {
+      for (size_t d = 1; d < sizeof (densities) / sizeof (densities[0]); ++d) {
+        struct bench_config cfg = { false, 2, 256, densities[d], 0, 0, 0, 0 };
+        bench_run(effect, &cfg, &bufs, &lat);
+      }
+      for (size_t x = 0; x < sizeof (sysex) / sizeof (sysex[0]); ++x) {
+        struct bench_config cfg = { false, 2, 256, 0, sysex[x], 0, 0, 0 };
+        bench_run(effect, &cfg, &bufs, &lat);
+      }
+      for (size_t d = 1; d < sizeof (densities) / sizeof (densities[0]); ++d) {
+        struct bench_config cfg = { false, 2, 256, 0, 0, densities[d] / 4, 0, 0 };
+        bench_run(effect, &cfg, &bufs, &lat);
+      }
+    }
+
+    bench_bridge_close(effect);
+  }
+
+  // a plugin generating MIDI, or asking about the DAW, read when it's
+  // instantiated
+  static const struct {
+    const char *name;
+    const char *value;
+    struct bench_config cfg;
+  } plugin_env[] = {
+    { "VST_BRIDGE_BENCH_MIDI_OUT", "1", { false, 2, 256, 0, 0, 0, 1, 0 } },
+    { "VST_BRIDGE_BENCH_MIDI_OUT", "16", { false, 2, 256, 0, 0, 0, 16, 0 } },
+    { "VST_BRIDGE_BENCH_QUERIES", "4", { false, 2, 256, 0, 0, 0, 0, 4 } },
+  };
+  for (size_t e = 0; e < sizeof (plugin_env) / sizeof (plugin_env[0]); ++e) {
+    setenv(plugin_env[e].name, plugin_env[e].value, 1);
+    AEffect *effect = bench_bridge_open(&bridge, 2);
+    unsetenv(plugin_env[e].name);
+    if (!effect) {
+      fprintf(stderr, "failed to instantiate the bridge\n");
+      return 1;
+    }
+
+    bench_run(effect, &plugin_env[e].cfg, &bufs, &lat);
+    bench_bridge_close(effect);
+  }
+
+  bench_bridge_unload(&bridge);
+  bench_latency_free(&lat);
+  return 0;
+}
@@ -0,0 +1,367 @@
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/common.h"
+#include "bench-util.h"
+
+/*
+ * Real-time cadence simulator: audio threads call the bridged
+ * processReplacing on a simulated DAW clock (one block per period), while
+ * a GUI thread loads the dispatcher. Reports the wake-up jitter, the
+ * callback completion time relative to the period, and the deadline
+ * misses, per configuration.
+ */
+
+#define CADENCE_CHANNELS 2
+#define CADENCE_MAX_FRAMES 4096
+#define CADENCE_JITTER_BUCKETS 18
+#define CADENCE_LOAD_BUCKETS 11
+
+struct cadence_config {
+  int instances;
+  int gui_hz;
+};
+
+struct cadence_thread {
+  pthread_t             thread;
+  AEffect             **effects;
+  int                   neffects;
+  float                *inputs[CADENCE_CHANNELS];
+  float                *outputs[CADENCE_CHANNELS];
+  struct bench_latency  wake;
+  struct bench_latency  callback;
+  uint64_t              cycles;
+  uint64_t              misses;
+  uint64_t              skipped;
+  // log2 buckets of the wake-up lateness in us
+  uint64_t              jitter_hist[CADENCE_JITTER_BUCKETS];
+  // completion time in tenths of the period, the last one is a miss
+  uint64_t              load_hist[CADENCE_LOAD_BUCKETS];
+};
+
+struct cadence_gui {
+  struct cadence_thread *threads;
+  int                    hz;
+};
+
+static const char *g_tpl  = "../plugin/vst-bridge-plugin-tpl.so";
+static const char *g_host = "./vst-bridge-host-native.exe";
+static const char *g_dll  = "./vst-bridge-bench-plugin.so";
+static int g_frames       = 64;
+static int g_seconds      = 5;
+static int g_threads      = 1;
+static int g_fifo_prio    = 0;
+static uint64_t g_period_ns;
+static uint64_t g_start_ns;
+static uint64_t g_end_ns;
+static volatile bool g_gui_stop;
+
+static void cadence_sleep_until(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec  = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static void *cadence_audio_thread(void *arg)
+{
+  struct cadence_thread *t = (struct cadence_thread *)arg;
+  uint64_t next = g_start_ns;
+
+  if (g_fifo_prio > 0) {
+    struct sched_param param;
+    param.sched_priority = g_fifo_prio;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err)
+      fprintf(stderr, "SCHED_FIFO %d unavailable: %s\n", g_fifo_prio, strerror(err));
+  }
+
+  while (next < g_end_ns) {
+    cadence_sleep_until(next);
+    uint64_t woke = bench_now_ns();
+
+    for (int i = 0; i < t->neffects; ++i)
+      t->effects[i]->processReplacing(t->effects[i], t->inputs, t->outputs, g_frames);
+
+    uint64_t done   = bench_now_ns();
+    uint64_t jitter = woke - next;
+    uint64_t load   = done - next;
+
+    bench_latency_add(&t->wake, jitter);
+    bench_latency_add(&t->callback, done - woke);
+    ++t->cycles;
+
+    int bucket = 0;
+    for (uint64_t us = jitter / 1000; us > 0 && bucket < CADENCE_JITTER_BUCKETS - 1; us >>= 1)
+      ++bucket;
+    ++t->jitter_hist[bucket];
+    ++t->load_hist[MIN(load * 10 / g_period_ns, CADENCE_LOAD_BUCKETS - 1)];
+
+    next += g_period_ns;
+    if (done > next) {
+      // the DAW drops the periods it missed
+      uint64_t late = (done - next) / g_period_ns + 1;
+      ++t->misses;
+      t->skipped += late;
+      next += late * g_period_ns;
+    }
+  }
+  return NULL;
+}
+
+static void *cadence_gui_thread(void *arg)
+{
+  struct cadence_gui *gui = (struct cadence_gui *)arg;
+  struct cadence_thread *threads = gui->threads;
+  uint64_t period = 1000000000ULL / gui->hz;
+  uint64_t next = bench_now_ns();
+  char buffer[256];
+
+  for (unsigned n = 0; !g_gui_stop; ++n) {
+    struct cadence_thread *t = threads + n % g_threads;
+    AEffect *effect = t->effects[(n / g_threads) % t->neffects];
+
+    effect->dispatcher(effect, effGetParamDisplay, n % effect->numParams, 0, buffer, 0);
+    effect->getParameter(effect, n % effect->numParams);
+    effect->dispatcher(effect, effEditIdle, 0, 0, NULL, 0);
+
+    next += period;
+    cadence_sleep_until(next);
+  }
+  return NULL;
+}
+
+static void cadence_report(const struct cadence_config *cfg,
+                           struct cadence_thread *threads)
+{
+  struct bench_latency wake;
+  struct bench_latency callback;
+  uint64_t jitter_hist[CADENCE_JITTER_BUCKETS] = { 0 };
+  uint64_t load_hist[CADENCE_LOAD_BUCKETS] = { 0 };
+  uint64_t cycles = 0, misses = 0, skipped = 0;
+
+  bench_latency_init(&wake, threads[0].wake.capacity * g_threads);
+  bench_latency_init(&callback, threads[0].callback.capacity * g_threads);
+  for (int t = 0; t < g_threads; ++t) {
+    for (size_t i = 0; i < threads[t].wake.count; ++i)
+      bench_latency_add(&wake, threads[t].wake.samples[i]);
+    for (size_t i = 0; i < threads[t].callback.count; ++i)
+      bench_latency_add(&callback, threads[t].callback.samples[i]);
+    for (int i = 0; i < CADENCE_JITTER_BUCKETS; ++i)
+      jitter_hist[i] += threads[t].jitter_hist[i];
+    for (int i = 0; i < CADENCE_LOAD_BUCKETS; ++i)
+      load_hist[i] += threads[t].load_hist[i];
+    cycles  += threads[t].cycles;
+    misses  += threads[t].misses;
+    skipped += threads[t].skipped;
+  }
+
+  printf("== %d instance(s) on %d audio thread(s), %d frames @ %.0f Hz (%.1f us),"
+         " gui load %d Hz, %s\n",
+         cfg->instances, g_threads, g_frames, g_bench_sample_rate, g_period_ns / 1e3,
+         cfg->gui_hz, g_fifo_prio > 0 ? "SCHED_FIFO" : "SCHED_OTHER");
+  printf("   cycles %lu, deadline misses %lu (%.3f%%), periods dropped %lu\n",
+         (unsigned long)cycles, (unsigned long)misses,
+         cycles ? 100.0 * misses / cycles : 0.0, (unsigned long)skipped);
+  printf("   wake jitter (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+         bench_latency_quantile(&wake, 0.5) / 1e3, bench_latency_quantile(&wake, 0.99) / 1e3,
+         bench_latency_quantile(&wake, 0.999) / 1e3, bench_latency_quantile(&wake, 1) / 1e3);
+  printf("   callback (us):    p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+         bench_latency_quantile(&callback, 0.5) / 1e3,
+         bench_latency_quantile(&callback, 0.99) / 1e3,
+         bench_latency_quantile(&callback, 0.999) / 1e3,
+         bench_latency_quantile(&callback, 1) / 1e3);
+
+  printf("   wake jitter histogram:\n");
+  for (int i = 0; i < CADENCE_JITTER_BUCKETS; ++i) {
+    if (!jitter_hist[i])
+      continue;
+    printf("     %7s%6u us %10lu  %5.1f%%\n", i == CADENCE_JITTER_BUCKETS - 1 ? ">=" : "<",
+           i == CADENCE_JITTER_BUCKETS - 1 ? 1u << (i - 1) : 1u << i,
+           (unsigned long)jitter_hist[i], 100.0 * jitter_hist[i] / cycles);
+  }
+
+  printf("   completion time / period histogram:\n");
+  for (int i = 0; i < CADENCE_LOAD_BUCKETS; ++i) {
+    if (!load_hist[i])
+      continue;
+    if (i == CADENCE_LOAD_BUCKETS - 1)
+      printf("     >= 100%% (miss) %10lu  %5.1f%%\n",
+             (unsigned long)load_hist[i], 100.0 * load_hist[i] / cycles);
+    else
+      printf("     %3d%% .. %3d%%   %10lu  %5.1f%%\n", i * 10, i * 10 + 10,
+             (unsigned long)load_hist[i], 100.0 * load_hist[i] / cycles);
+  }
+  fflush(stdout);
+
+  bench_latency_free(&wake);
+  bench_latency_free(&callback);
+}
+
+static bool cadence_run(struct bench_bridge *bridge, const struct cadence_config *cfg)
+{
+  struct cadence_thread threads[g_threads];
+  struct cadence_gui gui = { threads, cfg->gui_hz };
+  AEffect *effects[cfg->instances];
+  size_t cycles = (size_t)g_seconds * 1000000000ULL / g_period_ns + 1;
+  pthread_t gui_thread;
+  bool ok = true;
+
+  memset(threads, 0, sizeof (threads));
+  for (int i = 0; i < cfg->instances; ++i) {
+    effects[i] = bench_bridge_open(bridge, CADENCE_CHANNELS);
+    if (!effects[i]) {
+      fprintf(stderr, "failed to instantiate the bridge\n");
+      for (int j = 0; j < i; ++j)
+        bench_bridge_close(effects[j]);
+      return false;
+    }
+  }
+
+  // split the instances between the audio threads
+  AEffect **next = effects;
+  for (int t = 0; t < g_threads; ++t) {
+    threads[t].neffects = cfg->instances / g_threads + (t < cfg->instances % g_threads);
+    threads[t].effects  = next;
+    next += threads[t].neffects;
+    for (int c = 0; c < CADENCE_CHANNELS; ++c) {
+      threads[t].inputs[c]  = (float *)calloc(g_frames, sizeof (float));
+      threads[t].outputs[c] = (float *)calloc(g_frames, sizeof (float));
+    }
+    bench_latency_init(&threads[t].wake, cycles);
+    bench_latency_init(&threads[t].callback, cycles);
+  }
+
+  // warm up: the first blocks pay for the host start
+  for (int i = 0; i < cfg->instances; ++i)
+    for (int j = 0; j < 16; ++j)
+      effects[i]->processReplacing(effects[i], threads[0].inputs,
+                                   threads[0].outputs, g_frames);
+
+  g_start_ns = bench_now_ns() + 100 * 1000000ULL;
+  g_end_ns   = g_start_ns + g_seconds * 1000000000ULL;
+  g_gui_stop = false;
+
+  if (cfg->gui_hz > 0 && pthread_create(&gui_thread, NULL, cadence_gui_thread, &gui))
+    ok = false;
+  for (int t = 0; ok && t < g_threads; ++t)
+    pthread_create(&threads[t].thread, NULL, cadence_audio_thread, threads + t);
+  for (int t = 0; ok && t < g_threads; ++t)
+    pthread_join(threads[t].thread, NULL);
+  g_gui_stop = true;
+  if (ok && cfg->gui_hz > 0)
+    pthread_join(gui_thread, NULL);
+
+  if (ok)
+    cadence_report(cfg, threads);
+
+  for (int i = 0; i < cfg->instances; ++i)
+    bench_bridge_close(effects[i]);
+  for (int t = 0; t < g_threads; ++t) {
+    for (int c = 0; c < CADENCE_CHANNELS; ++c) {
+      free(threads[t].inputs[c]);
+      free(threads[t].outputs[c]);
+    }
+    bench_latency_free(&threads[t].wake);
+    bench_latency_free(&threads[t].callback);
+  }
+  return ok;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -t, --template=<so>    the plugin template (%s)\n"
+          "  -H, --host=<exe>       the native host (%s)\n"
+          "  -p, --plugin=<so>      the bench plugin (%s)\n"
+          "  -f, --frames=<n>       block size (%d)\n"
+          "  -r, --rate=<hz>        sample rate (%.0f)\n"
+          "  -s, --seconds=<n>      duration of each configuration (%d)\n"
+          "  -i, --instances=<n>    number of instances (default: 1, 8 and 32)\n"
+          "  -j, --threads=<n>      number of audio threads (%d)\n"
+          "  -g, --gui=<hz>         dispatcher calls per second (default: 0 and 200)\n"
+          "  -d, --dsp=<us>         simulated DSP time per block and instance (0)\n"
+          "  -R, --fifo[=<prio>]    run the audio threads with SCHED_FIFO (70)\n",
+          argv0, g_tpl, g_host, g_dll, g_frames, g_bench_sample_rate, g_seconds,
+          g_threads);
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option options[] = {
+    { "template", required_argument, NULL, 't' },
+    { "host", required_argument, NULL, 'H' },
+    { "plugin", required_argument, NULL, 'p' },
+    { "frames", required_argument, NULL, 'f' },
+    { "rate", required_argument, NULL, 'r' },
+    { "seconds", required_argument, NULL, 's' },
+    { "instances", required_argument, NULL, 'i' },
+    { "threads", required_argument, NULL, 'j' },
+    { "gui", required_argument, NULL, 'g' },
+    { "dsp", required_argument, NULL, 'd' },
+    { "fifo", optional_argument, NULL, 'R' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  int instances = 0;
+  int gui_hz = -1;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "t:H:p:f:r:s:i:j:g:d:R::h", options, NULL)) != -1) {
+    switch (opt) {
+    case 't': g_tpl = optarg; break;
+    case 'H': g_host = optarg; break;
+    case 'p': g_dll = optarg; break;
+    case 'f': g_frames = atoi(optarg); break;
+    case 'r': g_bench_sample_rate = atof(optarg); break;
+    case 's': g_seconds = atoi(optarg); break;
+    case 'i': instances = atoi(optarg); break;
+    case 'j': g_threads = atoi(optarg); break;
+    case 'g': gui_hz = atoi(optarg); break;
+    case 'd': setenv("VST_BRIDGE_BENCH_DSP_US", optarg, 1); break;
+    case 'R': g_fifo_prio = optarg ? atoi(optarg) : 70; break;
+    default: usage(argv[0]); return 2;
+    }
+  }
+  if (g_frames <= 0 || g_frames > CADENCE_MAX_FRAMES || g_bench_sample_rate <= 0 ||
+      g_seconds <= 0 || g_threads <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  g_bench_block_size = g_frames;
+  g_period_ns = g_frames * 1e9 / g_bench_sample_rate;
+
+  struct bench_bridge bridge;
+  if (!bench_bridge_load(&bridge, g_tpl, g_host, g_dll))
+    return 1;
+
+  static const int default_instances[] = { 1, 8, 32 };
+  static const int default_gui[] = { 0, 200 };
+  int ninstances = instances > 0 ? 1 : 3;
+  int ngui = gui_hz >= 0 ? 1 : 2;
+
+  for (int i = 0; i < ninstances; ++i) {
+    for (int g = 0; g < ngui; ++g) {
+      struct cadence_config cfg;
+      cfg.instances = instances > 0 ? instances : default_instances[i];
+      cfg.gui_hz    = gui_hz >= 0 ? gui_hz : default_gui[g];
+      if (cfg.instances < g_threads)
+        continue;
+      if (!cadence_run(&bridge, &cfg))
+        return 1;
+    }
+  }
+
+  bench_bridge_unload(&bridge);
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/common.h"
+#include "bench-util.h"
+
+/*
+ * Contention benchmark: an audio thread calls the bridged processReplacing
+ * once per period, while flood threads call the dispatcher
+ * (effGetParamDisplay, getParameter, effEditIdle) back to back on the
+ * same instance. Reports the latency of process with and without the
+ * flood, and with an expensive GUI call in the plugin.
+ */
+
+#define CONTENTION_CHANNELS 2
+#define CONTENTION_MAX_FRAMES 4096
+
+struct contention_config {
+  // flood threads
+  int flood;
+  // time spent by the plugin in each GUI call, in us
+  int gui_us;
+};
+
+struct contention_flood {
+  pthread_t  thread;
+  AEffect   *effect;
+  uint64_t   calls;
+};
+
+static const char *g_tpl  = "../plugin/vst-bridge-plugin-tpl.so";
+static const char *g_host = "./vst-bridge-host-native.exe";
+static const char *g_dll  = "./vst-bridge-bench-plugin.so";
+static int g_frames       = 256;
+static int g_blocks       = 4000;
+static int g_fifo_prio    = 0;
+static uint64_t g_period_ns;
+static volatile bool g_flood_stop;
+
+static void contention_sleep_until(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec  = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static void *contention_flood_thread(void *arg)
+{
+  struct contention_flood *flood = (struct contention_flood *)arg;
+  AEffect *effect = flood->effect;
+  char buffer[256];
+
+  for (unsigned n = 0; !g_flood_stop; ++n) {
+    switch (n % 3) {
+    case 0:
+      effect->dispatcher(effect, effGetParamDisplay, n % effect->numParams, 0, buffer, 0);
+      break;
+    case 1:
+      effect->getParameter(effect, n % effect->numParams);
+      break;
+    default:
+      effect->dispatcher(effect, effEditIdle, 0, 0, NULL, 0);
+      break;
+    }
+    ++flood->calls;
+  }
+  return NULL;
+}
+
+static bool contention_run(struct bench_bridge *bridge, const struct contention_config *cfg)
+{
+  struct contention_flood floods[cfg->flood > 0 ? cfg->flood : 1];
+  struct bench_latency lat;
+  float *inputs[CONTENTION_CHANNELS];
+  float *outputs[CONTENTION_CHANNELS];
+  char gui_us[16];
+  uint64_t misses = 0;
+
+  // read by the bench plugin in the host
+  snprintf(gui_us, sizeof (gui_us), "%d", cfg->gui_us);
+  setenv("VST_BRIDGE_BENCH_GUI_US", gui_us, 1);
+
+  AEffect *effect = bench_bridge_open(bridge, CONTENTION_CHANNELS);
+  if (!effect) {
+    fprintf(stderr, "failed to instantiate the bridge\n");
+    return false;
+  }
+
+  for (int c = 0; c < CONTENTION_CHANNELS; ++c) {
+    inputs[c]  = (float *)calloc(g_frames, sizeof (float));
+    outputs[c] = (float *)calloc(g_frames, sizeof (float));
+  }
+  bench_latency_init(&lat, g_blocks);
+
+  if (g_fifo_prio > 0) {
+    struct sched_param param;
+    param.sched_priority = g_fifo_prio;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err)
+      fprintf(stderr, "SCHED_FIFO %d unavailable: %s\n", g_fifo_prio, strerror(err));
+  }
+
+  // warm up: the first blocks pay for the host start
+  for (int j = 0; j < 16; ++j)
+    effect->processReplacing(effect, inputs, outputs, g_frames);
+
+  g_flood_stop = false;
+  memset(floods, 0, sizeof (floods));
+  for (int i = 0; i < cfg->flood; ++i) {
+    floods[i].effect = effect;
+    pthread_create(&floods[i].thread, NULL, contention_flood_thread, floods + i);
+  }
+
+  uint64_t start = bench_now_ns();
+  uint64_t next  = start;
+  for (int b = 0; b < g_blocks; ++b) {
+    contention_sleep_until(next);
+    uint64_t t0 = bench_now_ns();
+    effect->processReplacing(effect, inputs, outputs, g_frames);
+    uint64_t t1 = bench_now_ns();
+
+    bench_latency_add(&lat, t1 - t0);
+    if (t1 - next > g_period_ns)
+      ++misses;
+    next += g_period_ns;
+    if (t1 > next)
+      next = t1;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+
+  g_flood_stop = true;
+  uint64_t calls = 0;
+  for (int i = 0; i < cfg->flood; ++i) {
+    pthread_join(floods[i].thread, NULL);
+    calls += floods[i].calls;
+  }
+
+  if (g_fifo_prio > 0) {
+    struct sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  }
+
+  printf("%5d %7d %9.1f %9.1f %9.1f %9.1f %9.1f %8lu %10.0f\n",
+         cfg->flood, cfg->gui_us,
+         bench_latency_quantile(&lat, 0.5) / 1e3,
+         bench_latency_quantile(&lat, 0.9) / 1e3,
+         bench_latency_quantile(&lat, 0.99) / 1e3,
+         bench_latency_quantile(&lat, 0.999) / 1e3,
+         bench_latency_quantile(&lat, 1) / 1e3,
+         (unsigned long)misses, calls * 1e9 / elapsed);
+  fflush(stdout);
+
+  bench_bridge_close(effect);
+  for (int c = 0; c < CONTENTION_CHANNELS; ++c) {
+    free(inputs[c]);
+    free(outputs[c]);
+  }
+  bench_latency_free(&lat);
+  return true;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -t, --template=<so>    the plugin template (%s)\n"
+          "  -H, --host=<exe>       the native host (%s)\n"
+          "  -p, --plugin=<so>      the bench plugin (%s)\n"
+          "  -f, --frames=<n>       block size (%d)\n"
+          "  -r, --rate=<hz>        sample rate (%.0f)\n"
+          "  -n, --blocks=<n>       blocks per configuration (%d)\n"
+          "  -j, --flood=<n>        flood threads (default: 0 and 1)\n"
+          "  -g, --gui=<us>         time spent in each GUI call (default: 0 and 1000)\n"
+          "  -R, --fifo[=<prio>]    run the audio thread with SCHED_FIFO (70)\n",
+          argv0, g_tpl, g_host, g_dll, g_frames, g_bench_sample_rate, g_blocks);
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option options[] = {
+    { "template", required_argument, NULL, 't' },
+    { "host", required_argument, NULL, 'H' },
+    { "plugin", required_argument, NULL, 'p' },
+    { "frames", required_argument, NULL, 'f' },
+    { "rate", required_argument, NULL, 'r' },
+    { "blocks", required_argument, NULL, 'n' },
+    { "flood", required_argument, NULL, 'j' },
+    { "gui", required_argument, NULL, 'g' },
+    { "fifo", optional_argument, NULL, 'R' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  int flood = -1;
+  int gui_us = -1;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "t:H:p:f:r:n:j:g:R::h", options, NULL)) != -1) {
+    switch (opt) {
+    case 't': g_tpl = optarg; break;
+    case 'H': g_host = optarg; break;
+    case 'p': g_dll = optarg; break;
+    case 'f': g_frames = atoi(optarg); break;
+    case 'r': g_bench_sample_rate = atof(optarg); break;
+    case 'n': g_blocks = atoi(optarg); break;
+    case 'j': flood = atoi(optarg); break;
+    case 'g': gui_us = atoi(optarg); break;
+    case 'R': g_fifo_prio = optarg ? atoi(optarg) : 70; break;
+    default: usage(argv[0]); return 2;
+    }
+  }
+  if (g_frames <= 0 || g_frames > CONTENTION_MAX_FRAMES || g_bench_sample_rate <= 0 ||
+      g_blocks <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  g_bench_block_size = g_frames;
+  g_period_ns = g_frames * 1e9 / g_bench_sample_rate;
+
+  struct bench_bridge bridge;
+  if (!bench_bridge_load(&bridge, g_tpl, g_host, g_dll))
+    return 1;
+
+  printf("%d frames @ %.0f Hz (%.1f us), %d blocks, %s\n", g_frames, g_bench_sample_rate,
+         g_period_ns / 1e3, g_blocks, g_fifo_prio > 0 ? "SCHED_FIFO" : "SCHED_OTHER");
+  printf("flood  gui us   p50 us    p90 us    p99 us  p99.9 us    max us   misses    calls/s\n");
+
+  static const struct contention_config defaults[] = {
+    { 0, 0 }, { 1, 0 }, { 1, 1000 },
+  };
+  int nconfigs = flood >= 0 || gui_us >= 0 ? 1 : 3;
+
+  for (int i = 0; i < nconfigs; ++i) {
+    struct contention_config cfg = defaults[i];
+    if (flood >= 0)
+      cfg.flood = flood;
+    if (gui_us >= 0)
+      cfg.gui_us = gui_us;
+    if (!contention_run(&bridge, &cfg))
+      return 1;
+  }
+
+  bench_bridge_unload(&bridge);
+  return 0;
+}
@@ -0,0 +1,456 @@
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/common.h"
+#include "../common/capture.h"
+#include "bench-util.h"
+
+/*
+ * Replays a session captured with VST_BRIDGE_CAPTURE against a bridge,
+ * as fast as possible or with the original timing, and compares the
+ * latency of every kind of call with what was captured.
+ *
+ * By default the stand-in bench plugin is bridged, with the captured
+ * channel count; --bridge replays against a bridge made by
+ * vst-bridge-maker instead, i.e. the real plugin under wine.
+ */
+
+#define REPLAY_SCRATCH_SIZE (1024 * 1024)
+#define REPLAY_MAX_EVENTS 4096
+#define REPLAY_NUM_OPCODES \
+  (sizeof (vst_bridge_effect_opcode_name) / sizeof (vst_bridge_effect_opcode_name[0]))
+
+struct replay_stat {
+  size_t               count;
+  struct bench_latency replayed;
+  struct bench_latency captured;
+};
+
+struct replay_session {
+  uint8_t                          *data;
+  size_t                            size;
+  const struct vst_bridge_capture_header *header;
+  size_t                            first;
+  int                               max_frames;
+  // indexed by record type, then by dispatcher opcode
+  struct replay_stat                stats[VST_BRIDGE_CAPTURE_TYPE_COUNT + REPLAY_NUM_OPCODES];
+  size_t                            skipped;
+};
+
+struct replay_buffers {
+  int               channels;
+  float           **inputs;
+  float           **outputs;
+  double          **inputsd;
+  double          **outputsd;
+  uint8_t          *scratch;
+  uint8_t          *scratch2;
+  struct VstEvents *events;
+  // MIDI and SysEx events are both rebuilt in place
+  VstMidiEvent     *midi;
+  VstMidiSysexEvent *sysex;
+};
+
+static const char *g_tpl  = "../plugin/vst-bridge-plugin-tpl.so";
+static const char *g_host = "./vst-bridge-host-native.exe";
+static const char *g_dll  = "./vst-bridge-bench-plugin.so";
+static const char *g_bridge = NULL;
+static bool g_cadence       = false;
+
+static bool replay_load(struct replay_session *s, const char *path)
+{
+  struct stat st;
+
+  memset(s, 0, sizeof (*s));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) {
+    fprintf(stderr, "%s: %m\n", path);
+    return false;
+  }
+
+  s->size = st.st_size;
+  s->data = (uint8_t *)malloc(s->size + 1);
+  bool ok = s->data && read(fd, s->data, s->size) == (ssize_t)s->size;
+  close(fd);
+  if (!ok) {
+    fprintf(stderr, "%s: read failed\n", path);
+    return false;
+  }
+
+  s->header = (const struct vst_bridge_capture_header *)s->data;
+  if (s->size < sizeof (*s->header) ||
+      memcmp(s->header->magic, VST_BRIDGE_CAPTURE_MAGIC, sizeof (s->header->magic)) ||
+      sizeof (*s->header) + s->header->path_len > s->size) {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    return false;
+  }
+  s->first = sizeof (*s->header) + s->header->path_len;
+  return true;
+}
+
+/* iterates over the records, NULL at the end (or on a truncated record) */
+static const struct vst_bridge_capture_record *
+replay_next(const struct replay_session *s, size_t *off)
+{
+  const struct vst_bridge_capture_record *rec =
+    (const struct vst_bridge_capture_record *)(s->data + *off);
+
+  if (*off + sizeof (*rec) > s->size || *off + sizeof (*rec) + rec->size > s->size)
+    return NULL;
+  *off += sizeof (*rec) + rec->size;
+  return rec;
+}
+
+static struct replay_stat *replay_find_stat(struct replay_session *s,
+                                            const struct vst_bridge_capture_record *rec)
+{
+  if (rec->type >= VST_BRIDGE_CAPTURE_TYPE_COUNT)
+    return NULL;
+  if (rec->type != VST_BRIDGE_CAPTURE_DISPATCHER)
+    return s->stats + rec->type;
+  if (rec->opcode < 0 || (size_t)rec->opcode >= REPLAY_NUM_OPCODES)
+    return NULL;
+  return s->stats + VST_BRIDGE_CAPTURE_TYPE_COUNT + rec->opcode;
+}
+
+/* first pass: sizes the latency buffers and the audio buffers */
+static bool replay_scan(struct replay_session *s)
+{
+  const struct vst_bridge_capture_record *rec;
+  size_t off = s->first;
+
+  s->max_frames = 0;
+  while ((rec = replay_next(s, &off))) {
+    struct replay_stat *stat = replay_find_stat(s, rec);
+    if (stat)
+      ++stat->count;
+    if ((rec->type == VST_BRIDGE_CAPTURE_PROCESS ||
+         rec->type == VST_BRIDGE_CAPTURE_PROCESS_DOUBLE) && rec->value > s->max_frames)
+      s->max_frames = rec->value;
+  }
+  if (off != s->size)
+    fprintf(stderr, "warning: truncated capture, %zu trailing bytes ignored\n",
+            s->size - off);
+
+  for (size_t i = 0; i < sizeof (s->stats) / sizeof (s->stats[0]); ++i)
+    if (s->stats[i].count > 0 &&
+        (!bench_latency_init(&s->stats[i].replayed, s->stats[i].count) ||
+         !bench_latency_init(&s->stats[i].captured, s->stats[i].count)))
+      return false;
+  return true;
+}
+
+static bool replay_buffers_init(struct replay_buffers *bufs, int channels, int frames)
+{
+  memset(bufs, 0, sizeof (*bufs));
+  bufs->channels = channels;
+  bufs->inputs   = (float **)calloc(channels, sizeof (float *));
+  bufs->outputs  = (float **)calloc(channels, sizeof (float *));
+  bufs->inputsd  = (double **)calloc(channels, sizeof (double *));
+  bufs->outputsd = (double **)calloc(channels, sizeof (double *));
+  if (!bufs->inputs || !bufs->outputs || !bufs->inputsd || !bufs->outputsd)
+    return false;
+
+  for (int i = 0; i < channels; ++i) {
+    bufs->inputs[i]   = (float *)calloc(frames, sizeof (float));
+    bufs->outputs[i]  = (float *)calloc(frames, sizeof (float));
+    bufs->inputsd[i]  = (double *)calloc(frames, sizeof (double));
+    bufs->outputsd[i] = (double *)calloc(frames, sizeof (double));
+    if (!bufs->inputs[i] || !bufs->outputs[i] || !bufs->inputsd[i] || !bufs->outputsd[i])
+      return false;
+    for (int j = 0; j < frames; ++j) {
+      bufs->inputs[i][j]  = (j % 64) / 64.0f;
+      bufs->inputsd[i][j] = (j % 64) / 64.0;
+    }
+  }
+
+  bufs->scratch  = (uint8_t *)calloc(1, REPLAY_SCRATCH_SIZE);
+  bufs->scratch2 = (uint8_t *)calloc(1, REPLAY_SCRATCH_SIZE);
+  bufs->events   = (struct VstEvents *)calloc(
+    1, sizeof (*bufs->events) + REPLAY_MAX_EVENTS * sizeof (VstEvent *));
+  bufs->midi  = (VstMidiEvent *)calloc(REPLAY_MAX_EVENTS, sizeof (*bufs->midi));
+  bufs->sysex = (VstMidiSysexEvent *)calloc(REPLAY_MAX_EVENTS, sizeof (*bufs->sysex));
+  return bufs->scratch && bufs->scratch2 && bufs->events && bufs->midi && bufs->sysex;
+}
+
+/* rebuilds the VstEvents, the SysEx dumps pointing into the record */
+static struct VstEvents *replay_events(struct replay_buffers *bufs,
+                                       const struct vst_bridge_capture_record *rec)
+{
+  size_t off = 0;
+  int n = 0;
+
+  while (off + sizeof (struct vst_bridge_capture_event) <= rec->size &&
+         n < REPLAY_MAX_EVENTS) {
+    const struct vst_bridge_capture_event *ce =
+      (const struct vst_bridge_capture_event *)(rec->data + off);
+    off += sizeof (*ce) + ce->size;
+    if (off > rec->size)
+      break;
+
+    if (ce->type == kVstSysExType) {
+      VstMidiSysexEvent *sysex = bufs->sysex + n;
+      sysex->type        = ce->type;
+      sysex->byteSize    = sizeof (*sysex);
+      sysex->deltaFrames = ce->deltaFrames;
+      sysex->flags       = ce->flags;
+      sysex->dumpBytes   = ce->size;
+      sysex->sysexDump   = (char *)ce->data;
+      bufs->events->events[n] = (VstEvent *)sysex;
+    } else {
+      VstMidiEvent *me = bufs->midi + n;
+      me->type        = ce->type;
+      me->byteSize    = sizeof (*me);
+      me->deltaFrames = ce->deltaFrames;
+      me->flags       = ce->flags;
+      memcpy(&me->noteLength, ce->data, MIN(ce->size, sizeof (VstEvent().data)));
+      bufs->events->events[n] = (VstEvent *)me;
+    }
+    ++n;
+  }
+  bufs->events->numEvents = n;
+  return bufs->events;
+}
+
+/* returns false if the call must be skipped */
+static bool replay_dispatch(AEffect *effect,
+                            struct replay_buffers *bufs,
+                            const struct vst_bridge_capture_record *rec)
+{
+  VstIntPtr value = rec->value;
+  void *ptr = bufs->scratch;
+
+  switch (rec->opcode) {
+  case effEditOpen:
+  case effEditClose:
+    // there is no window to embed into
+    return false;
+
+  case effSetSampleRate:
+    g_bench_sample_rate = rec->opt;
+    break;
+
+  case effSetBlockSize:
+    g_bench_block_size = rec->value;
+    break;
+
+  case effProcessEvents:
+    ptr = replay_events(bufs, rec);
+    break;
+
+  case effSetSpeakerArrangement: {
+    const struct VstSpeakerArrangement *ar =
+      (const struct VstSpeakerArrangement *)rec->data;
+    size_t len = 8 + ar->numChannels * sizeof (ar->speakers[0]);
+    if (rec->size < len || rec->size - len > REPLAY_SCRATCH_SIZE)
+      return false;
+    memcpy(bufs->scratch2, rec->data, len);
+    memcpy(bufs->scratch, rec->data + len, rec->size - len);
+    value = (VstIntPtr)bufs->scratch2;
+    break;
+  }
+
+  case effSetChunk:
+    // the chunk is passed as is, it can be bigger than the scratch area
+    ptr = (void *)rec->data;
+    break;
+
+  default:
+    if (rec->size > REPLAY_SCRATCH_SIZE)
+      return false;
+    memcpy(bufs->scratch, rec->data, rec->size);
+    break;
+  }
+
+  effect->dispatcher(effect, rec->opcode, rec->index, value, ptr, rec->opt);
+  return true;
+}
+
+static bool replay_record(AEffect *effect,
+                          struct replay_buffers *bufs,
+                          const struct vst_bridge_capture_record *rec)
+{
+  int frames = rec->value;
+
+  switch (rec->type) {
+  case VST_BRIDGE_CAPTURE_DISPATCHER:
+    return replay_dispatch(effect, bufs, rec);
+
+  case VST_BRIDGE_CAPTURE_SET_PARAMETER:
+    effect->setParameter(effect, rec->opcode, rec->opt);
+    return true;
+
+  case VST_BRIDGE_CAPTURE_GET_PARAMETER:
+    effect->getParameter(effect, rec->opcode);
+    return true;
+
+  case VST_BRIDGE_CAPTURE_PROCESS:
+    effect->processReplacing(effect, bufs->inputs, bufs->outputs, frames);
+    return true;
+
+  case VST_BRIDGE_CAPTURE_PROCESS_DOUBLE:
+    effect->processDoubleReplacing(effect, bufs->inputsd, bufs->outputsd, frames);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+static void replay_sleep_until(uint64_t ns)
+{
+  struct timespec ts;
+  ts.tv_sec  = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static bool replay_run(struct replay_session *s, AEffect *effect,
+                       struct replay_buffers *bufs)
+{
+  const struct vst_bridge_capture_record *rec;
+  size_t off = s->first;
+  uint64_t start = bench_now_ns();
+  int64_t  time_us = 0;
+  bool closed = false;
+
+  while (!closed && (rec = replay_next(s, &off))) {
+    struct replay_stat *stat = replay_find_stat(s, rec);
+
+    time_us += rec->delta_us;
+    if (g_cadence && time_us > 0)
+      replay_sleep_until(start + time_us * 1000ULL);
+
+    uint64_t t0 = bench_now_ns();
+    if (!stat || !replay_record(effect, bufs, rec)) {
+      ++s->skipped;
+      continue;
+    }
+    bench_latency_add(&stat->replayed, bench_now_ns() - t0);
+    bench_latency_add(&stat->captured, rec->duration_us * 1000ULL);
+
+    closed = rec->type == VST_BRIDGE_CAPTURE_DISPATCHER && rec->opcode == effClose;
+  }
+
+  printf("replayed in %.3fs, captured over %.3fs, %zu calls skipped\n",
+         (bench_now_ns() - start) / 1e9, time_us / 1e6, s->skipped);
+  return closed;
+}
+
+static void replay_report(struct replay_session *s)
+{
+  static const char * const names[] = {
+    NULL, "setParameter", "getParameter", "process", "processDouble",
+  };
+
+  printf("%-28s %8s | %8s %8s %8s | %8s %8s %8s\n", "call (latency in us)", "count",
+         "p50", "p99", "max", "capt p50", "capt p99", "capt max");
+  for (size_t i = 0; i < sizeof (s->stats) / sizeof (s->stats[0]); ++i) {
+    struct replay_stat *stat = s->stats + i;
+    if (stat->replayed.count == 0)
+      continue;
+
+    printf("%-28s %8zu | %8.1f %8.1f %8.1f | %8.1f %8.1f %8.1f\n",
+           i < VST_BRIDGE_CAPTURE_TYPE_COUNT ? names[i] :
+           vst_bridge_effect_opcode_name[i - VST_BRIDGE_CAPTURE_TYPE_COUNT],
+           stat->replayed.count,
+           bench_latency_quantile(&stat->replayed, 0.5) / 1e3,
+           bench_latency_quantile(&stat->replayed, 0.99) / 1e3,
+           bench_latency_quantile(&stat->replayed, 1) / 1e3,
+           bench_latency_quantile(&stat->captured, 0.5) / 1e3,
+           bench_latency_quantile(&stat->captured, 0.99) / 1e3,
+           bench_latency_quantile(&stat->captured, 1) / 1e3);
+  }
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options] <capture.vbcap>\n"
+          "  -t, --template=<so>    the plugin template (%s)\n"
+          "  -H, --host=<exe>       the native host (%s)\n"
+          "  -p, --plugin=<so>      the bench plugin (%s)\n"
+          "  -b, --bridge=<so>      replay against this bridge instead\n"
+          "  -c, --cadence          keep the captured timing\n",
+          argv0, g_tpl, g_host, g_dll);
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option options[] = {
+    { "template", required_argument, NULL, 't' },
+    { "host", required_argument, NULL, 'H' },
+    { "plugin", required_argument, NULL, 'p' },
+    { "bridge", required_argument, NULL, 'b' },
+    { "cadence", no_argument, NULL, 'c' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "t:H:p:b:ch", options, NULL)) != -1) {
+    switch (opt) {
+    case 't': g_tpl = optarg; break;
+    case 'H': g_host = optarg; break;
+    case 'p': g_dll = optarg; break;
+    case 'b': g_bridge = optarg; break;
+    case 'c': g_cadence = true; break;
+    default: usage(argv[0]); return 2;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct replay_session *s = (struct replay_session *)malloc(sizeof (*s));
+  if (!s || !replay_load(s, argv[optind]) || !replay_scan(s))
+    return 1;
+
+  const struct vst_bridge_capture_header *h = s->header;
+  int channels = h->numInputs > h->numOutputs ? h->numInputs : h->numOutputs;
+  printf("%.*s: %d programs, %d params, %d inputs, %d outputs, up to %d frames\n",
+         (int)h->path_len, (const char *)(h + 1), h->numPrograms, h->numParams,
+         h->numInputs, h->numOutputs, s->max_frames);
+
+  struct bench_bridge bridge;
+  struct replay_buffers bufs;
+  char buffer[16];
+
+  if (!replay_buffers_init(&bufs, channels > 0 ? channels : 1,
+                           s->max_frames > 0 ? s->max_frames : 1))
+    return 1;
+  if (g_bridge ? !bench_bridge_load_so(&bridge, g_bridge) :
+      !bench_bridge_load(&bridge, g_tpl, g_host, g_dll))
+    return 1;
+
+  snprintf(buffer, sizeof (buffer), "%d", channels);
+  setenv("VST_BRIDGE_BENCH_CHANNELS", buffer, 1);
+  // replaying must not capture again
+  unsetenv("VST_BRIDGE_CAPTURE");
+
+  AEffect *effect = bridge.plugin_main(bench_audio_master);
+  if (!effect) {
+    fprintf(stderr, "failed to instantiate the bridge\n");
+    return 1;
+  }
+  if (effect->numInputs > bufs.channels || effect->numOutputs > bufs.channels) {
+    fprintf(stderr, "the bridge has more channels than the captured session\n");
+    return 1;
+  }
+
+  if (!replay_run(s, effect, &bufs))
+    effect->dispatcher(effect, effClose, 0, 0, NULL, 0);
+  replay_report(s);
+
+  bench_bridge_unload(&bridge);
+  return 0;
+}
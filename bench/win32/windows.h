@@ -0,0 +1,267 @@
+#ifndef WINDOWS_H
+# define WINDOWS_H
+
+/*
+ * Minimal stand-in for <windows.h>, used to build host.cc natively on
+ * Linux for the benchmarks: the "DLL" is a native shared object loaded
+ * with dlopen() and there is no window system behind the GUI calls.
+ */
+
+# include <dlfcn.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <string.h>
+# include <time.h>
+
+typedef void *        HWND;
+typedef void *        HMODULE;
+typedef void *        HINSTANCE;
+typedef void *        HICON;
+typedef void *        HCURSOR;
+typedef void *        HANDLE;
+typedef unsigned long DWORD;
+typedef unsigned int  UINT;
+typedef long          LRESULT;
+typedef unsigned long WPARAM;
+typedef long          LPARAM;
+typedef int           BOOL;
+
+# define WINAPI
+# define TRUE  1
+# define FALSE 0
+
+typedef LRESULT (*WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+typedef DWORD (*LPTHREAD_START_ROUTINE)(void *);
+
+typedef struct {
+  HWND   hwnd;
+  UINT   message;
+  WPARAM wParam;
+  LPARAM lParam;
+} MSG;
+
+typedef struct {
+  UINT        cbSize;
+  UINT        style;
+  WNDPROC     lpfnWndProc;
+  int         cbClsExtra;
+  int         cbWndExtra;
+  HINSTANCE   hInstance;
+  HICON       hIcon;
+  HCURSOR     hCursor;
+  void       *hbrBackground;
+  const char *lpszMenuName;
+  const char *lpszClassName;
+  HICON       hIconSm;
+} WNDCLASSEX;
+
+# define WS_EX_TOOLWINDOW 0x00000080
+# define WS_POPUP         0x80000000
+# define SW_HIDE          0
+# define SW_SHOWNORMAL    1
+# define CS_VREDRAW       0x0001
+# define CS_HREDRAW       0x0002
+# define WM_CLOSE         0x0010
+# define QS_ALLINPUT      0x04ff
+# define QS_SENDMESSAGE   0x0040
+# define PM_NOREMOVE      0x0000
+# define PM_REMOVE        0x0001
+# define PM_QS_SENDMESSAGE (QS_SENDMESSAGE << 16)
+# define IDI_APPLICATION  ((const char *)32512)
+# define INFINITE         0xffffffff
+# define WAIT_OBJECT_0    0
+# define WAIT_TIMEOUT     258
+
+static inline HMODULE LoadLibrary(const char *path)
+{
+  return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+}
+
+static inline void *GetProcAddress(HMODULE module, const char *symbol)
+{
+  return dlsym(module, symbol);
+}
+
+static inline BOOL FreeLibrary(HMODULE module)
+{
+  return !dlclose(module);
+}
+
+static inline HMODULE GetModuleHandle(const char * /*name*/)
+{
+  return NULL;
+}
+
+static inline DWORD GetCurrentThreadId(void)
+{
+  return (DWORD)pthread_self();
+}
+
+struct win32_thread {
+  LPTHREAD_START_ROUTINE start;
+  void                  *arg;
+};
+
+static inline void *win32_thread_start(void *arg)
+{
+  struct win32_thread thread = *(struct win32_thread *)arg;
+  delete (struct win32_thread *)arg;
+  thread.start(thread.arg);
+  return NULL;
+}
+
+static inline HANDLE CreateThread(void *, size_t stack_size,
+                                  LPTHREAD_START_ROUTINE start, void *arg,
+                                  DWORD, DWORD *thread_id)
+{
+  struct win32_thread *thread = new win32_thread;
+  pthread_attr_t attr;
+  pthread_t tid;
+
+  thread->start = start;
+  thread->arg   = arg;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (stack_size)
+    pthread_attr_setstacksize(&attr, stack_size);
+  int err = pthread_create(&tid, &attr, win32_thread_start, thread);
+  pthread_attr_destroy(&attr);
+  if (err) {
+    delete thread;
+    return NULL;
+  }
+  if (thread_id)
+    *thread_id = (DWORD)tid;
+  return (HANDLE)tid;
+}
+
+static inline DWORD GetTickCount(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* auto-reset events only; there are never messages to wait for */
+struct win32_event {
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  bool            set;
+};
+
+static inline HANDLE CreateEvent(void *, BOOL /*manual_reset*/, BOOL initial_state,
+                                 const char *)
+{
+  struct win32_event *event = new win32_event;
+  pthread_mutex_init(&event->lock, NULL);
+  pthread_cond_init(&event->cond, NULL);
+  event->set = initial_state;
+  return event;
+}
+
+static inline BOOL SetEvent(HANDLE handle)
+{
+  struct win32_event *event = (struct win32_event *)handle;
+  pthread_mutex_lock(&event->lock);
+  event->set = true;
+  pthread_cond_signal(&event->cond);
+  pthread_mutex_unlock(&event->lock);
+  return TRUE;
+}
+
+static inline DWORD MsgWaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL,
+                                              DWORD ms, DWORD)
+{
+  struct win32_event *event = count ? (struct win32_event *)handles[0] : NULL;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec  += ms / 1000;
+  ts.tv_nsec += (ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ++ts.tv_sec;
+    ts.tv_nsec -= 1000000000;
+  }
+
+  if (!event) {
+    if (ms != INFINITE)
+      clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL);
+    return WAIT_TIMEOUT;
+  }
+
+  pthread_mutex_lock(&event->lock);
+  while (!event->set) {
+    if (ms == INFINITE)
+      pthread_cond_wait(&event->cond, &event->lock);
+    else if (pthread_cond_timedwait(&event->cond, &event->lock, &ts))
+      break;
+  }
+  DWORD ret = event->set ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+  event->set = false;
+  pthread_mutex_unlock(&event->lock);
+  return ret;
+}
+
+static inline HWND CreateWindowEx(DWORD, const char *, const char *, DWORD,
+                                  int, int, int, int, HWND, void *,
+                                  HINSTANCE, void *)
+{
+  return NULL;
+}
+
+static inline BOOL DestroyWindow(HWND)
+{
+  return TRUE;
+}
+
+static inline BOOL ShowWindow(HWND, int)
+{
+  return TRUE;
+}
+
+static inline BOOL UpdateWindow(HWND)
+{
+  return TRUE;
+}
+
+static inline void *GetPropA(HWND, const char *)
+{
+  return NULL;
+}
+
+static inline LRESULT DefWindowProc(HWND, UINT, WPARAM, LPARAM)
+{
+  return 0;
+}
+
+static inline int RegisterClassEx(const WNDCLASSEX *)
+{
+  return 1;
+}
+
+static inline HICON LoadIcon(HINSTANCE, const char *)
+{
+  return NULL;
+}
+
+static inline HCURSOR LoadCursor(HINSTANCE, const char *)
+{
+  return NULL;
+}
+
+static inline DWORD GetQueueStatus(UINT)
+{
+  return 0;
+}
+
+static inline BOOL PeekMessage(MSG *, HWND, UINT, UINT, UINT)
+{
+  return FALSE;
+}
+
+static inline LRESULT DispatchMessage(const MSG *)
+{
+  return 0;
+}
+
+#endif /* !WINDOWS_H */
@@ -0,0 +1,64 @@
+#ifndef CAPTURE_H
+# define CAPTURE_H
+
+# include <stdint.h>
+
+/*
+ * Session capture file format.
+ *
+ * When VST_BRIDGE_CAPTURE=<prefix> is set, every bridge instance records
+ * the calls made by the DAW to <prefix>.<pid>.<n>.vbcap: a header, then
+ * one record per call. Only what is needed to replay the call is stored:
+ * input payloads (strings, chunks, events, ...), never the audio.
+ */
+
+# define VST_BRIDGE_CAPTURE_MAGIC "VBCAP001"
+
+enum vst_bridge_capture_type {
+  VST_BRIDGE_CAPTURE_DISPATCHER,
+  VST_BRIDGE_CAPTURE_SET_PARAMETER,
+  VST_BRIDGE_CAPTURE_GET_PARAMETER,
+  VST_BRIDGE_CAPTURE_PROCESS,
+  VST_BRIDGE_CAPTURE_PROCESS_DOUBLE,
+  VST_BRIDGE_CAPTURE_TYPE_COUNT,
+};
+
+struct vst_bridge_capture_header {
+  char     magic[8];
+  int32_t  numPrograms;
+  int32_t  numParams;
+  int32_t  numInputs;
+  int32_t  numOutputs;
+  int32_t  flags;
+  int32_t  uniqueID;
+  int32_t  version;
+  uint32_t path_len; // followed by the dll path, without '\0'
+} __attribute__((packed));
+
+struct vst_bridge_capture_record {
+  uint8_t  type;
+  uint8_t  thread;   // calling thread, numbered by order of appearance
+  uint16_t reserved;
+  int32_t  delta_us; // start time, relative to the previous record
+  uint32_t duration_us;
+  int32_t  opcode;   // dispatcher opcode, or parameter index
+  int32_t  index;
+  int64_t  value;    // frames for process
+  float    opt;      // value for set parameter
+  uint32_t size;     // payload size
+  uint8_t  data[0];
+} __attribute__((packed));
+
+/*
+ * effProcessEvents payload: a sequence of events. For MIDI events, data
+ * holds the 16 bytes following the VstEvent header; for SysEx, the dump.
+ */
+struct vst_bridge_capture_event {
+  int32_t  type;
+  int32_t  deltaFrames;
+  int32_t  flags;
+  uint32_t size;
+  uint8_t  data[0];
+} __attribute__((packed));
+
+#endif /* !CAPTURE_H */
@@ -0,0 +1,240 @@
+#ifndef CATALOG_H
+# define CATALOG_H
+
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <limits.h>
+# include <stdint.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+
+# include "common.h"
+
+/*
+ * The catalog of vst-bridge-scanner, which vst-bridge-maker reads to embed
+ * the plugin's info in the bridge: a header line, then a line per dll, tab
+ * separated: status, size, mtime, hash, bits, uniqueID, inputs, outputs,
+ * flags, category, params, programs, initial delay, funcs, version, vendor
+ * version, name, vendor, product and path.
+ */
+# define VST_BRIDGE_CATALOG_MAGIC "# vst-bridge catalog 2"
+# define VST_BRIDGE_CATALOG_FIELDS 20
+
+enum vst_bridge_catalog_status {
+  VST_BRIDGE_CATALOG_OK,
+  VST_BRIDGE_CATALOG_FAILED,
+  VST_BRIDGE_CATALOG_TIMEOUT,
+};
+
+static const char * const vst_bridge_catalog_status_names[] = {
+  "ok",
+  "failed",
+  "timeout",
+};
+
+/* the funcs field: which of the AEffect's functions the plugin has */
+# define VST_BRIDGE_CATALOG_SET_PARAMETER   (1 << 0)
+# define VST_BRIDGE_CATALOG_GET_PARAMETER   (1 << 1)
+# define VST_BRIDGE_CATALOG_PROCESS         (1 << 2)
+# define VST_BRIDGE_CATALOG_PROCESS_DOUBLE  (1 << 3)
+
+struct vst_bridge_catalog_entry {
+  int32_t                       status;
+  int64_t                       size;
+  int64_t                       mtime;
+  uint64_t                      hash;
+  int32_t                       arch;
+  struct vst_bridge_plugin_info info;
+  char                          path[PATH_MAX];
+};
+
+/* tabs and newlines would break the lines */
+static inline void vst_bridge_catalog_sanitize(char *str, size_t size)
+{
+  str[size - 1] = 0;
+  for (; *str; ++str)
+    if (*str == '\t' || *str == '\n' || *str == '\r')
+      *str = ' ';
+}
+
+/* parses a line, which it modifies; false if it isn't an entry */
+static inline bool vst_bridge_catalog_parse(char *line, struct vst_bridge_catalog_entry *entry)
+{
+  struct vst_bridge_plugin_data *data = &entry->info.plugin_data;
+  char *fields[VST_BRIDGE_CATALOG_FIELDS];
+  char *str = line;
+  int nfields;
+  int funcs;
+
+  line[strcspn(line, "\n")] = 0;
+  // strtok() would merge the empty fields
+  for (nfields = 0; nfields < VST_BRIDGE_CATALOG_FIELDS && str; ++nfields) {
+    fields[nfields] = str;
+    str = strchr(str, '\t');
+    if (str)
+      *str++ = 0;
+  }
+  if (nfields != VST_BRIDGE_CATALOG_FIELDS || str)
+    return false;
+
+  memset(entry, 0, sizeof (*entry) - sizeof (entry->path));
+  entry->status = VST_BRIDGE_CATALOG_FAILED;
+  for (int i = 0; i < 3; ++i)
+    if (!strcmp(fields[0], vst_bridge_catalog_status_names[i]))
+      entry->status = i;
+  entry->size                 = strtoll(fields[1], NULL, 10);
+  entry->mtime                = strtoll(fields[2], NULL, 10);
+  entry->hash                 = strtoull(fields[3], NULL, 16);
+  entry->arch                 = strtol(fields[4], NULL, 10);
+  data->uniqueID              = strtol(fields[5], NULL, 10);
+  data->numInputs             = strtol(fields[6], NULL, 10);
+  data->numOutputs            = strtol(fields[7], NULL, 10);
+  data->flags                 = strtol(fields[8], NULL, 10);
+  entry->info.category        = strtol(fields[9], NULL, 10);
+  data->numParams             = strtol(fields[10], NULL, 10);
+  data->numPrograms           = strtol(fields[11], NULL, 10);
+  data->initialDelay          = strtol(fields[12], NULL, 10);
+  funcs                       = strtol(fields[13], NULL, 10);
+  data->version               = strtol(fields[14], NULL, 10);
+  entry->info.vendor_version  = strtol(fields[15], NULL, 10);
+  snprintf(entry->info.name, sizeof (entry->info.name), "%s", fields[16]);
+  snprintf(entry->info.vendor, sizeof (entry->info.vendor), "%s", fields[17]);
+  snprintf(entry->info.product, sizeof (entry->info.product), "%s", fields[18]);
+  snprintf(entry->path, sizeof (entry->path), "%s", fields[19]);
+  data->hasSetParameter           = funcs & VST_BRIDGE_CATALOG_SET_PARAMETER;
+  data->hasGetParameter           = funcs & VST_BRIDGE_CATALOG_GET_PARAMETER;
+  data->hasProcessReplacing       = funcs & VST_BRIDGE_CATALOG_PROCESS;
+  data->hasProcessDoubleReplacing = funcs & VST_BRIDGE_CATALOG_PROCESS_DOUBLE;
+  return true;
+}
+
+static inline void vst_bridge_catalog_print(FILE *file, const struct vst_bridge_catalog_entry *entry)
+{
+  const struct vst_bridge_plugin_data *data = &entry->info.plugin_data;
+  int funcs =
+    (data->hasSetParameter ? VST_BRIDGE_CATALOG_SET_PARAMETER : 0) |
+    (data->hasGetParameter ? VST_BRIDGE_CATALOG_GET_PARAMETER : 0) |
+    (data->hasProcessReplacing ? VST_BRIDGE_CATALOG_PROCESS : 0) |
+    (data->hasProcessDoubleReplacing ? VST_BRIDGE_CATALOG_PROCESS_DOUBLE : 0);
+
+  fprintf(file, "%s\t%lld\t%lld\t%016llx\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s\t%s\t%s\t%s\n",
+          vst_bridge_catalog_status_names[entry->status], (long long)entry->size,
+          (long long)entry->mtime, (unsigned long long)entry->hash, entry->arch,
+          data->uniqueID, data->numInputs, data->numOutputs, data->flags,
+          entry->info.category, data->numParams, data->numPrograms,
+          data->initialDelay, funcs, data->version, entry->info.vendor_version,
+          entry->info.name, entry->info.vendor, entry->info.product, entry->path);
+}
+
+/* $XDG_CACHE_HOME/vst-bridge/<name>, or ~/.cache/vst-bridge/<name> */
+static inline void vst_bridge_cache_path(char *path, size_t size, const char *name)
+{
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  if (cache && *cache)
+    snprintf(path, size, "%s/vst-bridge/%s", cache, name);
+  else
+    snprintf(path, size, "%s/.cache/vst-bridge/%s", home ? home : ".", name);
+}
+
+static inline void vst_bridge_catalog_default_path(char *path, size_t size)
+{
+  vst_bridge_cache_path(path, size, "catalog");
+}
+
+/* creates the parents of path, like mkdir -p $(dirname path) */
+static inline bool vst_bridge_mkdirs(const char *path)
+{
+  char dir[PATH_MAX];
+  char *slash;
+
+  snprintf(dir, sizeof (dir), "%s", path);
+  for (slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+    *slash = 0;
+    if (mkdir(dir, 0755) && errno != EEXIST)
+      return false;
+    *slash = '/';
+  }
+  return true;
+}
+
+/*
+ * The catalog, the bridges and the queries' files are written next to the
+ * old one and renamed over it, so that a reader (a DAW which has the old
+ * bridge loaded included) sees either the old or the new one, never half
+ * of it. The name of the temporary goes to tmp, unique to the process as
+ * several may replace the same file; returns its fd, -1 on failure.
+ */
+static inline int vst_bridge_replace_begin(const char *path, char *tmp, size_t size, mode_t mode)
+{
+  if (snprintf(tmp, size, "%s.%d.tmp", path, (int)getpid()) >= (int)size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  vst_bridge_mkdirs(path);
+  return open(tmp, O_CREAT | O_TRUNC | O_WRONLY, mode);
+}
+
+/* renames tmp over path if it was written and closed ok, removes it otherwise */
+static inline bool vst_bridge_replace_end(const char *path, const char *tmp, bool ok)
+{
+  if (ok && !rename(tmp, path))
+    return true;
+  int err = errno;
+  unlink(tmp);
+  errno = err;
+  return false;
+}
+
+# define VST_BRIDGE_FNV_BASIS 0xcbf29ce484222325ULL
+
+static inline uint64_t vst_bridge_fnv(uint64_t h, const void *data, size_t size)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+
+  for (size_t i = 0; i < size; ++i) {
+    h ^= bytes[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/*
+ * FNV-1a of the dll's content: one touched, copied back or reinstalled has
+ * a new mtime but the same hash, and needs no new probe nor answers.
+ */
+static inline bool vst_bridge_catalog_hash(const char *path, uint64_t *hash)
+{
+  struct stat st;
+  void *data;
+  uint64_t h = VST_BRIDGE_FNV_BASIS;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    h = vst_bridge_fnv(h, data, st.st_size);
+    munmap(data, st.st_size);
+  }
+  close(fd);
+  *hash = h;
+  return true;
+}
+
+#endif /* !CATALOG_H */
@@ -9,6 +9,7 @@
 # include "../config.h"
 
 # define MIN(A, B) ((A) < (B) ? (A) : (B))
+# define MAX(A, B) ((A) > (B) ? (A) : (B))
 
 #define container_of(ptr, type, member) ({                              \
       const decltype( ((type *)0)->member ) *__mptr = (ptr);            \
@@ -17,6 +18,14 @@
 # define VST_BRIDGE_TPL_DLL "VST-BRIDGE-TPL-DLL"
 # define VST_BRIDGE_TPL_HOST "VST-BRIDGE-TPL-HOST"
 # define VST_BRIDGE_TPL_WINEPREFIX "VST-BRIDGE-TPL-WINEPREFIX"
+# define VST_BRIDGE_TPL_INFO "VST-BRIDGE-TPL-INFO"
+/* separates the dlls of a chain in the dll field, see host/chain.h */
+# define VST_BRIDGE_CHAIN_SEP "\n"
+# define VST_BRIDGE_CHAIN_MAX 16
+/* the most blocks in flight while rendering offline, VST_BRIDGE_OFFLINE_PIPELINE */
+# define VST_BRIDGE_PIPELINE_MAX 8
+/* the largest block VST_BRIDGE_REBLOCK gathers */
+# define VST_BRIDGE_REBLOCK_MAX 8192
 # define VST_BRIDGE_TPL_PATH INSTALL_PREFIX "/lib/vst-bridge/vst-bridge-plugin-tpl.so"
 # define VST_BRIDGE_HOST32_PATH INSTALL_PREFIX "/lib/vst-bridge/vst-bridge-host-32.exe"
 # define VST_BRIDGE_HOST64_PATH INSTALL_PREFIX "/lib/vst-bridge/vst-bridge-host-64.exe"
@@ -32,8 +41,21 @@ enum vst_bridge_cmd {
   VST_BRIDGE_CMD_SET_PARAMETER,
   VST_BRIDGE_CMD_GET_PARAMETER,
   VST_BRIDGE_CMD_SHOW_WINDOW,
+  VST_BRIDGE_CMD_SET_SCHEDULING,
+  VST_BRIDGE_CMD_EVENTS_RING,
+  VST_BRIDGE_CMD_AUTOMATE,
+  VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY,
+  VST_BRIDGE_CMD_HOST_INFO,
+  VST_BRIDGE_CMD_PROCESS_LEVEL,
 };
 
+/*
+ * Or'ed to the cmd of the requests the DAW makes while the plugin serves
+ * one of the host's callbacks: the host, waiting for that callback's
+ * reply, serves them right away, and the others after its request.
+ */
+# define VST_BRIDGE_CMD_NESTED 0x80000000U
+
 struct vst_bridge_effect_request {
   int32_t opcode;
   int32_t index;
@@ -50,13 +72,18 @@ struct vst_bridge_audio_master_request {
   uint8_t data[0];
 } __attribute__((packed));
 
+/* the block's struct vst_bridge_time_info follows the input frames */
+# define VST_BRIDGE_FRAMES_TIME_INFO (1 << 0)
+
 struct vst_bridge_frames {
   uint32_t nframes;
+  uint32_t flags;
   float    frames[0];
 } __attribute__((packed));
 
 struct vst_bridge_frames_double {
   uint32_t nframes;
+  uint32_t flags;
   double   frames[0];
 } __attribute__((packed));
 
@@ -65,6 +92,83 @@ struct vst_bridge_effect_parameter {
   float    value;
 } __attribute__((packed));
 
+/*
+ * The plugin's audioMasterAutomate calls, the last value of each
+ * parameter since the previous batch, in the order they were first
+ * changed. From the host, tag 0, no reply.
+ */
+struct vst_bridge_automate {
+  uint32_t                           nb;
+  struct vst_bridge_effect_parameter params[0];
+} __attribute__((packed));
+
+/*
+ * The DAW's answers to the queries which the host answers by itself. The
+ * plugin pushes them before PLUGIN_MAIN and before the calls which may
+ * change them (effSetSampleRate, effSetBlockSize, effMainsChanged), no
+ * reply. can_do holds the answers to vst_bridge_host_can_do, in order.
+ */
+# define VST_BRIDGE_HOST_STRING_SIZE 64
+# define VST_BRIDGE_HOST_CAN_DO_MAX 32
+
+static const char * const vst_bridge_host_can_do[] = {
+  "sendVstEvents",
+  "sendVstMidiEvent",
+  "sendVstTimeInfo",
+  "receiveVstEvents",
+  "receiveVstMidiEvent",
+  "reportConnectionChanges",
+  "acceptIOChanges",
+  "sizeWindow",
+  "offline",
+  "openFileSelector",
+  "closeFileSelector",
+  "startStopProcess",
+  "shellCategory",
+  "sendVstMidiEventFlagIsRealtime",
+  "supplyIdle",
+  "editFile",
+};
+
+# define VST_BRIDGE_HOST_CAN_DO_COUNT \
+  (sizeof (vst_bridge_host_can_do) / sizeof (*vst_bridge_host_can_do))
+
+struct vst_bridge_host_info {
+  int32_t version;
+  int32_t vendor_version;
+  int32_t sample_rate;
+  int32_t block_size;
+  int32_t input_latency;
+  int32_t output_latency;
+  int32_t has_vendor;
+  int32_t has_product;
+  char    vendor[VST_BRIDGE_HOST_STRING_SIZE];
+  char    product[VST_BRIDGE_HOST_STRING_SIZE];
+  int8_t  can_do[VST_BRIDGE_HOST_CAN_DO_MAX];
+} __attribute__((packed));
+
+/* the DAW's process level on the thread calling process, no reply */
+struct vst_bridge_process_level {
+  int32_t level;
+} __attribute__((packed));
+
+/*
+ * The DAW's VstTimeInfo for a block, in its process request (see
+ * VST_BRIDGE_FRAMES_TIME_INFO), which the host answers audioMasterGetTime
+ * with during that block: rendering offline, the DAW's clock has moved on
+ * by the time the host gets to it. valid is 0 if the DAW had none.
+ */
+struct vst_bridge_time_info {
+  int32_t valid;
+  uint8_t info[0];    // the VstTimeInfo
+} __attribute__((packed));
+
+/* the scheduling of the thread calling process, no reply */
+struct vst_bridge_scheduling {
+  int32_t policy;
+  int32_t priority;
+} __attribute__((packed));
+
 struct vst_bridge_plugin_data {
   bool    hasSetParameter;
   bool    hasGetParameter;
@@ -80,17 +184,47 @@ struct vst_bridge_plugin_data {
   int32_t version;
 } __attribute__((packed));
 
-struct vst_bridge_midi_event {
-  int32_t type;
-  int32_t byteSize;
-  int32_t deltaFrames;
-  int32_t flags;
-  uint8_t data[0];
+/*
+ * What vst-bridge-maker knew of the plugin, from the scanner's catalog, in
+ * the bridge's VST_BRIDGE_TPL_INFO slot: with it, VSTPluginMain returns
+ * before the host is up. magic is VST_BRIDGE_PLUGIN_INFO_MAGIC once filled.
+ */
+# define VST_BRIDGE_PLUGIN_INFO_MAGIC "vst-bridge plugin info 1"
+
+struct vst_bridge_plugin_info {
+  char                          magic[32];
+  struct vst_bridge_plugin_data plugin_data;
+  int32_t                       category;
+  int32_t                       vendor_version;
+  char                          name[VST_BRIDGE_HOST_STRING_SIZE];
+  char                          vendor[VST_BRIDGE_HOST_STRING_SIZE];
+  char                          product[VST_BRIDGE_HOST_STRING_SIZE];
+} __attribute__((packed));
+
+/*
+ * The events of effProcessEvents, packed one after the other in the
+ * instance's events ring (a memfd the plugin passes to the host with
+ * VST_BRIDGE_CMD_EVENTS_RING), or in the request itself. Events are copied
+ * as they are, but for the sysex events, which leave room for the host's
+ * VstMidiSysexEvent and are followed by their dump.
+ */
+# define VST_BRIDGE_EVENTS_RING_SIZE (1024 * 1024)
+# define VST_BRIDGE_EVENTS_MAX 4096
+# define VST_BRIDGE_EVENTS_INLINE 0xffffffff
+# define VST_BRIDGE_EVENT_MAX_SIZE 256
+# define VST_BRIDGE_SYSEX_EVENT_SIZE 48
+
+struct vst_bridge_event {
+  uint32_t size;      // of the whole entry, a multiple of 8
+  uint32_t dump_size; // of the sysex dump, at the end of the entry
+  uint8_t  event[0];  // the VstEvent
 } __attribute__((packed));
 
-struct vst_bridge_midi_events {
+struct vst_bridge_events {
+  uint32_t offset;    // of the first event in the ring, or VST_BRIDGE_EVENTS_INLINE
   uint32_t nb;
-  struct vst_bridge_midi_event events[0];
+  uint32_t pad;       // so the inline events are 8-byte aligned in the request
+  uint8_t  data[0];   // the events, when inline
 } __attribute__((packed));
 
 struct vst_bridge_request {
@@ -104,6 +238,10 @@ struct vst_bridge_request {
     struct vst_bridge_frames_double framesd;
     struct vst_bridge_effect_parameter param;
     struct vst_bridge_plugin_data plugin_data;
+    struct vst_bridge_scheduling scheduling;
+    struct vst_bridge_automate automate;
+    struct vst_bridge_host_info host_info;
+    struct vst_bridge_process_level process_level;
   };
 } __attribute__((packed));
 
@@ -112,6 +250,11 @@ struct vst_bridge_request {
 #define VST_BRIDGE_ERQ_LEN(X) ((X) + 8 + sizeof (struct vst_bridge_effect_request))
 #define VST_BRIDGE_AMRQ_LEN(X) ((X) + 8 + sizeof (struct vst_bridge_audio_master_request))
 #define VST_BRIDGE_PARAM_LEN (8 + sizeof (struct vst_bridge_effect_parameter))
+#define VST_BRIDGE_SCHEDULING_LEN (8 + sizeof (struct vst_bridge_scheduling))
+#define VST_BRIDGE_HOST_INFO_LEN (8 + sizeof (struct vst_bridge_host_info))
+#define VST_BRIDGE_PROCESS_LEVEL_LEN (8 + sizeof (struct vst_bridge_process_level))
+#define VST_BRIDGE_AUTOMATE_LEN(X) (8 + sizeof (struct vst_bridge_automate) + (X) * sizeof (struct vst_bridge_effect_parameter))
+#define VST_BRIDGE_AUTOMATE_MAX ((sizeof (((struct vst_bridge_request *)0)->data) - sizeof (struct vst_bridge_automate)) / sizeof (struct vst_bridge_effect_parameter))
 #define VST_BRIDGE_FRAMES_LEN(X) ((X) * sizeof (float) + 8 + sizeof (struct vst_bridge_frames))
 #define VST_BRIDGE_FRAMES_DOUBLE_LEN(X) ((X) * sizeof (double) + 8 + sizeof (struct vst_bridge_frames_double))
 
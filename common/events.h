@@ -0,0 +1,112 @@
+#ifndef EVENTS_H
+# define EVENTS_H
+
+# include <stddef.h>
+# include <string.h>
+
+# include "common.h"
+
+/*
+ * Packing of the VstEvents sent in both directions, see struct
+ * vst_bridge_event. aeffectx.h must be included first.
+ */
+
+/* where the events start after a reply of len bytes */
+# define VST_BRIDGE_EVENTS_AFTER(Len) (((Len) + 7) & ~(size_t)7)
+
+/* the size of an event once packed */
+static inline size_t vst_bridge_event_size(const VstEvent *ev,
+                                           size_t         *event_size,
+                                           size_t         *dump_size)
+{
+  if (ev->type == kVstSysExType) {
+    const VstMidiSysexEvent *sysex = (const VstMidiSysexEvent *)ev;
+    *event_size = VST_BRIDGE_SYSEX_EVENT_SIZE;
+    *dump_size  = sysex->sysexDump && sysex->dumpBytes > 0 ? sysex->dumpBytes : 0;
+  } else {
+    // byteSize doesn't count type and byteSize
+    *event_size = 2 * sizeof (VstInt32) + (ev->byteSize > 0 ? ev->byteSize : 0);
+    if (*event_size < sizeof (VstEvent))
+      *event_size = sizeof (VstEvent);
+    else if (*event_size > VST_BRIDGE_EVENT_MAX_SIZE)
+      *event_size = VST_BRIDGE_EVENT_MAX_SIZE;
+    *dump_size = 0;
+  }
+  return (sizeof (struct vst_bridge_event) + *event_size + *dump_size + 7) & ~(size_t)7;
+}
+
+/* the size of all the events once packed */
+static inline size_t vst_bridge_events_size(const struct VstEvents *evs)
+{
+  size_t size = 0;
+  size_t event_size;
+  size_t dump_size;
+
+  for (int32_t i = 0; i < evs->numEvents && i < VST_BRIDGE_EVENTS_MAX; ++i)
+    size += vst_bridge_event_size(evs->events[i], &event_size, &dump_size);
+  return size;
+}
+
+/*
+ * Packs as many events as fit in size bytes at dst, sysex dumps included.
+ * Returns the number of bytes used.
+ */
+static inline size_t vst_bridge_events_pack(uint8_t                *dst,
+                                            size_t                  size,
+                                            const struct VstEvents *evs,
+                                            uint32_t               *nb)
+{
+  size_t off = 0;
+  int32_t n;
+
+  for (n = 0; n < evs->numEvents && n < VST_BRIDGE_EVENTS_MAX; ++n) {
+    const VstEvent *ev = evs->events[n];
+    size_t event_size;
+    size_t dump_size;
+    size_t len = vst_bridge_event_size(ev, &event_size, &dump_size);
+    if (off + len > size)
+      break;
+
+    struct vst_bridge_event *bev = (struct vst_bridge_event *)(dst + off);
+    bev->size      = len;
+    bev->dump_size = dump_size;
+    if (ev->type == kVstSysExType) {
+      // the other side fills in the pointers
+      const VstMidiSysexEvent *sysex = (const VstMidiSysexEvent *)ev;
+      memset(bev->event, 0, event_size);
+      memcpy(bev->event, sysex, offsetof(VstMidiSysexEvent, dumpBytes) + sizeof (VstInt32));
+      memcpy(bev->event + event_size, sysex->sysexDump, dump_size);
+    } else
+      memcpy(bev->event, ev, event_size);
+    off += len;
+  }
+  *nb = n;
+  return off;
+}
+
+/*
+ * Points ves, which has room for VST_BRIDGE_EVENTS_MAX events, at the
+ * packed events; the sysex events get their pointers, in place.
+ */
+static inline struct VstEvents *vst_bridge_events_unpack(struct VstEvents *ves,
+                                                         uint8_t          *data,
+                                                         uint32_t          nb)
+{
+  ves->numEvents = MIN(nb, VST_BRIDGE_EVENTS_MAX);
+  ves->reserved  = 0;
+  for (int32_t i = 0; i < ves->numEvents; ++i) {
+    struct vst_bridge_event *bev = (struct vst_bridge_event *)data;
+    VstEvent *ev = (VstEvent *)bev->event;
+    if (ev->type == kVstSysExType) {
+      VstMidiSysexEvent *sysex = (VstMidiSysexEvent *)ev;
+      sysex->resvd1    = 0;
+      sysex->sysexDump = bev->dump_size ? (char *)bev->event + VST_BRIDGE_SYSEX_EVENT_SIZE : NULL;
+      sysex->resvd2    = 0;
+    }
+    ves->events[i] = ev;
+    data += bev->size;
+  }
+  return ves;
+}
+
+#endif /* !EVENTS_H */
@@ -0,0 +1,464 @@
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+
+#include "log.h"
+
+// number of records per thread, must be a power of 2
+#define VST_BRIDGE_LOG_RING_SIZE 128
+#define VST_BRIDGE_LOG_STR_SIZE 192
+// rings allocated up front, so that most threads never allocate
+#define VST_BRIDGE_LOG_PREALLOC 4
+// distinct call sites tracked per thread for rate limiting
+#define VST_BRIDGE_LOG_RATE_SITES 8
+// messages per call site and per second
+#define VST_BRIDGE_LOG_RATE_BURST 20
+#define VST_BRIDGE_LOG_POLL_NS (10 * 1000 * 1000)
+#define VST_BRIDGE_LOG_STR_TRUNCATED UINT64_MAX
+
+struct vst_bridge_log_record {
+  const char                *fmt;
+  int32_t                    err;
+  uint32_t                   nargs;
+  struct vst_bridge_log_arg  args[VST_BRIDGE_LOG_MAX_ARGS];
+  // string arguments are copied here, args[i].u is the offset
+  char                       strs[VST_BRIDGE_LOG_STR_SIZE];
+};
+
+struct vst_bridge_log_site {
+  const char *fmt;
+  uint64_t    window;
+  uint32_t    count;
+  uint32_t    suppressed;
+};
+
+/*
+ * Single producer (the owning thread), single consumer (the log thread).
+ * Rings are never freed: when a thread exits, its ring is released and
+ * can be claimed by the next thread which logs.
+ */
+struct vst_bridge_log_ring {
+  vst_bridge_log_ring()
+    : head(0),
+      tail(0),
+      dropped(0),
+      owned(false),
+      next(NULL)
+  {
+    memset(sites, 0, sizeof (sites));
+  }
+
+  std::atomic<uint32_t>         head;
+  std::atomic<uint32_t>         tail;
+  std::atomic<uint32_t>         dropped;
+  std::atomic<bool>             owned;
+  struct vst_bridge_log_ring   *next;
+  struct vst_bridge_log_site    sites[VST_BRIDGE_LOG_RATE_SITES];
+  struct vst_bridge_log_record  records[VST_BRIDGE_LOG_RING_SIZE];
+};
+
+struct vst_bridge_log_owner {
+  ~vst_bridge_log_owner();
+
+  struct vst_bridge_log_ring *ring;
+};
+
+static pthread_mutex_t g_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<struct vst_bridge_log_ring *> g_log_rings(NULL);
+static std::atomic<bool> g_log_stop(false);
+static FILE *g_log_file = NULL;
+static pthread_t g_log_thread;
+static bool g_log_running = false;
+
+static thread_local struct vst_bridge_log_owner t_log_owner = { NULL };
+
+static void vst_bridge_log_ring_push(struct vst_bridge_log_ring *ring,
+                                     const char *fmt,
+                                     const struct vst_bridge_log_arg *args,
+                                     unsigned nargs,
+                                     int err);
+static void vst_bridge_log_site_flush(struct vst_bridge_log_ring *ring,
+                                      struct vst_bridge_log_site *site,
+                                      int err);
+
+vst_bridge_log_owner::~vst_bridge_log_owner()
+{
+  if (!ring)
+    return;
+
+  for (int i = 0; i < VST_BRIDGE_LOG_RATE_SITES; ++i)
+    vst_bridge_log_site_flush(ring, ring->sites + i, 0);
+  ring->owned.store(false, std::memory_order_release);
+}
+
+static struct vst_bridge_log_ring *vst_bridge_log_ring_new(bool owned)
+{
+  struct vst_bridge_log_ring *ring = new (std::nothrow) vst_bridge_log_ring;
+  if (!ring)
+    return NULL;
+
+  ring->owned.store(owned, std::memory_order_relaxed);
+  ring->next = g_log_rings.load(std::memory_order_relaxed);
+  while (!g_log_rings.compare_exchange_weak(ring->next, ring,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+    ;
+  return ring;
+}
+
+static struct vst_bridge_log_ring *vst_bridge_log_ring_get(void)
+{
+  struct vst_bridge_log_owner *owner = &t_log_owner;
+  if (owner->ring)
+    return owner->ring;
+
+  for (struct vst_bridge_log_ring *ring = g_log_rings.load(std::memory_order_acquire);
+       ring; ring = ring->next) {
+    bool expected = false;
+    if (!ring->owned.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire))
+      continue;
+    memset(ring->sites, 0, sizeof (ring->sites));
+    owner->ring = ring;
+    return ring;
+  }
+
+  owner->ring = vst_bridge_log_ring_new(true);
+  return owner->ring;
+}
+
+static void vst_bridge_log_ring_push(struct vst_bridge_log_ring *ring,
+                                     const char *fmt,
+                                     const struct vst_bridge_log_arg *args,
+                                     unsigned nargs,
+                                     int err)
+{
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  uint32_t tail = ring->tail.load(std::memory_order_acquire);
+
+  if (head - tail >= VST_BRIDGE_LOG_RING_SIZE) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  struct vst_bridge_log_record *rec = ring->records + (head & (VST_BRIDGE_LOG_RING_SIZE - 1));
+  size_t off = 0;
+
+  rec->fmt   = fmt;
+  rec->err   = err;
+  rec->nargs = nargs < VST_BRIDGE_LOG_MAX_ARGS ? nargs : VST_BRIDGE_LOG_MAX_ARGS;
+  for (unsigned i = 0; i < rec->nargs; ++i) {
+    rec->args[i] = args[i];
+    if (args[i].type != VST_BRIDGE_LOG_ARG_STR)
+      continue;
+
+    const char *str = args[i].s ? args[i].s : "(null)";
+    if (off >= sizeof (rec->strs)) {
+      rec->args[i].u = VST_BRIDGE_LOG_STR_TRUNCATED;
+      continue;
+    }
+    size_t len = strnlen(str, sizeof (rec->strs) - off - 1);
+    memcpy(rec->strs + off, str, len);
+    rec->strs[off + len] = '\0';
+    rec->args[i].u = off;
+    off += len + 1;
+  }
+
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+static void vst_bridge_log_site_flush(struct vst_bridge_log_ring *ring,
+                                      struct vst_bridge_log_site *site,
+                                      int err)
+{
+  if (site->suppressed == 0)
+    return;
+
+  struct vst_bridge_log_arg args[2];
+  args[0].type = VST_BRIDGE_LOG_ARG_UINT;
+  args[0].u    = site->suppressed;
+  args[1].type = VST_BRIDGE_LOG_ARG_STR;
+  args[1].s    = site->fmt;
+  vst_bridge_log_ring_push(ring, "[log] %u similar messages suppressed: %s",
+                           args, 2, err);
+  site->suppressed = 0;
+}
+
+static bool vst_bridge_log_rate_check(struct vst_bridge_log_ring *ring,
+                                      const char *fmt,
+                                      int err)
+{
+  struct vst_bridge_log_site *site = NULL;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = 0; i < VST_BRIDGE_LOG_RATE_SITES; ++i) {
+    if (ring->sites[i].fmt == fmt) {
+      site = ring->sites + i;
+      break;
+    }
+    if (!site || ring->sites[i].window < site->window)
+      site = ring->sites + i;
+  }
+
+  if (site->fmt != fmt || site->window != static_cast<uint64_t>(now.tv_sec)) {
+    vst_bridge_log_site_flush(ring, site, err);
+    site->fmt        = fmt;
+    site->window     = now.tv_sec;
+    site->count      = 0;
+    site->suppressed = 0;
+  }
+
+  if (site->count >= VST_BRIDGE_LOG_RATE_BURST) {
+    ++site->suppressed;
+    return false;
+  }
+  ++site->count;
+  return true;
+}
+
+void vst_bridge_log_push(const char *fmt,
+                         const struct vst_bridge_log_arg *args,
+                         unsigned nargs)
+{
+  int err = errno;
+
+  struct vst_bridge_log_ring *ring = vst_bridge_log_ring_get();
+  if (ring && vst_bridge_log_rate_check(ring, fmt, err))
+    vst_bridge_log_ring_push(ring, fmt, args, nargs, err);
+
+  errno = err;
+}
+
+static int64_t vst_bridge_log_arg_int(const struct vst_bridge_log_arg *arg)
+{
+  switch (arg->type) {
+  case VST_BRIDGE_LOG_ARG_DOUBLE:
+    return static_cast<int64_t>(arg->d);
+  case VST_BRIDGE_LOG_ARG_PTR:
+    return reinterpret_cast<intptr_t>(arg->p);
+  case VST_BRIDGE_LOG_ARG_STR:
+    return 0;
+  default:
+    return arg->i;
+  }
+}
+
+static double vst_bridge_log_arg_double(const struct vst_bridge_log_arg *arg)
+{
+  switch (arg->type) {
+  case VST_BRIDGE_LOG_ARG_DOUBLE:
+    return arg->d;
+  case VST_BRIDGE_LOG_ARG_INT:
+    return arg->i;
+  case VST_BRIDGE_LOG_ARG_UINT:
+    return arg->u;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * printf-like formatting driven by the recorded argument types: the
+ * length modifiers of the format are ignored, so a mismatch between the
+ * format and the argument can't read garbage.
+ */
+static size_t vst_bridge_log_format(const struct vst_bridge_log_record *rec,
+                                    char *out,
+                                    size_t size)
+{
+  const char *f = rec->fmt;
+  unsigned argi = 0;
+  size_t len = 0;
+
+  while (*f && len + 1 < size) {
+    if (*f != '%') {
+      out[len++] = *f++;
+      continue;
+    }
+    if (f[1] == '%') {
+      out[len++] = '%';
+      f += 2;
+      continue;
+    }
+
+    char spec[32];
+    size_t spec_len = 0;
+    spec[spec_len++] = *f++;
+    while (*f && strchr("-+ #0", *f) && spec_len < 8)
+      spec[spec_len++] = *f++;
+    while (*f && (isdigit(*f) || *f == '.') && spec_len < 24)
+      spec[spec_len++] = *f++;
+    while (*f && strchr("hlLqjzt", *f))
+      ++f;
+    if (!*f)
+      break;
+
+    char   conv = *f++;
+    size_t room = size - len;
+    int    n    = 0;
+
+    if (conv == 'm') {
+      n = snprintf(out + len, room, "%s", strerror(rec->err));
+    } else if (argi >= rec->nargs) {
+      n = snprintf(out + len, room, "(missing)");
+    } else {
+      const struct vst_bridge_log_arg *arg = rec->args + argi++;
+
+      switch (conv) {
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec[spec_len++] = 'l';
+        spec[spec_len++] = 'l';
+        spec[spec_len++] = conv;
+        spec[spec_len]   = '\0';
+        n = snprintf(out + len, room, spec, static_cast<long long>(vst_bridge_log_arg_int(arg)));
+        break;
+
+      case 'c':
+        spec[spec_len++] = conv;
+        spec[spec_len]   = '\0';
+        n = snprintf(out + len, room, spec, static_cast<int>(vst_bridge_log_arg_int(arg)));
+        break;
+
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        spec[spec_len++] = conv;
+        spec[spec_len]   = '\0';
+        n = snprintf(out + len, room, spec, vst_bridge_log_arg_double(arg));
+        break;
+
+      case 's': {
+        const char *str = "(?)";
+        if (arg->type == VST_BRIDGE_LOG_ARG_STR)
+          str = arg->u == VST_BRIDGE_LOG_STR_TRUNCATED ? "(truncated)" : rec->strs + arg->u;
+        spec[spec_len++] = conv;
+        spec[spec_len]   = '\0';
+        n = snprintf(out + len, room, spec, str);
+        break;
+      }
+
+      case 'p':
+        spec[spec_len++] = conv;
+        spec[spec_len]   = '\0';
+        n = snprintf(out + len, room, spec,
+                     arg->type == VST_BRIDGE_LOG_ARG_PTR ? arg->p :
+                     reinterpret_cast<const void *>(vst_bridge_log_arg_int(arg)));
+        break;
+
+      default:
+        n = snprintf(out + len, room, "%%%c", conv);
+        break;
+      }
+    }
+
+    if (n < 0)
+      n = 0;
+    if (static_cast<size_t>(n) >= room)
+      n = room - 1;
+    len += n;
+  }
+
+  out[len] = '\0';
+  return len;
+}
+
+static void vst_bridge_log_drain(void)
+{
+  char buffer[2048];
+  bool wrote = false;
+
+  for (struct vst_bridge_log_ring *ring = g_log_rings.load(std::memory_order_acquire);
+       ring; ring = ring->next) {
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t head = ring->head.load(std::memory_order_acquire);
+
+    for (; tail != head; ++tail) {
+      size_t len = vst_bridge_log_format(
+        ring->records + (tail & (VST_BRIDGE_LOG_RING_SIZE - 1)), buffer, sizeof (buffer));
+      fwrite(buffer, 1, len, g_log_file);
+      ring->tail.store(tail + 1, std::memory_order_release);
+      wrote = true;
+    }
+
+    uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      fprintf(g_log_file, "[log] %u messages dropped (ring full)\n", dropped);
+      wrote = true;
+    }
+  }
+
+  if (wrote)
+    fflush(g_log_file);
+}
+
+static void *vst_bridge_log_thread(void * /*arg*/)
+{
+  struct timespec ts = { 0, VST_BRIDGE_LOG_POLL_NS };
+
+  while (!g_log_stop.load(std::memory_order_acquire)) {
+    vst_bridge_log_drain();
+    nanosleep(&ts, NULL);
+  }
+  vst_bridge_log_drain();
+  return NULL;
+}
+
+void vst_bridge_log_open(const char *path)
+{
+  pthread_mutex_lock(&g_log_lock);
+  if (g_log_running) {
+    pthread_mutex_unlock(&g_log_lock);
+    return;
+  }
+
+  g_log_file = path ? fopen(path, "w+") : stdout;
+  if (!g_log_file)
+    g_log_file = stderr;
+
+  for (int i = 0; i < VST_BRIDGE_LOG_PREALLOC; ++i)
+    vst_bridge_log_ring_new(false);
+
+  g_log_stop.store(false, std::memory_order_release);
+  g_log_running = !pthread_create(&g_log_thread, NULL, vst_bridge_log_thread, NULL);
+  pthread_mutex_unlock(&g_log_lock);
+}
+
+void vst_bridge_log_close(void)
+{
+  pthread_mutex_lock(&g_log_lock);
+  if (g_log_running) {
+    g_log_stop.store(true, std::memory_order_release);
+    pthread_join(g_log_thread, NULL);
+    g_log_running = false;
+    if (g_log_file != stdout && g_log_file != stderr)
+      fclose(g_log_file);
+    g_log_file = NULL;
+  }
+  pthread_mutex_unlock(&g_log_lock);
+}
+
+__attribute__((destructor))
+static void vst_bridge_log_fini(void)
+{
+  vst_bridge_log_close();
+}
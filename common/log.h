@@ -0,0 +1,129 @@
+#ifndef LOG_H
+# define LOG_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+# include <type_traits>
+
+/*
+ * Asynchronous logging.
+ *
+ * Callers only copy the format pointer and the raw arguments into a
+ * lock-free ring owned by the calling thread; formatting and the file
+ * I/O are done by a background thread. Each call site (format string) is
+ * rate limited per thread, so a flood of unhandled opcodes can't fill
+ * the rings nor the disk.
+ *
+ * The format string must be a literal: only its pointer is recorded.
+ */
+
+# define VST_BRIDGE_LOG_MAX_ARGS 12
+
+enum vst_bridge_log_arg_type {
+  VST_BRIDGE_LOG_ARG_INT,
+  VST_BRIDGE_LOG_ARG_UINT,
+  VST_BRIDGE_LOG_ARG_DOUBLE,
+  VST_BRIDGE_LOG_ARG_PTR,
+  VST_BRIDGE_LOG_ARG_STR,
+};
+
+struct vst_bridge_log_arg {
+  uint32_t type;
+  union {
+    int64_t     i;
+    uint64_t    u;
+    double      d;
+    const void *p;
+    const char *s;
+  };
+};
+
+/* path == NULL logs to stdout; the first call wins */
+void vst_bridge_log_open(const char *path);
+/* drains the rings and stops the background thread */
+void vst_bridge_log_close(void);
+void vst_bridge_log_push(const char *fmt,
+                         const struct vst_bridge_log_arg *args,
+                         unsigned nargs);
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value,
+                                      struct vst_bridge_log_arg>::type
+vst_bridge_log_make_arg(T v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_INT;
+  arg.i    = v;
+  return arg;
+}
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value,
+                                      struct vst_bridge_log_arg>::type
+vst_bridge_log_make_arg(T v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_UINT;
+  arg.u    = v;
+  return arg;
+}
+
+template <typename T>
+static inline typename std::enable_if<std::is_enum<T>::value,
+                                      struct vst_bridge_log_arg>::type
+vst_bridge_log_make_arg(T v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_INT;
+  arg.i    = v;
+  return arg;
+}
+
+template <typename T>
+static inline typename std::enable_if<std::is_floating_point<T>::value,
+                                      struct vst_bridge_log_arg>::type
+vst_bridge_log_make_arg(T v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_DOUBLE;
+  arg.d    = v;
+  return arg;
+}
+
+template <typename T>
+static inline struct vst_bridge_log_arg vst_bridge_log_make_arg(const T *v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_PTR;
+  arg.p    = v;
+  return arg;
+}
+
+static inline struct vst_bridge_log_arg vst_bridge_log_make_arg(const char *v)
+{
+  struct vst_bridge_log_arg arg;
+  arg.type = VST_BRIDGE_LOG_ARG_STR;
+  arg.s    = v;
+  return arg;
+}
+
+static inline struct vst_bridge_log_arg vst_bridge_log_make_arg(char *v)
+{
+  return vst_bridge_log_make_arg(static_cast<const char *>(v));
+}
+
+static inline void vst_bridge_log(const char *fmt)
+{
+  vst_bridge_log_push(fmt, NULL, 0);
+}
+
+template <typename ...Args>
+static inline void vst_bridge_log(const char *fmt, Args... args)
+{
+  static_assert(sizeof... (args) <= VST_BRIDGE_LOG_MAX_ARGS, "too many log arguments");
+  const struct vst_bridge_log_arg log_args[] = { vst_bridge_log_make_arg(args)... };
+  vst_bridge_log_push(fmt, log_args, sizeof... (args));
+}
+
+#endif /* !LOG_H */
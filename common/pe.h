@@ -0,0 +1,48 @@
+#ifndef PE_H
+# define PE_H
+
+# include <stdint.h>
+# include <stdio.h>
+# include <string.h>
+
+/*
+ * The architecture of a Windows dll, from its PE/COFF header: 32, 64, or 0
+ * if it isn't one we can host.
+ */
+
+# define VST_BRIDGE_PE_MACHINE_I386  0x014c
+# define VST_BRIDGE_PE_MACHINE_AMD64 0x8664
+
+static inline int vst_bridge_pe_arch(const char *path)
+{
+  unsigned char header[64];
+  unsigned char pe[6];
+  uint32_t offset;
+  uint16_t machine;
+  FILE *file;
+  int arch = 0;
+
+  file = fopen(path, "rb");
+  if (!file)
+    return 0;
+
+  // the DOS header, e_lfanew at 0x3c points to the PE signature
+  if (fread(header, sizeof (header), 1, file) != 1 || header[0] != 'M' || header[1] != 'Z')
+    goto out;
+  offset = header[0x3c] | header[0x3d] << 8 | header[0x3e] << 16 | (uint32_t)header[0x3f] << 24;
+  if (fseek(file, offset, SEEK_SET) || fread(pe, sizeof (pe), 1, file) != 1 ||
+      memcmp(pe, "PE\0\0", 4))
+    goto out;
+
+  machine = pe[4] | pe[5] << 8;
+  if (machine == VST_BRIDGE_PE_MACHINE_I386)
+    arch = 32;
+  else if (machine == VST_BRIDGE_PE_MACHINE_AMD64)
+    arch = 64;
+
+out:
+  fclose(file);
+  return arch;
+}
+
+#endif /* !PE_H */
@@ -0,0 +1,555 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <windows.h>
+
+#ifdef _WIN64
+# ifndef __LP64__
+#  define __LP64__
+# endif
+#endif
+
+#include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+#include "../common/common.h"
+#include "../common/log.h"
+#include "chain.h"
+
+#define CRIT(Args...) vst_bridge_log("[CRIT] H: " Args)
+
+#define VST_BRIDGE_CHAIN_MAGIC "vst-bridge chain"
+/* the audio between two links, until the DAW sets the block size */
+#define VST_BRIDGE_CHAIN_FRAMES 1024
+
+struct vst_bridge_chain {
+  struct AEffect   e;
+  int              nb;
+  struct AEffect  *links[VST_BRIDGE_CHAIN_MAX];
+  // the chain's index of each link's first parameter
+  VstInt32         param_base[VST_BRIDGE_CHAIN_MAX];
+  // the audio between two links, channels times frames each, one link
+  // writing the buffer the previous one didn't
+  VstInt32         channels;
+  VstInt32         frames;
+  float           *buffers[2];
+  double          *buffersd[2];
+  // for the inputs a link has and the previous one has no output for
+  float           *silence;
+  double          *silenced;
+  // the state of all the links, see vst_bridge_chain_get_chunk()
+  uint8_t         *chunk;
+};
+
+/*
+ * The chain's chunk: this header, then for each link a state followed by
+ * either its own chunk or, if it has none, its parameters as floats.
+ */
+struct vst_bridge_chain_header {
+  char    magic[16];
+  int32_t nb;
+  int32_t pad;
+};
+
+struct vst_bridge_chain_state {
+  int32_t chunk;
+  int32_t size;
+};
+
+static struct vst_bridge_chain *vst_bridge_chain_get(struct AEffect *e)
+{
+  return (struct vst_bridge_chain *)e->object;
+}
+
+static void vst_bridge_chain_free_buffers(struct vst_bridge_chain *chain)
+{
+  for (int i = 0; i < 2; ++i) {
+    free(chain->buffers[i]);
+    free(chain->buffersd[i]);
+    chain->buffers[i]  = NULL;
+    chain->buffersd[i] = NULL;
+  }
+  free(chain->silence);
+  free(chain->silenced);
+  chain->silence  = NULL;
+  chain->silenced = NULL;
+  chain->channels = 0;
+  chain->frames   = 0;
+}
+
+/*
+ * Grows the buffers between the links. The DAW only changes the block
+ * size, and the plugins their io, while suspended, so the audio thread
+ * isn't using them.
+ */
+static bool vst_bridge_chain_alloc(struct vst_bridge_chain *chain,
+                                   VstInt32 channels,
+                                   VstInt32 frames)
+{
+  if (channels < chain->channels)
+    channels = chain->channels;
+  if (channels < 1)
+    channels = 1;
+  if (frames < chain->frames)
+    frames = chain->frames;
+  if (channels == chain->channels && frames == chain->frames)
+    return true;
+
+  vst_bridge_chain_free_buffers(chain);
+  for (int i = 0; i < 2; ++i) {
+    chain->buffers[i]  = (float *)calloc((size_t)channels * frames, sizeof (float));
+    chain->buffersd[i] = (double *)calloc((size_t)channels * frames, sizeof (double));
+    if (!chain->buffers[i] || !chain->buffersd[i]) {
+      vst_bridge_chain_free_buffers(chain);
+      return false;
+    }
+  }
+  chain->silence  = (float *)calloc(frames, sizeof (float));
+  chain->silenced = (double *)calloc(frames, sizeof (double));
+  if (!chain->silence || !chain->silenced) {
+    vst_bridge_chain_free_buffers(chain);
+    return false;
+  }
+  chain->channels = channels;
+  chain->frames   = frames;
+  return true;
+}
+
+/* the link which has the chain's parameter index, which becomes its own */
+static int vst_bridge_chain_link(struct vst_bridge_chain *chain, VstInt32 *index)
+{
+  if (*index < 0)
+    return -1;
+  for (int i = chain->nb - 1; i >= 0; --i) {
+    if (*index < chain->param_base[i])
+      continue;
+    if (*index - chain->param_base[i] >= chain->links[i]->numParams)
+      return -1;
+    *index -= chain->param_base[i];
+    return i;
+  }
+  return -1;
+}
+
+VstInt32 vst_bridge_chain_param(struct AEffect *e, struct AEffect *link, VstInt32 index)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+
+  for (int i = 0; i < chain->nb; ++i)
+    if (chain->links[i] == link)
+      return chain->param_base[i] + index;
+  // from VSTPluginMain, before the chain knows the link
+  return index;
+}
+
+static inline void vst_bridge_chain_link_process(struct AEffect *link, float **inputs,
+                                                 float **outputs, VstInt32 frames)
+{
+  link->processReplacing(link, inputs, outputs, frames);
+}
+
+static inline void vst_bridge_chain_link_process(struct AEffect *link, double **inputs,
+                                                 double **outputs, VstInt32 frames)
+{
+  link->processDoubleReplacing(link, inputs, outputs, frames);
+}
+
+/*
+ * Runs the links in series, the first on the DAW's inputs and the last on
+ * its outputs. Blocks larger than the buffers are run in several parts.
+ */
+template <typename T>
+static void vst_bridge_chain_run(struct vst_bridge_chain *chain,
+                                 T                      **inputs,
+                                 T                      **outputs,
+                                 VstInt32                 frames,
+                                 T                      **buffers,
+                                 T                       *silence)
+{
+  T *ins[chain->channels];
+  T *outs[chain->channels];
+
+  if (!buffers[0]) {
+    for (VstInt32 c = 0; c < chain->e.numOutputs; ++c)
+      memset(outputs[c], 0, frames * sizeof (T));
+    return;
+  }
+
+  for (VstInt32 off = 0; off < frames; off += chain->frames) {
+    VstInt32 nframes = frames - off < chain->frames ? frames - off : chain->frames;
+    VstInt32 prev    = 0;
+
+    for (int i = 0; i < chain->nb; ++i) {
+      struct AEffect *link = chain->links[i];
+      T *from = buffers[(i + 1) & 1];
+      T *to   = buffers[i & 1];
+
+      for (VstInt32 c = 0; c < link->numInputs; ++c) {
+        if (!i)
+          ins[c] = inputs[c] + off;
+        else
+          ins[c] = c < prev ? from + c * chain->frames : silence;
+      }
+      for (VstInt32 c = 0; c < link->numOutputs; ++c) {
+        if (i == chain->nb - 1)
+          outs[c] = outputs[c] + off;
+        else
+          outs[c] = to + c * chain->frames;
+      }
+      vst_bridge_chain_link_process(link, ins, outs, nframes);
+      prev = link->numOutputs;
+    }
+  }
+}
+
+static void VSTCALLBACK vst_bridge_chain_process(struct AEffect *e, float **inputs,
+                                                 float **outputs, VstInt32 frames)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+
+  vst_bridge_chain_run(chain, inputs, outputs, frames, chain->buffers, chain->silence);
+}
+
+static void VSTCALLBACK vst_bridge_chain_process_double(struct AEffect *e, double **inputs,
+                                                        double **outputs, VstInt32 frames)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+
+  vst_bridge_chain_run(chain, inputs, outputs, frames, chain->buffersd, chain->silenced);
+}
+
+static void VSTCALLBACK vst_bridge_chain_set_parameter(struct AEffect *e, VstInt32 index,
+                                                       float value)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+  int i = vst_bridge_chain_link(chain, &index);
+
+  if (i >= 0)
+    chain->links[i]->setParameter(chain->links[i], index, value);
+}
+
+static float VSTCALLBACK vst_bridge_chain_get_parameter(struct AEffect *e, VstInt32 index)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+  int i = vst_bridge_chain_link(chain, &index);
+
+  if (i < 0)
+    return 0;
+  return chain->links[i]->getParameter(chain->links[i], index);
+}
+
+static VstIntPtr vst_bridge_chain_get_chunk(struct vst_bridge_chain *chain,
+                                            VstInt32 index,
+                                            void **ptr)
+{
+  struct vst_bridge_chain_header header;
+  struct vst_bridge_chain_state states[VST_BRIDGE_CHAIN_MAX];
+  void *data[VST_BRIDGE_CHAIN_MAX];
+  size_t size = sizeof (header);
+
+  for (int i = 0; i < chain->nb; ++i) {
+    struct AEffect *link = chain->links[i];
+
+    data[i] = NULL;
+    states[i].chunk = !!(link->flags & effFlagsProgramChunks);
+    if (states[i].chunk) {
+      VstIntPtr len = link->dispatcher(link, effGetChunk, index, 0, &data[i], 0);
+      states[i].size = data[i] && len > 0 ? len : 0;
+    } else
+      states[i].size = link->numParams * sizeof (float);
+    size += sizeof (states[i]) + states[i].size;
+  }
+
+  uint8_t *chunk = (uint8_t *)realloc(chain->chunk, size);
+  if (!chunk)
+    return 0;
+  chain->chunk = chunk;
+
+  memcpy(header.magic, VST_BRIDGE_CHAIN_MAGIC, sizeof (header.magic));
+  header.nb  = chain->nb;
+  header.pad = 0;
+  memcpy(chunk, &header, sizeof (header));
+  chunk += sizeof (header);
+
+  for (int i = 0; i < chain->nb; ++i) {
+    struct AEffect *link = chain->links[i];
+
+    memcpy(chunk, &states[i], sizeof (states[i]));
+    chunk += sizeof (states[i]);
+    if (states[i].chunk) {
+      memcpy(chunk, data[i], states[i].size);
+      chunk += states[i].size;
+      continue;
+    }
+    for (VstInt32 p = 0; p < link->numParams; ++p) {
+      float value = link->getParameter(link, p);
+      memcpy(chunk, &value, sizeof (value));
+      chunk += sizeof (value);
+    }
+  }
+
+  *ptr = chain->chunk;
+  return size;
+}
+
+static VstIntPtr vst_bridge_chain_set_chunk(struct vst_bridge_chain *chain,
+                                            VstInt32 index,
+                                            const uint8_t *chunk,
+                                            size_t size)
+{
+  struct vst_bridge_chain_header header;
+  size_t off = sizeof (header);
+
+  if (!chunk || size < sizeof (header))
+    return 0;
+  memcpy(&header, chunk, sizeof (header));
+  if (memcmp(header.magic, VST_BRIDGE_CHAIN_MAGIC, sizeof (header.magic)) ||
+      header.nb != chain->nb) {
+    CRIT("the chunk isn't the state of this chain\n");
+    return 0;
+  }
+
+  for (int i = 0; i < chain->nb; ++i) {
+    struct AEffect *link = chain->links[i];
+    struct vst_bridge_chain_state state;
+
+    if (size - off < sizeof (state))
+      return 0;
+    memcpy(&state, chunk + off, sizeof (state));
+    off += sizeof (state);
+    if (state.size < 0 || size - off < (size_t)state.size)
+      return 0;
+
+    if (state.chunk) {
+      link->dispatcher(link, effSetChunk, index, state.size, (void *)(chunk + off), 0);
+    } else {
+      for (VstInt32 p = 0; p < link->numParams && (p + 1) * sizeof (float) <= (size_t)state.size; ++p) {
+        float value;
+        memcpy(&value, chunk + off + p * sizeof (float), sizeof (value));
+        link->setParameter(link, p, value);
+      }
+    }
+    off += state.size;
+  }
+  return 1;
+}
+
+/* the links' names, joined, in at most size bytes */
+static VstIntPtr vst_bridge_chain_names(struct vst_bridge_chain *chain,
+                                        VstInt32 opcode,
+                                        char *str,
+                                        size_t size)
+{
+  size_t len = 0;
+
+  str[0] = '\0';
+  for (int i = 0; i < chain->nb; ++i) {
+    char name[256];
+
+    memset(name, 0, sizeof (name));
+    chain->links[i]->dispatcher(chain->links[i], opcode, 0, 0, name, 0);
+    name[sizeof (name) - 1] = '\0';
+    if (!name[0])
+      continue;
+    int n = snprintf(str + len, size - len, "%s%s", len ? " > " : "", name);
+    if (n < 0 || (size_t)n >= size - len)
+      break;
+    len += n;
+  }
+  return len > 0;
+}
+
+static VstIntPtr VSTCALLBACK vst_bridge_chain_dispatcher(struct AEffect *e,
+                                                         VstInt32  opcode,
+                                                         VstInt32  index,
+                                                         VstIntPtr value,
+                                                         void*     ptr,
+                                                         float     opt)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+  struct AEffect *head = chain->links[0];
+  struct AEffect *tail = chain->links[chain->nb - 1];
+  VstIntPtr ret = 0;
+  int i;
+
+  switch (opcode) {
+    // the setup, for every link; the first one answers
+  case effSetBlockSize:
+    vst_bridge_chain_alloc(chain, chain->channels, value);
+    // fall through
+  case effOpen:
+  case effClose:
+  case effSetSampleRate:
+  case effMainsChanged:
+  case effStartProcess:
+  case effStopProcess:
+  case effSetTotalSampleToProcess:
+  case effSetPanLaw:
+  case __effIdleDeprecated:
+    for (i = 0; i < chain->nb; ++i) {
+      VstIntPtr r = chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt);
+      if (!i)
+        ret = r;
+    }
+    return ret;
+
+    // every link has to take it
+  case effSetProcessPrecision:
+  case effSetSpeakerArrangement:
+    ret = 1;
+    for (i = 0; i < chain->nb; ++i)
+      if (!chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt))
+        ret = 0;
+    return ret;
+
+    // the track's MIDI goes to every link
+  case effProcessEvents:
+    for (i = 0; i < chain->nb; ++i)
+      if (chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt))
+        ret = 1;
+    return ret;
+
+  case effCanDo:
+    ret = -1;
+    for (i = 0; i < chain->nb; ++i) {
+      VstIntPtr can = chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt);
+      if (can > ret)
+        ret = can;
+    }
+    return ret;
+
+  case effGetVstVersion:
+    for (i = 0; i < chain->nb; ++i) {
+      VstIntPtr version = chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt);
+      if (!i || version < ret)
+        ret = version;
+    }
+    return ret;
+
+  case effGetTailSize:
+    for (i = 0; i < chain->nb; ++i) {
+      VstIntPtr tail_size = chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt);
+      if (tail_size > 1)
+        ret += tail_size;
+    }
+    return ret;
+
+  case effGetParamName:
+  case effGetParamLabel:
+  case effGetParamDisplay:
+  case effCanBeAutomated:
+  case effGetParameterProperties:
+  case effString2Parameter:
+    i = vst_bridge_chain_link(chain, &index);
+    if (i < 0)
+      return 0;
+    return chain->links[i]->dispatcher(chain->links[i], opcode, index, value, ptr, opt);
+
+  case effVendorSpecific:
+    // REAPER's parameter display, with the parameter in value
+    if (index == effGetParamDisplay) {
+      VstInt32 param = value;
+      i = vst_bridge_chain_link(chain, &param);
+      if (i < 0)
+        return 0;
+      return chain->links[i]->dispatcher(chain->links[i], opcode, index, param, ptr, opt);
+    }
+    return head->dispatcher(head, opcode, index, value, ptr, opt);
+
+  case effGetOutputProperties:
+  case effGetNumMidiOutputChannels:
+    return tail->dispatcher(tail, opcode, index, value, ptr, opt);
+
+  case effGetEffectName:
+    return vst_bridge_chain_names(chain, opcode, (char *)ptr, kVstMaxEffectNameLen);
+
+  case effGetProductString:
+    return vst_bridge_chain_names(chain, opcode, (char *)ptr, kVstMaxProductStrLen);
+
+  case effGetChunk:
+    return vst_bridge_chain_get_chunk(chain, index, (void **)ptr);
+
+  case effSetChunk:
+    return vst_bridge_chain_set_chunk(chain, index, (const uint8_t *)ptr, value);
+
+    // the programs, the editor and the rest are the first link's
+  default:
+    return head->dispatcher(head, opcode, index, value, ptr, opt);
+  }
+}
+
+void vst_bridge_chain_update(struct AEffect *e)
+{
+  struct vst_bridge_chain *chain = vst_bridge_chain_get(e);
+  struct AEffect *head = chain->links[0];
+  struct AEffect *tail = chain->links[chain->nb - 1];
+  VstInt32 all = effFlagsCanReplacing | effFlagsCanDoubleReplacing | effFlagsNoSoundInStop;
+  VstInt32 flags = all;
+  VstInt32 params = 0;
+  VstInt32 delay = 0;
+  VstInt32 channels = 0;
+
+  for (int i = 0; i < chain->nb; ++i) {
+    struct AEffect *link = chain->links[i];
+
+    chain->param_base[i] = params;
+    params += link->numParams;
+    delay  += link->initialDelay;
+    flags  &= link->flags | ~all;
+    if (!link->processDoubleReplacing)
+      flags &= ~effFlagsCanDoubleReplacing;
+    if (link->numInputs > channels)
+      channels = link->numInputs;
+    if (link->numOutputs > channels)
+      channels = link->numOutputs;
+  }
+
+  // the chain's state is always a chunk, see vst_bridge_chain_get_chunk()
+  flags |= effFlagsProgramChunks | (head->flags & (effFlagsHasEditor | effFlagsIsSynth));
+
+  e->numPrograms  = head->numPrograms;
+  e->numParams    = params;
+  e->numInputs    = head->numInputs;
+  e->numOutputs   = tail->numOutputs;
+  e->flags        = flags;
+  e->initialDelay = delay;
+  e->version      = head->version;
+  e->processDoubleReplacing =
+    flags & effFlagsCanDoubleReplacing ? vst_bridge_chain_process_double : NULL;
+
+  if (!vst_bridge_chain_alloc(chain, channels, chain->frames ? chain->frames : VST_BRIDGE_CHAIN_FRAMES))
+    CRIT("failed to allocate the chain's buffers: %m\n");
+}
+
+struct AEffect *vst_bridge_chain_new(struct AEffect **links, int nb)
+{
+  struct vst_bridge_chain *chain;
+  uint32_t id = 0;
+
+  if (nb < 1 || nb > VST_BRIDGE_CHAIN_MAX)
+    return NULL;
+  chain = (struct vst_bridge_chain *)calloc(1, sizeof (*chain));
+  if (!chain)
+    return NULL;
+
+  chain->nb = nb;
+  memcpy(chain->links, links, nb * sizeof (*links));
+  // a chain is a plugin of its own to the DAW
+  for (int i = 0; i < nb; ++i)
+    id = id * 31 + (uint32_t)links[i]->uniqueID;
+
+  chain->e.magic            = kEffectMagic;
+  chain->e.dispatcher       = vst_bridge_chain_dispatcher;
+  chain->e.setParameter     = vst_bridge_chain_set_parameter;
+  chain->e.getParameter     = vst_bridge_chain_get_parameter;
+  chain->e.processReplacing = vst_bridge_chain_process;
+  chain->e.object           = chain;
+  chain->e.uniqueID         = id;
+  vst_bridge_chain_update(&chain->e);
+  if (!chain->buffers[0]) {
+    free(chain);
+    return NULL;
+  }
+  return &chain->e;
+}
@@ -0,0 +1,19 @@
+#ifndef CHAIN_H
+# define CHAIN_H
+
+/*
+ * A chain of plugins loaded in the same host, shown to the bridge as a
+ * single AEffect: the audio goes from one plugin to the next inside the
+ * host, and only the chain's input and output cross the socket.
+ */
+
+/* takes the links, first to last; NULL if it can't allocate */
+struct AEffect *vst_bridge_chain_new(struct AEffect **links, int nb);
+
+/* the chain's index of a link's parameter, for the link's callbacks */
+VstInt32 vst_bridge_chain_param(struct AEffect *chain, struct AEffect *link, VstInt32 index);
+
+/* picks up the links' new io, delay and parameters */
+void vst_bridge_chain_update(struct AEffect *chain);
+
+#endif /* !CHAIN_H */
@@ -1,6 +1,10 @@
+#include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -8,6 +12,7 @@
 #include <pthread.h>
 #include <poll.h>
 
+#include <atomic>
 #include <list>
 
 #include <windows.h>
@@ -23,6 +28,9 @@
 #include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
 
 #include "../common/common.h"
+#include "../common/events.h"
+#include "../common/log.h"
+#include "chain.h"
 
 #define APPLICATION_CLASS_NAME "VST-BRIDGE"
 
@@ -30,21 +38,14 @@
 #define VST_BRIDGE_WMSG_EDIT_OPEN 19042
 
 #ifdef DEBUG
-
-# define LOG(Args...)                           \
-  do {                                          \
-    fprintf(g_host.log, "H: " Args);            \
-    fflush(g_host.log);                         \
-  } while (0)
+# define LOG(Args...) vst_bridge_log("H: " Args)
 #else
 # define LOG(Args...)
 #endif
 
-#define CRIT(Args...)                           \
-  do {                                          \
-    fprintf(g_host.log, "[CRIT] H: " Args);     \
-    fflush(g_host.log);                         \
-  } while (0)
+#define CRIT(Args...) vst_bridge_log("[CRIT] H: " Args)
+// the counters, in every build, when they aren't zero
+#define STATS(Args...) vst_bridge_log("[STATS] H: " Args)
 
 #define CHECKED_WRITE(Fd, Data, Size)           \
   do {                                          \
@@ -55,38 +56,275 @@
 
 typedef AEffect *(VSTCALLBACK *plug_main_f)(audioMasterCallback audioMaster);
 
-struct vst_bridge_host {
-  typedef std::list<vst_bridge_request> pending_type;
+/*
+ * A socket to the plugin: the control channel is served by the main
+ * thread, the audio channel (process, and the parameters when they come
+ * from the DAW's audio thread) by the audio thread, without the lock.
+ */
+/* an effSetChunk coming in pieces, see vst_bridge_set_chunk() */
+struct vst_bridge_chunk_in {
+  uint32_t  tag;
+  int32_t   index;
+  float     opt;
+  size_t    size;
+  size_t    off;
+  uint8_t  *data;
+};
+
+/* a notification from processReplacing, for the automate thread */
+struct vst_bridge_notification {
+  VstInt32  opcode;
+  VstInt32  index;
+  VstIntPtr value;
+  float     opt;
+};
+
+/* how many of them wait for the automate thread at most */
+#define VST_BRIDGE_NOTIFY_MAX 16
+
+/* how deep the plugin's callbacks and the requests they cause may nest */
+#define VST_BRIDGE_HOST_DEPTH 8
+/* how many requests a channel keeps for later, see vst_bridge_hold() */
+#define VST_BRIDGE_HOST_HELD 64
+
+/* requests read ahead, in the order they came */
+struct vst_bridge_held {
+  struct vst_bridge_request     *rqs[VST_BRIDGE_HOST_HELD];
+  size_t                         lens[VST_BRIDGE_HOST_HELD];
+  int                            nb;
+};
+
+struct vst_bridge_channel {
+  typedef std::list<vst_bridge_chunk_in> chunks_type;
 
   int                            socket;
-  struct AEffect                *e;
   uint32_t                       next_tag;
-  bool                           stop;
-  struct VstEvents              *ves;
+  // the replies to the outer callbacks, for their waiters
+  struct vst_bridge_held         pending;
   struct VstTimeInfo             time_info;
+  // room for VST_BRIDGE_EVENTS_MAX events, see vst_bridge_events_unpack()
+  struct VstEvents              *ves;
+  // the requests read while one was served, for after it, see wait_response()
+  struct vst_bridge_held         deferred;
+  chunks_type                    chunks;
+  // how many requests are being served
+  int                            serving;
+  // the requests of the calls in progress, see vst_bridge_rq_get()
+  struct vst_bridge_request     *rqs[VST_BRIDGE_HOST_DEPTH];
+  int                            depth;
+  // the buffers of pending and deferred not in use, allocated once
+  struct vst_bridge_request     *free[2 * VST_BRIDGE_HOST_HELD];
+  int                            nfree;
+};
+
+struct vst_bridge_host {
+  struct vst_bridge_channel      ctl;
+  struct vst_bridge_channel      audio;
+  struct AEffect                *e;
+  bool                           stop;
+  // the events ring, mapped by the audio thread
+  uint8_t                       *events;
+  // the process reply's room for the events the plugin sends meanwhile
+  struct vst_bridge_events      *out_events;
+  size_t                         out_events_used;
+  size_t                         out_events_room;
   HWND                           hwnd;
   DWORD                          main_thread_id;
   pthread_mutex_t                lock;
-  pending_type                   pending;
   struct vst_bridge_plugin_data  plugin_data;
-  FILE                          *log;
+  bool                           rt;
+  int                            rt_cpu;
+  bool                           rt_failed;
+  // editor idle rate of the GUI thread, 0 to leave it to the DAW
+  int                            edit_idle_hz;
+  HANDLE                         gui_thread;
+  DWORD                          gui_thread_id;
+  HANDLE                         gui_event;
+  pthread_mutex_t                gui_lock;
+  pthread_cond_t                 gui_cond;
+  // the call handed over to the GUI thread
+  struct vst_bridge_request     *gui_rq;
+  bool                           editor_open;
+  // the plugin's automation, for the automate thread
+  HANDLE                         automate_thread;
+  pthread_mutex_t                automate_lock;
+  pthread_mutex_t                automate_send_lock;
+  pthread_cond_t                 automate_cond;
+  int32_t                        automate_size;
+  float                         *automate_values;
+  bool                          *automate_pending;
+  int32_t                       *automate_order;
+  uint32_t                       automate_nb;
+  struct vst_bridge_request     *automate_rq;
+  // the notifications from the audio thread, sent after the automation
+  struct vst_bridge_notification notify[VST_BRIDGE_NOTIFY_MAX];
+  uint32_t                       notify_nb;
+  // the DAW's answers, pushed by the plugin, see vst_bridge_host_cached()
+  bool                           has_host_info;
+  struct vst_bridge_host_info    host_info;
+  int32_t                        process_level;
+  // the DAW's time for the block in audio.time_info: 1 if valid, 0 if the
+  // DAW had none, -1 to ask it, see VST_BRIDGE_FRAMES_TIME_INFO
+  int32_t                        time_info;
+  // e is a chain of several plugins, see chain.h
+  bool                           chain;
 };
 
 struct vst_bridge_host g_host = {
-  -1,
+  { -1, 1, {{NULL}, {0}, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, NULL,
+    {{NULL}, {0}, 0}, vst_bridge_channel::chunks_type(), 0, {NULL}, 0, {NULL}, 0 },
+  { -1, 1, {{NULL}, {0}, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, NULL,
+    {{NULL}, {0}, 0}, vst_bridge_channel::chunks_type(), 0, {NULL}, 0, {NULL}, 0 },
   NULL,
-  1,
   false,
   NULL,
-  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+  NULL,
+  0,
+  0,
   0,
   0,
   pthread_mutex_t(),
-  vst_bridge_host::pending_type(),
   {false, false, false, false, 0, 0, 0, 0, 0, 0, 0, 0},
-  NULL
+  false,
+  -1,
+  false,
+  30,
+  NULL,
+  0,
+  NULL,
+  pthread_mutex_t(),
+  pthread_cond_t(),
+  NULL,
+  false,
+  NULL,
+  pthread_mutex_t(),
+  pthread_mutex_t(),
+  pthread_cond_t(),
+  0,
+  NULL,
+  NULL,
+  NULL,
+  0,
+  NULL,
+  {},
+  0,
+  false,
+  {0, 0, 0, 0, 0, 0, 0, 0, {0}, {0}, {0}},
+  -1,
+  -1,
+  false,
 };
 
+/* the queries answered from g_host.host_info, and those forwarded */
+std::atomic<uint64_t> g_host_info_hits(0);
+std::atomic<uint64_t> g_host_info_misses(0);
+
+void vst_bridge_host_stats(void)
+{
+  if (g_host_info_hits + g_host_info_misses > 0)
+    STATS("%llu queries about the DAW answered locally, %llu forwarded\n",
+          (unsigned long long)g_host_info_hits, (unsigned long long)g_host_info_misses);
+}
+
+/* the channel the current thread serves */
+__thread struct vst_bridge_channel *g_channel = &g_host.ctl;
+
+/* how many times the current thread holds g_host.lock */
+__thread int g_lock_depth = 0;
+
+/* set by the GUI thread, before it may take g_host.lock */
+__thread bool g_gui_thread = false;
+
+void vst_bridge_lock(void)
+{
+  MSG msg;
+
+  // the holder may be sending a message to the GUI thread's windows, from
+  // the plugin's setParameter say: it is handled while waiting
+  if (g_gui_thread) {
+    while (pthread_mutex_trylock(&g_host.lock)) {
+      MsgWaitForMultipleObjects(0, NULL, FALSE, 1, QS_SENDMESSAGE);
+      PeekMessage(&msg, 0, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+    }
+  } else
+    pthread_mutex_lock(&g_host.lock);
+  ++g_lock_depth;
+}
+
+void vst_bridge_unlock(void)
+{
+  --g_lock_depth;
+  pthread_mutex_unlock(&g_host.lock);
+}
+
+/*
+ * Serves the process calls at the priority of the DAW's audio thread, or
+ * the highest RLIMIT_RTPRIO allows without CAP_SYS_NICE.
+ */
+void vst_bridge_set_scheduling(int policy, int priority)
+{
+  struct sched_param param;
+  int err;
+
+  if (policy != SCHED_FIFO && policy != SCHED_RR) {
+    policy   = SCHED_OTHER;
+    priority = 0;
+  }
+
+  param.sched_priority = priority;
+  err = pthread_setschedparam(pthread_self(), policy, &param);
+  if (err == EPERM && policy != SCHED_OTHER) {
+    struct rlimit limit;
+    if (!getrlimit(RLIMIT_RTPRIO, &limit) && limit.rlim_cur > 0 &&
+        (rlim_t)priority > limit.rlim_cur) {
+      param.sched_priority = limit.rlim_cur;
+      err = pthread_setschedparam(pthread_self(), policy, &param);
+    }
+  }
+  if (err && !g_host.rt_failed) {
+    g_host.rt_failed = true;
+    CRIT("failed to set the scheduling to %d/%d: %s\n",
+         policy, priority, strerror(err));
+  }
+
+#ifdef __linux__
+  if (g_host.rt_cpu >= 0 && policy != SCHED_OTHER) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(g_host.rt_cpu, &cpus);
+    err = pthread_setaffinity_np(pthread_self(), sizeof (cpus), &cpus);
+    if (err)
+      CRIT("failed to pin to cpu %d: %s\n", g_host.rt_cpu, strerror(err));
+  }
+#endif
+}
+
+/* touches the stack the request handlers will use, so it is resident */
+void __attribute__((noinline)) vst_bridge_prefault_stack(void)
+{
+  volatile char stack[4 * sizeof (struct vst_bridge_request)];
+  for (size_t i = 0; i < sizeof (stack); i += 4096)
+    stack[i] = 0;
+}
+
+void vst_bridge_rt_init(void)
+{
+  const char *value = getenv("VST_BRIDGE_RT");
+  g_host.rt = value && atoi(value);
+  if (!g_host.rt)
+    return;
+
+  value = getenv("VST_BRIDGE_RT_CPU");
+  if (value && *value)
+    g_host.rt_cpu = atoi(value);
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE))
+    CRIT("mlockall: %m\n");
+  vst_bridge_prefault_stack();
+}
+
 void copy_plugin_data(void)
 {
   g_host.plugin_data.hasSetParameter           = g_host.e->setParameter;
@@ -107,6 +345,8 @@ void check_plugin_data(void)
 {
   if (!g_host.e)
     return;
+  if (g_host.chain)
+    vst_bridge_chain_update(g_host.e);
 
 #define CHECK_FIELD(X) (g_host.plugin_data.X != g_host.e->X)
   if (CHECK_FIELD(numPrograms) ||
@@ -123,43 +363,302 @@ void check_plugin_data(void)
     rq.tag = 0;
     rq.cmd = VST_BRIDGE_CMD_PLUGIN_DATA;
     memcpy(&rq.plugin_data, &g_host.plugin_data, sizeof (rq.plugin_data));
-    write(g_host.socket, &rq, 8 + sizeof (rq.plugin_data));
+    write(g_host.ctl.socket, &rq, 8 + sizeof (rq.plugin_data));
   }
 #undef CHECK_FIELD
 }
 
 bool serve_request2(struct vst_bridge_request *rq);
 
+/*
+ * A request buffer for the call in progress, off the stack: the calls
+ * nest as the plugin's callbacks and the DAW's requests they cause are
+ * served, VST_BRIDGE_HOST_DEPTH deep at most. NULL beyond that.
+ */
+struct vst_bridge_request *vst_bridge_rq_get(void)
+{
+  struct vst_bridge_channel *chan = g_channel;
+
+  if (chan->depth == VST_BRIDGE_HOST_DEPTH) {
+    CRIT("calls nested more than %d deep\n", VST_BRIDGE_HOST_DEPTH);
+    return NULL;
+  }
+  if (!chan->rqs[chan->depth]) {
+    chan->rqs[chan->depth] = (struct vst_bridge_request *)malloc(sizeof (struct vst_bridge_request));
+    if (!chan->rqs[chan->depth])
+      return NULL;
+  }
+  return chan->rqs[chan->depth++];
+}
+
+void vst_bridge_rq_put(void)
+{
+  --g_channel->depth;
+}
+
+/* allocates the first levels and as many held requests ahead, so the audio path doesn't */
+void vst_bridge_rq_reserve(int nb)
+{
+  struct vst_bridge_channel *chan = g_channel;
+
+  for (int i = 0; i < nb && i < VST_BRIDGE_HOST_DEPTH; ++i) {
+    if (!chan->rqs[i])
+      chan->rqs[i] = (struct vst_bridge_request *)malloc(sizeof (struct vst_bridge_request));
+    if (chan->rqs[i])
+      memset(chan->rqs[i], 0, sizeof (struct vst_bridge_request));
+  }
+  while (chan->nfree < nb) {
+    struct vst_bridge_request *rq = (struct vst_bridge_request *)malloc(sizeof (*rq));
+    if (!rq)
+      break;
+    memset(rq, 0, sizeof (*rq));
+    chan->free[chan->nfree++] = rq;
+  }
+}
+
+/*
+ * Keeps the first len bytes of rq at the end of q, in one of the
+ * channel's buffers; false if q is full.
+ */
+bool vst_bridge_hold(struct vst_bridge_held *q, const struct vst_bridge_request *rq, size_t len)
+{
+  struct vst_bridge_channel *chan = g_channel;
+  struct vst_bridge_request *buf;
+
+  if (q->nb == VST_BRIDGE_HOST_HELD)
+    return false;
+  if (chan->nfree > 0)
+    buf = chan->free[--chan->nfree];
+  else if (!(buf = (struct vst_bridge_request *)malloc(sizeof (*buf))))
+    return false;
+  memcpy(buf, rq, len);
+  q->rqs[q->nb]  = buf;
+  q->lens[q->nb] = len;
+  ++q->nb;
+  return true;
+}
+
+/* copies the i-th request of q into rq, and gives its buffer back */
+void vst_bridge_unhold(struct vst_bridge_held *q, int i, struct vst_bridge_request *rq)
+{
+  struct vst_bridge_channel *chan = g_channel;
+
+  memcpy(rq, q->rqs[i], q->lens[i]);
+  chan->free[chan->nfree++] = q->rqs[i];
+  --q->nb;
+  memmove(q->rqs + i, q->rqs + i + 1, (q->nb - i) * sizeof (q->rqs[0]));
+  memmove(q->lens + i, q->lens + i + 1, (q->nb - i) * sizeof (q->lens[0]));
+}
+
+/*
+ * Waits for the reply to our callback. The replies to the outer ones are
+ * kept for their waiters; the requests the DAW makes while it serves the
+ * callback, flagged VST_BRIDGE_CMD_NESTED, are served right away, and the
+ * others after the request being served, by the channel's loop, see
+ * vst_bridge_next().
+ */
 bool wait_response(struct vst_bridge_request *rq,
                    uint32_t tag)
 {
   ssize_t len;
 
   while (true) {
-    for (vst_bridge_host::pending_type::iterator it = g_host.pending.begin();
-         it != g_host.pending.end(); ++it) {
-      if (it->tag == tag) {
-        *rq = *it;
-        g_host.pending.erase(it);
+    for (int i = 0; i < g_channel->pending.nb; ++i) {
+      if (g_channel->pending.rqs[i]->tag == tag) {
+        vst_bridge_unhold(&g_channel->pending, i, rq);
         return true;
       }
     }
-    len = read(g_host.socket, rq, sizeof (*rq));
+    len = read(g_channel->socket, rq, sizeof (*rq));
     if (len <= 0)
       return false;
     assert(len >= VST_BRIDGE_RQ_LEN);
     if (rq->tag == tag)
       return true;
-    if (rq->cmd != VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK) {
+    if (rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK) {
+      // one per waiter, so the room runs out only with the memory
+      if (!vst_bridge_hold(&g_channel->pending, rq, len))
+        CRIT("lost the reply to callback %d\n", rq->tag);
+    } else if (rq->cmd & VST_BRIDGE_CMD_NESTED || !g_channel->serving ||
+               !vst_bridge_hold(&g_channel->deferred, rq, len))
+      // out of room, it is served now rather than lost
       serve_request2(rq);
-      continue;
-    }
-    g_host.pending.push_back(*rq);
   }
 }
 
+/* the next deferred request; false if there is none */
+bool vst_bridge_next(struct vst_bridge_request *rq)
+{
+  if (!g_channel->deferred.nb)
+    return false;
+  vst_bridge_unhold(&g_channel->deferred, 0, rq);
+  return true;
+}
+
+/*
+ * Replies to a block with silence, in the request's own buffer, when there
+ * is none left to process it: the DAW's audio thread waits for a reply.
+ */
+void vst_bridge_process_silence(struct vst_bridge_request *rq, size_t size, size_t len)
+{
+  rq->frames.flags = 0;
+  memset(rq->frames.frames, 0, size);
+  write(g_channel->socket, rq, len);
+}
+
+/* the DAW's time, after the block's input frames, for its audioMasterGetTime */
+void vst_bridge_block_time(const void *after)
+{
+  const struct vst_bridge_time_info *ti = (const struct vst_bridge_time_info *)after;
+
+  memcpy(&g_host.audio.time_info, ti->info, sizeof (g_host.audio.time_info));
+  g_host.time_info = ti->valid;
+}
+
+/*
+ * The events the plugin sends during process are returned after the frames
+ * of the reply, rather than each in a round trip.
+ */
+void vst_bridge_out_events_begin(struct vst_bridge_request *reply, size_t len)
+{
+  size_t off = VST_BRIDGE_EVENTS_AFTER(len);
+
+  g_host.out_events = NULL;
+  if (off + sizeof (struct vst_bridge_events) > sizeof (*reply))
+    return;
+  g_host.out_events = (struct vst_bridge_events *)((uint8_t *)reply + off);
+  g_host.out_events->offset = VST_BRIDGE_EVENTS_INLINE;
+  g_host.out_events->nb     = 0;
+  g_host.out_events->pad    = 0;
+  g_host.out_events_used    = 0;
+  g_host.out_events_room    = sizeof (*reply) - off - sizeof (struct vst_bridge_events);
+}
+
+/* false if they don't fit, they go in a callback then */
+bool vst_bridge_out_events_add(const struct VstEvents *evs)
+{
+  struct vst_bridge_events *bevs = g_host.out_events;
+  uint32_t nb;
+
+  if (!bevs || bevs->nb + evs->numEvents > VST_BRIDGE_EVENTS_MAX ||
+      vst_bridge_events_size(evs) > g_host.out_events_room - g_host.out_events_used)
+    return false;
+  g_host.out_events_used += vst_bridge_events_pack(
+    bevs->data + g_host.out_events_used, g_host.out_events_room - g_host.out_events_used,
+    evs, &nb);
+  bevs->nb += nb;
+  return true;
+}
+
+/* the length of the reply */
+size_t vst_bridge_out_events_end(size_t len)
+{
+  if (!g_host.out_events)
+    return len;
+  g_host.out_events = NULL;
+  return VST_BRIDGE_EVENTS_AFTER(len) + sizeof (struct vst_bridge_events) +
+    g_host.out_events_used;
+}
+
+/*
+ * The calls which create, show and destroy the plugin's windows: the
+ * editor's, and those plugins make in effOpen and destroy in effClose,
+ * which only the thread owning them can.
+ */
+bool vst_bridge_is_gui_call(const struct vst_bridge_request *rq)
+{
+  if (rq->cmd == VST_BRIDGE_CMD_SHOW_WINDOW)
+    return true;
+  if (rq->cmd != VST_BRIDGE_CMD_EFFECT_DISPATCHER)
+    return false;
+  switch (rq->erq.opcode) {
+  case effOpen:
+  case effClose:
+  case effEditOpen:
+  case effEditClose:
+  case effEditKeyUp:
+  case effEditKeyDown:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Has the GUI thread serve a call, as windows belong to the thread which
+ * created them. g_host.lock is released meanwhile, as the GUI thread may be
+ * waiting for it.
+ */
+bool vst_bridge_gui_call(struct vst_bridge_request *rq)
+{
+  int depth = g_lock_depth;
+
+  for (int i = 0; i < depth; ++i)
+    vst_bridge_unlock();
+  pthread_mutex_lock(&g_host.gui_lock);
+  // a plugin thread's callback may have handed over one already
+  while (g_host.gui_rq)
+    pthread_cond_wait(&g_host.gui_cond, &g_host.gui_lock);
+  g_host.gui_rq = rq;
+  SetEvent(g_host.gui_event);
+  while (g_host.gui_rq == rq)
+    pthread_cond_wait(&g_host.gui_cond, &g_host.gui_lock);
+  pthread_mutex_unlock(&g_host.gui_lock);
+
+  for (int i = 0; i < depth; ++i)
+    vst_bridge_lock();
+  return true;
+}
+
+/*
+ * effSetChunk comes in VST_BRIDGE_CHUNK_SIZE pieces, each a message with
+ * the request's tag: the first one starts the chunk, and the last one
+ * gives it to the plugin. The channel serves what else comes meanwhile.
+ */
+bool vst_bridge_set_chunk(struct vst_bridge_request *rq)
+{
+  vst_bridge_channel::chunks_type &chunks = g_channel->chunks;
+  vst_bridge_channel::chunks_type::iterator it;
+
+  for (it = chunks.begin(); it != chunks.end() && it->tag != rq->tag; ++it)
+    ;
+  if (it == chunks.end()) {
+    struct vst_bridge_chunk_in chunk;
+    chunk.tag   = rq->tag;
+    chunk.index = rq->erq.index;
+    chunk.opt   = rq->erq.opt;
+    chunk.size  = rq->erq.value;
+    chunk.off   = 0;
+    // without it, the pieces are still taken and the plugin answers 0
+    chunk.data  = (uint8_t *)malloc(chunk.size);
+    it = chunks.insert(chunks.end(), chunk);
+  }
+
+  size_t can_read = MIN(VST_BRIDGE_CHUNK_SIZE, it->size - it->off);
+  if (it->data)
+    memcpy(it->data + it->off, rq->erq.data, can_read);
+  it->off += can_read;
+  if (it->off < it->size)
+    return true;
+
+  struct vst_bridge_chunk_in chunk = *it;
+  chunks.erase(it);
+  rq->erq.value = 0;
+  if (chunk.data || !chunk.size)
+    rq->erq.value = g_host.e->dispatcher(g_host.e, effSetChunk, chunk.index,
+                                         chunk.size, chunk.data, chunk.opt);
+  write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
+  free(chunk.data);
+  return true;
+}
+
 bool serve_request2(struct vst_bridge_request *rq)
 {
+  rq->cmd &= ~VST_BRIDGE_CMD_NESTED;
+  if (g_host.gui_thread && GetCurrentThreadId() != g_host.gui_thread_id &&
+      vst_bridge_is_gui_call(rq))
+    return vst_bridge_gui_call(rq);
+
   switch (rq->cmd) {
   case VST_BRIDGE_CMD_EFFECT_DISPATCHER:
     LOG("[%p] effect command: tag: %d, op: %s\n",
@@ -197,7 +696,7 @@ bool serve_request2(struct vst_bridge_request *rq)
     case effGetTailSize:
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
       return true;
 
     case effGetOutputProperties:
@@ -205,26 +704,26 @@ bool serve_request2(struct vst_bridge_request *rq)
       memset(rq->erq.data, 0, sizeof (VstPinProperties));
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (VstPinProperties)));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (VstPinProperties)));
       return true;
 
     case effGetParameterProperties:
       memset(rq->erq.data, 0, sizeof (VstParameterProperties));
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (VstParameterProperties)));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (VstParameterProperties)));
       return true;
 
     case effGetMidiKeyName:
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (MidiKeyName)));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (MidiKeyName)));
       return true;
 
     case effBeginLoadBank:
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
       return true;
 
     case effGetProgramName:
@@ -238,13 +737,14 @@ bool serve_request2(struct vst_bridge_request *rq)
     case effCanDo:
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(strlen((char *)rq->erq.data) + 1));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(strlen((char *)rq->erq.data) + 1));
       return true;
 
     case effClose:
       // quit
       g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                            rq->erq.value, rq->erq.data, rq->erq.opt);
+      vst_bridge_host_stats();
       exit(0);
       return true;
 
@@ -267,16 +767,17 @@ bool serve_request2(struct vst_bridge_request *rq)
       rq->erq.value = 0;
       rq->erq.index = (ptrdiff_t)GetPropA(g_host.hwnd, "__wine_x11_whole_window");
 
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
       return true;
     }
 
     case effEditClose:
+      g_host.editor_open = false;
       DestroyWindow(g_host.hwnd);
       g_host.hwnd = NULL;
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
       return true;
 
     case effEditGetRect: {
@@ -284,7 +785,7 @@ bool serve_request2(struct vst_bridge_request *rq)
       rq->erq.value = g_host.e->dispatcher(g_host.e, effEditGetRect, 0, 0, &rect, 0);
       if (rect)
         memcpy(rq->erq.data, rect, sizeof (*rect));
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (*rect)));
+      write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(sizeof (*rect)));
       return true;
     }
 
@@ -292,7 +793,7 @@ bool serve_request2(struct vst_bridge_request *rq)
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            reinterpret_cast<ptrdiff_t>(rq->erq.data),
                                            rq->erq.data, rq->erq.opt);
-      write(g_host.socket, rq, sizeof (*rq));
+      write(g_channel->socket, rq, sizeof (*rq));
       return true;
 
     case effGetChunk: {
@@ -303,51 +804,28 @@ bool serve_request2(struct vst_bridge_request *rq)
         size_t can_write = MIN(VST_BRIDGE_CHUNK_SIZE, rq->erq.value - off);
         memcpy(rq->erq.data, static_cast<uint8_t *>(ptr) + off, can_write);
         off += can_write;
-        write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(can_write));
+        write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(can_write));
       }
       return true;
     }
 
-    case effSetChunk: {
-      void *data = malloc(rq->erq.value);
-      if (!data && rq->erq.value > 0) {
-        write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
-        return true;
-      }
-
-      for (size_t off = 0; off < static_cast<size_t>(rq->erq.value); ) {
-        size_t can_read = MIN(VST_BRIDGE_CHUNK_SIZE, rq->erq.value - off);
-        memcpy(static_cast<uint8_t*>(data) + off, rq->erq.data, can_read);
-        off += can_read;
-        if (off == static_cast<size_t>(rq->erq.value))
-          break;
-        if (!wait_response(rq, rq->tag))
-          return 0;
-      }
-      rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
-                                           rq->erq.value, data, rq->erq.opt);
-      write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
-      free(data);
-      return true;
-    }
+    case effSetChunk:
+      return vst_bridge_set_chunk(rq);
 
     case effProcessEvents: {
-      struct vst_bridge_midi_events *mes = (struct vst_bridge_midi_events *)rq->erq.data;
-      struct VstEvents *ves = (struct VstEvents *)realloc(
-        (void*)g_host.ves, sizeof (*ves) + mes->nb * sizeof (void*));
-      assert(ves);
-      ves->numEvents = mes->nb;
-      ves->reserved  = 0;
-      struct vst_bridge_midi_event *me = mes->events;
-      for (size_t i = 0; i < mes->nb; ++i) {
-        ves->events[i] = (VstEvent*)me;
-        me = (struct vst_bridge_midi_event *)(me->data + me->byteSize);
+      struct vst_bridge_events *bevs = (struct vst_bridge_events *)rq->erq.data;
+      uint8_t *data = bevs->data;
+      if (bevs->offset != VST_BRIDGE_EVENTS_INLINE) {
+        if (g_host.events && bevs->offset < VST_BRIDGE_EVENTS_RING_SIZE)
+          data = g_host.events + bevs->offset;
+        else
+          bevs->nb = 0;
       }
 
+      struct VstEvents *ves = vst_bridge_events_unpack(g_channel->ves, data, bevs->nb);
       rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                            rq->erq.value, ves, rq->erq.opt);
-      CHECKED_WRITE(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(0));
-      fsync(g_host.socket);
+      CHECKED_WRITE(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(0));
       return true;
     }
 
@@ -356,7 +834,7 @@ bool serve_request2(struct vst_bridge_request *rq)
       case effGetParamDisplay:
         rq->erq.value = g_host.e->dispatcher(g_host.e, rq->erq.opcode, rq->erq.index,
                                              rq->erq.value, rq->erq.data, rq->erq.opt);
-        write(g_host.socket, rq, VST_BRIDGE_ERQ_LEN(strlen((const char *)rq->erq.data) + 1));
+        write(g_channel->socket, rq, VST_BRIDGE_ERQ_LEN(strlen((const char *)rq->erq.data) + 1));
         return true;
       }
       return true;
@@ -365,7 +843,7 @@ bool serve_request2(struct vst_bridge_request *rq)
       CRIT(" !!!!!!!!!! effectDispatcher unsupported: opcode: (%s, %d), index: %d,"
            " value: %d, opt: %f\n", vst_bridge_effect_opcode_name[rq->erq.opcode],
            rq->erq.opcode, rq->erq.index, static_cast<int>(rq->erq.value), rq->erq.opt);
-      write(g_host.socket, rq, sizeof (*rq));
+      write(g_channel->socket, rq, sizeof (*rq));
       return true;
     }
 
@@ -375,26 +853,38 @@ bool serve_request2(struct vst_bridge_request *rq)
 
   case VST_BRIDGE_CMD_GET_PARAMETER:
     rq->param.value = g_host.e->getParameter(g_host.e, rq->param.index);
-    write(g_host.socket, rq, VST_BRIDGE_PARAM_LEN);
+    write(g_channel->socket, rq, VST_BRIDGE_PARAM_LEN);
     return true;
 
   case VST_BRIDGE_CMD_PROCESS: {
     float *inputs[g_host.e->numInputs];
     float *outputs[g_host.e->numOutputs];
 
-    struct vst_bridge_request rq2;
-    rq2.cmd = rq->cmd;
-    rq2.tag = rq->tag;
-    rq2.frames.nframes = rq->frames.nframes;
+    struct vst_bridge_request *rq2 = vst_bridge_rq_get();
+    if (!rq2) {
+      vst_bridge_process_silence(rq, g_host.e->numOutputs * rq->frames.nframes * sizeof (float),
+                                 VST_BRIDGE_FRAMES_LEN(g_host.e->numOutputs * rq->frames.nframes));
+      return true;
+    }
+    rq2->cmd = rq->cmd;
+    rq2->tag = rq->tag;
+    rq2->frames.nframes = rq->frames.nframes;
+    rq2->frames.flags   = 0;
 
     for (int i = 0; i < g_host.e->numInputs; ++i)
       inputs[i] = rq->frames.frames + i * rq->frames.nframes;
     for (int i = 0; i < g_host.e->numOutputs; ++i)
-      outputs[i] = rq2.frames.frames + i * rq->frames.nframes;
+      outputs[i] = rq2->frames.frames + i * rq->frames.nframes;
+
+    if (rq->frames.flags & VST_BRIDGE_FRAMES_TIME_INFO)
+      vst_bridge_block_time(rq->frames.frames + g_host.e->numInputs * rq->frames.nframes);
 
+    size_t len = VST_BRIDGE_FRAMES_LEN(g_host.e->numOutputs * rq->frames.nframes);
+    vst_bridge_out_events_begin(rq2, len);
     g_host.e->processReplacing(g_host.e, inputs, outputs, rq->frames.nframes);
-    write(g_host.socket, &rq2,
-          VST_BRIDGE_FRAMES_LEN(g_host.e->numOutputs * rq->framesd.nframes));
+    g_host.time_info = -1;
+    write(g_channel->socket, rq2, vst_bridge_out_events_end(len));
+    vst_bridge_rq_put();
     return true;
   }
 
@@ -402,27 +892,53 @@ bool serve_request2(struct vst_bridge_request *rq)
     double *inputs[g_host.e->numInputs];
     double *outputs[g_host.e->numOutputs];
 
-    struct vst_bridge_request rq2;
-    rq2.cmd = rq->cmd;
-    rq2.tag = rq->tag;
-    rq2.framesd.nframes = rq->framesd.nframes;
+    struct vst_bridge_request *rq2 = vst_bridge_rq_get();
+    if (!rq2) {
+      vst_bridge_process_silence(rq, g_host.e->numOutputs * rq->framesd.nframes * sizeof (double),
+                                 VST_BRIDGE_FRAMES_DOUBLE_LEN(g_host.e->numOutputs * rq->framesd.nframes));
+      return true;
+    }
+    rq2->cmd = rq->cmd;
+    rq2->tag = rq->tag;
+    rq2->framesd.nframes = rq->framesd.nframes;
+    rq2->framesd.flags   = 0;
 
     for (int i = 0; i < g_host.e->numInputs; ++i)
       inputs[i] = rq->framesd.frames + i * rq->framesd.nframes;
     for (int i = 0; i < g_host.e->numOutputs; ++i)
-      outputs[i] = rq2.framesd.frames + i * rq->framesd.nframes;
+      outputs[i] = rq2->framesd.frames + i * rq->framesd.nframes;
+
+    if (rq->framesd.flags & VST_BRIDGE_FRAMES_TIME_INFO)
+      vst_bridge_block_time(rq->framesd.frames + g_host.e->numInputs * rq->framesd.nframes);
 
+    size_t len = VST_BRIDGE_FRAMES_DOUBLE_LEN(g_host.e->numOutputs * rq->framesd.nframes);
+    vst_bridge_out_events_begin(rq2, len);
     g_host.e->processDoubleReplacing(g_host.e, inputs, outputs, rq->framesd.nframes);
-    write(g_host.socket, &rq2,
-          VST_BRIDGE_FRAMES_DOUBLE_LEN(g_host.e->numOutputs * rq->framesd.nframes));
+    g_host.time_info = -1;
+    write(g_channel->socket, rq2, vst_bridge_out_events_end(len));
+    vst_bridge_rq_put();
     return true;
   }
 
+  case VST_BRIDGE_CMD_SET_SCHEDULING:
+    vst_bridge_set_scheduling(rq->scheduling.policy, rq->scheduling.priority);
+    return true;
+
+  case VST_BRIDGE_CMD_HOST_INFO:
+    memcpy(&g_host.host_info, &rq->host_info, sizeof (g_host.host_info));
+    g_host.has_host_info = true;
+    return true;
+
+  case VST_BRIDGE_CMD_PROCESS_LEVEL:
+    g_host.process_level = rq->process_level.level;
+    return true;
+
   case VST_BRIDGE_CMD_SHOW_WINDOW:
     g_host.e->dispatcher(g_host.e, effEditOpen, 0, 0, g_host.hwnd, 0);
     ShowWindow(g_host.hwnd, SW_SHOWNORMAL);
     UpdateWindow(g_host.hwnd);
-    write(g_host.socket, rq, VST_BRIDGE_RQ_LEN);
+    g_host.editor_open = true;
+    write(g_channel->socket, rq, VST_BRIDGE_RQ_LEN);
     return true;
 
   case VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK:
@@ -436,47 +952,290 @@ bool serve_request2(struct vst_bridge_request *rq)
   }
 }
 
+/* serves a request of the DAW, or one deferred while another was served */
 bool serve_request(void)
 {
-  struct vst_bridge_request rq;
-
-  pthread_mutex_lock(&g_host.lock);
+  struct vst_bridge_request *rq;
+  bool ret = true;
 
-  ssize_t len = read(g_host.socket, &rq, sizeof (rq));
-  if (len <= 0) {
-    pthread_mutex_unlock(&g_host.lock);
+  vst_bridge_lock();
+  rq = vst_bridge_rq_get();
+  if (!rq) {
+    vst_bridge_unlock();
     return false;
   }
 
-  bool ret = serve_request2(&rq);
+  if (!vst_bridge_next(rq)) {
+    // a plugin thread waiting for a callback reply may have taken it
+    ssize_t len = recv(g_host.ctl.socket, rq, sizeof (*rq), MSG_DONTWAIT);
+    if (len <= 0) {
+      ret = len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      goto out;
+    }
+  }
+
+  ++g_host.ctl.serving;
+  ret = serve_request2(rq);
+  --g_host.ctl.serving;
   check_plugin_data();
 
-  pthread_mutex_unlock(&g_host.lock);
+out:
+  vst_bridge_rq_put();
+  vst_bridge_unlock();
   return ret;
 }
 
-VstIntPtr VSTCALLBACK host_audio_master2(AEffect*  /*effect*/,
-                                         VstInt32  opcode,
-                                         VstInt32  index,
-                                         VstIntPtr value,
-                                         void*     ptr,
-                                         float     opt)
+/*
+ * The plugin's audioMasterAutomate calls are queued here and sent by the
+ * automate thread, one way: the thread calling it, often the editor's,
+ * never waits for the DAW, and only the last value of each parameter is
+ * sent when it changes faster than the DAW takes them.
+ */
+bool vst_bridge_automate_queue(VstInt32 index, float value)
+{
+  if (!g_host.automate_thread || index < 0 || index >= g_host.automate_size)
+    return false;
+
+  pthread_mutex_lock(&g_host.automate_lock);
+  g_host.automate_values[index] = value;
+  if (!g_host.automate_pending[index]) {
+    g_host.automate_pending[index] = true;
+    g_host.automate_order[g_host.automate_nb++] = index;
+    if (g_host.automate_nb == 1)
+      pthread_cond_signal(&g_host.automate_cond);
+  }
+  pthread_mutex_unlock(&g_host.automate_lock);
+  return true;
+}
+
+/*
+ * Queues a notification from the audio thread, which doesn't write to the
+ * control channel; a repeated one isn't queued twice. False if there is
+ * no automate thread yet.
+ */
+bool vst_bridge_notify_queue(VstInt32 opcode, VstInt32 index, VstIntPtr value, float opt)
 {
-  struct vst_bridge_request rq;
+  if (!g_host.automate_thread)
+    return false;
 
+  pthread_mutex_lock(&g_host.automate_lock);
+  uint32_t i;
+  for (i = 0; i < g_host.notify_nb; ++i) {
+    struct vst_bridge_notification *n = g_host.notify + i;
+    if (n->opcode == opcode && n->index == index && n->value == value && n->opt == opt)
+      break;
+  }
+  if (i == g_host.notify_nb && i < VST_BRIDGE_NOTIFY_MAX) {
+    struct vst_bridge_notification *n = g_host.notify + g_host.notify_nb++;
+    n->opcode = opcode;
+    n->index  = index;
+    n->value  = value;
+    n->opt    = opt;
+    if (!g_host.automate_nb && g_host.notify_nb == 1)
+      pthread_cond_signal(&g_host.automate_cond);
+  }
+  pthread_mutex_unlock(&g_host.automate_lock);
+  return true;
+}
+
+/* writes a notification's header, with automate_send_lock held */
+void vst_bridge_notify_write(VstInt32 opcode, VstInt32 index, VstIntPtr value, float opt)
+{
+  // only its header is sent, no need for a whole request on the stack
+  uint8_t buf[VST_BRIDGE_AMRQ_LEN(0)] __attribute__((aligned(8)));
+  struct vst_bridge_request *rq = (struct vst_bridge_request *)buf;
+
+  rq->tag         = 0;
+  rq->cmd         = VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY;
+  rq->amrq.opcode = opcode;
+  rq->amrq.index  = index;
+  rq->amrq.value  = value;
+  rq->amrq.opt    = opt;
+  write(g_host.ctl.socket, rq, VST_BRIDGE_AMRQ_LEN(0));
+}
+
+/*
+ * Sends the queued automation, then the queued notifications, with
+ * automate_send_lock held so that the batches go out in order;
+ * automate_lock is only held to pack them.
+ */
+void vst_bridge_automate_send(void)
+{
+  struct vst_bridge_request *rq = g_host.automate_rq;
+  struct vst_bridge_notification notify[VST_BRIDGE_NOTIFY_MAX];
+
+  while (true) {
+    pthread_mutex_lock(&g_host.automate_lock);
+    uint32_t notify_nb = g_host.notify_nb;
+    memcpy(notify, g_host.notify, notify_nb * sizeof (notify[0]));
+    g_host.notify_nb = 0;
+    uint32_t nb = MIN(g_host.automate_nb, VST_BRIDGE_AUTOMATE_MAX);
+    for (uint32_t i = 0; i < nb; ++i) {
+      int32_t index = g_host.automate_order[i];
+      rq->automate.params[i].index = index;
+      rq->automate.params[i].value = g_host.automate_values[index];
+      g_host.automate_pending[index] = false;
+    }
+    g_host.automate_nb -= nb;
+    memmove(g_host.automate_order, g_host.automate_order + nb,
+            g_host.automate_nb * sizeof (*g_host.automate_order));
+    pthread_mutex_unlock(&g_host.automate_lock);
+    if (!nb && !notify_nb)
+      return;
+
+    if (nb) {
+      rq->tag         = 0;
+      rq->cmd         = VST_BRIDGE_CMD_AUTOMATE;
+      rq->automate.nb = nb;
+      write(g_host.ctl.socket, rq, VST_BRIDGE_AUTOMATE_LEN(nb));
+    }
+    for (uint32_t i = 0; i < notify_nb; ++i)
+      vst_bridge_notify_write(notify[i].opcode, notify[i].index, notify[i].value, notify[i].opt);
+  }
+}
+
+/* sends the queued automation before a callback which may depend on it */
+void vst_bridge_automate_flush(void)
+{
+  if (!g_host.automate_thread)
+    return;
+
+  pthread_mutex_lock(&g_host.automate_send_lock);
+  vst_bridge_automate_send();
+  pthread_mutex_unlock(&g_host.automate_send_lock);
+}
+
+/*
+ * Answers the plugin's queries about the DAW from what the plugin pushed,
+ * without a round trip. The process level is only known for the thread
+ * calling process.
+ */
+bool vst_bridge_host_cached(VstInt32 opcode, void *ptr, VstIntPtr *ret)
+{
+  const struct vst_bridge_host_info *info = &g_host.host_info;
+
+  switch (opcode) {
+  case audioMasterVersion:
+  case audioMasterGetVendorVersion:
+  case audioMasterGetSampleRate:
+  case audioMasterGetBlockSize:
+  case audioMasterGetInputLatency:
+  case audioMasterGetOutputLatency:
+  case audioMasterGetVendorString:
+  case audioMasterGetProductString:
+  case audioMasterCanDo:
+  case audioMasterGetCurrentProcessLevel:
+    break;
+  default:
+    return false;
+  }
+
+  if (!g_host.has_host_info)
+    goto miss;
+
+  switch (opcode) {
+  case audioMasterVersion:          *ret = info->version; break;
+  case audioMasterGetVendorVersion: *ret = info->vendor_version; break;
+  case audioMasterGetSampleRate:    *ret = info->sample_rate; break;
+  case audioMasterGetBlockSize:     *ret = info->block_size; break;
+  case audioMasterGetInputLatency:  *ret = info->input_latency; break;
+  case audioMasterGetOutputLatency: *ret = info->output_latency; break;
+
+  case audioMasterGetVendorString:
+    strcpy((char *)ptr, info->vendor);
+    *ret = info->has_vendor;
+    break;
+
+  case audioMasterGetProductString:
+    strcpy((char *)ptr, info->product);
+    *ret = info->has_product;
+    break;
+
+  case audioMasterCanDo: {
+    size_t i;
+    for (i = 0; i < VST_BRIDGE_HOST_CAN_DO_COUNT; ++i)
+      if (!strcmp((const char *)ptr, vst_bridge_host_can_do[i]))
+        break;
+    if (i == VST_BRIDGE_HOST_CAN_DO_COUNT)
+      goto miss;
+    *ret = info->can_do[i];
+    break;
+  }
+
+  case audioMasterGetCurrentProcessLevel:
+    if (g_channel != &g_host.audio || g_host.process_level < 0)
+      goto miss;
+    *ret = g_host.process_level;
+    break;
+  }
+
+  ++g_host_info_hits;
+  return true;
+
+miss:
+  ++g_host_info_misses;
+  return false;
+}
+
+/* the callbacks whose return value plugins ignore */
+bool vst_bridge_is_notification(VstInt32 opcode)
+{
+  switch (opcode) {
+  case audioMasterBeginEdit:
+  case audioMasterEndEdit:
+  case audioMasterIdle:
+  case audioMasterIOChanged:
+  case audioMasterUpdateDisplay:
+  case audioMasterSizeWindow:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Sends a notification one way, after the automation queued before it;
+ * from the audio thread, the automate thread sends it. Returns what a DAW
+ * supporting it would.
+ */
+VstIntPtr vst_bridge_notify(VstInt32 opcode, VstInt32 index, VstIntPtr value, float opt)
+{
+  if (g_channel == &g_host.audio && vst_bridge_notify_queue(opcode, index, value, opt))
+    return 1;
+
+  // the DAW must see the new io before audioMasterIOChanged
+  if (opcode == audioMasterIOChanged && g_channel != &g_host.audio) {
+    vst_bridge_lock();
+    check_plugin_data();
+    vst_bridge_unlock();
+  }
+
+  pthread_mutex_lock(&g_host.automate_send_lock);
+  if (g_host.automate_thread)
+    vst_bridge_automate_send();
+  vst_bridge_notify_write(opcode, index, value, opt);
+  pthread_mutex_unlock(&g_host.automate_send_lock);
+  return 1;
+}
+
+/* sends the plugin's callback to the DAW, and waits for its answer */
+VstIntPtr vst_bridge_call_audio_master(struct vst_bridge_request *rq,
+                                       VstInt32                   opcode,
+                                       VstInt32                   index,
+                                       VstIntPtr                  value,
+                                       void                      *ptr,
+                                       float                      opt)
+{
   LOG("[%p] host_audio_master(%s, %d, %d, %p, %f) => %d\n",
       pthread_self(), vst_bridge_audio_master_opcode_name[opcode],
-      index, value, ptr, opt, g_host.next_tag);
+      index, value, ptr, opt, g_channel->next_tag);
 
   switch (opcode) {
     // no additional data
   case audioMasterAutomate:
   case audioMasterVersion:
   case audioMasterCurrentId:
-  case audioMasterIdle:
   case __audioMasterPinConnectedDeprecated:
-  case audioMasterIOChanged:
-    //case audioMasterSizeWindow:
   case audioMasterGetSampleRate:
   case audioMasterGetBlockSize:
   case audioMasterGetInputLatency:
@@ -486,107 +1245,97 @@ VstIntPtr VSTCALLBACK host_audio_master2(AEffect*  /*effect*/,
   case __audioMasterWantMidiDeprecated:
   case __audioMasterNeedIdleDeprecated:
   case audioMasterGetVendorVersion:
-  case audioMasterSizeWindow:
-    //case audioMasterUpdateDisplay:
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-
-    write(g_host.socket, &rq, VST_BRIDGE_AMRQ_LEN(0));
-    wait_response(&rq, rq.tag);
-    return rq.amrq.value;
-
-  case audioMasterUpdateDisplay:
-    return 1;
+  case __audioMasterTempoAtDeprecated:
+    rq->tag           = g_channel->next_tag;
+    rq->cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+    rq->amrq.opcode   = opcode;
+    rq->amrq.index    = index;
+    rq->amrq.value    = value;
+    rq->amrq.opt      = opt;
+    g_channel->next_tag += 2;
+
+    write(g_channel->socket, rq, VST_BRIDGE_AMRQ_LEN(0));
+    wait_response(rq, rq->tag);
+    return rq->amrq.value;
 
   case audioMasterCanDo:
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-    strcpy((char*)rq.amrq.data, (char*)ptr);
-
-    write(g_host.socket, &rq, VST_BRIDGE_AMRQ_LEN(strlen((char*)ptr) + 1));
-    wait_response(&rq, rq.tag);
-    return rq.amrq.value;
-
-  case __audioMasterTempoAtDeprecated:
-  case audioMasterBeginEdit:
-  case audioMasterEndEdit:
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-
-    write(g_host.socket, &rq, sizeof (rq));
-    wait_response(&rq, rq.tag);
-    return rq.amrq.value;
+    rq->tag           = g_channel->next_tag;
+    rq->cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+    rq->amrq.opcode   = opcode;
+    rq->amrq.index    = index;
+    rq->amrq.value    = value;
+    rq->amrq.opt      = opt;
+    g_channel->next_tag += 2;
+    strcpy((char*)rq->amrq.data, (char*)ptr);
+
+    write(g_channel->socket, rq, VST_BRIDGE_AMRQ_LEN(strlen((char*)ptr) + 1));
+    wait_response(rq, rq->tag);
+    return rq->amrq.value;
 
   case audioMasterProcessEvents: {
     struct VstEvents *evs = (struct VstEvents *)ptr;
-    struct vst_bridge_midi_events *mes = (struct vst_bridge_midi_events *)rq.erq.data;
-
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-
-    mes->nb = evs->numEvents;
-    struct vst_bridge_midi_event *me = mes->events;
-    for (int i = 0; i < evs->numEvents; ++i) {
-      memcpy(me, evs->events[i], sizeof (*me) + evs->events[i]->byteSize);
-      me = (struct vst_bridge_midi_event *)(me->data + me->byteSize);
-    }
+    struct vst_bridge_events *bevs = (struct vst_bridge_events *)rq->amrq.data;
+
+    // from processReplacing: returned with the reply
+    if (g_channel == &g_host.audio && vst_bridge_out_events_add(evs))
+      return 1;
 
-    write(g_host.socket, &rq, ((uint8_t*)me) - ((uint8_t*)&rq));
-    wait_response(&rq, rq.tag);
-    return rq.amrq.value;
+    rq->tag           = g_channel->next_tag;
+    rq->cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+    rq->amrq.opcode   = opcode;
+    rq->amrq.index    = index;
+    rq->amrq.value    = value;
+    rq->amrq.opt      = opt;
+    g_channel->next_tag += 2;
+
+    // bevs is a packed struct, the count goes through nb
+    uint32_t nb;
+    bevs->offset = VST_BRIDGE_EVENTS_INLINE;
+    bevs->pad    = 0;
+    size_t len = vst_bridge_events_pack(bevs->data, sizeof (rq->data) - (bevs->data - rq->data),
+                                        evs, &nb);
+    bevs->nb     = nb;
+
+    write(g_channel->socket, rq, VST_BRIDGE_AMRQ_LEN(sizeof (*bevs) + len));
+    wait_response(rq, rq->tag);
+    return rq->amrq.value;
   }
 
   case audioMasterGetTime:
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-
-    write(g_host.socket, &rq, VST_BRIDGE_AMRQ_LEN(0));
-    wait_response(&rq, rq.tag);
-    if (!rq.amrq.value)
+    // sent ahead with the block
+    if (g_channel == &g_host.audio && g_host.time_info >= 0)
+      return g_host.time_info ? reinterpret_cast<ptrdiff_t>(&g_host.audio.time_info) : 0;
+
+    rq->tag           = g_channel->next_tag;
+    rq->cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+    rq->amrq.opcode   = opcode;
+    rq->amrq.index    = index;
+    rq->amrq.value    = value;
+    rq->amrq.opt      = opt;
+    g_channel->next_tag += 2;
+
+    write(g_channel->socket, rq, VST_BRIDGE_AMRQ_LEN(0));
+    wait_response(rq, rq->tag);
+    if (!rq->amrq.value)
       return 0;
-    memcpy(&g_host.time_info, rq.amrq.data, sizeof (g_host.time_info));
-    return reinterpret_cast<ptrdiff_t>(&g_host.time_info);
+    memcpy(&g_channel->time_info, rq->amrq.data, sizeof (g_channel->time_info));
+    return reinterpret_cast<ptrdiff_t>(&g_channel->time_info);
 
   case audioMasterGetProductString:
   case audioMasterGetVendorString:
-    rq.tag           = g_host.next_tag;
-    rq.cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
-    rq.amrq.opcode   = opcode;
-    rq.amrq.index    = index;
-    rq.amrq.value    = value;
-    rq.amrq.opt      = opt;
-    g_host.next_tag += 2;
-
-    write(g_host.socket, &rq, VST_BRIDGE_AMRQ_LEN(0));
-    if (!wait_response(&rq, rq.tag))
+    rq->tag           = g_channel->next_tag;
+    rq->cmd           = VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+    rq->amrq.opcode   = opcode;
+    rq->amrq.index    = index;
+    rq->amrq.value    = value;
+    rq->amrq.opt      = opt;
+    g_channel->next_tag += 2;
+
+    write(g_channel->socket, rq, VST_BRIDGE_AMRQ_LEN(0));
+    if (!wait_response(rq, rq->tag))
       return 0;
-    strcpy((char*)ptr, (const char*)rq.amrq.data);
-    return rq.amrq.value;
+    strcpy((char*)ptr, (const char*)rq->amrq.data);
+    return rq->amrq.value;
 
   case audioMasterOpenFileSelector:
     return false;
@@ -600,6 +1349,22 @@ VstIntPtr VSTCALLBACK host_audio_master2(AEffect*  /*effect*/,
   }
 }
 
+VstIntPtr VSTCALLBACK host_audio_master2(AEffect*  /*effect*/,
+                                         VstInt32  opcode,
+                                         VstInt32  index,
+                                         VstIntPtr value,
+                                         void*     ptr,
+                                         float     opt)
+{
+  struct vst_bridge_request *rq = vst_bridge_rq_get();
+  if (!rq)
+    return 0;
+
+  VstIntPtr ret = vst_bridge_call_audio_master(rq, opcode, index, value, ptr, opt);
+  vst_bridge_rq_put();
+  return ret;
+}
+
 VstIntPtr VSTCALLBACK host_audio_master(AEffect*  effect,
                                         VstInt32  opcode,
                                         VstInt32  index,
@@ -607,11 +1372,35 @@ VstIntPtr VSTCALLBACK host_audio_master(AEffect*  effect,
                                         void*     ptr,
                                         float     opt)
 {
-  pthread_mutex_lock(&g_host.lock);
+  VstIntPtr ret;
+
+  if (vst_bridge_host_cached(opcode, ptr, &ret))
+    return ret;
+
+  // a link's parameter, to the DAW
+  if (g_host.chain && (opcode == audioMasterAutomate || opcode == audioMasterBeginEdit ||
+                       opcode == audioMasterEndEdit))
+    index = vst_bridge_chain_param(g_host.e, effect, index);
+
+  // one way, nobody uses the return value
+  if (opcode == audioMasterAutomate && vst_bridge_automate_queue(index, opt))
+    return 0;
+  if (vst_bridge_is_notification(opcode))
+    return vst_bridge_notify(opcode, index, value, opt);
+
+  // from processReplacing: answered on the audio channel, without waiting
+  // for the main thread
+  if (g_channel == &g_host.audio)
+    return host_audio_master2(effect, opcode, index, value, ptr, opt);
+
+  // the DAW sees the values the plugin set before calling back
+  vst_bridge_automate_flush();
+
+  vst_bridge_lock();
   check_plugin_data();
-  VstIntPtr ret = host_audio_master2(effect, opcode, index, value, ptr, opt);
+  ret = host_audio_master2(effect, opcode, index, value, ptr, opt);
   check_plugin_data();
-  pthread_mutex_unlock(&g_host.lock);
+  vst_bridge_unlock();
   LOG("  => audio master finished: %s\n",
       vst_bridge_audio_master_opcode_name[opcode]);
   return ret;
@@ -629,73 +1418,312 @@ MainProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
   return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+/* reads a request, and the events ring the plugin may pass with it */
+ssize_t vst_bridge_audio_read(struct vst_bridge_request *rq)
+{
+  char cbuf[CMSG_SPACE(sizeof (int))];
+  struct iovec iov;
+  struct msghdr msg;
+
+  iov.iov_base = rq;
+  iov.iov_len  = sizeof (*rq);
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof (cbuf);
+
+  ssize_t len = recvmsg(g_host.audio.socket, &msg, 0);
+  if (len < VST_BRIDGE_RQ_LEN || rq->cmd != VST_BRIDGE_CMD_EVENTS_RING)
+    return len;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    return len;
+
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof (fd));
+  void *mem = mmap(NULL, VST_BRIDGE_EVENTS_RING_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    CRIT("failed to map the events ring: %m\n");
+    return len;
+  }
+  if (g_host.events)
+    munmap(g_host.events, VST_BRIDGE_EVENTS_RING_SIZE);
+  g_host.events = (uint8_t *)mem;
+  return len;
+}
+
 DWORD WINAPI vst_bridge_audio_thread(void */*arg*/)
 {
-  while (!g_host.stop)
-    if (!serve_request())
-      break;
-  g_host.stop = true;
+  struct vst_bridge_request *rq;
+
+  g_channel = &g_host.audio;
+  if (g_host.rt)
+    vst_bridge_prefault_stack();
+  // a block's request and reply, and the plugin's callbacks from it
+  vst_bridge_rq_reserve(4);
+
+  rq = vst_bridge_rq_get();
+  if (!rq)
+    return 0;
+  while (vst_bridge_next(rq) || vst_bridge_audio_read(rq) > 0) {
+    if (rq->cmd == VST_BRIDGE_CMD_EVENTS_RING)
+      continue;
+    ++g_host.audio.serving;
+    serve_request2(rq);
+    --g_host.audio.serving;
+  }
+  return 0;
+}
+
+/* serves the call handed over by another thread, if any */
+void vst_bridge_gui_serve(void)
+{
+  pthread_mutex_lock(&g_host.gui_lock);
+  struct vst_bridge_request *rq = g_host.gui_rq;
+  pthread_mutex_unlock(&g_host.gui_lock);
+  if (!rq)
+    return;
+
+  vst_bridge_lock();
+  ++g_host.ctl.serving;
+  serve_request2(rq);
+  --g_host.ctl.serving;
+  check_plugin_data();
+  vst_bridge_unlock();
+
+  pthread_mutex_lock(&g_host.gui_lock);
+  g_host.gui_rq = NULL;
+  pthread_cond_broadcast(&g_host.gui_cond);
+  pthread_mutex_unlock(&g_host.gui_lock);
+}
+
+/*
+ * Owns the plugin's windows: creates the editor's, dispatches their
+ * messages as they come, and calls effEditIdle at a steady rate while the
+ * editor is open, so the DAW's own effEditIdle calls are answered by the
+ * plugin without a round trip.
+ */
+DWORD WINAPI vst_bridge_gui_thread(void */*arg*/)
+{
+  DWORD period = 1000 / g_host.edit_idle_hz;
+  DWORD next   = GetTickCount();
+  MSG msg;
+
+  g_gui_thread = true;
+  if (!period)
+    period = 1;
+
+  while (true) {
+    DWORD timeout = INFINITE;
+    if (g_host.editor_open) {
+      int32_t left = next - GetTickCount();
+      timeout = left > 0 ? left : 0;
+    }
+    MsgWaitForMultipleObjects(1, &g_host.gui_event, FALSE, timeout, QS_ALLINPUT);
+
+    vst_bridge_gui_serve();
+
+    while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+      vst_bridge_lock();
+      DispatchMessage(&msg);
+      check_plugin_data();
+      vst_bridge_unlock();
+    }
+
+    DWORD now = GetTickCount();
+    if (!g_host.editor_open) {
+      next = now;
+      continue;
+    }
+    if ((int32_t)(now - next) < 0)
+      continue;
+
+    vst_bridge_lock();
+    g_host.e->dispatcher(g_host.e, effEditIdle, 0, 0, NULL, 0);
+    check_plugin_data();
+    vst_bridge_unlock();
+
+    // late ticks are dropped rather than caught up with
+    next += period;
+    if ((int32_t)(now - next) >= 0)
+      next = now + period;
+  }
   return 0;
 }
 
+bool vst_bridge_gui_start(void)
+{
+  const char *value = getenv("VST_BRIDGE_EDIT_IDLE_HZ");
+  if (value && *value)
+    g_host.edit_idle_hz = atoi(value);
+  if (g_host.edit_idle_hz <= 0)
+    return true;
+
+  pthread_mutex_init(&g_host.gui_lock, NULL);
+  pthread_cond_init(&g_host.gui_cond, NULL);
+  g_host.gui_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!g_host.gui_event)
+    return false;
+  g_host.gui_thread = CreateThread(NULL, 0, vst_bridge_gui_thread, NULL, 0,
+                                   &g_host.gui_thread_id);
+  return g_host.gui_thread;
+}
+
+DWORD WINAPI vst_bridge_automate_thread(void */*arg*/)
+{
+  pthread_mutex_lock(&g_host.automate_send_lock);
+  while (true) {
+    pthread_mutex_lock(&g_host.automate_lock);
+    while (!g_host.automate_nb && !g_host.notify_nb) {
+      // let a flush through while idle
+      pthread_mutex_unlock(&g_host.automate_send_lock);
+      pthread_cond_wait(&g_host.automate_cond, &g_host.automate_lock);
+      pthread_mutex_unlock(&g_host.automate_lock);
+      pthread_mutex_lock(&g_host.automate_send_lock);
+      pthread_mutex_lock(&g_host.automate_lock);
+    }
+    pthread_mutex_unlock(&g_host.automate_lock);
+    vst_bridge_automate_send();
+  }
+  return 0;
+}
+
+/* sized for the parameters the plugin has once loaded; started without any, for the notifications */
+bool vst_bridge_automate_start(void)
+{
+  int32_t size = MAX(g_host.e->numParams, 1);
+
+  g_host.automate_values  = (float *)calloc(size, sizeof (float));
+  g_host.automate_pending = (bool *)calloc(size, sizeof (bool));
+  g_host.automate_order   = (int32_t *)calloc(size, sizeof (int32_t));
+  g_host.automate_rq      = (struct vst_bridge_request *)malloc(sizeof (struct vst_bridge_request));
+  if (!g_host.automate_values || !g_host.automate_pending ||
+      !g_host.automate_order || !g_host.automate_rq)
+    return false;
+  g_host.automate_size = MAX(g_host.e->numParams, 0);
+
+  g_host.automate_thread = CreateThread(NULL, 0, vst_bridge_automate_thread, NULL, 0, NULL);
+  return g_host.automate_thread;
+}
+
+/* the plugin's entry point, called */
+struct AEffect *vst_bridge_plugin_main(HMODULE module, const char *plugin_path)
+{
+  plug_main_f plug_main = NULL;
+  plug_main = (plug_main_f)GetProcAddress(module, "VSTPluginMain");
+
+  if (!plug_main) {
+    plug_main = (plug_main_f)GetProcAddress(module, "main");
+    if (!plug_main) {
+      fprintf(stderr, "failed to find entry symbol in %s\n", plugin_path);
+      return NULL;
+    }
+  }
+
+  struct AEffect *e = plug_main(host_audio_master);
+  if (!e) {
+    fprintf(stderr, "failed to initialize plugin %s\n", plugin_path);
+    return NULL;
+  }
+  return e;
+}
+
 int main(int argc, char **argv)
 {
-  HMODULE module;
-  const char *plugin_path = argv[1];
+  HMODULE modules[VST_BRIDGE_CHAIN_MAX];
+  struct AEffect *links[VST_BRIDGE_CHAIN_MAX];
+  char *plugin_paths[VST_BRIDGE_CHAIN_MAX];
+  int nb = 0;
 
-  if (argc != 3)
+  if (argc != 4)
+    return 1;
+
+  // a chain: the plugins' paths, one per line
+  for (char *path = strtok(argv[1], VST_BRIDGE_CHAIN_SEP); path;
+       path = strtok(NULL, VST_BRIDGE_CHAIN_SEP)) {
+    if (nb == VST_BRIDGE_CHAIN_MAX) {
+      fprintf(stderr, "more than %d plugins in the chain\n", VST_BRIDGE_CHAIN_MAX);
+      return 1;
+    }
+    plugin_paths[nb++] = path;
+  }
+  if (!nb)
     return 1;
 
 #ifdef DEBUG
     char path[128];
     snprintf(path, sizeof (path), "/tmp/vst-bridge-host.%d.log", getpid());
-    g_host.log = fopen(path, "w+");
+    vst_bridge_log_open(path);
 #else
-    g_host.log = stdout;
+    vst_bridge_log_open(NULL);
 #endif
 
   g_host.hwnd = 0;
   g_host.main_thread_id = GetCurrentThreadId();
+  g_host.ctl.ves   = (struct VstEvents *)malloc(
+    sizeof (struct VstEvents) + VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+  g_host.audio.ves = (struct VstEvents *)malloc(
+    sizeof (struct VstEvents) + VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+  if (!g_host.ctl.ves || !g_host.audio.ves)
+    return 1;
+  vst_bridge_rt_init();
   {
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if (g_host.rt)
+      pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
     pthread_mutex_init(&g_host.lock, &attr);
     pthread_mutexattr_destroy(&attr);
   }
-
-  module = LoadLibrary(plugin_path);
-  if (!module) {
-    fprintf(stderr, "failed to load %s: %m\n", plugin_path);
-    return 1;
+  // the plugin may notify from VSTPluginMain
+  pthread_mutex_init(&g_host.automate_lock, NULL);
+  pthread_mutex_init(&g_host.automate_send_lock, NULL);
+  pthread_cond_init(&g_host.automate_cond, NULL);
+
+  for (int i = 0; i < nb; ++i) {
+    modules[i] = LoadLibrary(plugin_paths[i]);
+    if (!modules[i]) {
+      fprintf(stderr, "failed to load %s: %m\n", plugin_paths[i]);
+      return 1;
+    }
   }
 
   // check the channel
-  g_host.socket = atoi(argv[2]);
+  g_host.ctl.socket   = atoi(argv[2]);
+  g_host.audio.socket = atoi(argv[3]);
   {
     struct vst_bridge_request rq;
-    read(g_host.socket, &rq, sizeof (rq));
+    do {
+      // a warm spare which was never used
+      if (read(g_host.ctl.socket, &rq, sizeof (rq)) <= 0)
+        return 0;
+      if (rq.cmd == VST_BRIDGE_CMD_HOST_INFO)
+        serve_request2(&rq);
+    } while (rq.cmd == VST_BRIDGE_CMD_HOST_INFO);
     assert(rq.cmd == VST_BRIDGE_CMD_PLUGIN_MAIN);
   }
 
-  // get the plugin entry
-  plug_main_f plug_main = NULL;
-  plug_main = (plug_main_f)GetProcAddress((HMODULE)module, "VSTPluginMain");
-
-  if (!plug_main) {
-    plug_main = (plug_main_f)GetProcAddress((HMODULE)module, "main");
-    if (!plug_main) {
-      fprintf(stderr, "failed to find entry symbol in %s\n", plugin_path);
+  // init the plugins
+  for (int i = 0; i < nb; ++i) {
+    links[i] = vst_bridge_plugin_main(modules[i], plugin_paths[i]);
+    if (!links[i])
       return 1;
-    }
   }
 
-  // init pluging
-  g_host.e = plug_main(host_audio_master);
-
-  if (!g_host.e) {
-    LOG("failed to initialize plugin\n");
-    return 1;
+  if (nb == 1)
+    g_host.e = links[0];
+  else {
+    g_host.e = vst_bridge_chain_new(links, nb);
+    if (!g_host.e) {
+      CRIT("failed to create the chain: %m\n");
+      return 1;
+    }
+    g_host.chain = true;
   }
 
   // send plugin main finished
@@ -706,7 +1734,7 @@ int main(int argc, char **argv)
     rq.tag = 0;
     rq.cmd = VST_BRIDGE_CMD_PLUGIN_MAIN;
     memcpy(&rq.plugin_data, &g_host.plugin_data, sizeof (rq.plugin_data));
-    write(g_host.socket, &rq, sizeof (rq));
+    write(g_channel->socket, &rq, sizeof (rq));
   }
 
   WNDCLASSEX wclass;
@@ -725,22 +1753,34 @@ int main(int argc, char **argv)
     LOG("failed to register Windows application class\n");
   }
 
-  // HANDLE audio_thread = CreateThread(
-  //   NULL, 8 * 1024 * 1024, vst_bridge_audio_thread, NULL, 0, NULL);
-  // if (!audio_thread) {
-  //   dprintf(g_host.logfd, "failed to create audio thread: %m\n");
-  //   return 1;
-  // }
+  HANDLE audio_thread = CreateThread(
+    NULL, 8 * 1024 * 1024, vst_bridge_audio_thread, NULL, 0, NULL);
+  if (!audio_thread) {
+    CRIT("failed to create audio thread: %m\n");
+    return 1;
+  }
+
+  if (!vst_bridge_gui_start()) {
+    CRIT("failed to create GUI thread: %m\n");
+    return 1;
+  }
 
-  sleep(1);
+  if (!vst_bridge_automate_start()) {
+    CRIT("failed to create automate thread: %m\n");
+    return 1;
+  }
 
   struct pollfd pfd;
   MSG msg;
 
   while (true) {
-    pfd.fd = g_host.socket;
+    pfd.fd = g_host.ctl.socket;
     pfd.events = POLLIN;
-    poll(&pfd, 1, 50);
+    // without a GUI thread, the editor's messages are dispatched from here
+    if (g_host.ctl.deferred.nb)
+      pfd.revents = POLLIN;
+    else
+      poll(&pfd, 1, g_host.gui_thread ? -1 : 50);
     if (pfd.revents & POLLIN &&
         !serve_request())
       break;
@@ -752,6 +1792,8 @@ int main(int argc, char **argv)
     }
   }
 
-  FreeLibrary(module);
+  vst_bridge_host_stats();
+  for (int i = 0; i < nb; ++i)
+    FreeLibrary(modules[i]);
   return 0;
 }
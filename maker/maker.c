@@ -1,138 +1,610 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
 
-#include <magic.h>
-
 #include "../config.h"
 #include "../common/common.h"
+#include "../common/catalog.h"
+#include "../common/pe.h"
 
-void replace_magic(void *mem_so, size_t mem_sz,
-                   const char *magic, const char *replacement);
+/*
+ * The template, read once: a bridge is the template with the dll, host,
+ * wineprefix and info fields, PATH_MAX bytes each, overwritten.
+ */
+struct maker_tpl {
+  int     fd;
+  char   *mem;
+  size_t  size;
+  struct timespec mtime;
+  size_t  dll_offset;
+  size_t  host_offset;
+  size_t  wineprefix_offset;
+  size_t  info_offset;
+};
 
-int main(int argc, char **argv)
+struct maker_job {
+  char *dll_path;
+  char *so_path;
+};
+
+enum maker_result {
+  MAKER_MADE,
+  MAKER_UP_TO_DATE,
+  MAKER_FAILED,
+};
+
+static struct maker_tpl g_tpl;
+static const char *g_wineprefix;
+static bool g_force;
+
+static struct maker_job *g_jobs;
+static size_t g_jobs_nb;
+static size_t g_jobs_size;
+static size_t g_next_job;
+static size_t g_results[3];
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the scanner's entries, sorted by path */
+static struct vst_bridge_catalog_entry *g_catalog;
+static size_t g_catalog_nb;
+
+static const char *g_dll_dir;
+static const char *g_so_dir;
+
+static size_t find_magic(const char *mem, size_t mem_sz, const char *magic)
 {
-  int arch = 32;
-  magic_t magic;
-  char dll_real_path[PATH_MAX];
-  char wineprefix_real_path[PATH_MAX];
+  char pattern[PATH_MAX];
 
-  if (argc != 3 && argc != 4) {
-    fprintf(stderr, "usage: %s <vst.dll> <vst.so> [<wine-prefix>]\n", argv[0]);
-    return 2;
+  // Just to make sure we replace only values of PATH_MAX length.
+  memset(pattern, 0, sizeof(pattern));
+  strcpy(pattern, magic);
+
+  const char *pos = memmem(mem, mem_sz, pattern, sizeof(pattern));
+  if (!pos) {
+    fprintf(stderr, "`%s' magic not found in plugin\n", magic);
+    exit(1);
   }
+  return pos - mem;
+}
 
-  int has_wineprefix = argc == 4;
+static int maker_catalog_cmp(const void *a, const void *b)
+{
+  return strcmp(((const struct vst_bridge_catalog_entry *)a)->path,
+                ((const struct vst_bridge_catalog_entry *)b)->path);
+}
 
-  struct stat st_dll;
-  if (stat(argv[1], &st_dll) ||
-      !realpath(argv[1], dll_real_path)) {
-    fprintf(stderr, "%s: %m\n", argv[1]);
-    return 1;
+/* the scanner's catalog, if there is one: a missing one isn't an error */
+static bool maker_catalog_load(const char *path)
+{
+  char line[PATH_MAX + 512];
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (!file) {
+    if (errno == ENOENT)
+      return true;
+    fprintf(stderr, "%s: %m\n", path);
+    return false;
   }
 
-  struct stat st_tpl;
-  if (stat(VST_BRIDGE_TPL_PATH, &st_tpl)) {
-    fprintf(stderr, "%s: %m\n", VST_BRIDGE_TPL_PATH);
-    return 1;
+  if (!fgets(line, sizeof (line), file) ||
+      strncmp(line, VST_BRIDGE_CATALOG_MAGIC, strlen(VST_BRIDGE_CATALOG_MAGIC))) {
+    fprintf(stderr, "%s: not a catalog, or an older one: run vst-bridge-scanner again\n", path);
+    fclose(file);
+    return true;
   }
 
-  if (has_wineprefix) {
-    struct stat st_wineprefix;
+  size_t size = 0;
+  while (fgets(line, sizeof (line), file)) {
+    if (g_catalog_nb == size) {
+      size = size ? 2 * size : 64;
+      g_catalog = realloc(g_catalog, size * sizeof (*g_catalog));
+      if (!g_catalog) {
+        fprintf(stderr, "%m\n");
+        fclose(file);
+        return false;
+      }
+    }
+    if (vst_bridge_catalog_parse(line, g_catalog + g_catalog_nb) &&
+        g_catalog[g_catalog_nb].status == VST_BRIDGE_CATALOG_OK)
+      ++g_catalog_nb;
+  }
+  fclose(file);
 
-    if (stat(argv[3], &st_wineprefix) ||
-        !realpath(argv[3], wineprefix_real_path)) {
-      fprintf(stderr, "%s: %m\n", argv[3]);
-      return 1;
+  qsort(g_catalog, g_catalog_nb, sizeof (*g_catalog), maker_catalog_cmp);
+  return true;
+}
+
+/* the plugin's entry, if the scanner saw this very dll */
+static const struct vst_bridge_catalog_entry *maker_catalog_find(const char *dll_path,
+                                                                 const struct stat *st_dll)
+{
+  const struct vst_bridge_catalog_entry *entry;
+  size_t lo = 0;
+  size_t hi = g_catalog_nb;
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = strcmp(dll_path, g_catalog[mid].path);
+
+    if (!cmp) {
+      entry = g_catalog + mid;
+      if (entry->size != st_dll->st_size || entry->mtime != st_dll->st_mtime)
+        return NULL;
+      return entry;
     }
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
 
-    if (!S_ISDIR(st_wineprefix.st_mode)) {
-      fprintf(stderr, "%s: %s\n", argv[3], strerror(ENOTDIR));
-      return 1;
+static bool maker_tpl_load(struct maker_tpl *tpl)
+{
+  struct stat st;
+
+  tpl->fd = open(VST_BRIDGE_TPL_PATH, O_RDONLY);
+  if (tpl->fd < 0 || fstat(tpl->fd, &st)) {
+    fprintf(stderr, "%s: %m\n", VST_BRIDGE_TPL_PATH);
+    return false;
+  }
+
+  tpl->size  = st.st_size;
+  tpl->mtime = st.st_mtim;
+  tpl->mem   = mmap(NULL, tpl->size, PROT_READ, MAP_PRIVATE, tpl->fd, 0);
+  if (tpl->mem == MAP_FAILED) {
+    fprintf(stderr, "mmap(%s): %m\n", VST_BRIDGE_TPL_PATH);
+    return false;
+  }
+
+  tpl->dll_offset        = find_magic(tpl->mem, tpl->size, VST_BRIDGE_TPL_DLL);
+  tpl->host_offset       = find_magic(tpl->mem, tpl->size, VST_BRIDGE_TPL_HOST);
+  tpl->wineprefix_offset = find_magic(tpl->mem, tpl->size, VST_BRIDGE_TPL_WINEPREFIX);
+  tpl->info_offset       = find_magic(tpl->mem, tpl->size, VST_BRIDGE_TPL_INFO);
+  return true;
+}
+
+/* the fields of a bridge, as they are in the file */
+struct maker_fields {
+  char dll[PATH_MAX];
+  char host[PATH_MAX];
+  char wineprefix[PATH_MAX];
+  char info[PATH_MAX];
+};
+
+static void maker_fields_init(struct maker_fields *fields, const char *dll_path, int arch,
+                              const struct vst_bridge_catalog_entry *entry)
+{
+  // Remove all the rubbish. Probably will never matter.
+  memset(fields, 0, sizeof (*fields));
+  strcpy(fields->dll, dll_path);
+  strcpy(fields->host, arch == 32 ? VST_BRIDGE_HOST32_PATH : VST_BRIDGE_HOST64_PATH);
+  strcpy(fields->wineprefix, g_wineprefix ? g_wineprefix : VST_BRIDGE_TPL_WINEPREFIX);
+  if (entry) {
+    struct vst_bridge_plugin_info info = entry->info;
+
+    strcpy(info.magic, VST_BRIDGE_PLUGIN_INFO_MAGIC);
+    memcpy(fields->info, &info, sizeof (info));
+  } else
+    strcpy(fields->info, VST_BRIDGE_TPL_INFO);
+}
+
+static bool maker_older(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * A bridge is up to date if it was made from this template, after the dll
+ * last changed, and with the same fields.
+ */
+static bool maker_up_to_date(const char *so_path, const struct stat *st_dll,
+                             const struct maker_fields *fields)
+{
+  char field[PATH_MAX];
+  struct stat st;
+  bool ok = false;
+  int fd;
+
+  fd = open(so_path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) || (size_t)st.st_size != g_tpl.size ||
+      maker_older(&st.st_mtim, &g_tpl.mtime) || maker_older(&st.st_mtim, &st_dll->st_mtim))
+    goto out;
+
+  if (pread(fd, field, PATH_MAX, g_tpl.dll_offset) != PATH_MAX ||
+      memcmp(field, fields->dll, PATH_MAX))
+    goto out;
+  if (pread(fd, field, PATH_MAX, g_tpl.host_offset) != PATH_MAX ||
+      memcmp(field, fields->host, PATH_MAX))
+    goto out;
+  if (pread(fd, field, PATH_MAX, g_tpl.wineprefix_offset) != PATH_MAX ||
+      memcmp(field, fields->wineprefix, PATH_MAX))
+    goto out;
+  if (pread(fd, field, PATH_MAX, g_tpl.info_offset) != PATH_MAX ||
+      memcmp(field, fields->info, PATH_MAX))
+    goto out;
+  ok = true;
+
+out:
+  close(fd);
+  return ok;
+}
+
+static bool maker_write_fields(int fd, const struct maker_fields *fields)
+{
+  return pwrite(fd, fields->dll, PATH_MAX, g_tpl.dll_offset) == PATH_MAX &&
+    pwrite(fd, fields->host, PATH_MAX, g_tpl.host_offset) == PATH_MAX &&
+    pwrite(fd, fields->wineprefix, PATH_MAX, g_tpl.wineprefix_offset) == PATH_MAX &&
+    pwrite(fd, fields->info, PATH_MAX, g_tpl.info_offset) == PATH_MAX;
+}
+
+/*
+ * Writes the bridge, see vst_bridge_replace_begin(). The template's blocks
+ * are shared (reflink) when the filesystem can, and copied otherwise.
+ */
+static bool maker_write(const char *so_path, const struct maker_fields *fields)
+{
+  char tmp_path[PATH_MAX + 32];
+  bool ok = false;
+  int fd;
+
+  fd = vst_bridge_replace_begin(so_path, tmp_path, sizeof (tmp_path), 0755);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %m\n", so_path);
+    return false;
+  }
+
+  if (fchmod(fd, 0755))
+    fprintf(stderr, "chmod(%s, 0755): %m\n", tmp_path);
+
+#ifdef FICLONE
+  if (!ioctl(fd, FICLONE, g_tpl.fd))
+    ok = true;
+  else
+#endif
+  {
+    size_t done = 0;
+
+    while (done < g_tpl.size) {
+      ssize_t ret = write(fd, g_tpl.mem + done, g_tpl.size - done);
+      if (ret <= 0)
+        break;
+      done += ret;
     }
+    ok = done == g_tpl.size;
   }
 
-  magic = magic_open(MAGIC_NONE);
-  if (!magic)
-    fprintf(stderr, "failed to initialize magic\n");
-  else {
-    magic_load(magic, NULL);
-    if (strstr(magic_file(magic, dll_real_path), "80386"))
-      arch = 32;
-    else if (strstr(magic_file(magic, dll_real_path), "x86-64"))
-      arch = 64;
-    printf("%s: detected %d bits dll\n", dll_real_path, arch);
-    magic_close(magic);
+  if (!ok || !maker_write_fields(fd, fields)) {
+    fprintf(stderr, "copy %s to %s: %m\n", VST_BRIDGE_TPL_PATH, tmp_path);
+    close(fd);
+    return vst_bridge_replace_end(so_path, tmp_path, false);
   }
 
-  // copy file
-  int fd_tpl = open(VST_BRIDGE_TPL_PATH, O_RDONLY, 0644);
-  if (fd_tpl < 0) {
-    fprintf(stderr, "%s: %m\n", VST_BRIDGE_TPL_PATH);
-    return 1;
+  ok = !close(fd);
+  if (!vst_bridge_replace_end(so_path, tmp_path, ok)) {
+    fprintf(stderr, "%s: %m\n", so_path);
+    return false;
   }
+  return true;
+}
 
-  int fd_so = open(argv[2], O_CREAT | O_TRUNC | O_RDWR, 0755);
-  if (fd_so < 0) {
-    fprintf(stderr, "%s: %m\n", argv[2]);
-    return 1;
+static enum maker_result maker_make(const char *dll_path, const char *so_path)
+{
+  char dll_real_path[PATH_MAX];
+  struct maker_fields fields;
+  const struct vst_bridge_catalog_entry *entry;
+  struct stat st_dll;
+  int arch;
+
+  if (stat(dll_path, &st_dll) ||
+      !realpath(dll_path, dll_real_path)) {
+    fprintf(stderr, "%s: %m\n", dll_path);
+    return MAKER_FAILED;
+  }
+
+  arch = vst_bridge_pe_arch(dll_real_path);
+  if (!arch) {
+    fprintf(stderr, "%s: not a 32 or 64 bits Windows dll\n", dll_real_path);
+    return MAKER_FAILED;
   }
 
-  if (fchmod(fd_so, 0755))
-    fprintf(stderr, "chmod(%s, 0755): %m\n", argv[2]);
+  entry = maker_catalog_find(dll_real_path, &st_dll);
+  maker_fields_init(&fields, dll_real_path, arch, entry);
+  if (!g_force && maker_up_to_date(so_path, &st_dll, &fields))
+    return MAKER_UP_TO_DATE;
 
-  if (sendfile(fd_so, fd_tpl, NULL, st_tpl.st_size) != st_tpl.st_size) {
-    fprintf(stderr, "copy %s to %s: %m\n", VST_BRIDGE_TPL_PATH, argv[2]);
-    return 1;
+  if (!maker_write(so_path, &fields))
+    return MAKER_FAILED;
+  printf("%s: %d bits dll%s, bridge %s\n", dll_real_path, arch,
+         entry ? ", scanned" : "", so_path);
+  return MAKER_MADE;
+}
+
+/*
+ * A bridge to a chain of dlls, run in series by a single host: the dll
+ * field has their paths, one per line. They must all be 32 or 64 bits.
+ */
+static enum maker_result maker_make_chain(char **dll_paths, int nb, const char *so_path)
+{
+  char dlls[PATH_MAX];
+  struct maker_fields fields;
+  struct stat st_newest;
+  size_t len = 0;
+  int arch = 0;
+
+  if (nb > VST_BRIDGE_CHAIN_MAX) {
+    fprintf(stderr, "%s: more than %d dlls in the chain\n", so_path, VST_BRIDGE_CHAIN_MAX);
+    return MAKER_FAILED;
   }
 
-  close(fd_tpl);
+  memset(&st_newest, 0, sizeof (st_newest));
+  for (int i = 0; i < nb; ++i) {
+    char dll_real_path[PATH_MAX];
+    struct stat st_dll;
+    int dll_arch;
 
-  void *mem_so = mmap(NULL, st_tpl.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                      fd_so, 0);
-  if (mem_so == MAP_FAILED) {
-    fprintf(stderr, "mmap(%s): %m\n", argv[2]);
-    return 1;
+    if (stat(dll_paths[i], &st_dll) ||
+        !realpath(dll_paths[i], dll_real_path)) {
+      fprintf(stderr, "%s: %m\n", dll_paths[i]);
+      return MAKER_FAILED;
+    }
+
+    dll_arch = vst_bridge_pe_arch(dll_real_path);
+    if (!dll_arch) {
+      fprintf(stderr, "%s: not a 32 or 64 bits Windows dll\n", dll_real_path);
+      return MAKER_FAILED;
+    }
+    if (arch && dll_arch != arch) {
+      fprintf(stderr, "%s: a %d bits dll in a chain of %d bits ones\n",
+              dll_real_path, dll_arch, arch);
+      return MAKER_FAILED;
+    }
+    arch = dll_arch;
+
+    len += snprintf(dlls + len, sizeof (dlls) - len, "%s%s",
+                    i ? VST_BRIDGE_CHAIN_SEP : "", dll_real_path);
+    if (len >= sizeof (dlls)) {
+      fprintf(stderr, "%s: %s\n", so_path, strerror(ENAMETOOLONG));
+      return MAKER_FAILED;
+    }
+    if (maker_older(&st_newest.st_mtim, &st_dll.st_mtim))
+      st_newest = st_dll;
   }
 
-  replace_magic(mem_so, st_tpl.st_size, VST_BRIDGE_TPL_DLL, dll_real_path);
-  replace_magic(mem_so, st_tpl.st_size, VST_BRIDGE_TPL_HOST, arch == 32 ? VST_BRIDGE_HOST32_PATH : VST_BRIDGE_HOST64_PATH);
-  if (has_wineprefix)
-    replace_magic(mem_so, st_tpl.st_size, VST_BRIDGE_TPL_WINEPREFIX, wineprefix_real_path);
+  // the scanner's info is per dll, a chain starts its host right away
+  maker_fields_init(&fields, dlls, arch, NULL);
+  if (!g_force && maker_up_to_date(so_path, &st_newest, &fields))
+    return MAKER_UP_TO_DATE;
+
+  if (!maker_write(so_path, &fields))
+    return MAKER_FAILED;
+  printf("%s: chain of %d %d bits dlls\n", so_path, nb, arch);
+  return MAKER_MADE;
+}
+
+/* <dll-dir>/a/b/Synth.dll goes to <so-dir>/a/b/Synth.so */
+static int maker_walk(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+  size_t len = strlen(path);
+  size_t dir_len = strlen(g_dll_dir);
+  char so_path[PATH_MAX];
 
-  munmap(mem_so, st_tpl.st_size);
+  (void)st;
+  (void)ftw;
 
-  close(fd_so);
+  if (type != FTW_F || len <= 4 || strcasecmp(path + len - 4, ".dll"))
+    return 0;
 
+  if (snprintf(so_path, sizeof (so_path), "%s%.*s.so", g_so_dir,
+               (int)(len - dir_len - 4), path + dir_len) >= (int)sizeof (so_path)) {
+    fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+    return 0;
+  }
+
+  if (g_jobs_nb == g_jobs_size) {
+    g_jobs_size = g_jobs_size ? 2 * g_jobs_size : 64;
+    g_jobs = realloc(g_jobs, g_jobs_size * sizeof (*g_jobs));
+    if (!g_jobs) {
+      fprintf(stderr, "%m\n");
+      return 1;
+    }
+  }
+  g_jobs[g_jobs_nb].dll_path = strdup(path);
+  g_jobs[g_jobs_nb].so_path  = strdup(so_path);
+  ++g_jobs_nb;
   return 0;
 }
 
-void replace_magic(void *mem_so, size_t mem_sz,
-                   const char *magic, const char *replacement)
+static void *maker_worker(void *arg)
 {
-  char pattern[PATH_MAX];
+  enum maker_result result;
+  struct maker_job *job;
 
-  // Just to make sure we replace only values of PATH_MAX length.
-  memset(pattern, 0, sizeof(pattern));
-  strcpy(pattern, magic);
+  (void)arg;
 
-  void *pos = memmem(mem_so, mem_sz, pattern, sizeof(pattern));
-  if (!pos) {
-    fprintf(stderr, "`%s' magic not found in plugin\n", magic);
-    exit(1);
+  while (true) {
+    pthread_mutex_lock(&g_lock);
+    if (g_next_job >= g_jobs_nb) {
+      pthread_mutex_unlock(&g_lock);
+      return NULL;
+    }
+    job = g_jobs + g_next_job++;
+    pthread_mutex_unlock(&g_lock);
+
+    if (vst_bridge_mkdirs(job->so_path))
+      result = maker_make(job->dll_path, job->so_path);
+    else {
+      fprintf(stderr, "%s: %m\n", job->so_path);
+      result = MAKER_FAILED;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    ++g_results[result];
+    pthread_mutex_unlock(&g_lock);
   }
+}
 
-  // Remove all the rubbish. Probably will never matter.
-  memset(pattern, 0, sizeof(pattern));
-  strcpy(pattern, replacement);
+static int maker_batch(long jobs)
+{
+  pthread_t *threads;
+  long nthreads = 0;
+
+  if (nftw(g_dll_dir, maker_walk, 32, FTW_PHYS)) {
+    fprintf(stderr, "%s: %m\n", g_dll_dir);
+    return 1;
+  }
+
+  if (jobs > (long)g_jobs_nb)
+    jobs = g_jobs_nb;
+  threads = calloc(jobs ? jobs : 1, sizeof (*threads));
+  for (; threads && nthreads < jobs; ++nthreads)
+    if (pthread_create(threads + nthreads, NULL, maker_worker, NULL))
+      break;
+  if (!nthreads)
+    maker_worker(NULL);
+  for (long i = 0; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  printf("%zu bridges: %zu made, %zu up to date, %zu failed\n", g_jobs_nb,
+         g_results[MAKER_MADE], g_results[MAKER_UP_TO_DATE], g_results[MAKER_FAILED]);
+  return g_results[MAKER_FAILED] ? 1 : 0;
+}
 
-  memcpy(pos, pattern, sizeof(pattern));
+static bool maker_load(const char *catalog_path)
+{
+  return maker_tpl_load(&g_tpl) && maker_catalog_load(catalog_path);
+}
+
+/* the exit status of a single bridge */
+static int maker_exit(enum maker_result result, const char *so_path)
+{
+  switch (result) {
+  case MAKER_UP_TO_DATE:
+    printf("%s: up to date\n", so_path);
+    return 0;
+  case MAKER_MADE:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-f] [-c catalog] [-w wine-prefix] <vst.dll> <vst.so> [<wine-prefix>]\n"
+          "       %s [-f] [-c catalog] [-w wine-prefix] [-j N] <vst-directory> <bridge-directory> [<wine-prefix>]\n"
+          "       %s [-f] [-w wine-prefix] -C <chain.so> <vst.dll>...\n"
+          "  -c PATH  the catalog of vst-bridge-scanner (default: ~/.cache/vst-bridge/catalog)\n"
+          "  -C PATH  make a single bridge running the dlls in series, in one host\n"
+          "  -f       make the bridges even if they are up to date\n"
+          "  -j N     make N bridges at a time (default: the number of CPUs)\n"
+          "  -w PATH  the WINEPREFIX of the plugins\n",
+          name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  char wineprefix_real_path[PATH_MAX];
+  char catalog_path[PATH_MAX];
+  char dll_dir[PATH_MAX];
+  char so_dir[PATH_MAX];
+  const char *name = argv[0];
+  const char *chain_so = NULL;
+  const char *wineprefix = NULL;
+  struct stat st_dll;
+  int opt;
+
+  vst_bridge_catalog_default_path(catalog_path, sizeof (catalog_path));
+  while ((opt = getopt(argc, argv, "c:C:fj:w:h")) != -1) {
+    switch (opt) {
+    case 'c':
+      snprintf(catalog_path, sizeof (catalog_path), "%s", optarg);
+      break;
+    case 'C':
+      chain_so = optarg;
+      break;
+    case 'w':
+      wineprefix = optarg;
+      break;
+    case 'f':
+      g_force = true;
+      break;
+    case 'j':
+      jobs = strtol(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (chain_so ? argc < 2 : argc != 3 && argc != 4) {
+    usage(name);
+    return 2;
+  }
+  if (jobs < 1)
+    jobs = 1;
+  if (!chain_so && argc == 4)
+    wineprefix = argv[3];
+
+  if (wineprefix) {
+    struct stat st_wineprefix;
+
+    if (stat(wineprefix, &st_wineprefix) ||
+        !realpath(wineprefix, wineprefix_real_path)) {
+      fprintf(stderr, "%s: %m\n", wineprefix);
+      return 1;
+    }
+
+    if (!S_ISDIR(st_wineprefix.st_mode)) {
+      fprintf(stderr, "%s: %s\n", wineprefix, strerror(ENOTDIR));
+      return 1;
+    }
+    g_wineprefix = wineprefix_real_path;
+  }
+
+  if (chain_so)
+    return maker_load(catalog_path) ?
+      maker_exit(maker_make_chain(argv + 1, argc - 1, chain_so), chain_so) : 1;
+
+  if (stat(argv[1], &st_dll)) {
+    fprintf(stderr, "%s: %m\n", argv[1]);
+    return 1;
+  }
+
+  if (!maker_load(catalog_path))
+    return 1;
+
+  if (!S_ISDIR(st_dll.st_mode))
+    return maker_exit(maker_make(argv[1], argv[2]), argv[2]);
+
+  if ((mkdir(argv[2], 0755) && errno != EEXIST) ||
+      !realpath(argv[1], dll_dir) || !realpath(argv[2], so_dir)) {
+    fprintf(stderr, "%s: %m\n", argv[2]);
+    return 1;
+  }
+  g_dll_dir = dll_dir;
+  g_so_dir  = so_dir;
+  return maker_batch(jobs);
 }
@@ -0,0 +1,398 @@
+#include <sys/types.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#define __cdecl
+
+#include "../common/log.h"
+#include "capture.h"
+
+#include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+#define VST_BRIDGE_CAPTURE_BLOCK_SIZE (64 * 1024)
+// about a minute of process records at 64 frames, before the writer catches up
+#define VST_BRIDGE_CAPTURE_PREALLOC 32
+#define VST_BRIDGE_CAPTURE_MAX_THREADS 255
+
+struct vst_bridge_capture_block {
+  struct vst_bridge_capture_block *next;
+  size_t                           size;
+  size_t                           used;
+  bool                             oversized;
+  uint8_t                          data[0];
+};
+
+struct vst_bridge_capture {
+  FILE                            *file;
+  char                             path[PATH_MAX];
+  pthread_mutex_t                  lock;
+  pthread_cond_t                   cond;
+  pthread_t                        thread;
+  bool                             stop;
+  // the block being filled
+  struct vst_bridge_capture_block *current;
+  // full blocks, waiting for the writer
+  struct vst_bridge_capture_block *queue_head;
+  struct vst_bridge_capture_block *queue_tail;
+  struct vst_bridge_capture_block *free_list;
+  uint64_t                         last_us;
+  uint32_t                         dropped;
+  pthread_t                        threads[VST_BRIDGE_CAPTURE_MAX_THREADS];
+  int                              nthreads;
+};
+
+static std::atomic<unsigned> g_capture_count(0);
+
+uint64_t vst_bridge_capture_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static struct vst_bridge_capture_block *vst_bridge_capture_block_new(size_t size)
+{
+  struct vst_bridge_capture_block *block =
+    (struct vst_bridge_capture_block *)malloc(sizeof (*block) + size);
+  if (!block)
+    return NULL;
+  block->next      = NULL;
+  block->size      = size;
+  block->used      = 0;
+  block->oversized = size > VST_BRIDGE_CAPTURE_BLOCK_SIZE;
+  return block;
+}
+
+/* called with the lock held */
+static void vst_bridge_capture_enqueue(struct vst_bridge_capture       *cap,
+                                       struct vst_bridge_capture_block *block)
+{
+  block->next = NULL;
+  if (cap->queue_tail)
+    cap->queue_tail->next = block;
+  else
+    cap->queue_head = block;
+  cap->queue_tail = block;
+  pthread_cond_signal(&cap->cond);
+}
+
+/* queues the current block and takes a free one, called with the lock held */
+static bool vst_bridge_capture_rotate(struct vst_bridge_capture *cap)
+{
+  if (!cap->free_list)
+    return false;
+  vst_bridge_capture_enqueue(cap, cap->current);
+  cap->current       = cap->free_list;
+  cap->free_list     = cap->current->next;
+  cap->current->used = 0;
+  return true;
+}
+
+static void *vst_bridge_capture_writer(void *arg)
+{
+  struct vst_bridge_capture *cap = (struct vst_bridge_capture *)arg;
+
+  pthread_mutex_lock(&cap->lock);
+  while (true) {
+    // flush the partial block from time to time, so that a crash loses
+    // at most a second
+    if (!cap->queue_head && cap->current && cap->current->used > 0) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1;
+      if (!cap->stop && pthread_cond_timedwait(&cap->cond, &cap->lock, &ts) == 0)
+        continue;
+      if (!cap->queue_head && cap->current->used > 0)
+        vst_bridge_capture_rotate(cap);
+    }
+
+    if (!cap->queue_head) {
+      if (cap->stop)
+        break;
+      pthread_cond_wait(&cap->cond, &cap->lock);
+      continue;
+    }
+
+    struct vst_bridge_capture_block *block = cap->queue_head;
+    cap->queue_head = block->next;
+    if (!cap->queue_head)
+      cap->queue_tail = NULL;
+
+    pthread_mutex_unlock(&cap->lock);
+    if (fwrite(block->data, block->used, 1, cap->file) != 1 && block->used > 0)
+      vst_bridge_log("[CRIT] P: capture: %s: write failed: %m\n", cap->path);
+    fflush(cap->file);
+    pthread_mutex_lock(&cap->lock);
+
+    if (block->oversized) {
+      free(block);
+    } else {
+      block->used    = 0;
+      block->next    = cap->free_list;
+      cap->free_list = block;
+    }
+  }
+  pthread_mutex_unlock(&cap->lock);
+  return NULL;
+}
+
+struct vst_bridge_capture *vst_bridge_capture_open(const struct AEffect *e,
+                                                   const char           *plugin_path)
+{
+  const char *prefix = getenv("VST_BRIDGE_CAPTURE");
+  if (!prefix || !*prefix)
+    return NULL;
+
+  struct vst_bridge_capture *cap =
+    (struct vst_bridge_capture *)calloc(1, sizeof (*cap));
+  if (!cap)
+    return NULL;
+
+  snprintf(cap->path, sizeof (cap->path), "%s.%d.%u.vbcap", prefix, getpid(),
+           g_capture_count.fetch_add(1));
+  cap->file = fopen(cap->path, "w");
+  if (!cap->file) {
+    vst_bridge_log("[CRIT] P: capture: %s: %m\n", cap->path);
+    free(cap);
+    return NULL;
+  }
+
+  struct vst_bridge_capture_header header;
+  memcpy(header.magic, VST_BRIDGE_CAPTURE_MAGIC, sizeof (header.magic));
+  header.numPrograms = e->numPrograms;
+  header.numParams   = e->numParams;
+  header.numInputs   = e->numInputs;
+  header.numOutputs  = e->numOutputs;
+  header.flags       = e->flags;
+  header.uniqueID    = e->uniqueID;
+  header.version     = e->version;
+  header.path_len    = strlen(plugin_path);
+  fwrite(&header, sizeof (header), 1, cap->file);
+  fwrite(plugin_path, header.path_len, 1, cap->file);
+  fflush(cap->file);
+
+  for (int i = 0; i < VST_BRIDGE_CAPTURE_PREALLOC; ++i) {
+    struct vst_bridge_capture_block *block =
+      vst_bridge_capture_block_new(VST_BRIDGE_CAPTURE_BLOCK_SIZE);
+    if (!block)
+      break;
+    block->next    = cap->free_list;
+    cap->free_list = block;
+  }
+  cap->current = cap->free_list;
+  if (cap->current)
+    cap->free_list = cap->current->next;
+
+  pthread_mutex_init(&cap->lock, NULL);
+  pthread_cond_init(&cap->cond, NULL);
+  if (!cap->current ||
+      pthread_create(&cap->thread, NULL, vst_bridge_capture_writer, cap)) {
+    vst_bridge_log("[CRIT] P: capture: failed to start the writer\n");
+    fclose(cap->file);
+    while (cap->free_list) {
+      struct vst_bridge_capture_block *block = cap->free_list;
+      cap->free_list = block->next;
+      free(block);
+    }
+    free(cap->current);
+    pthread_cond_destroy(&cap->cond);
+    pthread_mutex_destroy(&cap->lock);
+    free(cap);
+    return NULL;
+  }
+
+  vst_bridge_log("P: capturing the session to %s\n", cap->path);
+  return cap;
+}
+
+void vst_bridge_capture_close(struct vst_bridge_capture *cap)
+{
+  if (!cap)
+    return;
+
+  pthread_mutex_lock(&cap->lock);
+  if (cap->current->used > 0) {
+    vst_bridge_capture_enqueue(cap, cap->current);
+    cap->current = NULL;
+  }
+  cap->stop = true;
+  pthread_cond_signal(&cap->cond);
+  pthread_mutex_unlock(&cap->lock);
+  pthread_join(cap->thread, NULL);
+
+  if (cap->dropped > 0)
+    vst_bridge_log("[CRIT] P: capture: %s: %u records dropped, the writer"
+                   " could not keep up\n", cap->path, cap->dropped);
+  fclose(cap->file);
+
+  free(cap->current);
+  while (cap->free_list) {
+    struct vst_bridge_capture_block *block = cap->free_list;
+    cap->free_list = block->next;
+    free(block);
+  }
+  pthread_cond_destroy(&cap->cond);
+  pthread_mutex_destroy(&cap->lock);
+  free(cap);
+}
+
+/*
+ * Serializes the input payload of a dispatcher call into data, returns
+ * its size. Called twice: once with data == NULL to compute the size.
+ */
+static size_t vst_bridge_capture_payload(int32_t  opcode,
+                                         int64_t  value,
+                                         void    *ptr,
+                                         uint8_t *data)
+{
+  size_t size = 0;
+
+  switch (opcode) {
+  case effSetProgramName:
+  case effCanDo:
+    size = strlen((const char *)ptr) + 1;
+    if (data)
+      memcpy(data, ptr, size);
+    return size;
+
+  case effSetChunk:
+    size = value;
+    if (data)
+      memcpy(data, ptr, size);
+    return size;
+
+  case effBeginLoadBank:
+  case effBeginLoadProgram:
+    if (data)
+      memcpy(data, ptr, sizeof (VstPatchChunkInfo));
+    return sizeof (VstPatchChunkInfo);
+
+  case effGetMidiKeyName:
+    if (data)
+      memcpy(data, ptr, sizeof (MidiKeyName));
+    return sizeof (MidiKeyName);
+
+  case effSetSpeakerArrangement: {
+    // both arrangements, input then output
+    const struct VstSpeakerArrangement *ars[2] = {
+      (const struct VstSpeakerArrangement *)value,
+      (const struct VstSpeakerArrangement *)ptr,
+    };
+    for (int i = 0; i < 2; ++i) {
+      size_t len = 8 + ars[i]->numChannels * sizeof (ars[i]->speakers[0]);
+      if (data)
+        memcpy(data + size, ars[i], len);
+      size += len;
+    }
+    return size;
+  }
+
+  case effProcessEvents: {
+    const struct VstEvents *evs = (const struct VstEvents *)ptr;
+    for (int i = 0; i < evs->numEvents; ++i) {
+      const VstEvent *ev = evs->events[i];
+      struct vst_bridge_capture_event *ce =
+        (struct vst_bridge_capture_event *)(data + size);
+      const uint8_t *payload = (const uint8_t *)ev->data;
+      uint32_t len = sizeof (ev->data);
+
+      if (ev->type == kVstSysExType) {
+        const VstMidiSysexEvent *sysex = (const VstMidiSysexEvent *)ev;
+        payload = (const uint8_t *)sysex->sysexDump;
+        len     = sysex->dumpBytes;
+      }
+      if (data) {
+        ce->type        = ev->type;
+        ce->deltaFrames = ev->deltaFrames;
+        ce->flags       = ev->flags;
+        ce->size        = len;
+        memcpy(ce->data, payload, len);
+      }
+      size += sizeof (*ce) + len;
+    }
+    return size;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/* called with the lock held */
+static uint8_t vst_bridge_capture_thread_id(struct vst_bridge_capture *cap)
+{
+  pthread_t self = pthread_self();
+  for (int i = 0; i < cap->nthreads; ++i)
+    if (pthread_equal(cap->threads[i], self))
+      return i;
+  if (cap->nthreads == VST_BRIDGE_CAPTURE_MAX_THREADS)
+    return VST_BRIDGE_CAPTURE_MAX_THREADS;
+  cap->threads[cap->nthreads] = self;
+  return cap->nthreads++;
+}
+
+void vst_bridge_capture_call(struct vst_bridge_capture   *cap,
+                             enum vst_bridge_capture_type type,
+                             int32_t                      opcode,
+                             int32_t                      index,
+                             int64_t                      value,
+                             void                        *ptr,
+                             float                        opt,
+                             uint64_t                     start_us)
+{
+  uint64_t end_us = vst_bridge_capture_now();
+  size_t   size   = 0;
+
+  if (type == VST_BRIDGE_CAPTURE_DISPATCHER && ptr)
+    size = vst_bridge_capture_payload(opcode, value, ptr, NULL);
+  size_t len = sizeof (struct vst_bridge_capture_record) + size;
+
+  pthread_mutex_lock(&cap->lock);
+
+  struct vst_bridge_capture_block *block = cap->current;
+  if (len > VST_BRIDGE_CAPTURE_BLOCK_SIZE) {
+    // a big chunk, never on the audio thread: it gets its own block,
+    // queued after the current one to keep the order
+    block = vst_bridge_capture_block_new(len);
+    if (!block || (cap->current->used > 0 && !vst_bridge_capture_rotate(cap))) {
+      free(block);
+      block = NULL;
+    }
+  } else if (block->used + len > block->size) {
+    block = vst_bridge_capture_rotate(cap) ? cap->current : NULL;
+  }
+  if (!block) {
+    ++cap->dropped;
+    pthread_mutex_unlock(&cap->lock);
+    return;
+  }
+
+  struct vst_bridge_capture_record *rec =
+    (struct vst_bridge_capture_record *)(block->data + block->used);
+  rec->type        = type;
+  rec->thread      = vst_bridge_capture_thread_id(cap);
+  rec->reserved    = 0;
+  // calls from different threads may complete out of order
+  rec->delta_us    = cap->last_us ? (int64_t)(start_us - cap->last_us) : 0;
+  rec->duration_us = end_us - start_us;
+  rec->opcode      = opcode;
+  rec->index       = index;
+  rec->value       = value;
+  rec->opt         = opt;
+  rec->size        = size;
+  if (size > 0)
+    vst_bridge_capture_payload(opcode, value, ptr, rec->data);
+  block->used  += len;
+  cap->last_us  = start_us;
+
+  if (block->oversized)
+    vst_bridge_capture_enqueue(cap, block);
+  pthread_mutex_unlock(&cap->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef PLUGIN_CAPTURE_H
+# define PLUGIN_CAPTURE_H
+
+# include <stdint.h>
+
+# include "../common/capture.h"
+
+/*
+ * Session capture writer, see common/capture.h for the format.
+ *
+ * Records are appended to preallocated blocks and written to the disk
+ * by a background thread: recording a call never does I/O on the
+ * calling thread. Only oversized records (big chunks) allocate.
+ */
+
+struct AEffect;
+struct vst_bridge_capture;
+
+/* returns NULL if VST_BRIDGE_CAPTURE is not set */
+struct vst_bridge_capture *vst_bridge_capture_open(const struct AEffect *e,
+                                                   const char           *plugin_path);
+void vst_bridge_capture_close(struct vst_bridge_capture *cap);
+
+uint64_t vst_bridge_capture_now(void);
+
+/* records a call which started at start_us, and ends now */
+void vst_bridge_capture_call(struct vst_bridge_capture *cap,
+                             enum vst_bridge_capture_type type,
+                             int32_t                    opcode,
+                             int32_t                    index,
+                             int64_t                    value,
+                             void                      *ptr,
+                             float                      opt,
+                             uint64_t                   start_us);
+
+#endif /* !PLUGIN_CAPTURE_H */
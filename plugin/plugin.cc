@@ -1,15 +1,22 @@
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 #include <pthread.h>
+#include <poll.h>
 #include <signal.h>
+#include <time.h>
 
+#include <atomic>
 #include <list>
 
 #include <X11/Xlib.h>
@@ -18,101 +25,820 @@
 
 #include "../config.h"
 #include "../common/common.h"
+#include "../common/log.h"
+#include "capture.h"
+#include "queries.h"
 
 const char g_plugin_path[PATH_MAX] = VST_BRIDGE_TPL_DLL;
 const char g_host_path[PATH_MAX] = VST_BRIDGE_TPL_HOST;
 const char g_plugin_wineprefix[PATH_MAX] = VST_BRIDGE_TPL_WINEPREFIX;
+// a struct vst_bridge_plugin_info once filled by the maker; not const, so
+// GCC can't assume it still holds the magic
+char g_plugin_info[PATH_MAX] = VST_BRIDGE_TPL_INFO;
 
 #ifdef DEBUG
-
-# define LOG(Args...)                           \
-  do {                                          \
-    fprintf(g_log ? : stderr, "P: " Args);      \
-    fflush(g_log ? : stderr);                   \
-  } while (0)
+# define LOG(Args...) vst_bridge_log("P: " Args)
 #else
 # define LOG(Args...) do { ; } while (0)
 #endif
 
-#define CRIT(Args...)                                   \
-  do {                                                  \
-    fprintf(g_log ? : stderr, "[CRIT] P: " Args);       \
-    fflush(g_log ? : stderr);                           \
-  } while (0)
+#define CRIT(Args...) vst_bridge_log("[CRIT] P: " Args)
+// the counters, in every build, when they aren't zero
+#define STATS(Args...) vst_bridge_log("[STATS] P: " Args)
 
 #include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+#include "../common/events.h"
+
+/* loaded from the environment, see vst_bridge_config_load() */
+struct vst_bridge_config {
+  // per-block process deadline in us, 0 to disable, -1 for two block durations
+  int64_t deadline_us;
+  // on a miss, repeat the previous block rather than output silence
+  bool    fallback_previous;
+  // respawn the host when it dies
+  bool    restart;
+  // minimum time between two background snapshots, 0 to disable them
+  int     snapshot_interval_s;
+  // hosts spawned ahead of time, with the dll already loaded
+  int     warm_spares;
+  // priority inheritance, locked memory, and the host serving process
+  // calls at the priority of the DAW's audio thread
+  bool    rt;
+  // rate at which the host idles the editor, 0 to forward the DAW's calls
+  int     edit_idle_hz;
+  // return from VSTPluginMain before the host is up, if the maker embedded
+  // the plugin's info
+  bool    lazy;
+  // blocks in flight while the DAW renders offline, 0 to wait for each
+  int     offline_pipeline;
+  // send the setup calls without waiting for the plugin, see
+  // vst_bridge_is_async()
+  bool    async_setup;
+  // answer the plugin's queries from the last sessions, see queries.h
+  bool    query_cache;
+  // frames per block the plugin processes, 0 for the DAW's calls as they
+  // come, see struct vst_bridge_reblock
+  int     reblock;
+};
+
+struct vst_bridge_config g_config = { -1, false, true, 5, 0, false, 30, true, 0, true, true, 0 };
+
+/* what the DAW set, replayed on a restarted host */
+struct vst_bridge_state {
+  VstIntPtr  block_size;
+  VstIntPtr  precision;
+  VstIntPtr  program;
+  bool       opened;
+  bool       mains_on;
+  bool       processing;
+  // parameters set since the snapshot, NAN if not, and dirty below: under
+  // vbe->params_lock, the callback and audio threads set them too
+  float     *params;
+  int32_t    nparams;
+  // the last chunk we know of, from the DAW or taken on idle
+  void      *snapshot;
+  size_t     snapshot_size;
+  VstInt32   snapshot_index;
+  uint64_t   snapshot_ns;
+  bool       dirty;
+};
+
+/*
+ * A socket to the host, with its own tags. The control channel carries
+ * the dispatcher and the GUI calls, under vbe->lock; the audio channel
+ * carries process, and the parameters when they come from the audio
+ * thread, under vbe->audio_lock. The host serves them from two threads,
+ * so process never waits behind a control call.
+ */
+struct vst_bridge_channel {
+  vst_bridge_channel()
+    : socket(-1),
+      next_tag(0)
+  {
+  }
 
-static FILE *g_log = NULL;
+  int                            socket;
+  uint32_t                       next_tag;
+  std::list<vst_bridge_request>  pending;
+  // tags of the process replies which missed their deadline
+  std::list<uint32_t>            late_tags;
+  // tags of the setup calls nobody waits for, see vst_bridge_async()
+  std::list<uint32_t>            async_tags;
+};
+
+/*
+ * The DAW's buffers of a process call, one per channel, which the request
+ * is gathered from and the reply's frames scattered to by the socket,
+ * rather than copied through the request.
+ */
+struct vst_bridge_scatter {
+  void   **buffers;
+  int      nb;
+  // of each buffer
+  size_t   len;
+};
+
+/* a thread waiting on the control channel, fed by the reader */
+struct vst_bridge_waiter {
+  uint32_t                   tag;
+  struct vst_bridge_request *rq;
+  // rq holds the reply, or a callback made while the host serves us
+  bool                       ready;
+  bool                       reply;
+};
+
+/* a callback made while no request was in flight */
+struct vst_bridge_callback {
+  void   *data;
+  size_t  len;
+};
+
+struct vst_bridge_spare {
+  int   socket;
+  int   audio_socket;
+  pid_t child;
+};
+
+pthread_mutex_t g_spares_lock = PTHREAD_MUTEX_INITIALIZER;
+std::list<vst_bridge_spare> g_spares;
+
+/* the dll's cached queries, shared by the instances, see vst_bridge_queries_init() */
+pthread_mutex_t g_queries_lock = PTHREAD_MUTEX_INITIALIZER;
+struct vst_bridge_queries *g_queries;
+bool g_queries_opened;
+
+struct vst_bridge_stats {
+  uint64_t process_calls;
+  uint32_t deadline_misses;
+  // the lock was held by another thread past the deadline
+  uint32_t lock_timeouts;
+  // blocks replaced while waiting for a late reply
+  uint32_t resync_blocks;
+  uint32_t late_replies;
+  uint32_t restarts;
+  uint32_t restart_failures;
+  // blocks silenced while the host was restarting
+  uint64_t recovery_blocks;
+  uint64_t recovery_ns_last;
+  uint64_t recovery_ns_max;
+  // events which didn't fit in the ring or the request
+  uint64_t events_dropped;
+};
+
+/* the replies the host may queue before it blocks writing them */
+#define VST_BRIDGE_PIPELINE_BYTES (128 * 1024)
+/* room for the DAW's events of a block, with VST_BRIDGE_REBLOCK */
+#define VST_BRIDGE_REBLOCK_EVENTS_SIZE (128 * 1024)
+
+struct vst_bridge_inflight {
+  uint32_t tag;
+  // 0 for effProcessEvents
+  VstInt32 frames;
+  size_t   len;
+};
+
+/*
+ * Rendering offline, process sends the block and returns the output of an
+ * earlier one, so that the host works while the DAW goes on. The output is
+ * late by latency frames, reported in initialDelay; in real time, the
+ * replies go through the same delay line, so that the DAW can switch
+ * between the two at any block. See vst_bridge_pipeline_process().
+ */
+struct vst_bridge_pipeline {
+  // the requests waiting for their reply, oldest first
+  struct vst_bridge_inflight inflight[VST_BRIDGE_PIPELINE_MAX];
+  uint32_t                   first;
+  uint32_t                   nb;
+  size_t                     inflight_len;
+  // the output owed to the DAW, a ring of capacity frames per output
+  uint8_t                   *fifo;
+  VstInt32                   capacity;
+  VstInt32                   outputs;
+  size_t                     sample_size;
+  VstInt32                   head;
+  VstInt32                   count;
+  VstInt32                   latency;
+  // the last block was rendered offline
+  bool                       offline;
+};
+
+/*
+ * With VST_BRIDGE_REBLOCK, the DAW's calls, however small, are gathered
+ * into blocks of frames for the plugin, a round trip each: the output is
+ * a block late, reported in initialDelay. The DAW's events wait with its
+ * frames and go with the block. See vst_bridge_reblock_process().
+ */
+struct vst_bridge_reblock {
+  VstInt32                   frames;
+  // the DAW's input so far, and the last block's output, frames per channel
+  uint8_t                   *in;
+  uint8_t                   *out;
+  VstInt32                   inputs;
+  VstInt32                   outputs;
+  size_t                     sample_size;
+  VstInt32                   fill;
+  // the DAW's events, packed, their deltaFrames from the block's start
+  uint8_t                   *events;
+  size_t                     events_used;
+  uint32_t                   events_nb;
+  struct VstEvents          *ves;
+};
 
 struct vst_bridge_effect {
   vst_bridge_effect()
-    : socket(-1),
-      child(-1),
-      next_tag(0),
-      chunk(NULL)
+    : child(-1),
+      chunk(NULL),
+      capture(NULL),
+      sample_rate(0),
+      dead(false),
+      deaths(0),
+      died_ns(0),
+      restart(false),
+      supervisor_stop(false),
+      has_supervisor(false),
+      starting(false),
+      start_abort(false),
+      has_starter(false),
+      own_programs(false),
+      has_checker(false),
+      last_output(NULL),
+      last_capacity(0),
+      last_frames(0),
+      last_sample_size(0),
+      process_rq(NULL),
+      rt_blocks(0),
+      rt_policy(SCHED_OTHER),
+      rt_priority(0),
+      process_level(kVstProcessLevelUnknown),
+      host_process_level(-1),
+      has_audio_thread(false),
+      has_reader(false),
+      reader_stop(false),
+      reader_broken(false),
+      reader_reading(false),
+      reader_rq(NULL),
+      has_callback_thread(false),
+      callback_rq(NULL),
+      events(NULL),
+      events_fd(-1),
+      events_head(0),
+      out_events(NULL),
+      out_ves(NULL)
   {
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    if (g_config.rt)
+      pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
     pthread_mutex_init(&lock, &attr);
     pthread_mutexattr_destroy(&attr);
+    pthread_mutexattr_init(&attr);
+    if (g_config.rt)
+      pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&audio_lock, &attr);
+    pthread_mutex_init(&params_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
     memset(&e, 0, sizeof (e));
+    memset(&stats, 0, sizeof (stats));
+    memset(&state, 0, sizeof (state));
+    memset(&pipeline, 0, sizeof (pipeline));
+    memset(&reblock, 0, sizeof (reblock));
+    state.precision = -1;
+    state.program   = -1;
+    pthread_mutex_init(&supervisor_lock, NULL);
+    pthread_cond_init(&supervisor_cond, NULL);
+    pthread_mutex_init(&start_lock, NULL);
+    pthread_cond_init(&start_cond, NULL);
+    pthread_mutex_init(&reader_lock, NULL);
+    pthread_cond_init(&reader_cond, NULL);
+    pthread_cond_init(&callback_cond, NULL);
   }
 
   ~vst_bridge_effect()
   {
-    if (socket >= 0)
-      close(socket);
+    if (has_starter)
+      pthread_join(starter, NULL);
+    pthread_cond_destroy(&start_cond);
+    pthread_mutex_destroy(&start_lock);
+
+    if (has_checker)
+      pthread_join(checker, NULL);
+    if (g_queries)
+      vst_bridge_queries_save(g_queries, false);
+
+    if (has_supervisor) {
+      pthread_mutex_lock(&supervisor_lock);
+      supervisor_stop = true;
+      pthread_cond_signal(&supervisor_cond);
+      pthread_mutex_unlock(&supervisor_lock);
+      pthread_join(supervisor, NULL);
+    }
+    pthread_cond_destroy(&supervisor_cond);
+    pthread_mutex_destroy(&supervisor_lock);
+
+    pthread_mutex_lock(&reader_lock);
+    reader_stop = true;
+    pthread_cond_broadcast(&reader_cond);
+    pthread_cond_signal(&callback_cond);
+    pthread_mutex_unlock(&reader_lock);
+    if (has_reader) {
+      shutdown(ctl.socket, SHUT_RDWR);
+      pthread_join(reader, NULL);
+    }
+    if (has_callback_thread)
+      pthread_join(callback_thread, NULL);
+    for (std::list<vst_bridge_callback>::iterator it = callbacks.begin();
+         it != callbacks.end(); ++it)
+      free(it->data);
+    pthread_cond_destroy(&callback_cond);
+    pthread_cond_destroy(&reader_cond);
+    pthread_mutex_destroy(&reader_lock);
+    free(reader_rq);
+    free(callback_rq);
+
+    vst_bridge_capture_close(capture);
+    if (stats.deadline_misses > 0 || stats.lock_timeouts > 0)
+      STATS("%llu blocks, %u deadline misses, %u lock timeouts, %u blocks"
+            " skipped to resync, %u late replies discarded\n",
+            stats.process_calls, stats.deadline_misses, stats.lock_timeouts,
+            stats.resync_blocks, stats.late_replies);
+    if (stats.restarts > 0 || stats.restart_failures > 0)
+      STATS("%u host restarts (%u failed), recovery: last %llu ms, max %llu ms,"
+            " %llu blocks silenced\n", stats.restarts, stats.restart_failures,
+            stats.recovery_ns_last / 1000000, stats.recovery_ns_max / 1000000,
+            stats.recovery_blocks);
+    if (stats.events_dropped > 0)
+      CRIT("%llu MIDI events dropped\n", stats.events_dropped);
+    if (events)
+      munmap(events, VST_BRIDGE_EVENTS_RING_SIZE);
+    if (events_fd >= 0)
+      close(events_fd);
+    free(last_output);
+    free(pipeline.fifo);
+    free(reblock.in);
+    free(reblock.out);
+    free(reblock.events);
+    free(reblock.ves);
+    free(process_rq);
+    free(out_events);
+    free(out_ves);
+    free(state.params);
+    free(state.snapshot);
+    if (ctl.socket >= 0)
+      close(ctl.socket);
+    if (audio.socket >= 0)
+      close(audio.socket);
     free(chunk);
+    pthread_mutex_destroy(&params_lock);
+    pthread_mutex_destroy(&audio_lock);
     pthread_mutex_destroy(&lock);
     int st;
-    waitpid(child, &st, 0);
+    if (child > 0)
+      waitpid(child, &st, 0);
     if (display)
       XCloseDisplay(display);
   }
 
   struct AEffect                 e;
-  int                            socket;
+  struct vst_bridge_channel      ctl;
+  struct vst_bridge_channel      audio;
   pid_t                          child;
-  uint32_t                       next_tag;
   audioMasterCallback            audio_master;
   void                          *chunk;
   pthread_mutex_t                lock;
   ERect                          rect;
-  bool                           close_flag;
-  std::list<vst_bridge_request>  pending;
+  std::atomic<bool>              close_flag;
   Display                       *display;
   bool                           show_window;
+  struct vst_bridge_capture     *capture;
+  float                          sample_rate;
+  struct vst_bridge_state        state;
+  // the host is gone, process outputs silence until it's restarted
+  std::atomic<bool>              dead;
+  uint32_t                       deaths;
+  uint64_t                       died_ns;
+  pthread_t                      supervisor;
+  pthread_mutex_t                supervisor_lock;
+  pthread_cond_t                 supervisor_cond;
+  bool                           restart;
+  bool                           supervisor_stop;
+  bool                           has_supervisor;
+  // the host was spawned lazily and isn't up yet, see vst_bridge_starter()
+  std::atomic<bool>              starting;
+  bool                           start_abort;
+  pthread_t                      starter;
+  bool                           has_starter;
+  pthread_mutex_t                start_lock;
+  pthread_cond_t                 start_cond;
+  // the DAW loaded programs of its own, the cached names aren't theirs
+  std::atomic<bool>              own_programs;
+  // checks the cached queries, see vst_bridge_queries_checker()
+  pthread_t                      checker;
+  bool                           has_checker;
+  struct vst_bridge_stats        stats;
+  // the previous output, for the deadline fallback
+  uint8_t                       *last_output;
+  size_t                         last_capacity;
+  VstInt32                       last_frames;
+  size_t                         last_sample_size;
+  // process requests, off the DAW's audio thread stack and locked in RT mode
+  struct vst_bridge_request     *process_rq;
+  // the scheduling last sent to the host
+  pthread_t                      rt_thread;
+  uint32_t                       rt_blocks;
+  int                            rt_policy;
+  int                            rt_priority;
+  // the DAW's process level on the audio thread, and the one last sent
+  VstInt32                       process_level;
+  VstInt32                       host_process_level;
+  // the thread which last called process, and the lock it takes
+  pthread_mutex_t                audio_lock;
+  // state.params and state.dirty, taken after the other locks
+  pthread_mutex_t                params_lock;
+  pthread_t                      audio_thread;
+  bool                           has_audio_thread;
+  // the control channel reader, see vst_bridge_reader()
+  pthread_t                      reader;
+  pthread_mutex_t                reader_lock;
+  pthread_cond_t                 reader_cond;
+  std::list<vst_bridge_waiter *> waiters;
+  bool                           has_reader;
+  bool                           reader_stop;
+  // the socket is gone or being replaced, the reader waits
+  bool                           reader_broken;
+  bool                           reader_reading;
+  struct vst_bridge_request     *reader_rq;
+  // serves the callbacks made while no request is in flight
+  pthread_t                      callback_thread;
+  pthread_cond_t                 callback_cond;
+  std::list<vst_bridge_callback> callbacks;
+  bool                           has_callback_thread;
+  struct vst_bridge_request     *callback_rq;
+  // the events ring shared with the host, written under the audio lock
+  uint8_t                       *events;
+  int                            events_fd;
+  uint32_t                       events_head;
+  // the events the plugin sent during process, for the DAW
+  uint8_t                       *out_events;
+  struct VstEvents              *out_ves;
+  // under the audio lock, with VST_BRIDGE_OFFLINE_PIPELINE
+  struct vst_bridge_pipeline     pipeline;
+  // under the audio lock, with VST_BRIDGE_REBLOCK
+  struct vst_bridge_reblock      reblock;
 };
 
-void copy_plugin_data(struct vst_bridge_effect *vbe,
-                      struct vst_bridge_request *rq)
-{
-  vbe->e.numPrograms  = rq->plugin_data.numPrograms;
-  vbe->e.numParams    = rq->plugin_data.numParams;
-  vbe->e.numInputs    = rq->plugin_data.numInputs;
-  vbe->e.numOutputs   = rq->plugin_data.numOutputs;
-  vbe->e.flags        = rq->plugin_data.flags;
-  vbe->e.initialDelay = rq->plugin_data.initialDelay;
-  vbe->e.uniqueID     = rq->plugin_data.uniqueID;
-  vbe->e.version      = rq->plugin_data.version;
-  if (!rq->plugin_data.hasSetParameter)
+/*
+ * The instance behind the DAW's AEffect: e.object points back to it, as
+ * vst_bridge_effect isn't standard-layout for offsetof().
+ */
+static inline struct vst_bridge_effect *vst_bridge_effect_of(AEffect *effect)
+{
+  return (struct vst_bridge_effect *)effect->object;
+}
+
+void vst_bridge_config_load(struct vst_bridge_config *cfg)
+{
+  const char *value = getenv("VST_BRIDGE_DEADLINE");
+  if (value && *value)
+    cfg->deadline_us = atoll(value);
+
+  value = getenv("VST_BRIDGE_DEADLINE_FALLBACK");
+  if (value && !strcmp(value, "previous"))
+    cfg->fallback_previous = true;
+
+  value = getenv("VST_BRIDGE_RESTART");
+  if (value && *value)
+    cfg->restart = atoi(value);
+
+  value = getenv("VST_BRIDGE_SNAPSHOT_INTERVAL");
+  if (value && *value)
+    cfg->snapshot_interval_s = atoi(value);
+
+  value = getenv("VST_BRIDGE_WARM_SPARES");
+  if (value && *value)
+    cfg->warm_spares = atoi(value);
+
+  value = getenv("VST_BRIDGE_RT");
+  if (value && *value)
+    cfg->rt = atoi(value);
+
+  // read by the host too
+  value = getenv("VST_BRIDGE_EDIT_IDLE_HZ");
+  if (value && *value)
+    cfg->edit_idle_hz = atoi(value);
+
+  value = getenv("VST_BRIDGE_LAZY");
+  if (value && *value)
+    cfg->lazy = atoi(value);
+
+  value = getenv("VST_BRIDGE_OFFLINE_PIPELINE");
+  if (value && *value)
+    cfg->offline_pipeline = MIN(atoi(value) > 0 ? atoi(value) : 0, VST_BRIDGE_PIPELINE_MAX);
+
+  value = getenv("VST_BRIDGE_ASYNC_SETUP");
+  if (value && *value)
+    cfg->async_setup = atoi(value);
+
+  value = getenv("VST_BRIDGE_QUERY_CACHE");
+  if (value && *value)
+    cfg->query_cache = atoi(value);
+
+  value = getenv("VST_BRIDGE_REBLOCK");
+  if (value && *value)
+    cfg->reblock = MIN(atoi(value) > 0 ? atoi(value) : 0, VST_BRIDGE_REBLOCK_MAX);
+}
+
+/* locks and prefaults memory touched by the audio thread */
+void vst_bridge_rt_lock_memory(void *mem, size_t size)
+{
+  if (!g_config.rt || !mem)
+    return;
+  memset(mem, 0, size);
+  if (mlock(mem, size))
+    CRIT("mlock(%zu): %m\n", size);
+}
+
+uint64_t vst_bridge_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* has the supervisor restart the host, if there is one */
+void vst_bridge_supervisor_wake(struct vst_bridge_effect *vbe)
+{
+  if (!vbe->has_supervisor)
+    return;
+  pthread_mutex_lock(&vbe->supervisor_lock);
+  vbe->restart = true;
+  pthread_cond_signal(&vbe->supervisor_cond);
+  pthread_mutex_unlock(&vbe->supervisor_lock);
+}
+
+/* called with either lock held, wakes the supervisor up */
+void vst_bridge_host_died(struct vst_bridge_effect *vbe)
+{
+  ++vbe->deaths;
+  if (vbe->dead)
+    return;
+
+  vbe->dead    = true;
+  vbe->died_ns = vst_bridge_now_ns();
+  CRIT("the host died%s\n", vbe->has_supervisor ? ", restarting it" : "");
+  vst_bridge_supervisor_wake(vbe);
+}
+
+/* the host's callbacks this thread is serving, see vst_bridge_is_async() */
+static thread_local int t_callbacks;
+
+/*
+ * Sends with flags, the requests made while this thread serves one of the
+ * host's callbacks flagged VST_BRIDGE_CMD_NESTED, in a header of their own.
+ */
+ssize_t vst_bridge_send2(struct vst_bridge_effect  *vbe,
+                         struct vst_bridge_channel *chan,
+                         const void                *rq,
+                         size_t                     len,
+                         int                        flags)
+{
+  const struct vst_bridge_request *req = (const struct vst_bridge_request *)rq;
+  ssize_t ret;
+
+  if (!t_callbacks || len < VST_BRIDGE_RQ_LEN ||
+      req->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK)
+    ret = send(chan->socket, rq, len, flags);
+  else {
+    uint32_t header[2] = { req->tag, req->cmd | VST_BRIDGE_CMD_NESTED };
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len  = VST_BRIDGE_RQ_LEN;
+    iov[1].iov_base = (uint8_t *)rq + VST_BRIDGE_RQ_LEN;
+    iov[1].iov_len  = len - VST_BRIDGE_RQ_LEN;
+    memset(&msg, 0, sizeof (msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+    ret = sendmsg(chan->socket, &msg, flags);
+  }
+  if (ret < 0 && errno == EPIPE)
+    vst_bridge_host_died(vbe);
+  return ret;
+}
+
+/* like write(), without SIGPIPE if the host is gone */
+ssize_t vst_bridge_send(struct vst_bridge_effect  *vbe,
+                        struct vst_bridge_channel *chan,
+                        const void                *rq,
+                        size_t                     len)
+{
+  return vst_bridge_send2(vbe, chan, rq, len, MSG_NOSIGNAL);
+}
+
+/* the process request rq's header, then the frames of in, then extra */
+ssize_t vst_bridge_send_frames(struct vst_bridge_effect         *vbe,
+                               struct vst_bridge_channel        *chan,
+                               const struct vst_bridge_request  *rq,
+                               const struct vst_bridge_scatter  *in,
+                               const void                       *extra,
+                               size_t                            extra_len)
+{
+  struct iovec iov[in->nb + 2];
+  struct msghdr msg;
+  int nb = 0;
+
+  iov[nb].iov_base = (void *)rq;
+  iov[nb++].iov_len = VST_BRIDGE_FRAMES_LEN(0);
+  for (int i = 0; i < in->nb; ++i) {
+    iov[nb].iov_base = in->buffers[i];
+    iov[nb++].iov_len = in->len;
+  }
+  if (extra_len > 0) {
+    iov[nb].iov_base = (void *)extra;
+    iov[nb++].iov_len = extra_len;
+  }
+
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = nb;
+  ssize_t ret = sendmsg(chan->socket, &msg, MSG_NOSIGNAL);
+  if (ret < 0 && errno == EPIPE)
+    vst_bridge_host_died(vbe);
+  return ret;
+}
+
+/*
+ * Reads a message into rq; with out, the frames of a process reply land
+ * in out's buffers, and those of any other message are gathered back, so
+ * that rq holds it whole.
+ */
+ssize_t vst_bridge_recv(struct vst_bridge_channel       *chan,
+                        struct vst_bridge_request       *rq,
+                        uint32_t                         tag,
+                        const struct vst_bridge_scatter *out)
+{
+  if (!out)
+    return ::read(chan->socket, rq, sizeof (*rq));
+
+  size_t head = VST_BRIDGE_FRAMES_LEN(0);
+  struct iovec iov[out->nb + 2];
+  struct msghdr msg;
+
+  iov[0].iov_base = rq;
+  iov[0].iov_len  = head;
+  for (int i = 0; i < out->nb; ++i) {
+    iov[i + 1].iov_base = out->buffers[i];
+    iov[i + 1].iov_len  = out->len;
+  }
+  // the output events, after the frames
+  iov[out->nb + 1].iov_base = (uint8_t *)rq + head + out->nb * out->len;
+  iov[out->nb + 1].iov_len  = sizeof (*rq) - head - out->nb * out->len;
+
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = out->nb + 2;
+  ssize_t len = recvmsg(chan->socket, &msg, 0);
+  if (len > (ssize_t)head && rq->tag != tag)
+    for (int i = 0; i < out->nb; ++i)
+      memcpy((uint8_t *)rq + head + i * out->len, out->buffers[i], out->len);
+  return len;
+}
+
+/* from any thread: the DAW's, the audio one or the callback one */
+void vst_bridge_state_param(struct vst_bridge_effect *vbe,
+                            VstInt32 index,
+                            float    value)
+{
+  pthread_mutex_lock(&vbe->params_lock);
+  vbe->state.dirty = true;
+  if (index >= 0 && index < vbe->state.nparams)
+    vbe->state.params[index] = value;
+  pthread_mutex_unlock(&vbe->params_lock);
+}
+
+/* the state changed since the snapshot */
+void vst_bridge_state_dirty(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&vbe->params_lock);
+  vbe->state.dirty = true;
+  pthread_mutex_unlock(&vbe->params_lock);
+}
+
+/* called with the lock held, before forwarding the call */
+void vst_bridge_state_track(struct vst_bridge_effect *vbe,
+                            VstInt32  opcode,
+                            VstInt32  index,
+                            VstIntPtr value,
+                            float     opt)
+{
+  switch (opcode) {
+  case effOpen:                vbe->state.opened = true; break;
+  case effClose:               vbe->state.opened = false; break;
+  case effSetSampleRate:       vbe->sample_rate = opt; break;
+  case effSetBlockSize:        vbe->state.block_size = value; break;
+  case effSetProcessPrecision: vbe->state.precision = value; break;
+  case effMainsChanged:        vbe->state.mains_on = value; break;
+  case effStartProcess:        vbe->state.processing = true; break;
+  case effStopProcess:         vbe->state.processing = false; break;
+  case effSetProgram:
+    vbe->state.program = value;
+    vst_bridge_state_dirty(vbe);
+    break;
+  case effSetProgramName:
+    vst_bridge_state_dirty(vbe);
+    vbe->own_programs  = true;
+    break;
+  case effSetChunk:
+  case effBeginLoadBank:
+    vbe->own_programs = true;
+    break;
+  default:
+    (void)index;
+    break;
+  }
+}
+
+/* takes data, the parameters set so far are in it */
+void vst_bridge_snapshot_store(struct vst_bridge_effect *vbe,
+                               VstInt32 index,
+                               void    *data,
+                               size_t   size)
+{
+  free(vbe->state.snapshot);
+  vbe->state.snapshot       = data;
+  vbe->state.snapshot_size  = size;
+  vbe->state.snapshot_index = index;
+  vbe->state.snapshot_ns    = vst_bridge_now_ns();
+  pthread_mutex_lock(&vbe->params_lock);
+  vbe->state.dirty          = false;
+  for (int32_t i = 0; i < vbe->state.nparams; ++i)
+    vbe->state.params[i] = NAN;
+  pthread_mutex_unlock(&vbe->params_lock);
+}
+
+/* the DAW's chunk belongs to the DAW, copy it */
+void vst_bridge_snapshot_copy(struct vst_bridge_effect *vbe,
+                              VstInt32    index,
+                              const void *data,
+                              size_t      size)
+{
+  void *copy = malloc(size);
+  if (!copy)
+    return;
+  memcpy(copy, data, size);
+  vst_bridge_snapshot_store(vbe, index, copy, size);
+}
+
+/* the frames the bridge adds to the plugin's initialDelay: the pipeline's and the re-blocking's */
+VstInt32 vst_bridge_latency(const struct vst_bridge_effect *vbe)
+{
+  return vbe->pipeline.latency + vbe->reblock.frames;
+}
+
+void copy_plugin_data(struct vst_bridge_effect           *vbe,
+                      const struct vst_bridge_plugin_data *data)
+{
+  vbe->e.numPrograms  = data->numPrograms;
+  vbe->e.numParams    = data->numParams;
+  vbe->e.numInputs    = data->numInputs;
+  vbe->e.numOutputs   = data->numOutputs;
+  vbe->e.flags        = data->flags;
+  vbe->e.initialDelay = data->initialDelay + vst_bridge_latency(vbe);
+  vbe->e.uniqueID     = data->uniqueID;
+  vbe->e.version      = data->version;
+  if (!data->hasSetParameter)
     vbe->e.setParameter = NULL;
-  if (!rq->plugin_data.hasGetParameter)
+  if (!data->hasGetParameter)
     vbe->e.getParameter = NULL;
-  if (!rq->plugin_data.hasProcessReplacing)
+  if (!data->hasProcessReplacing)
     vbe->e.processReplacing = NULL;
-  if (!rq->plugin_data.hasProcessDoubleReplacing)
+  if (!data->hasProcessDoubleReplacing)
     vbe->e.processDoubleReplacing = NULL;
 }
 
-void vst_bridge_handle_audio_master(struct vst_bridge_effect *vbe,
+void vst_bridge_handle_audio_master(struct vst_bridge_effect  *vbe,
+                                    struct vst_bridge_channel *chan,
                                     struct vst_bridge_request *rq)
 {
   LOG("audio_master(%s, %d, %d, %f) <= tag %d\n",
       vst_bridge_audio_master_opcode_name[rq->amrq.opcode],
       rq->amrq.index, rq->amrq.value, rq->amrq.opt, rq->tag);
 
+  if (rq->amrq.opcode == audioMasterAutomate)
+    vst_bridge_state_param(vbe, rq->amrq.index, rq->amrq.opt);
+  // an editor's own program or chunk changes come as audioMasterUpdateDisplay
+  else if (rq->amrq.opcode == audioMasterEndEdit ||
+           rq->amrq.opcode == audioMasterUpdateDisplay)
+    vst_bridge_state_dirty(vbe);
+
+  // one way, see vst_bridge_is_notification() in the host
+  if (rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY) {
+    vbe->audio_master(&vbe->e, rq->amrq.opcode, rq->amrq.index,
+                      rq->amrq.value, NULL, rq->amrq.opt);
+    return;
+  }
+
   switch (rq->amrq.opcode) {
     // no additional data
   case audioMasterAutomate:
@@ -138,31 +864,26 @@ void vst_bridge_handle_audio_master(struct vst_bridge_effect *vbe,
   case __audioMasterTempoAtDeprecated:
     rq->amrq.value = vbe->audio_master(&vbe->e, rq->amrq.opcode, rq->amrq.index,
                                        rq->amrq.value, rq->amrq.data, rq->amrq.opt);
-    write(vbe->socket, rq, VST_BRIDGE_AMRQ_LEN(0));
+    vst_bridge_send(vbe, chan, rq, VST_BRIDGE_AMRQ_LEN(0));
     break;
 
   case audioMasterGetProductString:
   case audioMasterGetVendorString:
     rq->amrq.value = vbe->audio_master(&vbe->e, rq->amrq.opcode, rq->amrq.index,
                                        rq->amrq.value, rq->amrq.data, rq->amrq.opt);
-    write(vbe->socket, rq, VST_BRIDGE_AMRQ_LEN(strlen((const char *)rq->amrq.data) + 1));
+    vst_bridge_send(vbe, chan, rq, VST_BRIDGE_AMRQ_LEN(strlen((const char *)rq->amrq.data) + 1));
     break;
 
   case audioMasterProcessEvents: {
-    struct vst_bridge_midi_events *mes = (struct vst_bridge_midi_events *)rq->amrq.data;
-    struct VstEvents *ves = (struct VstEvents *)malloc(sizeof (*ves) + mes->nb * sizeof (void*));
-    ves->numEvents = mes->nb;
-    ves->reserved  = 0;
-    struct vst_bridge_midi_event *me = mes->events;
-    for (size_t i = 0; i < mes->nb; ++i) {
-      ves->events[i] = (VstEvent*)me;
-      me = (struct vst_bridge_midi_event *)(me->data + me->byteSize);
-    }
+    // outside of process, see vst_bridge_process_output_events() otherwise
+    struct vst_bridge_events *bevs = (struct vst_bridge_events *)rq->amrq.data;
+    uint32_t nb = MIN(bevs->nb, VST_BRIDGE_EVENTS_MAX);
+    void *ves[sizeof (struct VstEvents) / sizeof (void *) + nb];
 
+    vst_bridge_events_unpack((struct VstEvents *)ves, bevs->data, nb);
     rq->amrq.value = vbe->audio_master(&vbe->e, rq->amrq.opcode, rq->amrq.index,
                                        rq->amrq.value, ves, rq->amrq.opt);
-    free(ves);
-    write(vbe->socket, rq, ((uint8_t*)me) - ((uint8_t*)rq));
+    vst_bridge_send(vbe, chan, rq, VST_BRIDGE_AMRQ_LEN(0));
     break;
   }
 
@@ -176,7 +897,7 @@ void vst_bridge_handle_audio_master(struct vst_bridge_effect *vbe,
       rq->amrq.value = 1;
       memcpy(rq->amrq.data, time_info, sizeof (*time_info));
     }
-    write(vbe->socket, rq, VST_BRIDGE_AMRQ_LEN(sizeof (*time_info)));
+    vst_bridge_send(vbe, chan, rq, VST_BRIDGE_AMRQ_LEN(sizeof (*time_info)));
     break;
   }
 
@@ -188,27 +909,88 @@ void vst_bridge_handle_audio_master(struct vst_bridge_effect *vbe,
   }
 }
 
-bool vst_bridge_wait_response(struct vst_bridge_effect *vbe,
-                              struct vst_bridge_request *rq,
-                              uint32_t tag)
+/* the host's batched audioMasterAutomate, no reply */
+void vst_bridge_handle_automate(struct vst_bridge_effect  *vbe,
+                                struct vst_bridge_request *rq)
+{
+  uint32_t nb = MIN(rq->automate.nb, VST_BRIDGE_AUTOMATE_MAX);
+
+  for (uint32_t i = 0; i < nb; ++i) {
+    const struct vst_bridge_effect_parameter *param = rq->automate.params + i;
+    LOG("automate(%d, %f)\n", param->index, param->value);
+    vst_bridge_state_param(vbe, param->index, param->value);
+    vbe->audio_master(&vbe->e, audioMasterAutomate, param->index, 0, NULL, param->value);
+  }
+}
+
+/* a request from the host rather than a reply */
+void vst_bridge_handle_callback(struct vst_bridge_effect  *vbe,
+                                struct vst_bridge_channel *chan,
+                                struct vst_bridge_request *rq)
+{
+  ++t_callbacks;
+  if (rq->cmd == VST_BRIDGE_CMD_AUTOMATE)
+    vst_bridge_handle_automate(vbe, rq);
+  else
+    vst_bridge_handle_audio_master(vbe, chan, rq);
+  --t_callbacks;
+}
+
+/*
+ * Waits for the reply to tag, serving the host's requests meanwhile. With
+ * a deadline (CLOCK_MONOTONIC, in ns), gives up past it with errno set to
+ * ETIMEDOUT.
+ */
+bool vst_bridge_wait_reader(struct vst_bridge_effect  *vbe,
+                            struct vst_bridge_request *rq,
+                            uint32_t                   tag);
+
+/* waits for the reply to tag; with out, see vst_bridge_recv() */
+bool vst_bridge_wait_scatter(struct vst_bridge_effect        *vbe,
+                             struct vst_bridge_channel       *chan,
+                             struct vst_bridge_request       *rq,
+                             uint32_t                         tag,
+                             uint64_t                         deadline,
+                             const struct vst_bridge_scatter *out)
 {
   ssize_t len;
 
+  if (chan == &vbe->ctl && vbe->has_reader)
+    return vst_bridge_wait_reader(vbe, rq, tag);
+  if (out && VST_BRIDGE_FRAMES_LEN(0) + out->nb * out->len > sizeof (*rq))
+    out = NULL;
+
   while (true) {
     std::list<vst_bridge_request>::iterator it;
-    for (it = vbe->pending.begin(); it != vbe->pending.end(); ++it) {
+    for (it = chan->pending.begin(); it != chan->pending.end(); ++it) {
       if (it->tag != tag)
         continue;
       *rq = *it; // XXX could be optimized?
-      vbe->pending.erase(it);
+      chan->pending.erase(it);
+      for (int i = 0; out && i < out->nb; ++i)
+        memcpy(out->buffers[i], (uint8_t *)rq + VST_BRIDGE_FRAMES_LEN(0) + i * out->len,
+               out->len);
       return true;
     }
 
     LOG("     <=== Waiting for tag %d\n", tag);
 
-    len = ::read(vbe->socket, rq, sizeof (*rq));
-    if (len <= 0)
+    if (deadline) {
+      uint64_t now = vst_bridge_now_ns();
+      struct pollfd pfd = { chan->socket, POLLIN, 0 };
+      if (now >= deadline ||
+          poll(&pfd, 1, (deadline - now + 999999) / 1000000) == 0) {
+        errno = ETIMEDOUT;
+        return false;
+      }
+    }
+
+    len = vst_bridge_recv(chan, rq, tag, out);
+    if (len <= 0) {
+      vst_bridge_host_died(vbe);
+      errno = EPIPE;
       return false;
+    }
     assert(len >= VST_BRIDGE_RQ_LEN);
 
     LOG("     ===> Got tag %d\n", rq->tag);
@@ -217,122 +999,1548 @@ bool vst_bridge_wait_response(struct vst_bridge_effect *vbe,
       return true;
 
     // handle request
-    if (rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK) {
-      vst_bridge_handle_audio_master(vbe, rq);
+    if (rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK ||
+        rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY ||
+        rq->cmd == VST_BRIDGE_CMD_AUTOMATE) {
+      vst_bridge_handle_callback(vbe, chan, rq);
       continue;
     } else if (rq->cmd == VST_BRIDGE_CMD_PLUGIN_DATA) {
-      copy_plugin_data(vbe, rq);
+      copy_plugin_data(vbe, &rq->plugin_data);
       continue;
     }
 
-    vbe->pending.push_back(*rq);
+    std::list<uint32_t>::iterator late;
+    for (late = chan->late_tags.begin(); late != chan->late_tags.end(); ++late)
+      if (*late == rq->tag)
+        break;
+    if (late != chan->late_tags.end()) {
+      chan->late_tags.erase(late);
+      ++vbe->stats.late_replies;
+      continue;
+    }
+
+    chan->pending.push_back(*rq);
+  }
+}
+
+bool vst_bridge_wait_response_until(struct vst_bridge_effect  *vbe,
+                                    struct vst_bridge_channel *chan,
+                                    struct vst_bridge_request *rq,
+                                    uint32_t tag,
+                                    uint64_t deadline)
+{
+  return vst_bridge_wait_scatter(vbe, chan, rq, tag, deadline, NULL);
+}
+
+bool vst_bridge_wait_response(struct vst_bridge_effect *vbe,
+                              struct vst_bridge_request *rq,
+                              uint32_t tag)
+{
+  return vst_bridge_wait_response_until(vbe, &vbe->ctl, rq, tag, 0);
+}
+
+/*
+ * Waits for the setup calls sent so far, as the waiter of the last one:
+ * their callbacks come to this thread meanwhile, rather than to the
+ * callback thread while this one, and maybe the DAW, is stuck.
+ */
+void vst_bridge_async_drain(struct vst_bridge_effect *vbe)
+{
+  struct vst_bridge_request rq;
+  uint32_t tag;
+
+  if (t_callbacks)
+    return;
+  pthread_mutex_lock(&vbe->reader_lock);
+  if (vbe->ctl.async_tags.empty()) {
+    pthread_mutex_unlock(&vbe->reader_lock);
+    return;
+  }
+  tag = vbe->ctl.async_tags.back();
+  vbe->ctl.async_tags.pop_back();
+  pthread_mutex_unlock(&vbe->reader_lock);
+  vst_bridge_wait_response(vbe, &rq, tag);
+}
+
+/*
+ * Sends a message nobody waits for on the control channel; if the host is
+ * too busy with the setup calls to take it, drains them first.
+ */
+ssize_t vst_bridge_send_async(struct vst_bridge_effect *vbe,
+                              const void               *rq,
+                              size_t                    len)
+{
+  ssize_t ret = vst_bridge_send2(vbe, &vbe->ctl, rq, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (ret < 0 && errno == EAGAIN) {
+    vst_bridge_async_drain(vbe);
+    return vst_bridge_send(vbe, &vbe->ctl, rq, len);
+  }
+  return ret;
+}
+
+/* the reply to tag, sent already, goes to no one */
+void vst_bridge_async_forget(struct vst_bridge_effect *vbe, uint32_t tag)
+{
+  pthread_mutex_lock(&vbe->reader_lock);
+  std::list<vst_bridge_request>::iterator it;
+  for (it = vbe->ctl.pending.begin(); it != vbe->ctl.pending.end(); ++it) {
+    if (it->tag != tag)
+      continue;
+    vbe->ctl.pending.erase(it);
+    pthread_mutex_unlock(&vbe->reader_lock);
+    return;
+  }
+  vbe->ctl.async_tags.push_back(tag);
+  pthread_mutex_unlock(&vbe->reader_lock);
+}
+
+/*
+ * Waits for the reader to hand over the reply to tag. The callbacks the
+ * host makes meanwhile belong to our request (the host serves one at a
+ * time), so they are served here, by the DAW's thread, as before.
+ */
+bool vst_bridge_wait_reader(struct vst_bridge_effect  *vbe,
+                            struct vst_bridge_request *rq,
+                            uint32_t                   tag)
+{
+  struct vst_bridge_waiter waiter = { tag, rq, false, false };
+
+  pthread_mutex_lock(&vbe->reader_lock);
+  std::list<vst_bridge_request>::iterator it;
+  for (it = vbe->ctl.pending.begin(); it != vbe->ctl.pending.end(); ++it) {
+    if (it->tag != tag)
+      continue;
+    *rq = *it;
+    vbe->ctl.pending.erase(it);
+    pthread_mutex_unlock(&vbe->reader_lock);
+    return true;
+  }
+
+  LOG("     <=== Waiting for tag %d\n", tag);
+  vbe->waiters.push_back(&waiter);
+  while (true) {
+    while (!waiter.ready && !vbe->reader_broken)
+      pthread_cond_wait(&vbe->reader_cond, &vbe->reader_lock);
+    if (!waiter.ready)
+      break;
+
+    if (waiter.reply) {
+      waiter.ready = false;
+      vbe->waiters.remove(&waiter);
+      pthread_cond_broadcast(&vbe->reader_cond);
+      pthread_mutex_unlock(&vbe->reader_lock);
+      return true;
+    }
+
+    // rq is ours until ready is cleared: the host may send the next
+    // callback (e.g. automation, which has no reply) before we are done
+    pthread_mutex_unlock(&vbe->reader_lock);
+    vst_bridge_handle_callback(vbe, &vbe->ctl, rq);
+    pthread_mutex_lock(&vbe->reader_lock);
+    waiter.ready = false;
+    pthread_cond_broadcast(&vbe->reader_cond);
+  }
+  vbe->waiters.remove(&waiter);
+  pthread_mutex_unlock(&vbe->reader_lock);
+  errno = EPIPE;
+  return false;
+}
+
+/* called with the reader lock held, hands rq over to a waiting thread */
+void vst_bridge_reader_deliver(struct vst_bridge_effect  *vbe,
+                               struct vst_bridge_waiter  *waiter,
+                               struct vst_bridge_request *rq,
+                               size_t                     len,
+                               bool                       reply)
+{
+  memcpy(waiter->rq, rq, len);
+  waiter->ready = true;
+  waiter->reply = reply;
+  pthread_cond_broadcast(&vbe->reader_cond);
+}
+
+/* called with the reader lock held, the thread rq goes to if any */
+struct vst_bridge_waiter *vst_bridge_reader_target(struct vst_bridge_effect  *vbe,
+                                                   struct vst_bridge_request *rq,
+                                                   bool                       callback)
+{
+  // the innermost request is the one the host is serving
+  if (callback)
+    return vbe->waiters.empty() ? NULL : vbe->waiters.back();
+
+  std::list<vst_bridge_waiter *>::iterator it;
+  for (it = vbe->waiters.begin(); it != vbe->waiters.end(); ++it)
+    if ((*it)->tag == rq->tag)
+      return *it;
+  return NULL;
+}
+
+/* called with the reader lock held */
+void vst_bridge_reader_route(struct vst_bridge_effect  *vbe,
+                             struct vst_bridge_request *rq,
+                             size_t                     len)
+{
+  LOG("     ===> Got tag %d\n", rq->tag);
+
+  if (rq->cmd == VST_BRIDGE_CMD_PLUGIN_DATA) {
+    copy_plugin_data(vbe, &rq->plugin_data);
+    return;
+  }
+
+  // the one way callbacks all go to the callback thread, in order
+  bool one_way = rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY ||
+    rq->cmd == VST_BRIDGE_CMD_AUTOMATE;
+  bool callback = one_way || rq->cmd == VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK;
+  struct vst_bridge_waiter *waiter;
+  while (!one_way && (waiter = vst_bridge_reader_target(vbe, rq, callback))) {
+    if (!waiter->ready) {
+      vst_bridge_reader_deliver(vbe, waiter, rq, len, !callback);
+      return;
+    }
+    // still busy with the previous one, and may be gone once done
+    pthread_cond_wait(&vbe->reader_cond, &vbe->reader_lock);
+  }
+
+  if (callback) {
+    struct vst_bridge_callback cb = { malloc(len), len };
+    if (!cb.data)
+      return;
+    memcpy(cb.data, rq, len);
+    vbe->callbacks.push_back(cb);
+    pthread_cond_signal(&vbe->callback_cond);
+    return;
+  }
+
+  // a setup call's, nobody waits for it
+  std::list<uint32_t>::iterator async;
+  for (async = vbe->ctl.async_tags.begin(); async != vbe->ctl.async_tags.end(); ++async)
+    if (*async == rq->tag)
+      break;
+  if (async != vbe->ctl.async_tags.end()) {
+    vbe->ctl.async_tags.erase(async);
+    return;
+  }
+
+  // the reply came before its waiter
+  vbe->ctl.pending.push_back(*rq);
+}
+
+/*
+ * Reads the control channel: the replies go to the thread waiting for
+ * their tag, the host's callbacks to the thread whose request is in
+ * flight, or to the callback thread when there is none, so that the
+ * callbacks from the plugin's own GUI (automation, window resizing) are
+ * served right away instead of on the DAW's next call.
+ */
+void *vst_bridge_reader(void *arg)
+{
+  struct vst_bridge_effect *vbe = (struct vst_bridge_effect *)arg;
+  struct vst_bridge_request *rq = vbe->reader_rq;
+
+  pthread_mutex_lock(&vbe->reader_lock);
+  while (!vbe->reader_stop) {
+    if (vbe->reader_broken) {
+      pthread_cond_wait(&vbe->reader_cond, &vbe->reader_lock);
+      continue;
+    }
+
+    int sock = vbe->ctl.socket;
+    vbe->reader_reading = true;
+    pthread_mutex_unlock(&vbe->reader_lock);
+    ssize_t len = ::read(sock, rq, sizeof (*rq));
+    pthread_mutex_lock(&vbe->reader_lock);
+    vbe->reader_reading = false;
+
+    if (len >= VST_BRIDGE_RQ_LEN) {
+      vst_bridge_reader_route(vbe, rq, len);
+      continue;
+    }
+
+    // the host is gone, unless we're closing or replacing it
+    if (!vbe->reader_broken && !vbe->reader_stop && !vbe->close_flag)
+      vst_bridge_host_died(vbe);
+    vbe->reader_broken = true;
+    pthread_cond_broadcast(&vbe->reader_cond);
+  }
+  pthread_mutex_unlock(&vbe->reader_lock);
+  return NULL;
+}
+
+void *vst_bridge_callback_thread(void *arg)
+{
+  struct vst_bridge_effect *vbe = (struct vst_bridge_effect *)arg;
+
+  pthread_mutex_lock(&vbe->reader_lock);
+  while (!vbe->reader_stop) {
+    if (vbe->callbacks.empty()) {
+      pthread_cond_wait(&vbe->callback_cond, &vbe->reader_lock);
+      continue;
+    }
+
+    struct vst_bridge_callback cb = vbe->callbacks.front();
+    vbe->callbacks.pop_front();
+    pthread_mutex_unlock(&vbe->reader_lock);
+
+    memcpy(vbe->callback_rq, cb.data, cb.len);
+    free(cb.data);
+    vst_bridge_handle_callback(vbe, &vbe->ctl, vbe->callback_rq);
+
+    pthread_mutex_lock(&vbe->reader_lock);
+  }
+  pthread_mutex_unlock(&vbe->reader_lock);
+  return NULL;
+}
+
+bool vst_bridge_reader_start(struct vst_bridge_effect *vbe)
+{
+  vbe->reader_rq   = (struct vst_bridge_request *)malloc(sizeof (*vbe->reader_rq));
+  vbe->callback_rq = (struct vst_bridge_request *)malloc(sizeof (*vbe->callback_rq));
+  if (!vbe->reader_rq || !vbe->callback_rq)
+    return false;
+
+  if (pthread_create(&vbe->callback_thread, NULL, vst_bridge_callback_thread, vbe))
+    return false;
+  vbe->has_callback_thread = true;
+  if (pthread_create(&vbe->reader, NULL, vst_bridge_reader, vbe))
+    return false;
+  vbe->has_reader = true;
+  return true;
+}
+
+/* parks the reader and takes the old socket away from it */
+void vst_bridge_reader_suspend(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&vbe->reader_lock);
+  vbe->reader_broken = true;
+  shutdown(vbe->ctl.socket, SHUT_RDWR);
+  pthread_cond_broadcast(&vbe->reader_cond);
+  while (vbe->reader_reading)
+    pthread_cond_wait(&vbe->reader_cond, &vbe->reader_lock);
+  vbe->ctl.pending.clear();
+  pthread_mutex_unlock(&vbe->reader_lock);
+}
+
+void vst_bridge_reader_resume(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&vbe->reader_lock);
+  vbe->reader_broken = false;
+  pthread_cond_broadcast(&vbe->reader_cond);
+  pthread_mutex_unlock(&vbe->reader_lock);
+}
+
+/* the process deadline for this block, 0 if none */
+uint64_t vst_bridge_process_deadline(struct vst_bridge_effect *vbe,
+                                     VstInt32 frames)
+{
+  int64_t us = g_config.deadline_us;
+
+  // the host answers the plugin with it, see vst_bridge_process_level_sync()
+  vbe->process_level = vbe->audio_master(&vbe->e, audioMasterGetCurrentProcessLevel,
+                                         0, 0, NULL, 0);
+  if (us == 0)
+    return 0;
+  // no deadline when rendering offline, the DAW waits for us
+  if (vbe->process_level == kVstProcessLevelOffline)
+    return 0;
+  if (us < 0) {
+    if (vbe->sample_rate <= 0)
+      return 0;
+    us = 2000000LL * frames / vbe->sample_rate;
+  }
+  return vst_bridge_now_ns() + us * 1000;
+}
+
+bool vst_bridge_process_lock(struct vst_bridge_effect *vbe, uint64_t deadline)
+{
+  if (!deadline) {
+    pthread_mutex_lock(&vbe->audio_lock);
+    return true;
+  }
+
+  // another thread may hold the lock while the host is stuck
+  struct timespec ts;
+  uint64_t now = vst_bridge_now_ns();
+  uint64_t timeout = deadline > now ? deadline - now : 0;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  timeout += ts.tv_nsec;
+  ts.tv_sec  += timeout / 1000000000ULL;
+  ts.tv_nsec  = timeout % 1000000000ULL;
+  if (pthread_mutex_timedlock(&vbe->audio_lock, &ts) == 0)
+    return true;
+
+  ++vbe->stats.lock_timeouts;
+  CRIT("process: the bridge is busy past the deadline\n");
+  return false;
+}
+
+/*
+ * Waits for the replies which missed their deadline, the host processes
+ * requests in order. Until they are all there, the blocks are replaced by
+ * the fallback, so that the requests don't pile up in a stuck host.
+ */
+bool vst_bridge_process_resync(struct vst_bridge_effect  *vbe,
+                               struct vst_bridge_request *rq,
+                               uint64_t                   deadline)
+{
+  while (!vbe->audio.late_tags.empty()) {
+    uint32_t tag = vbe->audio.late_tags.front();
+    if (!vst_bridge_wait_response_until(vbe, &vbe->audio, rq, tag, deadline)) {
+      ++vbe->stats.resync_blocks;
+      return false;
+    }
+    vbe->audio.late_tags.pop_front();
+    ++vbe->stats.late_replies;
+  }
+  return true;
+}
+
+void vst_bridge_process_missed(struct vst_bridge_effect *vbe,
+                               uint32_t tag,
+                               VstInt32 frames)
+{
+  // the host is gone, there is nothing to wait for
+  if (errno != ETIMEDOUT)
+    return;
+
+  vbe->audio.late_tags.push_back(tag);
+  ++vbe->stats.deadline_misses;
+  CRIT("process: deadline missed (%d frames), the reply %u will be discarded\n",
+       frames, tag);
+}
+
+/* silence, or the previous block; last_output is only safe to read locked */
+void vst_bridge_process_fallback(struct vst_bridge_effect *vbe,
+                                 void    **outputs,
+                                 size_t    sample_size,
+                                 VstInt32  frames,
+                                 bool      locked)
+{
+  bool previous = locked && g_config.fallback_previous &&
+    vbe->last_frames == frames && vbe->last_sample_size == sample_size;
+  size_t len = frames * sample_size;
+
+  for (int i = 0; i < vbe->e.numOutputs; ++i) {
+    if (previous)
+      memcpy(outputs[i], vbe->last_output + i * len, len);
+    else
+      memset(outputs[i], 0, len);
+  }
+}
+
+void vst_bridge_process_save(struct vst_bridge_effect *vbe,
+                             void    **outputs,
+                             size_t    sample_size,
+                             VstInt32  frames)
+{
+  size_t len = frames * sample_size;
+
+  vbe->last_frames = 0;
+  if (!g_config.fallback_previous || vbe->e.numOutputs * len > vbe->last_capacity)
+    return;
+  for (int i = 0; i < vbe->e.numOutputs; ++i)
+    memcpy(vbe->last_output + i * len, outputs[i], len);
+  vbe->last_frames      = frames;
+  vbe->last_sample_size = sample_size;
+}
+
+/* called with the lock held, out of the audio thread */
+void vst_bridge_process_resize(struct vst_bridge_effect *vbe, VstInt32 frames)
+{
+  size_t capacity = vbe->e.numOutputs * frames * sizeof (double);
+
+  if (!g_config.fallback_previous || capacity <= vbe->last_capacity)
+    return;
+  pthread_mutex_lock(&vbe->audio_lock);
+  uint8_t *last_output = (uint8_t *)realloc(vbe->last_output, capacity);
+  if (last_output) {
+    vbe->last_output   = last_output;
+    vbe->last_capacity = capacity;
+    vbe->last_frames   = 0;
+    vst_bridge_rt_lock_memory(last_output, capacity);
   }
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+/* called with the audio lock held, from process */
+void vst_bridge_audio_thread_set(struct vst_bridge_effect *vbe)
+{
+  pthread_t self = pthread_self();
+
+  if (vbe->has_audio_thread && pthread_equal(self, vbe->audio_thread))
+    return;
+  vbe->audio_thread     = self;
+  vbe->has_audio_thread = true;
+}
+
+/* the parameter calls made by the audio thread go through the audio channel */
+bool vst_bridge_is_audio_thread(struct vst_bridge_effect *vbe)
+{
+  return vbe->has_audio_thread && pthread_equal(pthread_self(), vbe->audio_thread);
+}
+
+/*
+ * Tells the host the scheduling of the thread calling process, so that
+ * it serves it at the same priority. Checked from time to time, and when
+ * the DAW switches threads.
+ */
+void vst_bridge_rt_sync(struct vst_bridge_effect *vbe)
+{
+  pthread_t self = pthread_self();
+
+  if (!g_config.rt)
+    return;
+  if (vbe->rt_blocks++ % 256 != 0 && pthread_equal(self, vbe->rt_thread))
+    return;
+  vbe->rt_thread = self;
+
+  struct sched_param param;
+  int policy;
+  if (pthread_getschedparam(self, &policy, &param))
+    return;
+  if (policy == vbe->rt_policy && param.sched_priority == vbe->rt_priority)
+    return;
+  vbe->rt_policy   = policy;
+  vbe->rt_priority = param.sched_priority;
+
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  rq.tag                 = vbe->audio.next_tag;
+  rq.cmd                 = VST_BRIDGE_CMD_SET_SCHEDULING;
+  rq.scheduling.policy   = policy;
+  rq.scheduling.priority = param.sched_priority;
+  vbe->audio.next_tag   += 2;
+  vst_bridge_send(vbe, &vbe->audio, &rq, VST_BRIDGE_SCHEDULING_LEN);
+}
+
+/* called with the audio lock held, before the process request */
+void vst_bridge_process_level_sync(struct vst_bridge_effect *vbe)
+{
+  if (vbe->process_level == vbe->host_process_level)
+    return;
+  vbe->host_process_level = vbe->process_level;
+
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  rq.tag                 = vbe->audio.next_tag;
+  rq.cmd                 = VST_BRIDGE_CMD_PROCESS_LEVEL;
+  rq.process_level.level = vbe->process_level;
+  vbe->audio.next_tag   += 2;
+  vst_bridge_send(vbe, &vbe->audio, &rq, VST_BRIDGE_PROCESS_LEVEL_LEN);
 }
 
 void vst_bridge_show_window(struct vst_bridge_effect *vbe)
 {
   struct vst_bridge_request rq;
   if (vbe->show_window) {
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_SHOW_WINDOW;
-    vbe->next_tag += 2;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_SHOW_WINDOW;
+    vbe->ctl.next_tag += 2;
 
     vbe->show_window = false;
-    write(vbe->socket, &rq, VST_BRIDGE_RQ_LEN);
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_RQ_LEN);
     vst_bridge_wait_response(vbe, &rq, rq.tag);
   }
 }
 
-void vst_bridge_call_process(AEffect* effect,
-                             float**  inputs,
-                             float**  outputs,
-                             VstInt32 sampleFrames)
+/*
+ * Takes the events the plugin sent during process, which the host returns
+ * after the frames, for the DAW; delivered once the audio lock is released
+ * as the DAW may call us back.
+ */
+bool vst_bridge_process_output_events(struct vst_bridge_effect  *vbe,
+                                      struct vst_bridge_request *rq,
+                                      size_t                     len)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
-  struct vst_bridge_request rq;
+  size_t off = VST_BRIDGE_EVENTS_AFTER(len);
+  if (off + sizeof (struct vst_bridge_events) > sizeof (*rq))
+    return false;
 
-  pthread_mutex_lock(&vbe->lock);
+  struct vst_bridge_events *bevs = (struct vst_bridge_events *)((uint8_t *)rq + off);
+  uint32_t nb = MIN(bevs->nb, VST_BRIDGE_EVENTS_MAX);
+  if (!nb)
+    return false;
 
-  rq.tag             = vbe->next_tag;
-  rq.cmd             = VST_BRIDGE_CMD_PROCESS;
-  rq.frames.nframes  = sampleFrames;
-  vbe->next_tag     += 2;
+  size_t size = 0;
+  for (uint32_t i = 0; i < nb; ++i)
+    size += ((struct vst_bridge_event *)(bevs->data + size))->size;
+  memcpy(vbe->out_events, bevs->data, size);
+  vst_bridge_events_unpack(vbe->out_ves, vbe->out_events, nb);
+  return true;
+}
 
-  for (int i = 0; i < vbe->e.numInputs; ++i)
-    memcpy(rq.frames.frames + i * sampleFrames, inputs[i],
-           sizeof (float) * sampleFrames);
+/* the ring empty but for latency frames of silence, and nothing in flight */
+void vst_bridge_pipeline_clear(struct vst_bridge_pipeline *pl, size_t sample_size)
+{
+  pl->first        = 0;
+  pl->nb           = 0;
+  pl->inflight_len = 0;
+  pl->offline      = false;
+  pl->sample_size  = sample_size;
+  pl->head         = 0;
+  pl->count        = pl->latency;
+  memset(pl->fifo, 0, pl->outputs * pl->capacity * sizeof (double));
+}
+
+/* appends frames to the ring, src holding one pointer per output */
+void vst_bridge_pipeline_push(struct vst_bridge_pipeline *pl,
+                              void    **src,
+                              VstInt32  frames)
+{
+  size_t ss = pl->sample_size;
+  VstInt32 tail = (pl->head + pl->count) % pl->capacity;
+  VstInt32 part = MIN(frames, pl->capacity - tail);
+
+  for (int i = 0; i < pl->outputs; ++i) {
+    uint8_t *ring = pl->fifo + i * pl->capacity * ss;
+    memcpy(ring + tail * ss, src[i], part * ss);
+    memcpy(ring, (uint8_t *)src[i] + part * ss, (frames - part) * ss);
+  }
+  pl->count += frames;
+}
+
+void vst_bridge_pipeline_pop(struct vst_bridge_pipeline *pl,
+                             void    **dst,
+                             VstInt32  frames)
+{
+  size_t ss = pl->sample_size;
+  VstInt32 part = MIN(frames, pl->capacity - pl->head);
+
+  for (int i = 0; i < pl->outputs; ++i) {
+    uint8_t *ring = pl->fifo + i * pl->capacity * ss;
+    memcpy(dst[i], ring + pl->head * ss, part * ss);
+    memcpy((uint8_t *)dst[i] + part * ss, ring, (frames - part) * ss);
+  }
+  pl->head   = (pl->head + frames) % pl->capacity;
+  pl->count -= frames;
+}
+
+/* hands the events of a reply to the DAW, which may call us back */
+void vst_bridge_pipeline_deliver(struct vst_bridge_effect *vbe, bool *has_events)
+{
+  if (!has_events || !*has_events)
+    return;
+  *has_events = false;
+  pthread_mutex_unlock(&vbe->audio_lock);
+  vbe->audio_master(&vbe->e, audioMasterProcessEvents, 0, 0, vbe->out_ves, 0);
+  pthread_mutex_lock(&vbe->audio_lock);
+}
+
+/*
+ * Waits for the oldest request in flight; a block's frames go to the
+ * ring, and its events to the DAW unless has_events is NULL.
+ */
+bool vst_bridge_pipeline_collect(struct vst_bridge_effect *vbe, bool *has_events)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+  struct vst_bridge_request *rq = vbe->process_rq;
+
+  vst_bridge_pipeline_deliver(vbe, has_events);
+
+  struct vst_bridge_inflight in = pl->inflight[pl->first];
+  if (!vst_bridge_wait_response_until(vbe, &vbe->audio, rq, in.tag, 0)) {
+    vst_bridge_pipeline_clear(pl, pl->sample_size);
+    return false;
+  }
+  pl->first         = (pl->first + 1) % VST_BRIDGE_PIPELINE_MAX;
+  pl->nb           -= 1;
+  pl->inflight_len -= in.len;
+  if (!in.frames)
+    return true;
+
+  void *src[pl->outputs];
+  for (int i = 0; i < pl->outputs; ++i)
+    src[i] = (uint8_t *)rq->frames.frames + i * in.frames * pl->sample_size;
+  vst_bridge_pipeline_push(pl, src, in.frames);
+  if (has_events)
+    *has_events = vst_bridge_process_output_events(vbe, rq, in.len);
+  return true;
+}
+
+/* waits until a request whose reply is len bytes can be sent */
+bool vst_bridge_pipeline_room(struct vst_bridge_effect *vbe,
+                              size_t                    len,
+                              bool                     *has_events)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+
+  while (pl->nb == VST_BRIDGE_PIPELINE_MAX ||
+         (pl->nb > 0 && pl->inflight_len + len > VST_BRIDGE_PIPELINE_BYTES))
+    if (!vst_bridge_pipeline_collect(vbe, has_events))
+      return false;
+  return true;
+}
+
+void vst_bridge_pipeline_sent(struct vst_bridge_pipeline *pl,
+                              uint32_t tag,
+                              VstInt32 frames,
+                              size_t   len)
+{
+  struct vst_bridge_inflight *in =
+    &pl->inflight[(pl->first + pl->nb) % VST_BRIDGE_PIPELINE_MAX];
+
+  in->tag            = tag;
+  in->frames         = frames;
+  in->len            = len;
+  pl->nb            += 1;
+  pl->inflight_len  += len;
+}
+
+bool vst_bridge_pipeline_drain(struct vst_bridge_effect *vbe, bool *has_events)
+{
+  while (vbe->pipeline.nb > 0)
+    if (!vst_bridge_pipeline_collect(vbe, has_events))
+      return false;
+  return true;
+}
+
+/*
+ * Before the calls the plugin can't take while it processes, as the DAW
+ * thinks it's done: the blocks in flight are dropped with the delay line.
+ */
+void vst_bridge_pipeline_flush(struct vst_bridge_effect *vbe)
+{
+  if (!vbe->pipeline.fifo)
+    return;
+  pthread_mutex_lock(&vbe->audio_lock);
+  vst_bridge_pipeline_drain(vbe, NULL);
+  vst_bridge_pipeline_clear(&vbe->pipeline, vbe->pipeline.sample_size);
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+/*
+ * Sizes the delay line for blocks of frames, called with the lock held,
+ * out of the audio thread; true if the latency changed.
+ */
+bool vst_bridge_pipeline_resize(struct vst_bridge_effect *vbe, VstInt32 frames)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+  VstInt32 capacity = (g_config.offline_pipeline + 1) * frames;
+  size_t size = vbe->e.numOutputs * capacity * sizeof (double);
+  VstInt32 latency = pl->latency;
+
+  if (!g_config.offline_pipeline || frames <= 0)
+    return false;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  vst_bridge_pipeline_drain(vbe, NULL);
+  uint8_t *fifo = (uint8_t *)realloc(pl->fifo, size ? size : 1);
+  if (fifo) {
+    pl->fifo     = fifo;
+    pl->capacity = capacity;
+    pl->outputs  = vbe->e.numOutputs;
+    pl->latency  = g_config.offline_pipeline * frames;
+    vst_bridge_rt_lock_memory(fifo, size);
+    vst_bridge_pipeline_clear(pl, sizeof (float));
+    vbe->e.initialDelay += pl->latency - latency;
+  } else {
+    CRIT("failed to allocate the offline pipeline: %m\n");
+  }
+  pthread_mutex_unlock(&vbe->audio_lock);
+  return pl->latency != latency;
+}
+
+/* the block fits in the ring; called with the audio lock held */
+bool vst_bridge_pipeline_fits(struct vst_bridge_effect *vbe,
+                              size_t                    sample_size,
+                              VstInt32                  frames)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+
+  // the DAW went past its block size, or the plugin changed its I/O
+  if (vbe->e.numOutputs != pl->outputs || pl->latency + frames > pl->capacity)
+    return false;
+  if (pl->sample_size != sample_size) {
+    vst_bridge_pipeline_drain(vbe, NULL);
+    vst_bridge_pipeline_clear(pl, sample_size);
+  }
+  return true;
+}
+
+/*
+ * Gets the DAW's time for the process request, whose inputs take len
+ * bytes, see VST_BRIDGE_FRAMES_TIME_INFO: it goes in place of the frames,
+ * for vst_bridge_send_frames() to append; returns its size. If it doesn't
+ * fit, the plugin's audioMasterGetTime goes to the DAW.
+ */
+size_t vst_bridge_pipeline_time_info(struct vst_bridge_effect *vbe, size_t len)
+{
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  struct vst_bridge_time_info *ti = (struct vst_bridge_time_info *)rq.frames.frames;
+  size_t size = sizeof (*ti) + sizeof (VstTimeInfo);
+
+  if (len + size > sizeof (rq))
+    return 0;
+
+  const VstTimeInfo *info = (const VstTimeInfo *)vbe->audio_master(
+    &vbe->e, audioMasterGetTime, 0,
+    kVstNanosValid | kVstPpqPosValid | kVstTempoValid | kVstBarsValid |
+    kVstCyclePosValid | kVstTimeSigValid | kVstSmpteValid | kVstClockValid, NULL, 0);
+  ti->valid = info != NULL;
+  if (info)
+    memcpy(ti->info, info, sizeof (*info));
+  rq.frames.flags |= VST_BRIDGE_FRAMES_TIME_INFO;
+  return size;
+}
+
+/*
+ * process while the DAW renders offline: sends the block, then waits only
+ * until the ring holds enough frames for the DAW, that is for the block
+ * sent latency frames ago. false if the DAW renders in real time, the
+ * blocks still in flight having gone to the ring, for the caller to go
+ * through vst_bridge_pipeline_delay().
+ */
+bool vst_bridge_pipeline_process(struct vst_bridge_effect *vbe,
+                                 void    **inputs,
+                                 void    **outputs,
+                                 size_t    sample_size,
+                                 VstInt32  frames)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+  bool has_events = false;
+  bool doubles = sample_size == sizeof (double);
+  size_t len;
+
+  bool offline = vbe->audio_master(&vbe->e, audioMasterGetCurrentProcessLevel,
+                                   0, 0, NULL, 0) == kVstProcessLevelOffline;
+  if ((!offline && !pl->offline) || vbe->dead)
+    return false;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  if (!offline || !vst_bridge_pipeline_fits(vbe, sample_size, frames)) {
+    vst_bridge_pipeline_drain(vbe, &has_events);
+    pl->offline = false;
+    pthread_mutex_unlock(&vbe->audio_lock);
+    if (has_events)
+      vbe->audio_master(&vbe->e, audioMasterProcessEvents, 0, 0, vbe->out_ves, 0);
+    return false;
+  }
+  ++vbe->stats.process_calls;
+  vst_bridge_audio_thread_set(vbe);
+  vbe->process_level = kVstProcessLevelOffline;
+  pl->offline        = true;
+
+  len = doubles ? VST_BRIDGE_FRAMES_DOUBLE_LEN(vbe->e.numOutputs * frames) :
+    VST_BRIDGE_FRAMES_LEN(vbe->e.numOutputs * frames);
+  if (!vst_bridge_process_resync(vbe, &rq, 0) ||
+      !vst_bridge_pipeline_room(vbe, len, &has_events))
+    goto failed;
+  vst_bridge_process_level_sync(vbe);
+
+  rq.tag               = vbe->audio.next_tag;
+  rq.cmd               = doubles ? VST_BRIDGE_CMD_PROCESS_DOUBLE : VST_BRIDGE_CMD_PROCESS;
+  rq.frames.nframes    = frames;
+  rq.frames.flags      = 0;
+  vbe->audio.next_tag += 2;
+
+  {
+    struct vst_bridge_scatter in = { inputs, vbe->e.numInputs, frames * sample_size };
+    size_t size = vst_bridge_pipeline_time_info(
+      vbe, VST_BRIDGE_FRAMES_LEN(0) + in.nb * in.len);
+    vst_bridge_send_frames(vbe, &vbe->audio, &rq, &in, rq.frames.frames, size);
+  }
+  vst_bridge_pipeline_sent(pl, rq.tag, frames, len);
+
+  while (pl->count < frames)
+    if (!vst_bridge_pipeline_collect(vbe, &has_events))
+      goto failed;
+  vst_bridge_pipeline_pop(pl, outputs, frames);
+
+  pthread_mutex_unlock(&vbe->audio_lock);
+
+  if (has_events)
+    vbe->audio_master(&vbe->e, audioMasterProcessEvents, 0, 0, vbe->out_ves, 0);
+
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, doubles ? VST_BRIDGE_CAPTURE_PROCESS_DOUBLE :
+                            VST_BRIDGE_CAPTURE_PROCESS, 0, 0, frames, NULL, 0, start);
+  return true;
+
+failed:
+  // the host is gone
+  vst_bridge_process_fallback(vbe, outputs, sample_size, frames, true);
+  pthread_mutex_unlock(&vbe->audio_lock);
+  return true;
+}
+
+/* the real-time replies, through the delay line */
+void vst_bridge_pipeline_delay(struct vst_bridge_effect *vbe,
+                               void    **outputs,
+                               size_t    sample_size,
+                               VstInt32  frames)
+{
+  struct vst_bridge_pipeline *pl = &vbe->pipeline;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  if (vst_bridge_pipeline_fits(vbe, sample_size, frames)) {
+    vst_bridge_pipeline_push(pl, outputs, frames);
+    vst_bridge_pipeline_pop(pl, outputs, frames);
+  }
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+void vst_bridge_call_process2(AEffect* effect,
+                              float**  inputs,
+                              float**  outputs,
+                              VstInt32 sampleFrames)
+{
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+  uint64_t deadline;
+  uint32_t tag;
+
+  if (vbe->dead) {
+    ++vbe->stats.recovery_blocks;
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (float), sampleFrames, false);
+    return;
+  }
+
+  deadline = vst_bridge_process_deadline(vbe, sampleFrames);
+  if (!vst_bridge_process_lock(vbe, deadline)) {
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (float), sampleFrames, false);
+    return;
+  }
+  ++vbe->stats.process_calls;
+  vst_bridge_audio_thread_set(vbe);
+
+  if (!vst_bridge_process_resync(vbe, &rq, deadline)) {
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (float), sampleFrames, true);
+    pthread_mutex_unlock(&vbe->audio_lock);
+    return;
+  }
+  vst_bridge_rt_sync(vbe);
+  vst_bridge_process_level_sync(vbe);
+
+  rq.tag               = vbe->audio.next_tag;
+  rq.cmd               = VST_BRIDGE_CMD_PROCESS;
+  rq.frames.nframes    = sampleFrames;
+  rq.frames.flags      = 0;
+  vbe->audio.next_tag += 2;
+  tag                  = rq.tag;
+
+  struct vst_bridge_scatter in  = { (void **)inputs, vbe->e.numInputs,
+                                    sizeof (float) * sampleFrames };
+  struct vst_bridge_scatter out = { (void **)outputs, vbe->e.numOutputs,
+                                    sizeof (float) * sampleFrames };
+
+  vst_bridge_send_frames(vbe, &vbe->audio, &rq, &in, NULL, 0);
+  if (!vst_bridge_wait_scatter(vbe, &vbe->audio, &rq, tag, deadline, &out)) {
+    vst_bridge_process_missed(vbe, tag, sampleFrames);
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (float), sampleFrames, true);
+    pthread_mutex_unlock(&vbe->audio_lock);
+    return;
+  }
+
+  vst_bridge_process_save(vbe, (void **)outputs, sizeof (float), sampleFrames);
+  bool has_events = vst_bridge_process_output_events(
+    vbe, &rq, VST_BRIDGE_FRAMES_LEN(vbe->e.numOutputs * sampleFrames));
+
+  pthread_mutex_unlock(&vbe->audio_lock);
+
+  if (has_events)
+    vbe->audio_master(&vbe->e, audioMasterProcessEvents, 0, 0, vbe->out_ves, 0);
+
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, VST_BRIDGE_CAPTURE_PROCESS,
+                            0, 0, sampleFrames, NULL, 0, start);
+}
+
+void vst_bridge_call_process_double2(AEffect* effect,
+                                     double**  inputs,
+                                     double**  outputs,
+                                     VstInt32 sampleFrames)
+{
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+  struct vst_bridge_request &rq = *vbe->process_rq;
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+  uint64_t deadline;
+  uint32_t tag;
+
+  if (vbe->dead) {
+    ++vbe->stats.recovery_blocks;
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (double), sampleFrames, false);
+    return;
+  }
+
+  deadline = vst_bridge_process_deadline(vbe, sampleFrames);
+  if (!vst_bridge_process_lock(vbe, deadline)) {
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (double), sampleFrames, false);
+    return;
+  }
+  ++vbe->stats.process_calls;
+  vst_bridge_audio_thread_set(vbe);
+
+  if (!vst_bridge_process_resync(vbe, &rq, deadline)) {
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (double), sampleFrames, true);
+    pthread_mutex_unlock(&vbe->audio_lock);
+    return;
+  }
+  vst_bridge_rt_sync(vbe);
+  vst_bridge_process_level_sync(vbe);
+
+  rq.tag               = vbe->audio.next_tag;
+  rq.cmd               = VST_BRIDGE_CMD_PROCESS_DOUBLE;
+  rq.framesd.nframes   = sampleFrames;
+  rq.framesd.flags     = 0;
+  vbe->audio.next_tag += 2;
+  tag                  = rq.tag;
+
+  struct vst_bridge_scatter in  = { (void **)inputs, vbe->e.numInputs,
+                                    sizeof (double) * sampleFrames };
+  struct vst_bridge_scatter out = { (void **)outputs, vbe->e.numOutputs,
+                                    sizeof (double) * sampleFrames };
+
+  vst_bridge_send_frames(vbe, &vbe->audio, &rq, &in, NULL, 0);
+  if (!vst_bridge_wait_scatter(vbe, &vbe->audio, &rq, tag, deadline, &out)) {
+    vst_bridge_process_missed(vbe, tag, sampleFrames);
+    vst_bridge_process_fallback(vbe, (void **)outputs, sizeof (double), sampleFrames, true);
+    pthread_mutex_unlock(&vbe->audio_lock);
+    return;
+  }
+
+  vst_bridge_process_save(vbe, (void **)outputs, sizeof (double), sampleFrames);
+  bool has_events = vst_bridge_process_output_events(
+    vbe, &rq, VST_BRIDGE_FRAMES_DOUBLE_LEN(vbe->e.numOutputs * sampleFrames));
+
+  pthread_mutex_unlock(&vbe->audio_lock);
 
-  write(vbe->socket, &rq, VST_BRIDGE_FRAMES_LEN(vbe->e.numInputs * sampleFrames));
-  vst_bridge_wait_response(vbe, &rq, rq.tag);
+  if (has_events)
+    vbe->audio_master(&vbe->e, audioMasterProcessEvents, 0, 0, vbe->out_ves, 0);
 
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, VST_BRIDGE_CAPTURE_PROCESS_DOUBLE,
+                            0, 0, sampleFrames, NULL, 0, start);
+}
+
+/* a block, through the offline pipeline if there is one */
+void vst_bridge_process_block(struct vst_bridge_effect *vbe,
+                              void    **inputs,
+                              void    **outputs,
+                              size_t    sample_size,
+                              VstInt32  frames)
+{
+  if (vbe->pipeline.fifo &&
+      vst_bridge_pipeline_process(vbe, inputs, outputs, sample_size, frames))
+    return;
+  if (sample_size == sizeof (double))
+    vst_bridge_call_process_double2(&vbe->e, (double **)inputs, (double **)outputs, frames);
+  else
+    vst_bridge_call_process2(&vbe->e, (float **)inputs, (float **)outputs, frames);
+  if (vbe->pipeline.fifo)
+    vst_bridge_pipeline_delay(vbe, outputs, sample_size, frames);
+}
+
+VstIntPtr vst_bridge_process_events(struct vst_bridge_effect  *vbe,
+                                    struct vst_bridge_channel *chan,
+                                    struct vst_bridge_request *rq,
+                                    VstInt32                   index,
+                                    VstIntPtr                  value,
+                                    struct VstEvents          *evs,
+                                    float                      opt);
+
+/* the stage empty and its output silent, called with the audio lock held */
+void vst_bridge_reblock_clear(struct vst_bridge_reblock *rb, size_t sample_size)
+{
+  rb->sample_size = sample_size;
+  rb->fill        = 0;
+  rb->events_used = 0;
+  rb->events_nb   = 0;
+  memset(rb->out, 0, rb->outputs * rb->frames * sizeof (double));
+}
+
+/*
+ * Sizes the stage for the plugin's I/O and empties it as the DAW resumes
+ * the plugin, called with the lock held, out of the audio thread.
+ */
+void vst_bridge_reblock_resize(struct vst_bridge_effect *vbe)
+{
+  struct vst_bridge_reblock *rb = &vbe->reblock;
+  size_t block = rb->frames * sizeof (double);
+  VstInt32 inputs = MAX(vbe->e.numInputs, rb->inputs);
+  VstInt32 outputs = MAX(vbe->e.numOutputs, rb->outputs);
+
+  if (!rb->frames || !rb->events)
+    return;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  if (!rb->out || inputs > rb->inputs || outputs > rb->outputs) {
+    uint8_t *in = (uint8_t *)realloc(rb->in, inputs * block + 1);
+    if (in)
+      rb->in = in;
+    uint8_t *out = (uint8_t *)realloc(rb->out, outputs * block + 1);
+    if (out)
+      rb->out = out;
+    if (in && out) {
+      rb->inputs  = inputs;
+      rb->outputs = outputs;
+      vst_bridge_rt_lock_memory(in, inputs * block);
+      vst_bridge_rt_lock_memory(out, outputs * block);
+    } else
+      CRIT("failed to allocate the reblocking stage: %m\n");
+  }
+  if (rb->out)
+    vst_bridge_reblock_clear(rb, rb->sample_size ? rb->sample_size : sizeof (float));
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+/*
+ * The DAW's events for its next call, from the audio thread: they wait
+ * for the block that call's frames go to, from where they start in it.
+ */
+VstIntPtr vst_bridge_reblock_events(struct vst_bridge_effect *vbe,
+                                    const struct VstEvents   *evs)
+{
+  struct vst_bridge_reblock *rb = &vbe->reblock;
+  uint32_t nb;
+  uint32_t kept;
+  size_t off = 0;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  uint8_t *data = rb->events + rb->events_used;
+  vst_bridge_events_pack(data, VST_BRIDGE_REBLOCK_EVENTS_SIZE - rb->events_used, evs, &nb);
+  for (kept = 0; kept < nb && rb->events_nb + kept < VST_BRIDGE_EVENTS_MAX; ++kept) {
+    struct vst_bridge_event *bev = (struct vst_bridge_event *)(data + off);
+    ((VstEvent *)bev->event)->deltaFrames += rb->fill;
+    off += bev->size;
+  }
+  if ((int32_t)kept < evs->numEvents)
+    vbe->stats.events_dropped += evs->numEvents - kept;
+  rb->events_used += off;
+  rb->events_nb   += kept;
+  pthread_mutex_unlock(&vbe->audio_lock);
+  return 1;
+}
+
+/*
+ * Sends the events of the block about to be processed, called with the
+ * audio lock held; those of the next ones stay, a block earlier.
+ */
+void vst_bridge_reblock_send_events(struct vst_bridge_effect *vbe)
+{
+  struct vst_bridge_reblock *rb = &vbe->reblock;
+  struct VstEvents *ves = rb->ves;
+  uint8_t *data = rb->events;
+  size_t used = 0;
+  uint32_t nb = 0;
+  int32_t now = 0;
+
+  if (!rb->events_nb)
+    return;
+
+  vst_bridge_events_unpack(ves, rb->events, rb->events_nb);
+  for (int32_t i = 0; i < ves->numEvents; ++i)
+    if (ves->events[i]->deltaFrames < rb->frames)
+      ves->events[now++] = ves->events[i];
+  ves->numEvents = now;
+  if (now > 0 && !vbe->dead)
+    vst_bridge_process_events(vbe, &vbe->audio, vbe->process_rq, 0, 0, ves, 0);
+
+  for (uint32_t i = 0; i < rb->events_nb; ++i) {
+    struct vst_bridge_event *bev = (struct vst_bridge_event *)data;
+    VstEvent *ev = (VstEvent *)bev->event;
+    size_t size = bev->size;
+    if (ev->deltaFrames >= rb->frames) {
+      ev->deltaFrames -= rb->frames;
+      memmove(rb->events + used, bev, size);
+      used += size;
+      ++nb;
+    }
+    data += size;
+  }
+  rb->events_used = used;
+  rb->events_nb   = nb;
+}
+
+/* a block gathered, in pieces if it doesn't fit in a request */
+void vst_bridge_reblock_block(struct vst_bridge_effect *vbe,
+                              void    **inputs,
+                              void    **outputs,
+                              size_t    sample_size)
+{
+  VstInt32 frames   = vbe->reblock.frames;
+  VstInt32 channels = MAX(MAX(vbe->e.numInputs, vbe->e.numOutputs), 1);
+  VstInt32 piece    = (sizeof (struct vst_bridge_request) - VST_BRIDGE_FRAMES_DOUBLE_LEN(0)) /
+    (channels * sample_size);
+  void *in[vbe->e.numInputs];
+  void *out[vbe->e.numOutputs];
+
+  if (piece >= frames) {
+    vst_bridge_process_block(vbe, inputs, outputs, sample_size, frames);
+    return;
+  }
+  for (VstInt32 done = 0; done < frames; done += piece) {
+    VstInt32 n = MIN(piece, frames - done);
+    for (int i = 0; i < vbe->e.numInputs; ++i)
+      in[i] = (uint8_t *)inputs[i] + done * sample_size;
+    for (int i = 0; i < vbe->e.numOutputs; ++i)
+      out[i] = (uint8_t *)outputs[i] + done * sample_size;
+    vst_bridge_process_block(vbe, in, out, sample_size, n);
+  }
+}
+
+/*
+ * process with VST_BRIDGE_REBLOCK: the DAW's frames go to the block being
+ * gathered, for the last block's output in exchange, and the block goes
+ * to the plugin once full. A whole block in the DAW's buffers goes from
+ * there, unless it processes in place.
+ */
+void vst_bridge_reblock_process(struct vst_bridge_effect *vbe,
+                                void    **inputs,
+                                void    **outputs,
+                                size_t    sample_size,
+                                VstInt32  frames)
+{
+  struct vst_bridge_reblock *rb = &vbe->reblock;
+  void *in[vbe->e.numInputs];
+  void *out[vbe->e.numOutputs];
+  void *direct[vbe->e.numInputs];
+  bool in_place = false;
+  VstInt32 done = 0;
+
+  pthread_mutex_lock(&vbe->audio_lock);
+  // the plugin's I/O grew since the DAW resumed it
+  if (vbe->e.numInputs > rb->inputs || vbe->e.numOutputs > rb->outputs) {
+    pthread_mutex_unlock(&vbe->audio_lock);
+    vst_bridge_process_block(vbe, inputs, outputs, sample_size, frames);
+    return;
+  }
+  // the DAW's events from this thread wait for the block too
+  vst_bridge_audio_thread_set(vbe);
+  if (rb->sample_size != sample_size)
+    vst_bridge_reblock_clear(rb, sample_size);
+
+  size_t block = rb->frames * sample_size;
+  for (int i = 0; i < vbe->e.numInputs; ++i)
+    in[i] = rb->in + i * block;
   for (int i = 0; i < vbe->e.numOutputs; ++i)
-    memcpy(outputs[i], rq.frames.frames + i * sampleFrames,
-           sizeof (float) * sampleFrames);
+    out[i] = rb->out + i * block;
+  for (int i = 0; i < vbe->e.numInputs; ++i)
+    for (int j = 0; j < vbe->e.numOutputs; ++j)
+      in_place |= inputs[i] == outputs[j];
+
+  while (done < frames) {
+    VstInt32 n = MIN(frames - done, rb->frames - rb->fill);
+    size_t at = rb->fill * sample_size;
+    size_t from = done * sample_size;
+    size_t len = n * sample_size;
+    bool whole = !rb->fill && n == rb->frames && !in_place;
+
+    for (int i = 0; i < vbe->e.numInputs; ++i) {
+      direct[i] = (uint8_t *)inputs[i] + from;
+      if (!whole)
+        memcpy((uint8_t *)in[i] + at, direct[i], len);
+    }
+    for (int i = 0; i < vbe->e.numOutputs; ++i)
+      memcpy((uint8_t *)outputs[i] + from, (uint8_t *)out[i] + at, len);
+    rb->fill += n;
+    done     += n;
+    if (rb->fill < rb->frames)
+      break;
 
-  pthread_mutex_unlock(&vbe->lock);
+    rb->fill = 0;
+    vst_bridge_reblock_send_events(vbe);
+    pthread_mutex_unlock(&vbe->audio_lock);
+    vst_bridge_reblock_block(vbe, whole ? direct : in, out, sample_size);
+    pthread_mutex_lock(&vbe->audio_lock);
+  }
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+void vst_bridge_call_process(AEffect* effect,
+                             float**  inputs,
+                             float**  outputs,
+                             VstInt32 sampleFrames)
+{
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+
+  if (vbe->reblock.out)
+    vst_bridge_reblock_process(vbe, (void **)inputs, (void **)outputs,
+                               sizeof (float), sampleFrames);
+  else
+    vst_bridge_process_block(vbe, (void **)inputs, (void **)outputs,
+                             sizeof (float), sampleFrames);
 }
 
 void vst_bridge_call_process_double(AEffect* effect,
-                                    double**  inputs,
-                                    double**  outputs,
+                                    double** inputs,
+                                    double** outputs,
                                     VstInt32 sampleFrames)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
-  struct vst_bridge_request rq;
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+
+  if (vbe->reblock.out)
+    vst_bridge_reblock_process(vbe, (void **)inputs, (void **)outputs,
+                               sizeof (double), sampleFrames);
+  else
+    vst_bridge_process_block(vbe, (void **)inputs, (void **)outputs,
+                             sizeof (double), sampleFrames);
+}
 
-  pthread_mutex_lock(&vbe->lock);
+float vst_bridge_get_parameter(struct vst_bridge_effect  *vbe,
+                               struct vst_bridge_channel *chan,
+                               struct vst_bridge_request *rq,
+                               VstInt32                   index)
+{
+  rq->tag         = chan->next_tag;
+  rq->cmd         = VST_BRIDGE_CMD_GET_PARAMETER;
+  rq->param.index = index;
+  chan->next_tag += 2;
+  if (vbe->dead || vst_bridge_send(vbe, chan, rq, VST_BRIDGE_PARAM_LEN) < 0 ||
+      !vst_bridge_wait_response_until(vbe, chan, rq, rq->tag, 0)) {
+    // the last value we know of
+    rq->param.value = 0;
+    pthread_mutex_lock(&vbe->params_lock);
+    if (index >= 0 && index < vbe->state.nparams && !isnan(vbe->state.params[index]))
+      rq->param.value = vbe->state.params[index];
+    pthread_mutex_unlock(&vbe->params_lock);
+  }
+  return rq->param.value;
+}
 
-  rq.tag              = vbe->next_tag;
-  rq.cmd              = VST_BRIDGE_CMD_PROCESS_DOUBLE;
-  rq.framesd.nframes  = sampleFrames;
-  vbe->next_tag      += 2;
+/* the thread running vst_bridge_starter(), for the DAW's calls it makes */
+static thread_local struct vst_bridge_effect *t_starting;
 
-  for (int i = 0; i < vbe->e.numInputs; ++i)
-    memcpy(rq.framesd.frames + i * sampleFrames, inputs[i],
-           sizeof (double) * sampleFrames);
+/* blocks until the host spawned by a lazy VSTPluginMain is up */
+void vst_bridge_wait_started(struct vst_bridge_effect *vbe)
+{
+  if (t_starting == vbe)
+    return;
+  pthread_mutex_lock(&vbe->start_lock);
+  while (vbe->starting)
+    pthread_cond_wait(&vbe->start_cond, &vbe->start_lock);
+  pthread_mutex_unlock(&vbe->start_lock);
+}
 
-  write(vbe->socket, &rq, VST_BRIDGE_FRAMES_DOUBLE_LEN(vbe->e.numInputs * sampleFrames));
-  vst_bridge_wait_response(vbe, &rq, rq.tag);
-  for (int i = 0; i < vbe->e.numOutputs; ++i)
-    memcpy(outputs[i], rq.framesd.frames + i * sampleFrames,
-           sizeof (double) * sampleFrames);
+float vst_bridge_call_get_parameter_ctl(struct vst_bridge_effect *vbe,
+                                        VstInt32                  index)
+{
+  struct vst_bridge_request rq;
+  float value;
 
+  // the audio thread gets the last value set, it can't wait for the host
+  if (vbe->starting)
+    vst_bridge_wait_started(vbe);
+
+  pthread_mutex_lock(&vbe->lock);
+  value = vst_bridge_get_parameter(vbe, &vbe->ctl, &rq, index);
   pthread_mutex_unlock(&vbe->lock);
+  return value;
 }
 
 float vst_bridge_call_get_parameter(AEffect* effect,
                                     VstInt32 index)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+  float value;
+
+  if (vst_bridge_is_audio_thread(vbe)) {
+    pthread_mutex_lock(&vbe->audio_lock);
+    value = vst_bridge_get_parameter(vbe, &vbe->audio, vbe->process_rq, index);
+    pthread_mutex_unlock(&vbe->audio_lock);
+  } else
+    value = vst_bridge_call_get_parameter_ctl(vbe, index);
+
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, VST_BRIDGE_CAPTURE_GET_PARAMETER,
+                            index, 0, 0, NULL, 0, start);
+  return value;
+}
+
+void vst_bridge_set_parameter(struct vst_bridge_effect  *vbe,
+                              struct vst_bridge_channel *chan,
+                              struct vst_bridge_request *rq,
+                              VstInt32                   index,
+                              float                      parameter)
+{
+  vst_bridge_state_param(vbe, index, parameter);
+  rq->tag         = chan->next_tag;
+  rq->cmd         = VST_BRIDGE_CMD_SET_PARAMETER;
+  rq->param.index = index;
+  rq->param.value = parameter;
+  chan->next_tag += 2;
+  if (vbe->dead)
+    return;
+  if (chan == &vbe->ctl)
+    vst_bridge_send_async(vbe, rq, VST_BRIDGE_PARAM_LEN);
+  else
+    vst_bridge_send(vbe, chan, rq, VST_BRIDGE_PARAM_LEN);
+}
+
+void vst_bridge_call_set_parameter_ctl(struct vst_bridge_effect *vbe,
+                                       VstInt32                  index,
+                                       float                     parameter)
+{
   struct vst_bridge_request rq;
 
   pthread_mutex_lock(&vbe->lock);
-
-  rq.tag         = vbe->next_tag;
-  rq.cmd         = VST_BRIDGE_CMD_GET_PARAMETER;
-  rq.param.index = index;
-  vbe->next_tag += 2;
-  write(vbe->socket, &rq, VST_BRIDGE_PARAM_LEN);
-  vst_bridge_wait_response(vbe, &rq, rq.tag);
+  vst_bridge_set_parameter(vbe, &vbe->ctl, &rq, index, parameter);
   pthread_mutex_unlock(&vbe->lock);
-  return rq.param.value;
 }
 
 void vst_bridge_call_set_parameter(AEffect* effect,
                                    VstInt32 index,
                                    float    parameter)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
-  struct vst_bridge_request rq;
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+
+  if (vst_bridge_is_audio_thread(vbe)) {
+    pthread_mutex_lock(&vbe->audio_lock);
+    vst_bridge_set_parameter(vbe, &vbe->audio, vbe->process_rq, index, parameter);
+    pthread_mutex_unlock(&vbe->audio_lock);
+  } else
+    vst_bridge_call_set_parameter_ctl(vbe, index, parameter);
+
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, VST_BRIDGE_CAPTURE_SET_PARAMETER,
+                            index, 0, 0, NULL, parameter, start);
+}
 
-  pthread_mutex_lock(&vbe->lock);
-  rq.tag         = vbe->next_tag;
-  rq.cmd         = VST_BRIDGE_CMD_SET_PARAMETER;
-  rq.param.index = index;
-  rq.param.value = parameter;
-  vbe->next_tag += 2;
-  write(vbe->socket, &rq, VST_BRIDGE_PARAM_LEN);
-  pthread_mutex_unlock(&vbe->lock);
+VstIntPtr vst_bridge_process_events(struct vst_bridge_effect  *vbe,
+                                    struct vst_bridge_channel *chan,
+                                    struct vst_bridge_request *rq,
+                                    VstInt32                   index,
+                                    VstIntPtr                  value,
+                                    struct VstEvents          *evs,
+                                    float                      opt)
+{
+  struct vst_bridge_events *bevs = (struct vst_bridge_events *)rq->erq.data;
+  // rendering offline, the events go with the blocks in flight
+  bool pipelined = chan == &vbe->audio && vbe->pipeline.offline;
+  bool has_events = false;
+  size_t len = 0;
+
+  if (pipelined) {
+    if (!vst_bridge_pipeline_room(vbe, VST_BRIDGE_ERQ_LEN(0), &has_events))
+      return 0;
+    vst_bridge_pipeline_deliver(vbe, &has_events);
+  }
+
+  rq->tag         = chan->next_tag;
+  rq->cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+  rq->erq.opcode  = effProcessEvents;
+  rq->erq.index   = index;
+  rq->erq.value   = value;
+  rq->erq.opt     = opt;
+  chan->next_tag += 2;
+  bevs->pad       = 0;
+
+  // bevs is a packed struct, the count goes through nb
+  uint32_t nb;
+  if (chan == &vbe->audio && vbe->events && !pipelined) {
+    // the previous events stay valid until the ring wraps
+    uint32_t head = vbe->events_head;
+    size_t used = vst_bridge_events_pack(vbe->events + head, VST_BRIDGE_EVENTS_RING_SIZE - head,
+                                         evs, &nb);
+    if ((int32_t)nb < evs->numEvents && head > 0) {
+      head = 0;
+      used = vst_bridge_events_pack(vbe->events, VST_BRIDGE_EVENTS_RING_SIZE, evs, &nb);
+    }
+    bevs->offset     = head;
+    vbe->events_head = head + used;
+  } else {
+    bevs->offset = VST_BRIDGE_EVENTS_INLINE;
+    len = vst_bridge_events_pack(bevs->data, sizeof (rq->data) - (bevs->data - rq->data),
+                                 evs, &nb);
+  }
+  bevs->nb = nb;
+  if ((int32_t)nb < evs->numEvents)
+    vbe->stats.events_dropped += evs->numEvents - nb;
+
+  vst_bridge_send(vbe, chan, rq, VST_BRIDGE_ERQ_LEN(sizeof (*bevs) + len));
+  if (pipelined) {
+    vst_bridge_pipeline_sent(&vbe->pipeline, rq->tag, 0, VST_BRIDGE_ERQ_LEN(0));
+    return 1;
+  }
+  if (!vst_bridge_wait_response_until(vbe, chan, rq, rq->tag, 0))
+    return 0;
+  return rq->amrq.value;
+}
+
+/*
+ * Passes the events ring to the host, creating it the first time; without
+ * it the events go in the requests.
+ */
+void vst_bridge_events_attach(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&vbe->audio_lock);
+  if (vbe->events_fd < 0) {
+    vbe->events_fd = memfd_create("vst-bridge-events", MFD_CLOEXEC);
+    if (vbe->events_fd < 0 || ftruncate(vbe->events_fd, VST_BRIDGE_EVENTS_RING_SIZE)) {
+      CRIT("failed to create the events ring: %m\n");
+      goto failed;
+    }
+    void *mem = mmap(NULL, VST_BRIDGE_EVENTS_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     vbe->events_fd, 0);
+    if (mem == MAP_FAILED) {
+      CRIT("failed to map the events ring: %m\n");
+      goto failed;
+    }
+    vbe->events = (uint8_t *)mem;
+    vst_bridge_rt_lock_memory(vbe->events, VST_BRIDGE_EVENTS_RING_SIZE);
+  }
+  vbe->events_head = 0;
+
+  {
+    struct vst_bridge_request rq;
+    char cbuf[CMSG_SPACE(sizeof (int))];
+    struct iovec iov;
+    struct msghdr msg;
+
+    rq.tag               = vbe->audio.next_tag;
+    rq.cmd               = VST_BRIDGE_CMD_EVENTS_RING;
+    vbe->audio.next_tag += 2;
+    iov.iov_base = &rq;
+    iov.iov_len  = VST_BRIDGE_RQ_LEN;
+    memset(&msg, 0, sizeof (msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof (cbuf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof (int));
+    memcpy(CMSG_DATA(cmsg), &vbe->events_fd, sizeof (int));
+    if (sendmsg(vbe->audio.socket, &msg, MSG_NOSIGNAL) == VST_BRIDGE_RQ_LEN) {
+      pthread_mutex_unlock(&vbe->audio_lock);
+      return;
+    }
+    CRIT("failed to pass the events ring: %m\n");
+  }
+
+failed:
+  if (vbe->events)
+    munmap(vbe->events, VST_BRIDGE_EVENTS_RING_SIZE);
+  if (vbe->events_fd >= 0)
+    close(vbe->events_fd);
+  vbe->events    = NULL;
+  vbe->events_fd = -1;
+  pthread_mutex_unlock(&vbe->audio_lock);
+}
+
+/*
+ * The setup calls whose result the DAW has no use for are sent without
+ * waiting for the plugin: the host serves them in order while the DAW goes
+ * on loading its project, and the next call that needs a reply waits
+ * behind them. effMainsChanged still waits, so that the plugin is set up
+ * before it processes. Not while serving a callback: the host waits for
+ * us then, see vst_bridge_async_drain().
+ */
+bool vst_bridge_is_async(struct vst_bridge_effect *vbe, VstInt32 opcode)
+{
+  switch (opcode) {
+  case effOpen:
+  case effSetSampleRate:
+  case effSetBlockSize:
+  case effSetProgram:
+  case effSetChunk:
+    return g_config.async_setup && vbe->has_reader && !t_callbacks;
+
+  default:
+    return false;
+  }
 }
 
 VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
@@ -342,19 +2550,24 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
                                              void*     ptr,
                                              float     opt)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
   struct vst_bridge_request rq;
   ssize_t len;
+  bool async;
 
   LOG("[%p] effect_dispatcher(%s, %d, %d, %p, %f) => next_tag: %d\n",
       pthread_self(), vst_bridge_effect_opcode_name[opcode], index, value,
-      ptr, opt, vbe->next_tag);
+      ptr, opt, vbe->ctl.next_tag);
 
   switch (opcode) {
+  case effEditIdle:
+    // the host's GUI thread idles the editor on its own
+    if (g_config.edit_idle_hz > 0)
+      return 0;
+    /* fall through */
   case effSetBlockSize:
   case effSetProgram:
   case effSetSampleRate:
-  case effEditIdle:
   case effGetProgram:
   case __effIdleDeprecated:
   case effSetTotalSampleToProcess:
@@ -367,43 +2580,48 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   case effEditClose:
   case effCanBeAutomated:
   case effGetTailSize:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    if (vst_bridge_is_async(vbe, opcode)) {
+      vst_bridge_send_async(vbe, &rq, VST_BRIDGE_ERQ_LEN(0));
+      vst_bridge_async_forget(vbe, rq.tag);
+      return 0;
+    }
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     return rq.amrq.value;
 
   case effGetOutputProperties:
   case effGetInputProperties:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     memcpy(ptr, rq.erq.data, sizeof (VstPinProperties));
     return rq.erq.value;
 
   case effBeginLoadBank:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(sizeof (VstPatchChunkInfo)));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(sizeof (VstPatchChunkInfo)));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     return rq.erq.value;
 
@@ -419,42 +2637,48 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   case effSetEditKnobMode:
   case effEditKeyUp:
   case effEditKeyDown:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, sizeof (rq));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    if (vst_bridge_is_async(vbe, opcode)) {
+      vst_bridge_send_async(vbe, &rq, VST_BRIDGE_ERQ_LEN(0));
+      vst_bridge_async_forget(vbe, rq.tag);
+      return 0;
+    }
+    vst_bridge_send(vbe, &vbe->ctl, &rq, sizeof (rq));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     return rq.amrq.value;
 
   case effClose:
     // quit
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    // the host exits right after
     vbe->close_flag = true;
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     return 0;
 
   case effEditOpen: {
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
 
     Window   parent  = (Window)ptr;
@@ -489,15 +2713,15 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   }
 
   case effEditGetRect: {
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     memcpy(&vbe->rect, rq.erq.data, sizeof (vbe->rect));
     ERect **r = (ERect **)ptr;
@@ -506,31 +2730,31 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   }
 
   case effSetProgramName:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
 
     strcpy((char*)rq.erq.data, (const char *)ptr);
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(strlen((const char *)ptr) + 1));
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(strlen((const char *)ptr) + 1));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
     return rq.amrq.value;
 
   case effGetMidiKeyName:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
 
     memcpy(rq.erq.data, ptr, sizeof (MidiKeyName));
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(sizeof (MidiKeyName)));
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(sizeof (MidiKeyName)));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
 
@@ -545,15 +2769,15 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   case effGetVendorString:
   case effGetProductString:
   case effGetProgramNameIndexed:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
     strcpy((char*)ptr, (const char *)rq.erq.data);
@@ -561,30 +2785,30 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
     return rq.amrq.value;
 
   case effCanDo:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
     strcpy((char*)rq.erq.data, (const char *)ptr);
 
-    write(vbe->socket, &rq, sizeof (rq));
+    vst_bridge_send(vbe, &vbe->ctl, &rq, sizeof (rq));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
     return rq.erq.value;
 
   case effGetParameterProperties:
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
 
@@ -593,15 +2817,15 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
     return rq.amrq.value;
 
   case effGetChunk: {
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    write(vbe->socket, &rq, sizeof (rq));
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    vst_bridge_send(vbe, &vbe->ctl, &rq, sizeof (rq));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
     void *chunk = realloc(vbe->chunk, rq.erq.value);
@@ -622,81 +2846,67 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   }
 
   case effSetChunk: {
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
+
+    async = vst_bridge_is_async(vbe, opcode);
     for (size_t off = 0; off < static_cast<size_t>(value); ) {
       size_t can_write = MIN(VST_BRIDGE_CHUNK_SIZE, value - off);
       memcpy(rq.erq.data, static_cast<uint8_t *>(ptr) + off, can_write);
-      write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(can_write));
+      if (async)
+        vst_bridge_send_async(vbe, &rq, VST_BRIDGE_ERQ_LEN(can_write));
+      else
+        vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(can_write));
       off += can_write;
     }
+    if (async) {
+      vst_bridge_async_forget(vbe, rq.tag);
+      return 0;
+    }
     vst_bridge_wait_response(vbe, &rq, rq.tag);
     return rq.erq.value;
   }
 
   case effSetSpeakerArrangement: {
     struct VstSpeakerArrangement *ar = (struct VstSpeakerArrangement *)value;
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+    rq.erq.opcode      = opcode;
+    rq.erq.index       = index;
+    rq.erq.value       = value;
+    rq.erq.opt         = opt;
+    vbe->ctl.next_tag += 2;
     size_t len = 8 + ar->numChannels * sizeof (ar->speakers[0]);
     memcpy(rq.erq.data, ptr, len);
 
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(len));
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(len));
     if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
       return 0;
     memcpy(ptr, rq.erq.data, 8 + ar->numChannels * sizeof (ar->speakers[0]));
     return rq.amrq.value;
   }
 
-  case effProcessEvents: {
-    // compute the size
-    struct VstEvents *evs = (struct VstEvents *)ptr;
-    struct vst_bridge_midi_events *mes = (struct vst_bridge_midi_events *)rq.erq.data;
-
-    rq.tag         = vbe->next_tag;
-    rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-    rq.erq.opcode  = opcode;
-    rq.erq.index   = index;
-    rq.erq.value   = value;
-    rq.erq.opt     = opt;
-    vbe->next_tag += 2;
-
-    mes->nb = evs->numEvents;
-    struct vst_bridge_midi_event *me = mes->events;
-    for (int i = 0; i < evs->numEvents; ++i) {
-      memcpy(me, evs->events[i], sizeof (*me) + evs->events[i]->byteSize);
-      me = (struct vst_bridge_midi_event *)(me->data + me->byteSize);
-    }
-
-    write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(((uint8_t *)me) - rq.erq.data));
-    if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
-      return 0;
-    return rq.amrq.value;
-  }
+  case effProcessEvents:
+    return vst_bridge_process_events(vbe, &vbe->ctl, &rq, index, value,
+                                     (struct VstEvents *)ptr, opt);
 
   case effVendorSpecific: {
     switch (index) {
     case effGetParamDisplay:
-      rq.tag         = vbe->next_tag;
-      rq.cmd         = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
-      rq.erq.opcode  = opcode;
-      rq.erq.index   = index;
-      rq.erq.value   = value;
-      rq.erq.opt     = opt;
-      vbe->next_tag += 2;
-
-      write(vbe->socket, &rq, VST_BRIDGE_ERQ_LEN(0));
+      rq.tag             = vbe->ctl.next_tag;
+      rq.cmd             = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+      rq.erq.opcode      = opcode;
+      rq.erq.index       = index;
+      rq.erq.value       = value;
+      rq.erq.opt         = opt;
+      vbe->ctl.next_tag += 2;
+
+      vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_ERQ_LEN(0));
       if (!vst_bridge_wait_response(vbe, &rq, rq.tag))
         return 0;
       strcpy((char*)ptr, (const char *)rq.erq.data);
@@ -717,6 +2927,309 @@ VstIntPtr vst_bridge_call_effect_dispatcher2(AEffect*  effect,
   }
 }
 
+/*
+ * Snapshots the plugin state on the DAW's idle calls, if it changed and
+ * the last one is old enough: this thread isn't the audio thread and
+ * already holds the lock.
+ */
+void vst_bridge_snapshot_maybe(struct vst_bridge_effect *vbe, bool force)
+{
+  pthread_mutex_lock(&vbe->params_lock);
+  bool dirty = vbe->state.dirty;
+  pthread_mutex_unlock(&vbe->params_lock);
+
+  if (!(vbe->e.flags & effFlagsProgramChunks) || vbe->dead ||
+      g_config.snapshot_interval_s <= 0 || !dirty)
+    return;
+  if (!force && vst_bridge_now_ns() - vbe->state.snapshot_ns <
+      g_config.snapshot_interval_s * 1000000000ULL)
+    return;
+
+  // get the chunk in a buffer of our own, the DAW may still use vbe->chunk
+  void *chunk = vbe->chunk;
+  void *data = NULL;
+  vbe->chunk = NULL;
+  VstIntPtr size = vst_bridge_call_effect_dispatcher2(
+    &vbe->e, effGetChunk, 0, 0, &data, 0);
+  if (size > 0 && data == vbe->chunk)
+    vst_bridge_snapshot_store(vbe, 0, vbe->chunk, size);
+  else
+    free(vbe->chunk);
+  vbe->chunk = chunk;
+}
+
+/* answers what we can while the host is restarting */
+VstIntPtr vst_bridge_dispatch_dead(struct vst_bridge_effect *vbe,
+                                   VstInt32  opcode,
+                                   VstInt32  index,
+                                   VstIntPtr /*value*/,
+                                   void*     ptr,
+                                   float     /*opt*/)
+{
+  switch (opcode) {
+  case effClose:
+    vbe->close_flag = true;
+    return 0;
+
+  case effGetProgram:
+    return vbe->state.program >= 0 ? vbe->state.program : 0;
+
+  case effGetChunk: {
+    if (!vbe->state.snapshot || index != vbe->state.snapshot_index)
+      return 0;
+    void *chunk = realloc(vbe->chunk, vbe->state.snapshot_size);
+    if (!chunk)
+      return 0;
+    vbe->chunk = chunk;
+    memcpy(chunk, vbe->state.snapshot, vbe->state.snapshot_size);
+    *((void **)ptr) = chunk;
+    return vbe->state.snapshot_size;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/* the info the maker embedded, NULL if it didn't */
+const struct vst_bridge_plugin_info *vst_bridge_embedded_info(void)
+{
+  const struct vst_bridge_plugin_info *info = (const struct vst_bridge_plugin_info *)g_plugin_info;
+
+  if (strncmp(info->magic, VST_BRIDGE_PLUGIN_INFO_MAGIC, sizeof (info->magic)))
+    return NULL;
+  return info;
+}
+
+/*
+ * The calls which don't need the plugin while its host is starting: the
+ * embedded info answers the queries, and the setup is replayed by
+ * vst_bridge_restore() once the host is up, as after a restart.
+ */
+bool vst_bridge_start_local(struct vst_bridge_effect *vbe,
+                            VstInt32 opcode,
+                            VstInt32 index)
+{
+  switch (opcode) {
+  case effGetEffectName:
+  case effGetVendorString:
+  case effGetProductString:
+  case effGetVendorVersion:
+  case effGetPlugCategory:
+  case effOpen:
+  case effClose:
+  case effSetSampleRate:
+  case effSetBlockSize:
+  case effSetProcessPrecision:
+  case effSetProgram:
+  case effSetChunk:
+  case effMainsChanged:
+  case effStartProcess:
+  case effStopProcess:
+  case effEditIdle:
+  case __effIdleDeprecated:
+    return true;
+
+  case effGetProgram:
+    return vbe->state.program >= 0;
+
+  case effGetChunk:
+    return vbe->state.snapshot && index == vbe->state.snapshot_index;
+
+  default:
+    return false;
+  }
+}
+
+/* copies a string of the embedded info into the DAW's buffer of size bytes */
+bool vst_bridge_info_string(void *ptr, size_t size, const char *str, size_t str_size)
+{
+  size_t len = strnlen(str, MIN(str_size, size - 1));
+
+  memcpy(ptr, str, len);
+  ((char *)ptr)[len] = '\0';
+  return len > 0;
+}
+
+/* called with the lock held while the host is starting */
+VstIntPtr vst_bridge_dispatch_starting(struct vst_bridge_effect *vbe,
+                                       VstInt32  opcode,
+                                       VstInt32  index,
+                                       VstIntPtr value,
+                                       void*     ptr,
+                                       float     opt)
+{
+  const struct vst_bridge_plugin_info *info = vst_bridge_embedded_info();
+
+  switch (opcode) {
+  case effGetEffectName:
+    return vst_bridge_info_string(ptr, kVstMaxEffectNameLen, info->name, sizeof (info->name));
+
+  case effGetVendorString:
+    return vst_bridge_info_string(ptr, kVstMaxVendorStrLen, info->vendor, sizeof (info->vendor));
+
+  case effGetProductString:
+    return vst_bridge_info_string(ptr, kVstMaxProductStrLen, info->product, sizeof (info->product));
+
+  case effGetVendorVersion:
+    return info->vendor_version;
+
+  case effGetPlugCategory:
+    return info->category;
+
+  case effClose:
+    // the plugin never saw the DAW, no need to wait for it
+    vbe->start_abort = true;
+    shutdown(vbe->ctl.socket, SHUT_RDWR);
+    kill(vbe->child, SIGKILL);
+    vbe->close_flag = true;
+    return 0;
+
+  default:
+    return vst_bridge_dispatch_dead(vbe, opcode, index, value, ptr, opt);
+  }
+}
+
+/*
+ * Sends the DAW's answers to the queries the host answers by itself,
+ * opcode being the call about to be forwarded, which may change them.
+ */
+void vst_bridge_host_info_push(struct vst_bridge_effect *vbe,
+                               VstInt32  opcode,
+                               VstIntPtr value,
+                               float     opt)
+{
+  struct vst_bridge_request rq;
+  struct vst_bridge_host_info *info = &rq.host_info;
+  audioMasterCallback am = vbe->audio_master;
+
+  memset(info, 0, sizeof (*info));
+  info->version        = am(&vbe->e, audioMasterVersion, 0, 0, NULL, 0);
+  info->vendor_version = am(&vbe->e, audioMasterGetVendorVersion, 0, 0, NULL, 0);
+  info->sample_rate    = am(&vbe->e, audioMasterGetSampleRate, 0, 0, NULL, 0);
+  info->block_size     = am(&vbe->e, audioMasterGetBlockSize, 0, 0, NULL, 0);
+  info->input_latency  = am(&vbe->e, audioMasterGetInputLatency, 0, 0, NULL, 0);
+  info->output_latency = am(&vbe->e, audioMasterGetOutputLatency, 0, 0, NULL, 0);
+  info->has_vendor     = am(&vbe->e, audioMasterGetVendorString, 0, 0, info->vendor, 0);
+  info->has_product    = am(&vbe->e, audioMasterGetProductString, 0, 0, info->product, 0);
+  info->vendor[sizeof (info->vendor) - 1]   = '\0';
+  info->product[sizeof (info->product) - 1] = '\0';
+  for (size_t i = 0; i < VST_BRIDGE_HOST_CAN_DO_COUNT; ++i)
+    info->can_do[i] = am(&vbe->e, audioMasterCanDo, 0, 0,
+                         (void *)vst_bridge_host_can_do[i], 0);
+
+  // the DAW may not have updated its own yet
+  if (opcode == effSetSampleRate)
+    info->sample_rate = opt;
+  else if (opcode == effSetBlockSize)
+    info->block_size = value;
+
+  rq.tag = 0;
+  rq.cmd = VST_BRIDGE_CMD_HOST_INFO;
+  vst_bridge_send_async(vbe, &rq, VST_BRIDGE_HOST_INFO_LEN);
+}
+
+/* whether the query goes through the cache, for this instance */
+bool vst_bridge_queries_cached(struct vst_bridge_effect *vbe, VstInt32 opcode)
+{
+  return g_queries && vst_bridge_queries_cacheable(opcode) &&
+    !(opcode == effGetProgramNameIndexed && vbe->own_programs);
+}
+
+/* answers a query from the cache; false if the plugin has to */
+bool vst_bridge_queries_answer(struct vst_bridge_effect *vbe,
+                               VstInt32   opcode,
+                               VstInt32   index,
+                               VstIntPtr  value,
+                               void      *ptr,
+                               VstIntPtr *ret)
+{
+  int64_t answer;
+
+  if (!vst_bridge_queries_cached(vbe, opcode) ||
+      !vst_bridge_queries_get(g_queries, opcode, index, value, ptr, &answer))
+    return false;
+  *ret = answer;
+  return true;
+}
+
+/* the plugin's answer, for the next sessions */
+void vst_bridge_queries_record(struct vst_bridge_effect *vbe,
+                               VstInt32    opcode,
+                               VstInt32    index,
+                               VstIntPtr   value,
+                               const void *ptr,
+                               VstIntPtr   ret)
+{
+  if (vst_bridge_queries_cached(vbe, opcode))
+    vst_bridge_queries_put(g_queries, opcode, index, value, ptr, ret);
+}
+
+/*
+ * Asks the plugin the queries the cache answered, once the host is up,
+ * and has the DAW ask again if an answer changed. Then saves the cache,
+ * with the dll's hash.
+ */
+void *vst_bridge_queries_checker(void *arg)
+{
+  struct vst_bridge_effect *vbe = (struct vst_bridge_effect *)arg;
+  struct vst_bridge_request *answer;
+  struct vst_bridge_query query;
+  bool changed = false;
+  bool alive;
+  void *ptr;
+  VstIntPtr ret;
+
+  // whatever the plugin writes, it fits in a request
+  answer = (struct vst_bridge_request *)malloc(sizeof (*answer));
+  if (!answer)
+    return NULL;
+
+  vst_bridge_wait_started(vbe);
+  while (vst_bridge_queries_next(g_queries, &query)) {
+    if (query.opcode == effGetProgramNameIndexed && vbe->own_programs)
+      continue;
+
+    ptr = query.opcode == effCanDo ? (void *)query.key : (void *)answer;
+    memset(answer, 0, sizeof (*answer));
+    pthread_mutex_lock(&vbe->lock);
+    alive = !vbe->dead && !vbe->close_flag;
+    if (alive) {
+      ret   = vst_bridge_call_effect_dispatcher2(&vbe->e, query.opcode, query.index,
+                                                 query.value, ptr, 0);
+      alive = !vbe->dead;
+    }
+    pthread_mutex_unlock(&vbe->lock);
+    if (!alive)
+      break;
+    if (!vst_bridge_queries_check(g_queries, &query, ptr, ret))
+      changed = true;
+  }
+  free(answer);
+
+  // the instance is going, the DAW is waiting for us
+  vst_bridge_queries_save(g_queries, !vbe->close_flag);
+  if (changed && !vbe->close_flag)
+    vbe->audio_master(&vbe->e, audioMasterUpdateDisplay, 0, 0, NULL, 0);
+  return NULL;
+}
+
+/* opens the dll's cache for the first instance, which checks it too */
+void vst_bridge_queries_init(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&g_queries_lock);
+  // a chain's queries are its plugins', which can be chained differently
+  if (!g_queries_opened && g_config.query_cache &&
+      !strstr(g_plugin_path, VST_BRIDGE_CHAIN_SEP))
+    g_queries = vst_bridge_queries_open(g_plugin_path, vbe->e.uniqueID, vbe->e.version);
+  g_queries_opened = true;
+  pthread_mutex_unlock(&g_queries_lock);
+
+  if (g_queries && vst_bridge_queries_claim(g_queries) &&
+      !pthread_create(&vbe->checker, NULL, vst_bridge_queries_checker, vbe))
+    vbe->has_checker = true;
+}
+
 VstIntPtr vst_bridge_call_effect_dispatcher(AEffect*  effect,
                                             VstInt32  opcode,
                                             VstInt32  index,
@@ -724,12 +3237,72 @@ VstIntPtr vst_bridge_call_effect_dispatcher(AEffect*  effect,
                                             void*     ptr,
                                             float     opt)
 {
-  struct vst_bridge_effect *vbe = container_of(effect, struct vst_bridge_effect, e);
+  struct vst_bridge_effect *vbe = vst_bridge_effect_of(effect);
+  uint64_t start = vbe->capture ? vst_bridge_capture_now() : 0;
+  bool latency_changed = false;
+  VstIntPtr ret;
+
+  // the events for the next block, from the audio thread
+  if (opcode == effProcessEvents && vbe->reblock.out &&
+      (vst_bridge_is_audio_thread(vbe) || !vbe->has_audio_thread)) {
+    // for the block the DAW's next call goes to, even before the first
+    ret = vst_bridge_reblock_events(vbe, (struct VstEvents *)ptr);
+  } else if (opcode == effProcessEvents && vst_bridge_is_audio_thread(vbe)) {
+    pthread_mutex_lock(&vbe->audio_lock);
+    ret = vbe->dead ? 0 : vst_bridge_process_events(vbe, &vbe->audio, vbe->process_rq,
+                                                    index, value,
+                                                    (struct VstEvents *)ptr, opt);
+    pthread_mutex_unlock(&vbe->audio_lock);
+  } else if (vst_bridge_queries_answer(vbe, opcode, index, value, ptr, &ret)) {
+    // from the cache, neither the host nor the lock are needed
+  } else {
+    if (vbe->starting && !vst_bridge_start_local(vbe, opcode, index))
+      vst_bridge_wait_started(vbe);
+
+    pthread_mutex_lock(&vbe->lock);
+    vst_bridge_state_track(vbe, opcode, index, value, opt);
+    if (opcode == effSetBlockSize) {
+      // with VST_BRIDGE_REBLOCK, the plugin's blocks are the stage's
+      vst_bridge_process_resize(vbe, MAX(value, vbe->reblock.frames));
+      latency_changed = vst_bridge_pipeline_resize(
+        vbe, vbe->reblock.frames ? vbe->reblock.frames : value);
+    } else if (opcode == effMainsChanged) {
+      vst_bridge_pipeline_flush(vbe);
+      if (value)
+        vst_bridge_reblock_resize(vbe);
+    } else if (opcode == effSetChunk && value > 0)
+      vst_bridge_snapshot_copy(vbe, index, ptr, value);
+    if ((!vbe->dead || vbe->starting) &&
+        (opcode == effSetSampleRate || opcode == effSetBlockSize ||
+         opcode == effMainsChanged))
+      vst_bridge_host_info_push(vbe, opcode, value, opt);
+
+    if (vbe->starting)
+      ret = vst_bridge_dispatch_starting(vbe, opcode, index, value, ptr, opt);
+    else if (vbe->dead)
+      ret = vst_bridge_dispatch_dead(vbe, opcode, index, value, ptr, opt);
+    else {
+      ret = vst_bridge_call_effect_dispatcher2(effect, opcode, index, value, ptr, opt);
+      if (!vbe->dead)
+        vst_bridge_queries_record(vbe, opcode, index, value, ptr, ret);
+    }
 
-  pthread_mutex_lock(&vbe->lock);
-  VstIntPtr ret =  vst_bridge_call_effect_dispatcher2(
-    effect, opcode, index, value, ptr, opt);
-  pthread_mutex_unlock(&vbe->lock);
+    if (opcode == effGetChunk && ret > 0 && !vbe->dead)
+      vst_bridge_snapshot_copy(vbe, index, *(void **)ptr, ret);
+    else if (opcode == effEditIdle || opcode == __effIdleDeprecated)
+      vst_bridge_snapshot_maybe(vbe, false);
+    else if (opcode == effEditClose || (opcode == effMainsChanged && !value))
+      vst_bridge_snapshot_maybe(vbe, true);
+    pthread_mutex_unlock(&vbe->lock);
+  }
+
+  // the pipeline's latency follows the block size
+  if (latency_changed)
+    vbe->audio_master(&vbe->e, audioMasterIOChanged, 0, 0, NULL, 0);
+
+  if (vbe->capture)
+    vst_bridge_capture_call(vbe->capture, VST_BRIDGE_CAPTURE_DISPATCHER,
+                            opcode, index, value, ptr, opt, start);
 
   if (!vbe->close_flag)
     return ret;
@@ -738,17 +3311,25 @@ VstIntPtr vst_bridge_call_effect_dispatcher(AEffect*  effect,
   return ret;
 }
 
-bool vst_bridge_call_plugin_main(struct vst_bridge_effect *vbe)
+bool vst_bridge_send_plugin_main(struct vst_bridge_effect *vbe)
 {
   struct vst_bridge_request rq;
 
+  // answers the plugin's queries from its VSTPluginMain already
+  vst_bridge_host_info_push(vbe, 0, 0, 0);
+
   rq.tag = 0;
   rq.cmd = VST_BRIDGE_CMD_PLUGIN_MAIN;
-  if (write(vbe->socket, &rq, sizeof (rq)) != sizeof (rq))
-    return false;
+  return vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_RQ_LEN) == VST_BRIDGE_RQ_LEN;
+}
+
+/* reads the host's reply to PLUGIN_MAIN, serving the plugin's callbacks */
+bool vst_bridge_wait_plugin_main(struct vst_bridge_effect *vbe)
+{
+  struct vst_bridge_request rq;
 
   while (true) {
-    ssize_t rbytes = read(vbe->socket, &rq, sizeof (rq));
+    ssize_t rbytes = read(vbe->ctl.socket, &rq, sizeof (rq));
     if (rbytes <= 0)
       return false;
 
@@ -756,15 +3337,17 @@ bool vst_bridge_call_plugin_main(struct vst_bridge_effect *vbe)
 
     switch (rq.cmd) {
     case VST_BRIDGE_CMD_PLUGIN_DATA:
-      copy_plugin_data(vbe, &rq);
+      copy_plugin_data(vbe, &rq.plugin_data);
       break;
 
     case VST_BRIDGE_CMD_PLUGIN_MAIN:
-      copy_plugin_data(vbe, &rq);
+      copy_plugin_data(vbe, &rq.plugin_data);
       return true;
 
     case VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK:
-      vst_bridge_handle_audio_master(vbe, &rq);
+    case VST_BRIDGE_CMD_AUDIO_MASTER_NOTIFY:
+    case VST_BRIDGE_CMD_AUTOMATE:
+      vst_bridge_handle_callback(vbe, &vbe->ctl, &rq);
       break;
 
     default:
@@ -774,6 +3357,370 @@ bool vst_bridge_call_plugin_main(struct vst_bridge_effect *vbe)
   }
 }
 
+bool vst_bridge_call_plugin_main(struct vst_bridge_effect *vbe)
+{
+  return vst_bridge_send_plugin_main(vbe) && vst_bridge_wait_plugin_main(vbe);
+}
+
+/* forks the host, which loads the dll and waits for PLUGIN_MAIN */
+bool vst_bridge_spawn_host(int *sock, int *audio_sock, pid_t *child)
+{
+  int fds[2];
+  int audio_fds[2];
+
+  // initialize sockets, not inherited by the hosts the other threads spawn
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds))
+    return false;
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, audio_fds)) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  // the child only execs: the other threads may hold malloc's or the
+  // log's locks, so its arguments and environment are made here
+  char buff[8];
+  char audio_buff[8];
+  char failed[2 * PATH_MAX + 128];
+  snprintf(buff, sizeof (buff), "%d", fds[1]);
+  snprintf(audio_buff, sizeof (audio_buff), "%d", audio_fds[1]);
+  snprintf(failed, sizeof (failed),
+           "[CRIT] P: Failed to spawn child process: /bin/sh %s %s %s %s\n",
+           g_host_path, g_plugin_path, buff, audio_buff);
+
+  // A hack to cheat GCC optimisation. If we'd simply compare
+  // g_plugin_wineprefix to VST_BRIDGE_TPL_WINEPREFIX, the
+  // whole if(strcmp(...)) {} will disappear in the assembly.
+  char *local_plugin_wineprefix = strdup(g_plugin_wineprefix);
+  char wineprefix[PATH_MAX + 16];
+  size_t nenv = 0;
+  while (environ[nenv])
+    ++nenv;
+  char **env = (char **)malloc((nenv + 2) * sizeof (*env));
+  if (!local_plugin_wineprefix || !env) {
+    free(local_plugin_wineprefix);
+    free(env);
+    close(fds[0]);
+    close(fds[1]);
+    close(audio_fds[0]);
+    close(audio_fds[1]);
+    return false;
+  }
+  size_t j = 0;
+  bool set_prefix = strcmp(local_plugin_wineprefix, VST_BRIDGE_TPL_WINEPREFIX) != 0;
+  for (size_t i = 0; i < nenv; ++i)
+    if (!set_prefix || strncmp(environ[i], "WINEPREFIX=", 11)) // Should we really override an existing var?
+      env[j++] = environ[i];
+  if (set_prefix) {
+    snprintf(wineprefix, sizeof (wineprefix), "WINEPREFIX=%s", local_plugin_wineprefix);
+    env[j++] = wineprefix;
+  }
+  env[j] = NULL;
+  free(local_plugin_wineprefix);
+
+  // fork
+  *child = fork();
+  if (*child == -1) {
+    free(env);
+    close(fds[0]);
+    close(fds[1]);
+    close(audio_fds[0]);
+    close(audio_fds[1]);
+    return false;
+  }
+
+  if (!*child) {
+    // in the child
+    fcntl(fds[1], F_SETFD, 0);
+    fcntl(audio_fds[1], F_SETFD, 0);
+    execle("/bin/sh", "/bin/sh", g_host_path, g_plugin_path, buff, audio_buff,
+           (char *)NULL, env);
+    // the log thread doesn't survive fork(), nor do the atexit handlers
+    ssize_t ret = write(STDERR_FILENO, failed, strlen(failed));
+    (void)ret;
+    _exit(1);
+  }
+
+  // in the father
+  free(env);
+  close(fds[1]);
+  close(audio_fds[1]);
+  *sock       = fds[0];
+  *audio_sock = audio_fds[0];
+  return true;
+}
+
+/* spawns hosts until there are enough spares */
+void vst_bridge_spares_fill(void)
+{
+  pthread_mutex_lock(&g_spares_lock);
+  while (g_spares.size() < (size_t)g_config.warm_spares) {
+    struct vst_bridge_spare spare;
+    if (!vst_bridge_spawn_host(&spare.socket, &spare.audio_socket, &spare.child))
+      break;
+    g_spares.push_back(spare);
+  }
+  pthread_mutex_unlock(&g_spares_lock);
+}
+
+/* a warm spare if there is one, a new host otherwise */
+bool vst_bridge_take_host(int *sock, int *audio_sock, pid_t *child)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&g_spares_lock);
+  if (!g_spares.empty()) {
+    *sock       = g_spares.front().socket;
+    *audio_sock = g_spares.front().audio_socket;
+    *child      = g_spares.front().child;
+    g_spares.pop_front();
+    found = true;
+  }
+  pthread_mutex_unlock(&g_spares_lock);
+
+  if (found) {
+    vst_bridge_spares_fill();
+    return true;
+  }
+  return vst_bridge_spawn_host(sock, audio_sock, child);
+}
+
+/* replays the state on a new host, called with the lock held */
+void vst_bridge_restore(struct vst_bridge_effect *vbe)
+{
+  struct vst_bridge_state *st = &vbe->state;
+  struct vst_bridge_request rq;
+
+  if (st->opened)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effOpen, 0, 0, NULL, 0);
+  if (vbe->sample_rate > 0)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effSetSampleRate, 0, 0, NULL,
+                                       vbe->sample_rate);
+  if (st->block_size > 0)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effSetBlockSize, 0, st->block_size,
+                                       NULL, 0);
+  if (st->precision >= 0)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effSetProcessPrecision, 0,
+                                       st->precision, NULL, 0);
+  if (st->program >= 0)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effSetProgram, 0, st->program, NULL, 0);
+  if (st->snapshot)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effSetChunk, st->snapshot_index,
+                                       st->snapshot_size, st->snapshot, 0);
+
+  // then the parameters which changed since the snapshot
+  for (int32_t i = 0; ; ++i) {
+    pthread_mutex_lock(&vbe->params_lock);
+    bool  last  = i >= st->nparams;
+    float value = last ? NAN : st->params[i];
+    pthread_mutex_unlock(&vbe->params_lock);
+    if (last)
+      break;
+    if (isnan(value))
+      continue;
+    rq.tag             = vbe->ctl.next_tag;
+    rq.cmd             = VST_BRIDGE_CMD_SET_PARAMETER;
+    rq.param.index     = i;
+    rq.param.value     = value;
+    vbe->ctl.next_tag += 2;
+    vst_bridge_send(vbe, &vbe->ctl, &rq, VST_BRIDGE_PARAM_LEN);
+  }
+
+  if (st->mains_on)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effMainsChanged, 0, 1, NULL, 0);
+  if (st->processing)
+    vst_bridge_call_effect_dispatcher2(&vbe->e, effStartProcess, 0, 0, NULL, 0);
+}
+
+bool vst_bridge_restart(struct vst_bridge_effect *vbe)
+{
+  int sock;
+  int audio_sock;
+  pid_t child;
+
+  // the new host starts while the old one is cleaned up
+  if (!vst_bridge_take_host(&sock, &audio_sock, &child))
+    return false;
+
+  pthread_mutex_lock(&vbe->lock);
+  vst_bridge_reader_suspend(vbe);
+  pthread_mutex_lock(&vbe->audio_lock);
+  close(vbe->ctl.socket);
+  close(vbe->audio.socket);
+  kill(vbe->child, SIGKILL);
+  waitpid(vbe->child, NULL, 0);
+  vbe->ctl.socket   = sock;
+  vbe->audio.socket = audio_sock;
+  vbe->child        = child;
+  vbe->ctl.pending.clear();
+  vbe->ctl.late_tags.clear();
+  vbe->ctl.async_tags.clear();
+  vbe->audio.pending.clear();
+  vbe->audio.late_tags.clear();
+  if (vbe->pipeline.fifo)
+    vst_bridge_pipeline_clear(&vbe->pipeline, vbe->pipeline.sample_size);
+  vbe->rt_policy   = SCHED_OTHER;
+  vbe->rt_priority = 0;
+  vbe->host_process_level = -1;
+  pthread_mutex_unlock(&vbe->audio_lock);
+
+  uint32_t deaths = vbe->deaths;
+  bool ok = vst_bridge_call_plugin_main(vbe);
+  if (ok && vbe->has_reader)
+    vst_bridge_reader_resume(vbe);
+  if (ok && vbe->events)
+    vst_bridge_events_attach(vbe);
+  if (ok) {
+    // the dispatcher answers locally until we're done
+    vst_bridge_restore(vbe);
+    ok = deaths == vbe->deaths;
+  }
+  if (ok) {
+    uint64_t ns = vst_bridge_now_ns() - vbe->died_ns;
+    ++vbe->stats.restarts;
+    vbe->stats.recovery_ns_last = ns;
+    if (ns > vbe->stats.recovery_ns_max)
+      vbe->stats.recovery_ns_max = ns;
+    vbe->dead = false;
+    CRIT("the host is back after %llu ms\n", ns / 1000000);
+  } else {
+    ++vbe->stats.restart_failures;
+  }
+  pthread_mutex_unlock(&vbe->lock);
+  return ok;
+}
+
+/*
+ * The real plugin against the info the bridge was made with, once the
+ * host is up; true if the DAW has to be told that the I/O changed.
+ * Called with the lock held.
+ */
+bool vst_bridge_info_check(struct vst_bridge_effect *vbe,
+                           const struct vst_bridge_plugin_info *info)
+{
+  const struct vst_bridge_plugin_data *data = &info->plugin_data;
+  const AEffect *e = &vbe->e;
+
+  if (e->numPrograms == data->numPrograms && e->numParams == data->numParams &&
+      e->numInputs == data->numInputs && e->numOutputs == data->numOutputs &&
+      e->flags == data->flags &&
+      e->initialDelay - vst_bridge_latency(vbe) == data->initialDelay &&
+      e->uniqueID == data->uniqueID && e->version == data->version)
+    return false;
+
+  CRIT("%s isn't what the bridge was made with, run vst-bridge-scanner and"
+       " vst-bridge-maker again\n", g_plugin_path);
+
+  pthread_mutex_lock(&vbe->params_lock);
+  if (e->numParams != vbe->state.nparams) {
+    float *params = (float *)realloc(vbe->state.params, e->numParams * sizeof (float));
+    if (params || !e->numParams) {
+      for (int32_t i = vbe->state.nparams; i < e->numParams; ++i)
+        params[i] = NAN;
+      vbe->state.params  = params;
+      vbe->state.nparams = e->numParams;
+    }
+  }
+  pthread_mutex_unlock(&vbe->params_lock);
+
+  return e->numInputs != data->numInputs || e->numOutputs != data->numOutputs ||
+    e->initialDelay - vst_bridge_latency(vbe) != data->initialDelay;
+}
+
+void vst_bridge_started(struct vst_bridge_effect *vbe)
+{
+  pthread_mutex_lock(&vbe->start_lock);
+  vbe->starting = false;
+  pthread_cond_broadcast(&vbe->start_cond);
+  pthread_mutex_unlock(&vbe->start_lock);
+}
+
+/*
+ * Waits for the host a lazy VSTPluginMain spawned to answer PLUGIN_MAIN,
+ * then replays what the DAW did meanwhile, like after a restart. If the
+ * host doesn't make it, the supervisor takes over.
+ */
+void *vst_bridge_starter(void *arg)
+{
+  struct vst_bridge_effect *vbe = (struct vst_bridge_effect *)arg;
+  bool io_changed = false;
+  bool ok;
+
+  t_starting = vbe;
+  ok = vst_bridge_wait_plugin_main(vbe);
+
+  pthread_mutex_lock(&vbe->lock);
+  if (vbe->start_abort) {
+    vst_bridge_started(vbe);
+    pthread_mutex_unlock(&vbe->lock);
+    return NULL;
+  }
+
+  if (ok)
+    io_changed = vst_bridge_info_check(vbe, vst_bridge_embedded_info());
+  else
+    // the supervisor gives the reader a new host
+    vbe->reader_broken = true;
+  if (!vst_bridge_reader_start(vbe)) {
+    CRIT("failed to start the reader: %m\n");
+    vst_bridge_started(vbe);
+    pthread_mutex_unlock(&vbe->lock);
+    return NULL;
+  }
+
+  uint32_t deaths = vbe->deaths;
+  if (ok) {
+    vst_bridge_events_attach(vbe);
+    vst_bridge_restore(vbe);
+    ok = deaths == vbe->deaths;
+  }
+  vbe->dead = !ok;
+  vst_bridge_started(vbe);
+  if (!ok) {
+    CRIT("the host failed to start%s\n", vbe->has_supervisor ? ", restarting it" : "");
+    vbe->died_ns = vst_bridge_now_ns();
+    vst_bridge_supervisor_wake(vbe);
+  }
+  pthread_mutex_unlock(&vbe->lock);
+
+  if (io_changed)
+    vbe->audio_master(&vbe->e, audioMasterIOChanged, 0, 0, NULL, 0);
+  return NULL;
+}
+
+void *vst_bridge_supervisor(void *arg)
+{
+  struct vst_bridge_effect *vbe = (struct vst_bridge_effect *)arg;
+  int failures = 0;
+  bool retry = false;
+
+  pthread_mutex_lock(&vbe->supervisor_lock);
+  while (!vbe->supervisor_stop) {
+    if (!vbe->restart) {
+      pthread_cond_wait(&vbe->supervisor_cond, &vbe->supervisor_lock);
+      continue;
+    }
+    vbe->restart = false;
+    pthread_mutex_unlock(&vbe->supervisor_lock);
+
+    retry = false;
+    if (vst_bridge_restart(vbe)) {
+      failures = 0;
+    } else if (++failures < 5) {
+      CRIT("failed to restart the host, retrying\n");
+      sleep(failures);
+      retry = true;
+    } else {
+      CRIT("failed to restart the host, giving up\n");
+    }
+
+    pthread_mutex_lock(&vbe->supervisor_lock);
+    vbe->restart = vbe->restart || retry;
+  }
+  pthread_mutex_unlock(&vbe->supervisor_lock);
+  return NULL;
+}
+
 extern "C" {
   AEffect* VSTPluginMain(audioMasterCallback audio_master);
   AEffect* VSTPluginMain2(audioMasterCallback audio_master) asm ("main");
@@ -786,19 +3733,21 @@ AEffect* VSTPluginMain2(audioMasterCallback audio_master)
 
 AEffect* VSTPluginMain(audioMasterCallback audio_master)
 {
+  const struct vst_bridge_plugin_info *info;
   struct vst_bridge_effect *vbe = NULL;
-  int fds[2];
 
-  if (!g_log) {
+  {
 #ifdef DEBUG
       char path[128];
       snprintf(path, sizeof (path), "/tmp/vst-bridge-plugin.%d.log", getpid());
-      g_log = fopen(path, "w+");
+      vst_bridge_log_open(path);
 #else
-      g_log = stdout;
+      vst_bridge_log_open(NULL);
 #endif
   }
 
+  vst_bridge_config_load(&g_config);
+
   // allocate the context
   vbe = new vst_bridge_effect;
   if (!vbe)
@@ -807,6 +3756,7 @@ AEffect* VSTPluginMain(audioMasterCallback audio_master)
   // XXX move to the class description
   vbe->audio_master             = audio_master;
   vbe->e.user                   = NULL;
+  vbe->e.object                 = vbe;
   vbe->e.magic                  = kEffectMagic;
   vbe->e.dispatcher             = vst_bridge_call_effect_dispatcher;
   vbe->e.setParameter           = vst_bridge_call_set_parameter;
@@ -817,55 +3767,76 @@ AEffect* VSTPluginMain(audioMasterCallback audio_master)
   vbe->show_window              = false;
   vbe->display                  = NULL;
 
-  // initialize sockets
-  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
-    goto failed_sockets;
-  vbe->socket = fds[0];
-
-  // fork
-  vbe->child = fork();
-  if (vbe->child == -1)
-    goto failed_fork;
-
-  if (!vbe->child) {
-    // in the child
-
-    // A hack to cheat GCC optimisation. If we'd simply compare
-    // g_plugin_wineprefix to VST_BRIDGE_TPL_WINEPREFIX, the
-    // whole if(strcmp(...)) {} will disappear in the assembly.
+  vbe->process_rq = (struct vst_bridge_request *)malloc(sizeof (*vbe->process_rq));
+  if (!vbe->process_rq)
+    goto failed;
+  vst_bridge_rt_lock_memory(vbe->process_rq, sizeof (*vbe->process_rq));
+  vbe->out_events = (uint8_t *)malloc(sizeof (vbe->process_rq->data));
+  vbe->out_ves    = (struct VstEvents *)malloc(
+    sizeof (struct VstEvents) + VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+  if (!vbe->out_events || !vbe->out_ves)
+    goto failed;
+  vst_bridge_rt_lock_memory(vbe->out_events, sizeof (vbe->process_rq->data));
+  vst_bridge_rt_lock_memory(vbe->out_ves, sizeof (struct VstEvents) +
+                            VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+
+  vbe->reblock.frames = g_config.reblock;
+  if (vbe->reblock.frames) {
+    vbe->reblock.events = (uint8_t *)malloc(VST_BRIDGE_REBLOCK_EVENTS_SIZE);
+    vbe->reblock.ves    = (struct VstEvents *)malloc(
+      sizeof (struct VstEvents) + VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+    if (!vbe->reblock.events || !vbe->reblock.ves)
+      goto failed;
+    vst_bridge_rt_lock_memory(vbe->reblock.events, VST_BRIDGE_REBLOCK_EVENTS_SIZE);
+    vst_bridge_rt_lock_memory(vbe->reblock.ves, sizeof (struct VstEvents) +
+                              VST_BRIDGE_EVENTS_MAX * sizeof (VstEvent *));
+  }
 
-    char *local_plugin_wineprefix = strdup(g_plugin_wineprefix);
-    if (strcmp(local_plugin_wineprefix, VST_BRIDGE_TPL_WINEPREFIX) != 0)
-      setenv("WINEPREFIX", local_plugin_wineprefix, 1); // Should we really override an existing var?
-    free(local_plugin_wineprefix);
+  if (!vst_bridge_take_host(&vbe->ctl.socket, &vbe->audio.socket, &vbe->child))
+    goto failed;
 
-    char buff[8];
-    close(fds[0]);
-    snprintf(buff, sizeof (buff), "%d", fds[1]);
-    execl("/bin/sh", "/bin/sh", g_host_path, g_plugin_path, buff, NULL);
-    CRIT("Failed to spawn child process: /bin/sh %s %s %s\n", g_host_path, g_plugin_path, buff);
-    exit(1);
+  info = g_config.lazy ? vst_bridge_embedded_info() : NULL;
+  if (info) {
+    // the DAW gets the embedded info, the host comes up in the background
+    copy_plugin_data(vbe, &info->plugin_data);
+    vbe->dead     = true;
+    vbe->starting = true;
+    if (!vst_bridge_send_plugin_main(vbe))
+      goto failed;
+  } else {
+    // forward plugin main
+    if (!vst_bridge_call_plugin_main(vbe))
+      goto failed;
+
+    LOG(" => PluginMain done!\n");
+
+    if (!vst_bridge_reader_start(vbe))
+      goto failed;
+    vst_bridge_events_attach(vbe);
   }
 
-  // in the father
-  close(fds[1]);
-
-  // forward plugin main
-  if (!vst_bridge_call_plugin_main(vbe)) {
-    close(vbe->socket);
-    delete vbe;
-    return NULL;
+  vbe->state.params = (float *)malloc(vbe->e.numParams * sizeof (float));
+  if (vbe->state.params)
+    vbe->state.nparams = vbe->e.numParams;
+  for (int32_t i = 0; i < vbe->state.nparams; ++i)
+    vbe->state.params[i] = NAN;
+
+  if (g_config.restart &&
+      !pthread_create(&vbe->supervisor, NULL, vst_bridge_supervisor, vbe))
+    vbe->has_supervisor = true;
+  if (info) {
+    if (pthread_create(&vbe->starter, NULL, vst_bridge_starter, vbe))
+      goto failed;
+    vbe->has_starter = true;
   }
+  vst_bridge_spares_fill();
+  vst_bridge_queries_init(vbe);
 
-  LOG(" => PluginMain done!\n");
+  vbe->capture = vst_bridge_capture_open(&vbe->e, g_plugin_path);
 
   // Return the VST AEffect structure
   return &vbe->e;
 
-  failed_fork:
-  close(fds[0]);
-  close(fds[1]);
-  failed_sockets:
   failed:
   delete vbe;
   return NULL;
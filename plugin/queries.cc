@@ -0,0 +1,519 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#define __cdecl
+
+#include "../common/log.h"
+#include "../common/catalog.h"
+#include "queries.h"
+
+#include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+// longer strings aren't cached, and dropped from the file
+#define VST_BRIDGE_QUERIES_MAX_STRING 256
+#define VST_BRIDGE_QUERIES_FIELDS 7
+
+struct vst_bridge_queries_less {
+  bool operator()(const vst_bridge_query &a, const vst_bridge_query &b) const
+  {
+    if (a.opcode != b.opcode)
+      return a.opcode < b.opcode;
+    if (a.index != b.index)
+      return a.index < b.index;
+    if (a.value != b.value)
+      return a.value < b.value;
+    return strcmp(a.key, b.key) < 0;
+  }
+};
+
+struct vst_bridge_queries_answer {
+  int64_t     ret;
+  std::string data;
+  // the plugin answered something else once, it is always asked now
+  bool        is_volatile;
+  // from the plugin, this session: not to be checked
+  bool        checked;
+};
+
+typedef std::map<vst_bridge_query, vst_bridge_queries_answer,
+                 vst_bridge_queries_less> vst_bridge_queries_map;
+
+struct vst_bridge_queries {
+  pthread_mutex_t        lock;
+  // the file
+  char                   path[PATH_MAX];
+  char                   dll[PATH_MAX];
+  int64_t                size;
+  int64_t                mtime;
+  // 0 until the dll is hashed
+  uint64_t               hash;
+  int32_t                unique_id;
+  int32_t                version;
+  vst_bridge_queries_map answers;
+  bool                   dirty;
+  bool                   claimed;
+};
+
+bool vst_bridge_queries_cacheable(int32_t opcode)
+{
+  switch (opcode) {
+  case effGetParamName:
+  case effGetParameterProperties:
+  case effGetProgramNameIndexed:
+  case effGetInputProperties:
+  case effGetOutputProperties:
+  case effGetEffectName:
+  case effGetVendorString:
+  case effGetProductString:
+  case effGetVendorVersion:
+  case effGetVstVersion:
+  case effGetPlugCategory:
+  case effGetNumMidiInputChannels:
+  case effGetNumMidiOutputChannels:
+  case effCanDo:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+static bool vst_bridge_queries_is_string(int32_t opcode)
+{
+  return opcode == effGetParamName || opcode == effGetProgramNameIndexed ||
+    opcode == effGetEffectName || opcode == effGetVendorString ||
+    opcode == effGetProductString;
+}
+
+/* whether the plugin wrote its answer: it doesn't if it can't answer, bar effGetParamName, which is void */
+static bool vst_bridge_queries_wrote(int32_t opcode, int64_t ret)
+{
+  return ret || opcode == effGetParamName;
+}
+
+/* the index and value which matter to the answer; false if it can't be cached */
+static bool vst_bridge_queries_key(int32_t                  opcode,
+                                   int32_t                  index,
+                                   int64_t                  value,
+                                   const void              *ptr,
+                                   struct vst_bridge_query *query)
+{
+  memset(query, 0, sizeof (*query));
+  query->opcode = opcode;
+  switch (opcode) {
+  case effGetProgramNameIndexed:
+    query->value = value;
+    /* fall through */
+  case effGetParamName:
+  case effGetParameterProperties:
+  case effGetInputProperties:
+  case effGetOutputProperties:
+    query->index = index;
+    return ptr;
+
+  case effGetEffectName:
+  case effGetVendorString:
+  case effGetProductString:
+    return ptr;
+
+  case effCanDo:
+    if (!ptr || strlen((const char *)ptr) >= sizeof (query->key) ||
+        strpbrk((const char *)ptr, "\t\r\n"))
+      return false;
+    strcpy(query->key, (const char *)ptr);
+    return true;
+
+  default:
+    return true;
+  }
+}
+
+/* the most the plugin writes to ptr, bar the strings' NUL */
+static size_t vst_bridge_queries_size(int32_t opcode)
+{
+  if (vst_bridge_queries_is_string(opcode))
+    return VST_BRIDGE_QUERIES_MAX_STRING - 1;
+  if (opcode == effGetParameterProperties)
+    return sizeof (VstParameterProperties);
+  if (opcode == effGetInputProperties || opcode == effGetOutputProperties)
+    return sizeof (VstPinProperties);
+  return 0;
+}
+
+/* whether an answer read from the file is one the plugin could have given */
+static bool vst_bridge_queries_valid(int32_t opcode, int64_t ret, const std::string &data)
+{
+  if (!vst_bridge_queries_wrote(opcode, ret))
+    return data.empty();
+  if (vst_bridge_queries_is_string(opcode))
+    return data.size() <= vst_bridge_queries_size(opcode) &&
+      !memchr(data.data(), '\0', data.size());
+  return data.size() == vst_bridge_queries_size(opcode);
+}
+
+/* what the plugin wrote to ptr; false if it can't be cached */
+static bool vst_bridge_queries_data(int32_t      opcode,
+                                    const void  *ptr,
+                                    int64_t      ret,
+                                    std::string *data)
+{
+  size_t len;
+
+  data->clear();
+  if (!vst_bridge_queries_wrote(opcode, ret))
+    return true;
+  if (vst_bridge_queries_is_string(opcode)) {
+    len = strnlen((const char *)ptr, VST_BRIDGE_QUERIES_MAX_STRING);
+    if (len == VST_BRIDGE_QUERIES_MAX_STRING)
+      return false;
+    data->assign((const char *)ptr, len);
+  } else if (opcode == effGetParameterProperties)
+    data->assign((const char *)ptr, sizeof (VstParameterProperties));
+  else if (opcode == effGetInputProperties || opcode == effGetOutputProperties)
+    data->assign((const char *)ptr, sizeof (VstPinProperties));
+  return true;
+}
+
+/*
+ * Records an answer of the plugin; false if it isn't the one we had, the
+ * query is volatile then. Called with the lock held.
+ */
+static bool vst_bridge_queries_store(struct vst_bridge_queries     *q,
+                                     const struct vst_bridge_query *query,
+                                     const void                    *ptr,
+                                     int64_t                        ret)
+{
+  std::string data;
+
+  if (!vst_bridge_queries_data(query->opcode, ptr, ret, &data))
+    return true;
+
+  vst_bridge_queries_map::iterator it = q->answers.find(*query);
+  if (it == q->answers.end()) {
+    struct vst_bridge_queries_answer &answer = q->answers[*query];
+    answer.ret         = ret;
+    answer.data        = data;
+    answer.is_volatile = false;
+    answer.checked     = true;
+    q->dirty           = true;
+    return true;
+  }
+
+  struct vst_bridge_queries_answer &answer = it->second;
+  answer.checked = true;
+  if (answer.is_volatile || (answer.ret == ret && answer.data == data))
+    return true;
+
+  vst_bridge_log("[CRIT] P: queries: %s: the answer to %d(%d, %lld) changed,"
+                 " not caching it anymore\n", q->dll, query->opcode,
+                 query->index, (long long)query->value);
+  answer.is_volatile = true;
+  answer.data.clear();
+  q->dirty = true;
+  return false;
+}
+
+static void vst_bridge_queries_hex(FILE *file, const std::string &data)
+{
+  for (size_t i = 0; i < data.size(); ++i)
+    fprintf(file, "%02x", (uint8_t)data[i]);
+}
+
+static bool vst_bridge_queries_unhex(const char *str, std::string *data)
+{
+  unsigned byte;
+
+  data->clear();
+  for (; str[0] && str[1]; str += 2) {
+    if (sscanf(str, "%2x", &byte) != 1)
+      return false;
+    data->push_back((char)byte);
+  }
+  return !str[0];
+}
+
+/* splits a line, which it modifies, in count tab separated fields */
+static bool vst_bridge_queries_split(char *line, char **fields, int count)
+{
+  char *str = line;
+  int nfields;
+
+  line[strcspn(line, "\n")] = 0;
+  // strtok() would merge the empty fields
+  for (nfields = 0; nfields < count && str; ++nfields) {
+    fields[nfields] = str;
+    str = strchr(str, '\t');
+    if (str)
+      *str++ = 0;
+  }
+  return nfields == count && !str;
+}
+
+/* the header: true if the file is for the dll as it is now */
+static bool vst_bridge_queries_header(struct vst_bridge_queries *q,
+                                      FILE                      *file,
+                                      const struct stat         *st)
+{
+  char line[PATH_MAX + 256];
+  char *fields[6];
+  uint64_t hash;
+
+  if (!fgets(line, sizeof (line), file) ||
+      strncmp(line, VST_BRIDGE_QUERIES_MAGIC, strlen(VST_BRIDGE_QUERIES_MAGIC)) ||
+      !fgets(line, sizeof (line), file) || !vst_bridge_queries_split(line, fields, 6))
+    return false;
+
+  if (strcmp(fields[5], q->dll) ||
+      strtoll(fields[0], NULL, 10) != st->st_size ||
+      strtol(fields[3], NULL, 10) != q->unique_id ||
+      strtol(fields[4], NULL, 10) != q->version)
+    return false;
+
+  q->hash = strtoull(fields[2], NULL, 16);
+  if (strtoll(fields[1], NULL, 10) == st->st_mtime)
+    return true;
+
+  // a new mtime only, see vst_bridge_catalog_hash()
+  if (!q->hash || !vst_bridge_catalog_hash(q->dll, &hash) || hash != q->hash)
+    return false;
+  q->dirty = true;
+  return true;
+}
+
+static void vst_bridge_queries_load(struct vst_bridge_queries *q,
+                                    const struct stat         *st)
+{
+  char line[4096];
+  char *fields[VST_BRIDGE_QUERIES_FIELDS];
+  FILE *file;
+
+  file = fopen(q->path, "r");
+  if (!file)
+    return;
+
+  if (!vst_bridge_queries_header(q, file, st)) {
+    // another build of the dll, or another format: start over
+    q->hash  = 0;
+    q->dirty = false;
+    fclose(file);
+    return;
+  }
+
+  while (fgets(line, sizeof (line), file)) {
+    struct vst_bridge_queries_answer answer;
+    struct vst_bridge_query query;
+
+    if (!vst_bridge_queries_split(line, fields, VST_BRIDGE_QUERIES_FIELDS) ||
+        strlen(fields[5]) >= sizeof (query.key) ||
+        !vst_bridge_queries_unhex(fields[6], &answer.data))
+      continue;
+
+    memset(&query, 0, sizeof (query));
+    query.opcode = strtol(fields[1], NULL, 10);
+    query.index  = strtol(fields[2], NULL, 10);
+    query.value  = strtoll(fields[3], NULL, 10);
+    strcpy(query.key, fields[5]);
+    if (!vst_bridge_queries_cacheable(query.opcode))
+      continue;
+
+    answer.ret         = strtoll(fields[4], NULL, 10);
+    answer.is_volatile = !strcmp(fields[0], "volatile");
+    // the answers are copied to the DAW's buffers: a bad one is asked again
+    if (!answer.is_volatile && !vst_bridge_queries_valid(query.opcode, answer.ret, answer.data))
+      continue;
+    answer.checked     = false;
+    q->answers[query]  = answer;
+  }
+  fclose(file);
+}
+
+struct vst_bridge_queries *vst_bridge_queries_open(const char *dll,
+                                                   int32_t     unique_id,
+                                                   int32_t     version)
+{
+  struct vst_bridge_queries *q;
+  char name[64];
+  struct stat st;
+
+  if (stat(dll, &st))
+    return NULL;
+
+  q = new vst_bridge_queries;
+  if (!q)
+    return NULL;
+  pthread_mutex_init(&q->lock, NULL);
+  snprintf(name, sizeof (name), "queries/%016llx",
+           (unsigned long long)vst_bridge_fnv(VST_BRIDGE_FNV_BASIS, dll, strlen(dll)));
+  vst_bridge_cache_path(q->path, sizeof (q->path), name);
+  snprintf(q->dll, sizeof (q->dll), "%s", dll);
+  q->size      = st.st_size;
+  q->mtime     = st.st_mtime;
+  q->hash      = 0;
+  q->unique_id = unique_id;
+  q->version   = version;
+  q->dirty     = false;
+  q->claimed   = false;
+  vst_bridge_queries_load(q, &st);
+  return q;
+}
+
+/* see vst_bridge_replace_begin() */
+static bool vst_bridge_queries_write(struct vst_bridge_queries *q)
+{
+  char tmp[PATH_MAX + 32];
+  FILE *file;
+  int fd;
+
+  fd = vst_bridge_replace_begin(q->path, tmp, sizeof (tmp), 0644);
+  if (fd < 0)
+    return false;
+  file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    return vst_bridge_replace_end(q->path, tmp, false);
+  }
+
+  fprintf(file, "%s\n%lld\t%lld\t%016llx\t%d\t%d\t%s\n", VST_BRIDGE_QUERIES_MAGIC,
+          (long long)q->size, (long long)q->mtime, (unsigned long long)q->hash,
+          q->unique_id, q->version, q->dll);
+  for (vst_bridge_queries_map::iterator it = q->answers.begin();
+       it != q->answers.end(); ++it) {
+    fprintf(file, "%s\t%d\t%d\t%lld\t%lld\t%s\t",
+            it->second.is_volatile ? "volatile" : "ok", it->first.opcode,
+            it->first.index, (long long)it->first.value,
+            (long long)it->second.ret, it->first.key);
+    vst_bridge_queries_hex(file, it->second.data);
+    fputc('\n', file);
+  }
+
+  // no fsync(): losing the file only costs the next session its round trips
+  return vst_bridge_replace_end(q->path, tmp, !fclose(file));
+}
+
+void vst_bridge_queries_save(struct vst_bridge_queries *q, bool hash)
+{
+  uint64_t h;
+
+  pthread_mutex_lock(&q->lock);
+  hash = hash && !q->hash;
+  pthread_mutex_unlock(&q->lock);
+
+  // not under the lock, the DAW's queries would wait for it
+  if (hash && vst_bridge_catalog_hash(q->dll, &h)) {
+    pthread_mutex_lock(&q->lock);
+    q->hash  = h;
+    q->dirty = true;
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  pthread_mutex_lock(&q->lock);
+  if (q->dirty) {
+    if (vst_bridge_queries_write(q))
+      q->dirty = false;
+    else
+      vst_bridge_log("[CRIT] P: queries: %s: %m\n", q->path);
+  }
+  pthread_mutex_unlock(&q->lock);
+}
+
+bool vst_bridge_queries_get(struct vst_bridge_queries *q,
+                            int32_t                    opcode,
+                            int32_t                    index,
+                            int64_t                    value,
+                            void                      *ptr,
+                            int64_t                   *ret)
+{
+  struct vst_bridge_query query;
+  bool found = false;
+
+  if (!vst_bridge_queries_key(opcode, index, value, ptr, &query))
+    return false;
+
+  pthread_mutex_lock(&q->lock);
+  vst_bridge_queries_map::iterator it = q->answers.find(query);
+  if (it != q->answers.end() && !it->second.is_volatile) {
+    const std::string &data = it->second.data;
+    size_t size = std::min(data.size(), vst_bridge_queries_size(opcode));
+    if (vst_bridge_queries_is_string(opcode) && vst_bridge_queries_wrote(opcode, it->second.ret)) {
+      memcpy(ptr, data.data(), size);
+      ((char *)ptr)[size] = '\0';
+    } else if (size)
+      memcpy(ptr, data.data(), size);
+    *ret  = it->second.ret;
+    found = true;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return found;
+}
+
+void vst_bridge_queries_put(struct vst_bridge_queries *q,
+                            int32_t                    opcode,
+                            int32_t                    index,
+                            int64_t                    value,
+                            const void                *ptr,
+                            int64_t                    ret)
+{
+  struct vst_bridge_query query;
+
+  if (!vst_bridge_queries_key(opcode, index, value, ptr, &query))
+    return;
+
+  pthread_mutex_lock(&q->lock);
+  vst_bridge_queries_store(q, &query, ptr, ret);
+  pthread_mutex_unlock(&q->lock);
+}
+
+bool vst_bridge_queries_next(struct vst_bridge_queries *q,
+                             struct vst_bridge_query   *query)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&q->lock);
+  for (vst_bridge_queries_map::iterator it = q->answers.begin();
+       it != q->answers.end(); ++it) {
+    if (it->second.checked || it->second.is_volatile)
+      continue;
+    // asked once, whatever comes of it
+    it->second.checked = true;
+    *query = it->first;
+    found  = true;
+    break;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return found;
+}
+
+bool vst_bridge_queries_check(struct vst_bridge_queries     *q,
+                              const struct vst_bridge_query *query,
+                              const void                    *ptr,
+                              int64_t                        ret)
+{
+  bool same;
+
+  pthread_mutex_lock(&q->lock);
+  same = vst_bridge_queries_store(q, query, ptr, ret);
+  pthread_mutex_unlock(&q->lock);
+  return same;
+}
+
+bool vst_bridge_queries_claim(struct vst_bridge_queries *q)
+{
+  bool claimed;
+
+  pthread_mutex_lock(&q->lock);
+  claimed    = !q->claimed;
+  q->claimed = true;
+  pthread_mutex_unlock(&q->lock);
+  return claimed;
+}
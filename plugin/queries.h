@@ -0,0 +1,76 @@
+#ifndef PLUGIN_QUERIES_H
+# define PLUGIN_QUERIES_H
+
+# include <stdint.h>
+
+/*
+ * The plugin's answers to the queries which don't change from a session
+ * to the next (the names and properties of its parameters, programs and
+ * pins, its canDo, name, vendor and category), kept on the disk so that
+ * the next session answers them without the host. A file per dll, in
+ * $XDG_CACHE_HOME/vst-bridge/queries/, named after the hash of its path:
+ * a header line, the dll's size, mtime, hash, uniqueID, version and path,
+ * then a line per query, tab separated: status (ok, or volatile for the
+ * queries whose answer changed, which aren't cached anymore), opcode,
+ * index, value, return value, canDo string and the data, in hex.
+ *
+ * The answers served from the file are checked against the plugin's in
+ * the background, see vst_bridge_queries_next() and
+ * vst_bridge_queries_check().
+ */
+# define VST_BRIDGE_QUERIES_MAGIC "# vst-bridge queries 1"
+
+struct vst_bridge_queries;
+
+struct vst_bridge_query {
+  int32_t opcode;
+  int32_t index;
+  int64_t value;
+  // effCanDo's string
+  char    key[64];
+};
+
+/* whether the query is one to cache */
+bool vst_bridge_queries_cacheable(int32_t opcode);
+
+/* reads the dll's file, if it is for that build of it; NULL if there is no dll */
+struct vst_bridge_queries *vst_bridge_queries_open(const char *dll,
+                                                   int32_t     unique_id,
+                                                   int32_t     version);
+
+/* writes the file if it changed; hash the dll too if it isn't yet */
+void vst_bridge_queries_save(struct vst_bridge_queries *q, bool hash);
+
+/* answers from the file; false if the query isn't in it */
+bool vst_bridge_queries_get(struct vst_bridge_queries *q,
+                            int32_t                    opcode,
+                            int32_t                    index,
+                            int64_t                    value,
+                            void                      *ptr,
+                            int64_t                   *ret);
+
+/* records the plugin's answer */
+void vst_bridge_queries_put(struct vst_bridge_queries *q,
+                            int32_t                    opcode,
+                            int32_t                    index,
+                            int64_t                    value,
+                            const void                *ptr,
+                            int64_t                    ret);
+
+/* the next answer read from the file which the plugin didn't confirm yet */
+bool vst_bridge_queries_next(struct vst_bridge_queries *q,
+                             struct vst_bridge_query   *query);
+
+/*
+ * The plugin's answer to a query vst_bridge_queries_next() returned; false
+ * if it isn't the one in the file, and the query is volatile from now on.
+ */
+bool vst_bridge_queries_check(struct vst_bridge_queries     *q,
+                              const struct vst_bridge_query *query,
+                              const void                    *ptr,
+                              int64_t                        ret);
+
+/* true once per process, for the instance which checks the answers */
+bool vst_bridge_queries_claim(struct vst_bridge_queries *q);
+
+#endif /* !PLUGIN_QUERIES_H */
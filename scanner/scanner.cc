@@ -0,0 +1,624 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define __cdecl
+
+#include "../config.h"
+#include "../common/common.h"
+#include "../common/catalog.h"
+#include "../common/pe.h"
+
+#include "../vstsdk2.4/pluginterfaces/vst2.x/aeffectx.h"
+
+/*
+ * Probes Windows VST plugins through the bridge's host, a bounded number at
+ * a time, and keeps what it learns in a catalog, so a DAW or a script can
+ * list the plugins without loading them. A plugin is probed again only when
+ * its dll changes.
+ */
+
+struct scanner {
+  const char *host_path;
+  const char *wineprefix;
+  int         timeout_ms;
+  int         verbose;
+
+  pthread_mutex_t                                lock;
+  std::vector<struct vst_bridge_catalog_entry *> jobs;
+  size_t                                         next_job;
+  size_t                                         done;
+};
+
+static struct scanner g_scanner;
+static std::vector<std::string> g_dlls;
+
+static uint64_t scanner_now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* reads a reply, or the next message, from the host before the deadline */
+static ssize_t scanner_read(int sock, struct vst_bridge_request *rq, uint64_t deadline)
+{
+  struct pollfd pfd;
+  int64_t left;
+  ssize_t len;
+
+  while (true) {
+    left = deadline - scanner_now_ms();
+    if (left <= 0)
+      return -ETIMEDOUT;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, left) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    if (!pfd.revents)
+      continue;
+
+    len = read(sock, rq, sizeof (*rq));
+    if (len <= 0)
+      return len < 0 ? -errno : -EPIPE;
+    return len;
+  }
+}
+
+/*
+ * Waits for the reply to tag (the host replies to PLUGIN_MAIN with tag 0,
+ * so that one is recognized by its cmd) and answers the plugin's callbacks meanwhile,
+ * as a DAW which does nothing would: the queries about the DAW were answered
+ * by the host info, the others get 0.
+ */
+static int scanner_wait(int sock, struct vst_bridge_request *rq, uint32_t tag,
+                        struct vst_bridge_catalog_entry *entry, uint64_t deadline)
+{
+  ssize_t len;
+
+  while (true) {
+    len = scanner_read(sock, rq, deadline);
+    if (len < 0)
+      return len == -ETIMEDOUT ? VST_BRIDGE_CATALOG_TIMEOUT : VST_BRIDGE_CATALOG_FAILED;
+    if (len < VST_BRIDGE_RQ_LEN)
+      return VST_BRIDGE_CATALOG_FAILED;
+
+    if (rq->cmd == VST_BRIDGE_CMD_PLUGIN_MAIN ||
+        (rq->tag == tag && rq->cmd == VST_BRIDGE_CMD_EFFECT_DISPATCHER))
+      return VST_BRIDGE_CATALOG_OK;
+
+    switch (rq->cmd) {
+    case VST_BRIDGE_CMD_PLUGIN_DATA:
+      entry->info.plugin_data = rq->plugin_data;
+      break;
+
+    case VST_BRIDGE_CMD_AUDIO_MASTER_CALLBACK:
+      rq->amrq.value = rq->amrq.opcode == audioMasterVersion ? 2400 : 0;
+      rq->amrq.data[0] = 0;
+      if (write(sock, rq, VST_BRIDGE_AMRQ_LEN(1)) < 0)
+        return VST_BRIDGE_CATALOG_FAILED;
+      break;
+
+    default:
+      // automation and notifications, one way
+      break;
+    }
+  }
+}
+
+static int scanner_dispatch(int sock, struct vst_bridge_request *rq, uint32_t *tag,
+                            int32_t opcode, struct vst_bridge_catalog_entry *entry, uint64_t deadline)
+{
+  *tag += 2;
+  rq->tag        = *tag;
+  rq->cmd        = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+  rq->erq.opcode = opcode;
+  rq->erq.index  = 0;
+  rq->erq.value  = 0;
+  rq->erq.opt    = 0;
+  // the host hands its buffer to the plugin, which may leave the strings untouched
+  memset(rq->erq.data, 0, 256);
+  if (write(sock, rq, VST_BRIDGE_ERQ_LEN(256)) < 0)
+    return VST_BRIDGE_CATALOG_FAILED;
+  return scanner_wait(sock, rq, *tag, entry, deadline);
+}
+
+static bool scanner_spawn(const char *host_path, const char *dll_path,
+                          int *sock, int *audio_sock, pid_t *child)
+{
+  int fds[2];
+  int audio_fds[2];
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds))
+    return false;
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, audio_fds)) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  *child = fork();
+  if (*child == -1) {
+    close(fds[0]);
+    close(fds[1]);
+    close(audio_fds[0]);
+    close(audio_fds[1]);
+    return false;
+  }
+
+  if (!*child) {
+    char buff[8];
+    char audio_buff[8];
+
+    // the host's ends have to survive exec, the others are closed by it
+    fcntl(fds[1], F_SETFD, 0);
+    fcntl(audio_fds[1], F_SETFD, 0);
+    if (g_scanner.wineprefix)
+      setenv("WINEPREFIX", g_scanner.wineprefix, 1);
+    if (!g_scanner.verbose) {
+      int null = open("/dev/null", O_WRONLY);
+      if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+      }
+    }
+    // its own process group, to kill wine's children along with it
+    setpgid(0, 0);
+    snprintf(buff, sizeof (buff), "%d", fds[1]);
+    snprintf(audio_buff, sizeof (audio_buff), "%d", audio_fds[1]);
+    execl("/bin/sh", "/bin/sh", host_path, dll_path, buff, audio_buff, NULL);
+    _exit(1);
+  }
+
+  close(fds[1]);
+  close(audio_fds[1]);
+  *sock       = fds[0];
+  *audio_sock = audio_fds[0];
+  return true;
+}
+
+/* loads the plugin in a host of its own and asks it what it is */
+static void scanner_probe(struct vst_bridge_catalog_entry *entry, struct vst_bridge_request *rq)
+{
+  const char *host_path = g_scanner.host_path;
+  uint64_t deadline = scanner_now_ms() + g_scanner.timeout_ms;
+  uint32_t tag = 0;
+  int sock;
+  int audio_sock;
+  pid_t child;
+  int status;
+
+  entry->status = VST_BRIDGE_CATALOG_FAILED;
+  memset(&entry->info, 0, sizeof (entry->info));
+
+  if (!host_path) {
+    if (entry->arch == 32)
+      host_path = VST_BRIDGE_HOST32_PATH;
+    else if (entry->arch == 64)
+      host_path = VST_BRIDGE_HOST64_PATH;
+    else
+      return;
+  }
+
+  if (!scanner_spawn(host_path, entry->path, &sock, &audio_sock, &child)) {
+    fprintf(stderr, "%s: failed to spawn the host: %m\n", entry->path);
+    return;
+  }
+
+  // a DAW which has nothing to offer, so the plugin doesn't wait for one
+  memset(rq, 0, VST_BRIDGE_HOST_INFO_LEN);
+  rq->cmd                       = VST_BRIDGE_CMD_HOST_INFO;
+  rq->host_info.version         = 2400;
+  rq->host_info.vendor_version  = 1;
+  rq->host_info.sample_rate     = 44100;
+  rq->host_info.block_size      = 512;
+  rq->host_info.has_vendor      = 1;
+  rq->host_info.has_product     = 1;
+  strcpy(rq->host_info.vendor, "vst-bridge");
+  strcpy(rq->host_info.product, "vst-bridge-scanner");
+  write(sock, rq, VST_BRIDGE_HOST_INFO_LEN);
+
+  tag = 2;
+  rq->tag = tag;
+  rq->cmd = VST_BRIDGE_CMD_PLUGIN_MAIN;
+  if (write(sock, rq, VST_BRIDGE_RQ_LEN) < 0)
+    goto out;
+  status = scanner_wait(sock, rq, tag, entry, deadline);
+  if (status != VST_BRIDGE_CATALOG_OK) {
+    entry->status = status;
+    goto out;
+  }
+  entry->info.plugin_data = rq->plugin_data;
+
+  if ((status = scanner_dispatch(sock, rq, &tag, effOpen, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  if ((status = scanner_dispatch(sock, rq, &tag, effGetPlugCategory, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  entry->info.category = rq->erq.value;
+  if ((status = scanner_dispatch(sock, rq, &tag, effGetVendorVersion, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  entry->info.vendor_version = rq->erq.value;
+  if ((status = scanner_dispatch(sock, rq, &tag, effGetEffectName, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  strncpy(entry->info.name, (const char *)rq->erq.data, sizeof (entry->info.name));
+  vst_bridge_catalog_sanitize(entry->info.name, sizeof (entry->info.name));
+  if ((status = scanner_dispatch(sock, rq, &tag, effGetVendorString, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  strncpy(entry->info.vendor, (const char *)rq->erq.data, sizeof (entry->info.vendor));
+  vst_bridge_catalog_sanitize(entry->info.vendor, sizeof (entry->info.vendor));
+  if ((status = scanner_dispatch(sock, rq, &tag, effGetProductString, entry, deadline)) != VST_BRIDGE_CATALOG_OK)
+    goto failed;
+  strncpy(entry->info.product, (const char *)rq->erq.data, sizeof (entry->info.product));
+  vst_bridge_catalog_sanitize(entry->info.product, sizeof (entry->info.product));
+  entry->status = VST_BRIDGE_CATALOG_OK;
+
+  // effClose has no reply, the host exits
+  rq->tag        = tag + 2;
+  rq->cmd        = VST_BRIDGE_CMD_EFFECT_DISPATCHER;
+  rq->erq.opcode = effClose;
+  rq->erq.index  = 0;
+  rq->erq.value  = 0;
+  rq->erq.opt    = 0;
+  if (write(sock, rq, VST_BRIDGE_ERQ_LEN(0)) < 0)
+    goto out;
+  // drain until the host hangs up, the time left is its to close the plugin
+  while (scanner_read(sock, rq, deadline) > 0)
+    continue;
+  goto out;
+
+failed:
+  entry->status = status;
+out:
+  close(sock);
+  close(audio_sock);
+  if (waitpid(child, NULL, WNOHANG) != child) {
+    kill(-child, SIGKILL);
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+  }
+}
+
+static void *scanner_worker(void *arg)
+{
+  struct vst_bridge_request *rq;
+  struct vst_bridge_catalog_entry *entry;
+  size_t total = g_scanner.jobs.size();
+
+  (void)arg;
+
+  rq = (struct vst_bridge_request *)malloc(sizeof (*rq));
+  if (!rq)
+    return NULL;
+
+  while (true) {
+    pthread_mutex_lock(&g_scanner.lock);
+    if (g_scanner.next_job >= total) {
+      pthread_mutex_unlock(&g_scanner.lock);
+      break;
+    }
+    entry = g_scanner.jobs[g_scanner.next_job++];
+    pthread_mutex_unlock(&g_scanner.lock);
+
+    scanner_probe(entry, rq);
+
+    pthread_mutex_lock(&g_scanner.lock);
+    ++g_scanner.done;
+    if (g_scanner.verbose || entry->status != VST_BRIDGE_CATALOG_OK)
+      fprintf(stderr, "[%zu/%zu] %-7s %s%s%s\n", g_scanner.done, total,
+              vst_bridge_catalog_status_names[entry->status], entry->path,
+              entry->info.name[0] ? ": " : "", entry->info.name);
+    pthread_mutex_unlock(&g_scanner.lock);
+  }
+
+  free(rq);
+  return NULL;
+}
+
+static bool scanner_is_dll(const char *path)
+{
+  size_t len = strlen(path);
+
+  return len > 4 && !strcasecmp(path + len - 4, ".dll");
+}
+
+static int scanner_walk(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+  (void)st;
+  (void)ftw;
+
+  if (type == FTW_F && scanner_is_dll(path))
+    g_dlls.push_back(path);
+  return 0;
+}
+
+static bool scanner_load(const char *path, std::map<std::string, struct vst_bridge_catalog_entry *> &catalog)
+{
+  char line[PATH_MAX + 512];
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (!file)
+    return errno == ENOENT;
+
+  if (!fgets(line, sizeof (line), file) || strncmp(line, VST_BRIDGE_CATALOG_MAGIC, strlen(VST_BRIDGE_CATALOG_MAGIC))) {
+    // an older format, or not a catalog: scan everything again
+    fclose(file);
+    return true;
+  }
+
+  while (fgets(line, sizeof (line), file)) {
+    struct vst_bridge_catalog_entry *entry = new vst_bridge_catalog_entry();
+
+    if (!vst_bridge_catalog_parse(line, entry)) {
+      delete entry;
+      continue;
+    }
+
+    auto it = catalog.find(entry->path);
+    if (it != catalog.end())
+      delete it->second;
+    catalog[entry->path] = entry;
+  }
+
+  fclose(file);
+  return true;
+}
+
+/* see vst_bridge_replace_begin() */
+static bool scanner_save(const char *path, std::map<std::string, struct vst_bridge_catalog_entry *> &catalog)
+{
+  char tmp[PATH_MAX + 32];
+  FILE *file;
+  int fd;
+
+  fd = vst_bridge_replace_begin(path, tmp, sizeof (tmp), 0644);
+  if (fd < 0)
+    return false;
+  file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    return vst_bridge_replace_end(path, tmp, false);
+  }
+
+  fprintf(file, "%s\n", VST_BRIDGE_CATALOG_MAGIC);
+  for (auto &it : catalog)
+    vst_bridge_catalog_print(file, it.second);
+
+  bool ok = !fflush(file) && !fsync(fileno(file));
+  ok = !fclose(file) && ok;
+  return vst_bridge_replace_end(path, tmp, ok);
+}
+
+static std::string scanner_default_catalog(void)
+{
+  char path[PATH_MAX];
+
+  vst_bridge_catalog_default_path(path, sizeof (path));
+  return path;
+}
+
+static void scanner_usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options] <vst.dll | directory>...\n"
+          "  -j, --jobs=N          probe N plugins at a time (default: the number of CPUs)\n"
+          "  -t, --timeout=SECS    give up on a plugin after SECS seconds (default: 30)\n"
+          "  -o, --catalog=PATH    the catalog (default: $XDG_CACHE_HOME/vst-bridge/catalog)\n"
+          "  -w, --wineprefix=DIR  the WINEPREFIX of the plugins\n"
+          "  -f, --force           probe the plugins again, even if they didn't change\n"
+          "  -H, --host=PATH       the host to use for every plugin\n"
+          "  -v, --verbose         print each plugin, and the hosts' output\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  static const struct option options[] = {
+    { "jobs",       required_argument, NULL, 'j' },
+    { "timeout",    required_argument, NULL, 't' },
+    { "catalog",    required_argument, NULL, 'o' },
+    { "wineprefix", required_argument, NULL, 'w' },
+    { "force",      no_argument,       NULL, 'f' },
+    { "host",       required_argument, NULL, 'H' },
+    { "verbose",    no_argument,       NULL, 'v' },
+    { "help",       no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  std::map<std::string, struct vst_bridge_catalog_entry *> catalog;
+  std::string catalog_path;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  bool force = false;
+  size_t up_to_date = 0;
+  size_t failed = 0;
+  uint64_t start;
+  int opt;
+
+  g_scanner.timeout_ms = 30 * 1000;
+  pthread_mutex_init(&g_scanner.lock, NULL);
+
+  while ((opt = getopt_long(argc, argv, "j:t:o:w:fH:vh", options, NULL)) != -1) {
+    switch (opt) {
+    case 'j':
+      jobs = strtol(optarg, NULL, 0);
+      break;
+    case 't':
+      g_scanner.timeout_ms = strtod(optarg, NULL) * 1000;
+      break;
+    case 'o':
+      catalog_path = optarg;
+      break;
+    case 'w':
+      g_scanner.wineprefix = optarg;
+      break;
+    case 'f':
+      force = true;
+      break;
+    case 'H':
+      g_scanner.host_path = optarg;
+      break;
+    case 'v':
+      g_scanner.verbose = 1;
+      break;
+    case 'h':
+      scanner_usage(argv[0]);
+      return 0;
+    default:
+      scanner_usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind >= argc) {
+    scanner_usage(argv[0]);
+    return 2;
+  }
+  if (jobs < 1)
+    jobs = 1;
+  if (g_scanner.timeout_ms < 1)
+    g_scanner.timeout_ms = 1;
+  if (catalog_path.empty())
+    catalog_path = scanner_default_catalog();
+
+  if (!scanner_load(catalog_path.c_str(), catalog)) {
+    fprintf(stderr, "%s: %m\n", catalog_path.c_str());
+    return 1;
+  }
+
+  for (int i = optind; i < argc; ++i) {
+    struct stat st;
+
+    if (stat(argv[i], &st)) {
+      fprintf(stderr, "%s: %m\n", argv[i]);
+      continue;
+    }
+    if (S_ISDIR(st.st_mode))
+      nftw(argv[i], scanner_walk, 32, FTW_PHYS);
+    else
+      g_dlls.push_back(argv[i]);
+  }
+
+  start = scanner_now_ms();
+
+  for (auto &dll : g_dlls) {
+    char real_path[PATH_MAX];
+    struct stat st;
+    uint64_t hash;
+
+    if (!realpath(dll.c_str(), real_path) || stat(real_path, &st)) {
+      fprintf(stderr, "%s: %m\n", dll.c_str());
+      continue;
+    }
+
+    struct vst_bridge_catalog_entry *entry;
+    auto it = catalog.find(real_path);
+    if (it != catalog.end()) {
+      entry = it->second;
+      // already queued, the same dll given twice
+      if (entry->status < 0)
+        continue;
+      // a failure or a timeout, maybe from a slow wine boot, is probed again
+      if (!force && entry->status == VST_BRIDGE_CATALOG_OK &&
+          entry->size == st.st_size && entry->mtime == st.st_mtime) {
+        ++up_to_date;
+        continue;
+      }
+    } else {
+      entry = new vst_bridge_catalog_entry();
+      snprintf(entry->path, sizeof (entry->path), "%s", real_path);
+      entry->status = VST_BRIDGE_CATALOG_FAILED;
+      catalog[entry->path] = entry;
+    }
+
+    // a new mtime only, see vst_bridge_catalog_hash()
+    if (!vst_bridge_catalog_hash(real_path, &hash)) {
+      fprintf(stderr, "%s: %m\n", real_path);
+      continue;
+    }
+    if (!force && it != catalog.end() && entry->status == VST_BRIDGE_CATALOG_OK &&
+        entry->hash == hash && entry->size == st.st_size) {
+      entry->mtime = st.st_mtime;
+      ++up_to_date;
+      continue;
+    }
+
+    entry->size  = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->hash  = hash;
+    entry->arch  = vst_bridge_pe_arch(real_path);
+    if (!entry->arch && !g_scanner.host_path) {
+      entry->status = VST_BRIDGE_CATALOG_FAILED;
+      fprintf(stderr, "%s: not a 32 or 64 bits Windows dll\n", real_path);
+      continue;
+    }
+    entry->status = -1;
+    g_scanner.jobs.push_back(entry);
+  }
+
+  if (jobs > (long)g_scanner.jobs.size())
+    jobs = g_scanner.jobs.size();
+
+  std::vector<pthread_t> threads(jobs);
+  for (long i = 0; i < jobs; ++i)
+    if (pthread_create(&threads[i], NULL, scanner_worker, NULL)) {
+      fprintf(stderr, "failed to create a worker: %m\n");
+      threads.resize(i);
+      break;
+    }
+  if (threads.empty() && !g_scanner.jobs.empty())
+    scanner_worker(NULL);
+  for (auto &thread : threads)
+    pthread_join(thread, NULL);
+
+  // the dlls which are gone leave the catalog
+  for (auto it = catalog.begin(); it != catalog.end();) {
+    struct stat st;
+
+    if (stat(it->first.c_str(), &st)) {
+      delete it->second;
+      it = catalog.erase(it);
+    } else {
+      if (it->second->status != VST_BRIDGE_CATALOG_OK)
+        ++failed;
+      ++it;
+    }
+  }
+
+  if (!scanner_save(catalog_path.c_str(), catalog)) {
+    fprintf(stderr, "%s: %m\n", catalog_path.c_str());
+    return 1;
+  }
+
+  printf("%s: %zu plugins, %zu probed in %.1fs, %zu up to date, %zu failed\n",
+         catalog_path.c_str(), catalog.size(), g_scanner.jobs.size(),
+         (scanner_now_ms() - start) / 1000.0, up_to_date, failed);
+
+  for (auto &it : catalog)
+    delete it.second;
+  return 0;
+}